@@ -0,0 +1,82 @@
+#!/usr/bin/perl -w
+#
+# (c) Copyright 2013, Hewlett-Packard Development Company, LP
+#
+#  See the file named COPYING for license details
+#
+# Writes the pcap used by run-check-nettrace2ds.sh to stdout: NFSv3
+# getattr calls and replies over UDP every 50ms for 10 seconds starting
+# at 1000000000, with an unrelated TCP packet every second.  The output
+# was saved as check-data/nfs-getattr.pcap.
+use strict;
+
+my $start = 1000000000;
+my ($client, $server, $other) = (0x0a000002, 0x0a000001, 0x0a000003);
+
+sub ipChecksum {
+    my $sum = 0;
+    foreach my $word (unpack("n*", $_[0])) {
+        $sum += $word;
+    }
+    $sum = ($sum & 0xFFFF) + ($sum >> 16) while $sum > 0xFFFF;
+    return ~$sum & 0xFFFF;
+}
+
+# The ethernet and IP headers in front of the protocol header and payload.
+sub ipPacket {
+    my ($src, $dest, $protocol, $l4) = @_;
+    my $ip = pack("CCnnnCCnNN", 0x45, 0, 20 + length($l4), 0, 0x4000, 64, $protocol, 0,
+                  $src, $dest);
+    substr($ip, 10, 2) = pack("n", ipChecksum($ip));
+    return pack("H12H12n", "020000000001", "020000000002", 0x800) . $ip . $l4;
+}
+
+sub udpPacket {
+    my ($src, $sport, $dest, $dport, $payload) = @_;
+    return ipPacket($src, $dest, 17, pack("nnnn", $sport, $dport, 8 + length($payload), 0)
+                    . $payload);
+}
+
+sub tcpPacket {
+    my ($src, $sport, $dest, $dport, $seq, $payload) = @_;
+    return ipPacket($src, $dest, 6, pack("nnNNnnnn", $sport, $dport, $seq, 0, 0x5018, 1024,
+                                          0, 0) . $payload);
+}
+
+sub record {
+    my ($usec, $packet) = @_;
+    print pack("VVVV", $start + int($usec / 1000000), $usec % 1000000, length($packet),
+               length($packet)), $packet;
+}
+
+sub filehandle {
+    return pack("N8", 0x01000001, 0, 0, $_[0], 0, 0, 0, 0x12345678);
+}
+
+binmode STDOUT;
+# magic, version 2.4, thiszone, sigfigs, snaplen, ethernet
+print pack("VvvVVVV", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1);
+
+for (my $i = 0; $i < 200; ++$i) {
+    my $usec = $i * 50000;
+    my $xid = 0x5000 + $i;
+    my $fh = filehandle($i % 7);
+    # xid, call, rpc version 2, nfs, version 3, getattr, auth_none credential and verifier
+    my $call = pack("NNNNNNNNNN", $xid, 0, 2, 100003, 3, 1, 0, 0, 0, 0)
+        . pack("N", length($fh)) . $fh;
+    record($usec, udpPacket($client, 800, $server, 2049, $call));
+
+    # xid, reply, accepted, null verifier, success; then NFS3_OK and a fattr3 with type,
+    # mode, nlink, uid, gid, size, used, rdev, fsid, fileid, atime, mtime, ctime.
+    my $attr = pack("NNNNN", 1, 0644, 1, 100 + $i % 3, 100)
+        . pack("NN", 0, 4096 * ($i % 7)) . pack("NN", 0, 4096 * ($i % 7)) . pack("NN", 0, 0)
+        . pack("NN", 0, 1) . pack("NN", 0, 1000 + $i % 7)
+        . pack("NN", $start - 3600, 0) . pack("NN", $start - 7200, 0)
+        . pack("NN", $start - 7200, 0);
+    my $reply = pack("NNNNNN", $xid, 1, 0, 0, 0, 0) . pack("N", 0) . $attr;
+    record($usec + 10000, udpPacket($server, 2049, $client, 800, $reply));
+
+    if ($i % 20 == 5) {
+        record($usec + 20000, tcpPacket($other, 22, $client, 40000, $i, "\0" x 8));
+    }
+}
@@ -0,0 +1,100 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Process-wide reader that keeps several extent reads in flight
+*/
+
+#ifndef DATASERIES_ASYNCEXTENTREADER_HPP
+#define DATASERIES_ASYNCEXTENTREADER_HPP
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesSource.hpp>
+
+namespace dataseries {
+    /** \brief Issues compressed extent reads for all IndexSourceModules in a process.
+
+        A single prefetch thread doing one blocking pread per extent can't
+        keep a large disk array or an NVMe device busy.  This reader keeps
+        up to queueDepth() reads outstanding across all of the files being
+        read.  It uses io_uring when DataSeries was built with liburing and
+        the kernel supports it; otherwise it uses queueDepth() threads that
+        each do blocking preads.  Reads complete in any order; the done
+        callback is run on an internal thread without any reader locks held.
+
+        Asynchronous reads are disabled (queueDepth() == 0) unless enabled
+        with setQueueDepth() or the environment variable
+        DATASERIES_READ_QUEUE_DEPTH. */
+    class AsyncExtentReader : boost::noncopyable {
+      public:
+        typedef boost::function<void ()> Callback;
+
+        struct Request {
+            DataSeriesSource::SharedFdPtr file;
+            off64_t offset;
+            bool need_bitflip;
+            Extent::ByteArray *into; // filled in with the packed extent
+            Callback done;
+        };
+
+        /** Returns the reader, creating it on first use.  The reader lives
+            until the process exits. */
+        static AsyncExtentReader &instance();
+
+        /** Sets the number of reads to keep in flight; 0 disables
+            asynchronous reads.  Only has an effect before the first read is
+            submitted. */
+        void setQueueDepth(unsigned depth);
+        unsigned queueDepth() {
+            return queue_depth;
+        }
+
+        /** Returns true if reads are being done with io_uring; only
+            meaningful after the first submit(). */
+        bool usingUring() {
+            return uring != NULL;
+        }
+
+        /** Queue a read; never blocks waiting for other reads. It is an
+            error to read at the end of the file. */
+        void submit(const Request &request);
+
+        /// \cond INTERNAL_ONLY
+        void preadThread();
+        void uringThread();
+        /// \endcond
+
+      private:
+        struct Uring;
+        struct Op;
+
+        AsyncExtentReader();
+        ~AsyncExtentReader();
+
+        void lockedStart();
+        bool lockedStartUring();
+        bool uringAdvance(Op *op, int result);
+        void uringSubmitRead(Op *op);
+
+        PThreadMutex mutex;
+        PThreadCond pending_cond;
+        Deque<Request> pending;
+        unsigned queue_depth;
+        bool started;
+        std::vector<PThread *> threads;
+        Uring *uring; // NULL if using the pread threads
+    };
+}
+
+#endif
@@ -0,0 +1,104 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Process-wide pool of recycled buffers for Extent::ByteArray
+*/
+
+#ifndef DATASERIES_BUFFERPOOL_HPP
+#define DATASERIES_BUFFERPOOL_HPP
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <Lintel/PThread.hpp>
+
+namespace dataseries {
+    /** \brief Size-classed buffer pool behind Extent::ByteArray.
+
+        Extents allocate and free large fixed and variable data buffers, as
+        do the compressed buffers in DataSeriesSink and IndexSourceModule;
+        going through malloc each time means that large buffers are mmaped
+        and unmapped over and over.  Buffers of at least min_pooled_size
+        bytes are instead rounded up to a size class (four classes per power
+        of two) and, when released, kept for reuse.  Each thread keeps a
+        small cache of its own, so the common case of an unpack or compress
+        thread recycling its own buffers takes no lock; beyond that, buffers
+        go to shared lists, up to a process-wide limit on retained bytes.
+
+        The limit defaults to 256 MiB, and can be set with the
+        DATASERIES_BUFFER_POOL_MB environment variable; 0 disables pooling. */
+    class BufferPool : boost::noncopyable {
+      public:
+        typedef unsigned char byte;
+
+        /// smaller buffers are allocated directly
+        static const size_t min_pooled_size = 64 * 1024;
+        /// larger buffers are allocated directly
+        static const size_t max_pooled_size = 256 * 1024 * 1024;
+
+        struct Stats {
+            /// allocations satisfied from the pool, and ones that weren't
+            uint64_t hits, misses;
+            /// buffers released to the pool, and ones freed because it was full
+            uint64_t kept, freed;
+            /// bytes currently held by the pool, including the thread caches
+            uint64_t retained_bytes;
+            Stats() : hits(0), misses(0), kept(0), freed(0), retained_bytes(0) { }
+        };
+
+        /** Returns the pool, creating it on first use.  The pool lives
+            until the process exits. */
+        static BufferPool &instance();
+
+        /** Returns a buffer of at least nbytes; capacity is set to its actual
+            size, which must be passed back to release(). */
+        byte *allocate(size_t nbytes, size_t &capacity);
+
+        /** Return a buffer from allocate() to the pool. */
+        void release(byte *buffer, size_t capacity);
+
+        /** Sets the limit on bytes retained by the pool; buffers beyond the
+            limit are freed when they are released. */
+        void setRetainLimit(size_t nbytes);
+
+        Stats getStats();
+
+        /// \cond INTERNAL_ONLY
+        struct ThreadCache;
+        void flushThreadCache(ThreadCache *cache);
+        /// \endcond
+
+      private:
+        BufferPool();
+        ~BufferPool();
+
+        static int sizeClass(size_t nbytes);
+        static size_t classSize(int size_class);
+        ThreadCache *threadCache();
+        void freeBuffer(byte *buffer);
+        void lockedTrim();
+
+        size_t retain_limit;
+        // thread caches hold at most this many bytes
+        size_t thread_cache_limit;
+
+        // protects free_lists and shared_bytes
+        PThreadMutex mutex;
+        std::vector< std::vector<byte *> > free_lists;
+        size_t shared_bytes;
+
+        // updated with atomic operations so they can be read without the lock
+        uint64_t hits, misses, kept, freed, retained_bytes;
+    };
+}
+
+#endif
@@ -25,6 +25,11 @@
 class DSExpr;
 class DSExprParser;
 
+namespace DSExprImpl {
+    struct Batch;
+    class Kernel;
+}
+
 class DSExprFunction : boost::noncopyable {
     // name
     // min required args
@@ -103,6 +108,23 @@ class DSExpr : boost::noncopyable {
 
     virtual void dump(std::ostream &) = 0;
 
+    /// A bound on the values of a field implied by an expression.  Numeric
+    /// bounds may be infinite; string bounds are used for variable32 fields.
+    struct FieldRange {
+        std::string field_name;
+        bool is_string;
+        double min, max;
+        std::string min_string, max_string;
+        bool max_string_unbounded;
+    };
+
+    /// Collect the ranges implied by the comparisons between a field and a
+    /// constant that are and'ed together at the top level of expr; other
+    /// parts of the expression are ignored.  Every row for which expr is
+    /// true has each field within the returned ranges, so the ranges can be
+    /// used to skip data that can not match.
+    static void conjunctiveRanges(DSExpr *expr, std::vector<FieldRange> &into);
+
     /// Make an expression over a single series.
     static DSExpr *make(ExtentSeries &series, const std::string &expr_string) {
         boost::scoped_ptr<DSExprParser> parser(DSExprParser::MakeDefaultParser());
@@ -126,4 +148,56 @@ class DSExpr : boost::noncopyable {
 
 };
 
+/// An expression compiled to evaluate over all of the rows of an extent at once.  Evaluating a
+/// DSExpr row by row makes a chain of virtual calls for every row, and creates a std::string for
+/// every string value.  A DSExprBatch instead turns the expression tree into a tree of kernels,
+/// each of which loops over a vector of rows with code specialized for the column type, and which
+/// compares strings in place in the extent.  The results are the same as evaluating the DSExpr on
+/// each row, including && and || only evaluating their right side on rows where it is needed;
+/// parts of the expression without a specialized kernel (functions, string conversions) are
+/// evaluated row by row on just the rows that need them.
+class DSExprBatch : boost::noncopyable {
+  public:
+    /// Row numbers within an extent, in increasing order.
+    typedef std::vector<uint32_t> Selection;
+
+    /// Compile expr, which must have been made over series.  Returns NULL if the expression uses
+    /// fields from some other series, in which case it can only be evaluated row by row.  expr
+    /// and series must outlive the returned object.
+    static DSExprBatch *compile(DSExpr *expr, ExtentSeries &series);
+
+    ~DSExprBatch();
+
+    /// Set rows to the rows of the series' current extent for which the expression is true.
+    void select(Selection &rows);
+
+    /// Evaluate the expression for every row of the series' current extent.  If nulls is
+    /// given, as filled in by evalNull(), the rows it marks are not evaluated and are set to 0,
+    /// just as row by row callers check isNull() before getting the value; otherwise e.g. an
+    /// integer division by a null divisor, which reads as 0, would trap.
+    void evalDouble(std::vector<double> &out, const std::vector<uint8_t> *nulls = NULL);
+    void evalInt64(std::vector<int64_t> &out, const std::vector<uint8_t> *nulls = NULL);
+    void evalBool(std::vector<uint8_t> &out, const std::vector<uint8_t> *nulls = NULL);
+    void evalNull(std::vector<uint8_t> &out);
+
+    /// Convert a row number from a selection into an offset for accessing fields.
+    dataseries::SEP_RowOffset rowOffset(uint32_t row) {
+        const Extent &e(series.getExtentRef());
+        return dataseries::SEP_RowOffset(row * e.getTypePtr()->fixedrecordsize(), &e);
+    }
+
+  private:
+    DSExprBatch(ExtentSeries &series, DSExprImpl::Kernel *root);
+
+    void allRows();
+    template<typename T>
+    void evalValues(std::vector<T> &out, const std::vector<uint8_t> *nulls,
+                    void (DSExprImpl::Kernel::*eval)(const DSExprImpl::Batch &, T *));
+
+    ExtentSeries &series;
+    DSExprImpl::Kernel *root;
+    Selection rows, nonnull_rows;
+    std::vector<uint8_t> selected;
+};
+
 #endif
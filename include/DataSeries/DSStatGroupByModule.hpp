@@ -13,12 +13,19 @@
 #ifndef __DATASERIES_DSSTATGROUPBY_H
 #define __DATASERIES_DSSTATGROUPBY_H
 
-#include <Lintel/HashMap.hpp>
+#include <vector>
 
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/GeneralField.hpp>
 #include <DataSeries/RowAnalysisModule.hpp>
 
+/** \brief Calculates a statistic over an expression, grouped by zero or more
+    columns.
+
+    groupby is a comma separated list of column names; an empty list puts
+    every row in one group.  Rows are grouped on the bytes of the key
+    columns, read through typed fields, in an open addressing hash table;
+    the expression is evaluated a whole extent at a time when possible.  */
 class DSStatGroupByModule : public RowAnalysisModule {
   public:
     DSStatGroupByModule(DataSeriesModule &source,
@@ -28,8 +35,6 @@ class DSStatGroupByModule : public RowAnalysisModule {
                         const std::string &whereexpr = "",
                         ExtentSeries::typeCompatibilityT tc = ExtentSeries::typeExact);
 
-    typedef HashMap<GeneralValue, Stats *> mytableT;
-
     virtual ~DSStatGroupByModule();
     
     virtual void prepareForProcessing();
@@ -39,11 +44,20 @@ class DSStatGroupByModule : public RowAnalysisModule {
     /// return true if the specified stat_type is valid for constructing a
     /// DSStatGroupByModule.
     static bool validStatType(const std::string &stat_type);
+
+  protected:
+    /// only basic statistics can be merged, so quantile statistics are
+    /// always calculated serially.
+    virtual ThreadState *newThreadState(ExtentSeries &thread_series);
+    virtual void mergeThreadState(ThreadState &state);
+
   private:
-    mytableT mystats;
+    class Groups;
+    class GroupState;
+
     std::string expression, groupby_name, stattype;
-    GeneralField *groupby;
-    DSExpr *expr;
+    std::vector<std::string> groupby_names;
+    Groups *groups;
 };
 
 #endif
@@ -12,14 +12,20 @@
     Class for writing DataSeries files.
 */
 
+#include <map>
+
 #include <Lintel/Deque.hpp>
 #include <Lintel/HashUnique.hpp>
 #include <Lintel/PThread.hpp>
 
 #include <DataSeries/ExtentField.hpp>
 #include <DataSeries/IExtentSink.hpp>
+#include <DataSeries/SinkPool.hpp>
 
 /** \brief Writes Extents to a DataSeries file.
+ *
+ * Extents are packed and written by the threads of the process-wide
+ * dataseries::SinkPool, which all sinks share.
  */
 class DataSeriesSink : public dataseries::IExtentSink {
   public:
@@ -93,6 +99,19 @@ class DataSeriesSink : public dataseries::IExtentSink {
         are not used. */
     void writeExtentLibrary(const ExtentTypeLibrary &lib);
 
+    /** Record the minimum and maximum value of each of the named
+        columns in every extent of the specified type, so that readers can
+        skip extents that can not match a range predicate (see
+        TypeIndexModule::addRangePredicate).  The statistics are written
+        as a "DataSeries: ExtentMinMax" extent just before the index.
+        Columns must be numeric or variable32; no statistics are recorded
+        for a column in an extent if any of its values are null.  Each row
+        also says whether the column is sorted (non-decreasing) in the
+        extent, so that readers know when the binary searches in
+        SortedSearch.hpp are valid (see DataSeriesSource::extentSortedBy).
+        Must be called before writeExtentLibrary. */
+    void recordMinMax(const ExtentType::Ptr &type, const std::vector<std::string> &columns);
+
     /** See dataseries::IExtentSink documentation */
     virtual void writeExtent(Extent &e, Stats *toUpdate);
 
@@ -112,31 +131,68 @@ class DataSeriesSink : public dataseries::IExtentSink {
     static void verifyTail(ExtentType::byte *data, bool need_bitflip,
                            const std::string &filename);
     
-    /** Sets the number of threads that each @c DataSeriesSink uses to
-        compress Extents.
+    /** Sets the number of threads used to compress Extents.
         compressor_count == -1 ==> use # cpus or limit set by MAX_THREAD_COUNT (see DataSeriesSink.cpp)
-        compressor_count == 0 ==> no threading;
-        Only affects \link DataSeriesSink DataSeriesSinks \endlink
-        created after a call. */
+        compressor_count == 0 ==> no threading, extents are packed and written by writeExtent();
+        Only affects \link DataSeriesSink DataSeriesSinks \endlink opened after a call.  The
+        threads are shared by all sinks (see dataseries::SinkPool), so a thread count other
+        than 0 only has an effect before the first sink is opened. */
     static void setCompressorCount(int compressor_count = -1);
 
     const std::string &getFilename() const {
         return filename;
     }
 
-    void setMaxBytesInProgress(size_t nbytes) {
-        worker_info.setMaxBytesInProgress(mutex, nbytes);
+    /** Sets the limit on bytes of extents that have been queued but not yet written.  The
+        limit is shared by all sinks in the process; see dataseries::SinkPool. */
+    static void setMaxBytesInProgress(size_t nbytes) {
+        dataseries::SinkPool::instance().setMaxBytesInProgress(nbytes);
+    }
+
+    /** How a sink picks the compression algorithms to try on each extent.
+        CompressTryAll packs with every enabled algorithm and keeps the
+        smallest result.  CompressAdaptive remembers, separately for each
+        ExtentType, which algorithms won for the fixed and variable data
+        of the last probe, and only tries those.  It re-probes with every
+        enabled algorithm every adaptive_probe_interval extents, or on the
+        next extent if the compression ratio gets more than
+        adaptive_drift_ratio worse than it was at the last probe.
+        Extents of pack_layout="columns" types choose an algorithm for
+        each column, so they are always packed as with CompressTryAll. */
+    enum CompressionPolicy { CompressTryAll, CompressAdaptive };
+
+    static const uint32_t adaptive_probe_interval = 32;
+    static const double adaptive_drift_ratio;
+
+    /** Sets the compression policy for \link DataSeriesSink DataSeriesSinks \endlink 
+        created after the call; getPackingArgs() calls this for --compress-policy */
+    static void setDefaultCompressionPolicy(CompressionPolicy policy);
+
+    /** Sets the compression policy for extents queued after the call. */
+    void setCompressionPolicy(CompressionPolicy policy) {
+        PThreadScopedLock lock(mutex);
+        compression_policy = policy;
     }
 
   private:
+    struct ColumnMinMax {
+        std::string column;
+        bool is_string, sorted;
+        double min, max;
+        std::string min_string, max_string;
+    };
+
     struct ToCompress {
         Extent::Ptr extent;
         Stats *to_update;
         bool in_progress;
         uint32_t checksum;
+        size_t queued_size; // counted against the SinkPool limit until written
         Extent::ByteArray compressed;
+        std::vector<ColumnMinMax> minmax; // filled in when packing
         ToCompress(Extent::Ptr e, Stats *_to_update)
-                : extent(e), to_update(_to_update), in_progress(false), checksum(0) 
+                : extent(e), to_update(_to_update), in_progress(false), checksum(0),
+                  queued_size(e->size())
         { }
         void wipeExtent() {
             Extent tmp(extent->getTypePtr());
@@ -151,33 +207,31 @@ class DataSeriesSink : public dataseries::IExtentSink {
     struct WorkerInfo {
         // protected by the standard mutex, users should have separate access to it.
         bool keep_going;
-        size_t bytes_in_progress, max_bytes_in_progress;
+        // a SinkPool thread is in writeOutPending(); only one thread writes at a time so
+        // that extents go out in order.
+        bool writing;
+        // the sink while it is attached to the SinkPool, NULL if it packs and writes
+        // extents itself (compressor_count == 0) or is closed.
+        DataSeriesSink *pooled;
+        size_t bytes_in_progress;
         Deque<ToCompress *> pending_work;
+        PThreadCond available_queue_cond; // broadcast whenever extents are written
 
-        std::vector<PThread *> compressors;
-        PThread *writer;
-        PThreadCond available_queue_cond, available_work_cond, available_write_cond;
-        WorkerInfo(size_t max_bytes_in_progress)
-        : keep_going(false), bytes_in_progress(0), max_bytes_in_progress(max_bytes_in_progress),
-          pending_work(), compressors(), writer(), available_queue_cond(),
-          available_work_cond(), available_write_cond()
+        WorkerInfo()
+        : keep_going(false), writing(false), pooled(NULL), bytes_in_progress(0),
+          pending_work(), available_queue_cond()
         { }
 
-        bool canQueueWork() {
-            return bytes_in_progress < max_bytes_in_progress &&
-                    pending_work.size() < 2 * compressors.size();
-        }
-        void startThreads(PThreadScopedLock &lock, DataSeriesSink *sink);
-        void stopThreads(PThreadScopedLock &lock);
-        void setMaxBytesInProgress(PThreadMutex &mutex, size_t nbytes);
+        void attach(DataSeriesSink *sink);
+        void detach(PThreadScopedLock &lock, PThreadMutex &mutex);
         void flushPending(PThreadMutex &mutex);
         bool frontReadyToWrite() { // Assume lock is held
             return pending_work.empty() ? false : pending_work.front()->readyToWrite();
         }
 
         bool isQuiesced() {
-            return !keep_going && bytes_in_progress == 0 && pending_work.empty()
-                    && compressors.empty() && writer == NULL;
+            return !keep_going && !writing && pooled == NULL && bytes_in_progress == 0
+                && pending_work.empty();
         }
     };
 
@@ -190,6 +244,12 @@ class DataSeriesSink : public dataseries::IExtentSink {
         ExtentSeries index_series;
         Int64Field field_extentOffset;
         Variable32Field field_extentType;
+        ExtentSeries minmax_series;
+        Int64Field minmax_offset;
+        Variable32Field minmax_column;
+        DoubleField minmax_min, minmax_max;
+        Variable32Field minmax_min_string, minmax_max_string;
+        BoolField minmax_sorted;
         ExtentWriteCallback extent_write_callback;
 
         WriterInfo()
@@ -197,13 +257,23 @@ class DataSeriesSink : public dataseries::IExtentSink {
                   index_series(ExtentType::getDataSeriesIndexTypeV0Ptr()), 
                   field_extentOffset(index_series,"offset"),
                   field_extentType(index_series,"extenttype"), 
+                  minmax_series(ExtentType::getDataSeriesMinMaxTypePtr()),
+                  minmax_offset(minmax_series, "offset"),
+                  minmax_column(minmax_series, "column"),
+                  minmax_min(minmax_series, "min", Field::flag_nullable),
+                  minmax_max(minmax_series, "max", Field::flag_nullable),
+                  minmax_min_string(minmax_series, "min_string", Field::flag_nullable),
+                  minmax_max_string(minmax_series, "max_string", Field::flag_nullable),
+                  minmax_sorted(minmax_series, "sorted"),
                   extent_write_callback()
         { }
         void writeOutPending(PThreadScopedLock &lock, WorkerInfo &worker_info);
+        void addMinMaxRows(const std::vector<ColumnMinMax> &minmax);
         void checkedWrite(const void *buf, int bufsize);
         bool isQuiesced() {
             return fd == -1 && wrote_library == false && cur_offset == -1
-                    && !index_series.hasExtent() && chained_checksum == 0;
+                    && !index_series.hasExtent() && !minmax_series.hasExtent()
+                    && chained_checksum == 0;
         }
     };
 
@@ -212,10 +282,30 @@ class DataSeriesSink : public dataseries::IExtentSink {
     }
     void writeExtentType(ExtentType &et);
 
+    // Per ExtentType state for CompressAdaptive, protected by mutex.
+    struct AdaptiveCompressState {
+        bool probed;
+        uint32_t extents_since_probe;
+        Extent::byte fixed_mode, variable_mode;
+        double probe_ratio; // packed / unpacked bytes on the last probe
+        double probe_time_per_byte; // pack time of the last probe
+        AdaptiveCompressState()
+        : probed(false), extents_since_probe(0), fixed_mode(0), variable_mode(0),
+          probe_ratio(0), probe_time_per_byte(0) { }
+    };
+
     void queueWriteExtent(Extent::Ptr e, Stats *to_update);
+    uint32_t lockedWriteTrailingExtent(PThreadScopedLock &lock, Extent::Ptr e);
+    static void computeMinMax(const Extent::Ptr &e, const std::vector<std::string> &columns,
+                              std::vector<ColumnMinMax> &into);
     void lockedProcessToCompress(PThreadScopedLock &lock, ToCompress *work);
+    int lockedChooseCompressionModes(const ExtentType::Ptr &type, bool &probe);
+    double lockedUpdateAdaptiveState(const ExtentType::Ptr &type, bool probe, 
+                                     const Extent::ByteArray &compressed,
+                                     size_t unpacked_size, double pack_time);
 
     static int compressor_count;
+    static CompressionPolicy default_compression_policy;
 
     Stats stats;
     PThreadMutex mutex; // this mutex is ordered after Stats::getMutex(), so grab it second if you need both.
@@ -223,15 +313,17 @@ class DataSeriesSink : public dataseries::IExtentSink {
                lintel::SharedPointerEqual<const ExtentType> > valid_types;
     const int compression_modes;
     const int compression_level;
+    CompressionPolicy compression_policy;
+    std::map<ExtentType::Ptr, AdaptiveCompressState> adaptive_state;
+    // Fixed once the library is written, so readable without the mutex.
+    std::map<ExtentType::Ptr, std::vector<std::string> > minmax_columns;
 
     WriterInfo writer_info;
     WorkerInfo worker_info;
                                    
     std::string filename;
-    friend class DataSeriesSinkPThreadCompressor;
-    void compressorThread();
-    friend class DataSeriesSinkPThreadWriter;
-    void writerThread();
+    friend class dataseries::SinkPool;
+    void packAndWriteOne();
 };
 
 inline DataSeriesSink::Stats 
@@ -12,6 +12,11 @@
 #ifndef DATASERIES_SOURCE_H
 #define DATASERIES_SOURCE_H
 
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <DataSeries/Extent.hpp>
 
 /** \brief Reads Extents from a DataSeries file.
@@ -19,6 +24,41 @@
  **/
 class DataSeriesSource {
   public:
+    /** How extents are read from the file.  ReadPread reads each extent
+        into a freshly allocated buffer.  ReadMmap maps the whole file
+        when it is opened; extents from files in host byte order are then
+        handed out as read-only views into the mapping (see
+        Extent::ByteArray::setView), so there is no copy until unpacking,
+        and uncompressed extents are unpacked straight out of the page
+        cache.  Files that need bitflipping are copied out of the mapping
+        since unpacking them modifies the packed bytes.  The mapping
+        stays alive until both the source and all views into it are gone,
+        so it is safe to delete the source while extents are queued up
+        for unpacking.  Files that change size after they are opened
+        should use ReadPread. */
+    enum ReadMode { ReadPread, ReadMmap };
+
+    /** Sets the read mode for sources opened after the call.  The initial
+        default is ReadPread, or the value of the environment variable
+        DATASERIES_READ_MODE=pread|mmap if it is set. */
+    static void setDefaultReadMode(ReadMode mode);
+    static ReadMode getDefaultReadMode() { return default_read_mode; }
+
+    /** In ReadMmap mode, how far beyond the last extent read we ask the
+        kernel to prefetch (madvise(MADV_WILLNEED)); sequential scans
+        such as TypeIndexModule then rarely block on a page fault. */
+    static const size_t mmap_readahead = 8 * 1024 * 1024;
+
+    /** Sets the number of files whose metadata is kept in the
+        process-wide metadata cache; 0 disables the cache.  Opening a
+        file with read_index set looks up its type library, byte order
+        and index extent by path, size and modify time, and only reads
+        and parses them on a miss, so scanning the same unchanged files
+        again, or from several modules, costs an open and an fstat per
+        file.  The default is 32768 files, or the value of the
+        environment variable DATASERIES_METADATA_CACHE_FILES. */
+    static void setMetadataCacheFiles(size_t max_files);
+
     /** Opens the specified file and reads its @c ExtentTypeLibary and
         its index @c Extent. Sets the current offset to the first @c
         Extent in the file.  Optionally does not read extentIndex at
@@ -66,9 +106,32 @@ class DataSeriesSource {
         to the size of the file.
         - isactive() */
     bool preadCompressed(off64_t &offset, Extent::ByteArray &bytes) {
+        if (mapped != NULL) {
+            return mappedExtent(offset, bytes);
+        }
         return Extent::preadExtent(fd,offset, bytes, need_bitflip);
     }
 
+    /** Returns true if the file is currently being read through mmap */
+    bool isMapped() { return mapped != NULL; }
+
+    /** A duplicate of the file descriptor that is closed when the last
+        reference goes away, so that asynchronous reads (see
+        dataseries::AsyncExtentReader) can finish after the source has
+        been closed or deleted. */
+    struct SharedFd : boost::noncopyable {
+        explicit SharedFd(int fd) : fd(fd) { }
+        ~SharedFd();
+        const int fd;
+    };
+    typedef boost::shared_ptr<SharedFd> SharedFdPtr;
+
+    /** Returns the shared descriptor for the currently open file.
+
+        Preconditions:
+        - isactive() */
+    SharedFdPtr sharedFd();
+
     /** Returns true if the file is currently open. */
     bool isactive() { return fd >= 0; }
 
@@ -106,6 +169,22 @@ class DataSeriesSource {
         for the file. */
     Extent::Ptr index_extent; 
 
+    /** Returns the "DataSeries: ExtentMinMax" extent written by
+        DataSeriesSink::recordMinMax(), or NULL if the file has none or the
+        index wasn't read.  The extent is read on first use.
+
+        Preconditions:
+        - isactive() */
+    Extent::Ptr minMaxExtent();
+
+    /** Returns true if the writer recorded that column is sorted
+        (non-decreasing) in the extent at extent_offset, i.e. that the
+        binary searches in SortedSearch.hpp are valid for it.
+
+        Preconditions:
+        - isactive() */
+    bool extentSortedBy(off64_t extent_offset, const std::string &column);
+
     /** Returns true if the endianness of the file is different from the
         endianness of the host processor. */
     bool needBitflip() { return need_bitflip; }
@@ -113,9 +192,20 @@ class DataSeriesSource {
     /** get the Filename associated with this file */
     const std::string &getFilename() { return filename; }
   private:
+    struct MappedFile;
+    struct Metadata;
+    typedef boost::shared_ptr<Metadata> MetadataPtr;
+    class MetadataCache;
+    static MetadataCache &metadataCache();
+
     void checkHeader();
-    void readTypeExtent();
+    void readTypeExtent(std::vector<ExtentType::Ptr> &types);
+    void readMetadata(off64_t file_size);
     void readTailIndex();
+    void mapFile(size_t file_size);
+    void readBytes(off64_t offset, ExtentType::byte *into, size_t amount);
+    bool mappedExtent(off64_t &offset, Extent::ByteArray &into);
+    void adviseReadahead(off64_t offset);
 
     ExtentTypeLibrary mylibrary;
 
@@ -125,6 +215,15 @@ class DataSeriesSource {
     off64_t cur_offset;
     bool need_bitflip, read_index, check_tail;
     int64_t mtime_nanosec;
+    const ReadMode read_mode;
+    boost::shared_ptr<MappedFile> mapped; // NULL unless ReadMmap and open
+    SharedFdPtr shared_fd; // created on demand, dropped on close
+    off64_t advised_until;
+    bool read_minmax; // minmax_extent and sorted_columns are filled in
+    Extent::Ptr minmax_extent;
+    std::set< std::pair<off64_t, std::string> > sorted_columns;
+
+    static ReadMode default_read_mode;
 };
 
 #endif
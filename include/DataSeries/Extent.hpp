@@ -23,6 +23,8 @@ extern "C" {
 #include <inttypes.h>
 #include <cstring>
 
+#include <vector>
+
 #if defined(__linux__) && defined(__GNUC__) && __GNUC__ >= 2 
 #  ifdef __i386__
 #    if defined __i486__ || defined __pentium__ || defined __pentiumpro__ || defined __pentium4__ || defined __k6__ || defined __k8__ || defined __athlon__ 
@@ -98,7 +100,7 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
             if (newsize <= oldsize) {
                 // shrink
                 endV = beginV + newsize;
-            } else if (newsize < static_cast<size_t>(maxV - beginV)) {
+            } else if (!isView() && newsize < static_cast<size_t>(maxV - beginV)) {
                 endV = beginV + newsize;
                 if (zero_it) {
                     memset(beginV + oldsize,0,newsize - oldsize);
@@ -119,7 +121,22 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
             swap(beginV,with.beginV);
             swap(endV,with.endV);
             swap(maxV,with.maxV);
+            view_owner.swap(with.view_owner);
+        }
+
+        /** Make this array refer to [begin, end) rather than owning its own
+            memory; owner keeps that memory alive (e.g. a file mapping) for
+            as long as the view exists.  The contents must not be modified.
+            Growing a view, or calling reserve(), turns it back into an
+            ordinary copy. */
+        void setView(byte *begin, byte *end, const boost::shared_ptr<void> &owner) {
+            SINVARIANT(owner != NULL && begin <= end);
+            clear();
+            beginV = begin;
+            endV = maxV = end;
+            view_owner = owner;
         }
+        bool isView() const { return view_owner != NULL; }
       
         typedef byte * iterator;
       
@@ -131,6 +148,9 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         // if you want to look at the retaining space code again, version 
         // d5bb884b572b07590a8131710f01513577e24813, prior to 2007-10-25
         // will have a copy of the old code.
+        //
+        // Buffers of at least BufferPool::min_pooled_size are also
+        // recycled through dataseries::BufferPool rather than freed.
         static void initMallocTuning();
       private:
         void swap(byte * &a, byte * &b) {
@@ -141,6 +161,7 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
       
         void copyResize(size_t newsize, bool zero_it);
         byte *beginV, *endV, *maxV;
+        boost::shared_ptr<void> view_owner; // non-NULL iff we don't own beginV
     };
   
     /// \cond INTERNAL_ONLY
@@ -200,8 +221,46 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     void clear() {
         fixeddata.clear();
         variabledata.clear();
+        dictionaries.clear();
         init();
     }
+
+    /** The dictionary of a pack_dictionary variable32 field in an unpacked
+        Extent.  Codes are dense, [0, value_offsets.size()), and equal
+        values in the field have equal codes, so grouping, equality tests
+        and joins on the field can use the codes without looking at the
+        values.  Code 0 is always the empty string.  Use
+        Variable32Field::dictionary() to get the dictionary for a field. */
+    struct Dictionary {
+        int32 field_offset; // of the field in each record
+        std::vector<int32> value_offsets; // code -> offset of the value in variabledata
+        std::vector<int32> codes; // record number -> code
+
+        int32 nValues() const {
+            return value_offsets.size();
+        }
+    };
+
+    /** Returns the dictionary for the variable32 field at field_offset, or
+        NULL if the field doesn't have one: it isn't pack_dictionary, the
+        Extent wasn't unpacked from a file, or the field or the number of
+        records has changed since it was. */
+    const Dictionary *getDictionary(int32 field_offset) const {
+        for (std::vector<Dictionary>::const_iterator i = dictionaries.begin();
+             i != dictionaries.end(); ++i) {
+            if (i->field_offset == field_offset) {
+                bool same_records = i->codes.size() * type->fixedrecordsize() == fixeddata.size();
+                return same_records ? &*i : NULL;
+            }
+        }
+        return NULL;
+    }
+
+    /// \cond INTERNAL_ONLY
+    /// Called when field_offset is modified, its codes are no longer right.
+    void dropDictionary(int32 field_offset);
+    /// \endcond
+
     /** Returns the total size of the @c Extent in bytes. */
     size_t size() {
         return fixeddata.size() + variabledata.size();
@@ -291,9 +350,51 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         Preconditions:
         - The type of the data must be the type of this Extent.
 
+        \arg only_fields If not NULL, and the type is
+        pack_layout="columns", only the columns needed for the named
+        fields are uncompressed and unpacked; the variable data is
+        skipped unless one of them is a variable32 field.  The other
+        fields will have arbitrary values, and size() will be smaller
+        than unpackedSize().  Ignored for other layouts.
+
+        \arg lazy If true, the byte flipping, scaling and relative
+        unpacking of each field is left until the field is first used,
+        see unpackField(); fields that are never used are never
+        unpacked.  Code that reads fixeddata other than through fields
+        bound to a series over the Extent (e.g. with the Extent and row
+        offset accessors) must call unpackField() or
+        unpackAllFields() first, as must any thread other than the one
+        that will use the fields.
+
         Note you can't unpack the same data twice, it may modify the
         input data */
-    void unpackData(Extent::ByteArray &from, bool need_bitflip);
+    void unpackData(Extent::ByteArray &from, bool need_bitflip,
+                    const std::vector<std::string> *only_fields = NULL, bool lazy = false);
+
+    /** Returns true if unpackData(..., lazy = true) left some fields packed. */
+    bool hasPendingFields() const {
+        return !pending_fields.empty();
+    }
+
+    /** Finishes unpacking field name, and any field it is packed relative
+        to, if unpackData() left it packed.  ExtentSeries calls this for
+        each of its fields when it is set to the Extent, and for a field
+        when it is added or renamed.  Does nothing for names not in the
+        type.  The result is the same as if the Extent had been
+        unpacked eagerly. */
+    void unpackField(const std::string &name) const {
+        if (!pending_fields.empty()) {
+            unpackPendingField(name);
+        }
+    }
+
+    /** Finishes unpacking all of the fields unpackData() left packed; after
+        this the bytes are identical to those of an eager unpackData(). */
+    void unpackAllFields() const {
+        if (!pending_fields.empty()) {
+            unpackPendingFields();
+        }
+    }
 
     /** Returns true if position is inside the fixed data for this extent, otherwise false */
     bool insideExtentFixed(byte *position) const {
@@ -399,6 +500,12 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // updates offset to the end of the extent
     static bool preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip);
 
+    // the first packed_prefix_size bytes of a packed extent determine its
+    // total size; packedExtentSize returns that size, or 0 if prefix is
+    // actually the start of the file tail (which it verifies).
+    static const int packed_prefix_size = 6*4 + 4*1;
+    static uint64_t packedExtentSize(byte *prefix, bool need_bitflip);
+
     // returns true if it read amount bytes, returns false if it read
     // 0 bytes and eof_ok; aborts otherwise
     static bool checkedPread(int fd, off64_t offset, byte *into, int amount, 
@@ -420,6 +527,19 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // if it hasn't already been called.
     static void setReadChecksFromEnv(bool default_with_env_unset = false);
 
+    /** How unpackData applies the byte flipping, scaling and relative
+        packing transforms.  UnpackByColumn (the default) makes one
+        strided pass over fixeddata per transform; UnpackByRow is the
+        original record-at-a-time loop, retained for comparison.  Both
+        produce identical bytes. */
+    enum UnpackStrategy { UnpackByColumn, UnpackByRow };
+    static void setUnpackStrategy(UnpackStrategy strategy) {
+        unpack_strategy = strategy;
+    }
+    static UnpackStrategy getUnpackStrategy() {
+        return unpack_strategy;
+    }
+
     /// \cond INTERNAL_ONLY
     // be smart before directly accessing these!  here because making
     // them private and using friend class ExtentSeries::iterator
@@ -454,7 +574,37 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
                                  int32 fromsize);
 
     void compactNulls(Extent::ByteArray &fixed_coded);
-    void uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size);
+    void uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size, int32_t nrecords,
+                        bool fix_endianness);
+    void encodeIntColumns(const Extent::ByteArray &records, Extent::ByteArray &into);
+    const byte *decodeIntColumns(Extent::ByteArray &records, const byte *from,
+                                 const byte *from_end, bool fix_endianness);
+    uint32_t packColumns(const Extent::ByteArray &records, uint32_t compression_modes,
+                         uint32_t compression_level, Extent::ByteArray &into);
+    bool neededColumns(const std::vector<std::string> *only_fields,
+                       std::vector<bool> &columns) const;
+    uint32_t unpackColumns(byte *from, int32 from_size, bool fix_endianness,
+                           const std::vector<bool> &columns);
+    void unpackFieldsByRow(bool fix_endianness);
+    void unpackFieldsByColumn(bool fix_endianness);
+    void unpackFieldColumn(uint32_t field_num, bool fix_endianness) const;
+    void unpackOtherRelative(uint32_t j) const;
+    static UnpackStrategy unpack_strategy;
+    void decodeDictionaries(const std::vector<byte *> &tables, bool fix_endianness);
+
+    std::vector<Dictionary> dictionaries; // only for extents made by unpackData
+
+    // unpackData(..., lazy = true)
+    void startLazyUnpack(bool fix_endianness);
+    void unpackPendingField(const std::string &name) const;
+    void unpackPendingField(uint32_t field_num) const;
+    void unpackPendingFields() const;
+    int otherRelativeIndex(int field_num) const;
+    // Unpacking a field doesn't change its value, so these are mutable to let const users of
+    // an Extent finish it.
+    mutable std::vector<bool> pending_fields; // by field number; empty if none are pending
+    mutable uint32_t npending_fields;
+    bool pending_fix_endianness;
     friend class ExtentSeries;
     void createRecords(unsigned int nrecords); // will leave iterator pointing at the current record
     void init();
@@ -225,7 +225,9 @@ class ExtentSeries {
         Postconditions:
         - getExtent() = e
         - the current position will be set to the beginning of the
-        new @c Extent. */
+        new @c Extent.
+        - the fields of the series are unpacked, if e was lazily unpacked;
+        see Extent::unpackField() */
     void setExtent(Extent *e) DS_RAW_EXTENT_PTR_DEPRECATED;
 
     // TODO: deprecate the non-shared pointer versions of series stuff; probably want to
@@ -289,6 +291,9 @@ class ExtentSeries {
     /** Removes a field. Never call this directly, the @c Field destructor
         handles this automatically.*/
     void removeField(Field &field, bool must_exist = true);
+    /** Returns the names of the fields registered with the series, e.g. to tell
+        IndexSourceModule::setNeededFields() which fields will be read. */
+    std::vector<std::string> getFieldNames() const;
 
     /** Appends a record to the end of the current Extent. Invalidates any
         other @c ExtentSeries operating on the same Extent. i.e. you must
@@ -428,6 +433,14 @@ class ExtentSeries {
                                          pos.cur_extent);
     }
 
+    /** Moves the current position to row_offset in the current extent;
+        the inverse of getRowOffset().  row_offset may be the end of the
+        extent, in which case morerecords() will be false. */
+    void setRowOffset(const dataseries::SEP_RowOffset &row_offset) {
+        DEBUG_SINVARIANT(pos.cur_extent != NULL);
+        pos.setPos(pos.cur_extent->fixeddata.begin() + row_offset.row_offset);
+    }
+
   private:
     // both friends to get at pos.record_start()
     friend class Field;
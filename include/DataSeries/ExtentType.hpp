@@ -46,9 +46,11 @@ namespace dataseries {
  <field type="int32" name="input2" pack_relative="input1" />
  <field type="int64" name="int64-1" pack_relative="int64-1" opt_nullable="yes" />
  <field type="int64" name="int64-2" />
+ <field type="int64" name="int64-3" pack_int_encoding="frame_of_reference" />
  <field type="double" name="double1" pack_scale="1e-6" pack_relative="double1" />
  <field type="variable32" name="var1" pack_unique="yes"/>\n"
  <field type="variable32" name="var2"/>\n"
+ <field type="variable32" name="var3" pack_dictionary="yes"/>\n"
  <field type="fixedwidth" name="fw1" size="7" note="experimental" />
  <field type="fixedwidth" name="fw2" size="20" note="experimental" />
  </ExtentType>
@@ -126,6 +128,26 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         CompactNo
     };
 
+    /** Determines how the values of an int32 or int64 field are stored
+        when writing an Extent to a file.  The encoded values are removed
+        from the records and stored as one column for the Extent, after
+        any pack_relative transformation, and before compression.  If an
+        encoding would be larger than the plain values for an Extent,
+        the plain values are stored instead. */
+    enum IntEncoding {
+        /** Store the values in the records. */
+        IntEncodingNone = 0,
+        /** Subtract the minimum value in the Extent, and store the
+            differences in the number of bits needed for the largest.
+            Good for values in a small range, e.g. offsets from a
+            pack_relative base. */
+        IntEncodingFrameOfReference,
+        /** Store the difference from the previous record's value as a
+            zig-zag encoded variable length integer.  Good for slowly
+            changing values, e.g. timestamps of records in time order. */
+        IntEncodingZigZagDelta
+    };
+
     /** \brief Determines how much padding to add to align records properly.
 
         The original padding was a mistake because it always padded to 8 bytes
@@ -168,6 +190,22 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         FieldOrderingBigToSmallSepVar32,
     };
 
+    /** \brief Specifies how the records are stored in a file.
+
+        The records of an unpacked Extent are always stored one after
+        another; the layout only changes how they are written out. */
+    enum PackLayout {
+        /** Store the records one after another; the default. */
+        LayoutRows,
+        /** Store each column of the records contiguously, and compress
+            each column separately, so a reader that only needs a few
+            fields only has to uncompress and unpack their columns, see
+            Extent::unpackData().  Each non-bool field is a column, as
+            is each byte of bool fields.  Can not be combined with
+            pack_null_compact or pack_int_encoding. */
+        LayoutColumns
+    };
+
     /** Returns the type of the Extent that stores the XML descriptions
         of all the ExtentTypes used in a DataSeries file. */
     static const ExtentType::Ptr getDataSeriesXMLTypePtr() {
@@ -183,6 +221,11 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     static const ExtentType &getDataSeriesIndexTypeV0() FUNC_DEPRECATED {
         return *dataseries_index_type_v0;
     }
+    /** Returns the type of the per-extent column statistics that
+        DataSeriesSink::recordMinMax() adds to a DataSeries file. */
+    static const ExtentType::Ptr getDataSeriesMinMaxTypePtr() {
+        return dataseries_minmax_type;
+    }
 
 
     // we have visible and invisible fields; visible fields are
@@ -257,6 +300,28 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         int cnum = getColumnNumber(rep, column, false);
         return getUnique(cnum);
     }
+    /** Returns true for a @c variable32 field which has been marked
+        pack_dictionary.  Each distinct value of the field is stored once
+        per packed Extent, and the records store a small integer code for
+        their value rather than an offset.  When the Extent is unpacked
+        the codes are kept (see Extent::Dictionary), so equal values can
+        be recognized by comparing codes.
+
+        Preconditions:
+        - The field exists and is a @c variable32 field. */
+    bool getDictionary(const std::string &column) const {
+        int cnum = getColumnNumber(rep, column, false);
+        return getDictionary(cnum);
+    }
+    /** Returns the pack_int_encoding of a field, IntEncodingNone if it
+        doesn't have one.
+
+        Preconditions:
+        - The specified field exists. */
+    IntEncoding getIntEncoding(const std::string &column) const {
+        int cnum = getColumnNumber(rep, column, false);
+        return getIntEncoding(cnum);
+    }
     /** Returns true if a field is nullable. A nullable field does not have
         to be present in any given record.
 
@@ -344,6 +409,10 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     PackNullCompact getPackNullCompact() const { 
         return rep.pack_null_compact; 
     }
+    /** Returns the layout of the records when writing to a file. */
+    PackLayout getPackLayout() const {
+        return rep.pack_layout;
+    }
     /** Returns the name of the ExtentType. This corresponds the the "name"
         attribute in the XML. */
     const std::string &getName() const { return rep.name; }
@@ -379,12 +448,15 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         // valid for bool fields.
         int32 size, offset, bitpos; 
         int null_fieldnum;
-        bool unique;
+        bool unique, dictionary;
+        IntEncoding int_encoding;
+        int layout_column; // index into layout_columns, -1 for LayoutRows
         nullCompactInfo *null_compact_info;
         double doublebase;
         xmlNodePtr xmldesc;
         fieldInfo() : type(ft_unknown), size(-1), offset(-1), bitpos(-1),
-                      null_fieldnum(-1), unique(false), 
+                      null_fieldnum(-1), unique(false), dictionary(false),
+                      int_encoding(IntEncodingNone), layout_column(-1),
                       null_compact_info(NULL), doublebase(0), xmldesc(NULL)
         { }
     };
@@ -397,6 +469,7 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
   private:
     static const ExtentType::Ptr dataseries_xml_type;
     static const ExtentType::Ptr dataseries_index_type_v0;
+    static const ExtentType::Ptr dataseries_minmax_type;
 
     // a compelling case has been made that identifying fields by
     // column number is not necessary (the only use so far is for
@@ -410,6 +483,8 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     int32 getOffset(int column) const;
     int getBitPos(int column) const;
     bool getUnique(int column) const;
+    bool getDictionary(int column) const;
+    IntEncoding getIntEncoding(int column) const;
     bool getNullable(int column) const;
     double getDoubleBase(int column) const;
 
@@ -453,8 +528,11 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         std::vector<fieldInfo> field_info;
         std::vector<nullCompactInfo> nonbool_compact_info_size1,
             nonbool_compact_info_size4, nonbool_compact_info_size8; 
+        // pack_int_encoding fields; not in the above, they are stored separately
+        std::vector<nullCompactInfo> int_encoded_compact_info;
         int bool_bytes;
         std::vector<int32> variable32_field_columns;
+        std::vector<int32> dictionary_field_columns; // subset of the above
         
         std::vector<pack_scaleT> pack_scale;
         std::vector<pack_other_relativeT> pack_other_relative;
@@ -464,8 +542,17 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         uint32_t major_version, minor_version;
         std::string type_namespace;
         PackNullCompact pack_null_compact;
+        // pack_null_compact or pack_int_encoding fields; records are written compacted
+        bool compact_records;
         PackPadRecord pad_record;
         PackFieldOrdering field_ordering;
+        PackLayout pack_layout;
+        // LayoutColumns: the bytes of each column in the record, in offset order; padding
+        // bytes are not in any column.
+        struct layoutColumn {
+            int32 offset, size;
+        };
+        std::vector<layoutColumn> layout_columns;
         void sortAssignNCI(std::vector<nullCompactInfo> &nci);
 
         ~ParsedRepresentation() {
@@ -108,6 +108,13 @@ class Field {
         setNull(e, e.fixeddata.begin() + row_offset.row_offset, val);
     }
 
+    /** Returns true if the field may be null in the current type; false
+        if either the type's field isn't nullable or flag_nullable wasn't
+        passed to the constructor. */
+    bool isNullable() const {
+        return nullable;
+    }
+
     /** Returns the name of the field. */
     const std::string &getName() const {
         return fieldname;
@@ -18,7 +18,13 @@
 class FixedField : public Field {
   public:
     typedef ExtentType::byte byte;
-    
+
+    /** Byte offset of the field within each row, for code that scans a
+        column directly (see SortedSearch.hpp); -1 until the type is set. */
+    int32_t getOffset() const {
+        return offset;
+    }
+
   protected:
     FixedField(ExtentSeries &dataseries, const std::string &field, 
                ExtentType::fieldType ft, int flags);
@@ -68,6 +68,13 @@ namespace dataseries {
                 DataSeriesSink.cpp:get_thread_cputime() */
             double pack_time; 
 
+            /** An estimate of the packing time avoided by the adaptive
+                compression policy, i.e. how much longer packing would
+                have taken if every enabled algorithm had been tried on
+                the extents that only used the remembered winners.  Always
+                0 with the default try-all policy. */
+            double pack_time_saved;
+
             /** Initializes all statistics to 0. */
             Stats() {
                 reset();
@@ -12,6 +12,8 @@
 #ifndef __DATASERIES_INDEXSOURCEMODULE_H
 #define __DATASERIES_INDEXSOURCEMODULE_H
 
+#include <sys/time.h>
+
 #include <Lintel/PThread.hpp>
 #include <Lintel/Deque.hpp>
 #include <Lintel/Stats.hpp>
@@ -48,16 +50,11 @@
 // function while we are destroying.  If we rewrite this to have a subclass
 // which does the locked extent operations, then we can properly cleanup.
 // Moreover, once we do a rewrite, we can use the modern lintel locking support
-// (locking in here is a bit weird), and we can probably share the
-// decompression threads and prefetching threads across multiple new-style
-// index source modules which would reduce the number of threads and give us
-// better control over the priority of decompression, and the memory used
-// during it (effectively a global pool rather than a per-type pool).  While
-// making those changes, also fixing the code so that we have parallel
-// compressed reading would be a good idea.  With large disk subsystem
-// machines, and the really many cores we have now, it is not difficult to need
-// to have multiple threads reading in extents in order to read them fast
-// enough to keep the pipeline full.
+// (locking in here is a bit weird).  Unpacking is already shared across all
+// modules through dataseries::UnpackPool, which also holds the process-wide
+// budget for compressed extents; each module still has its own compressed
+// prefetch thread, but if dataseries::AsyncExtentReader is enabled that
+// thread only issues reads, so many reads can be in flight at once.
 
 class IndexSourceModule : public SourceModule {
   public:
@@ -67,13 +64,34 @@ class IndexSourceModule : public SourceModule {
     virtual Extent::Ptr getSharedExtent();
 
     /** call this to start prefetching; if you don't call it, it will
-        be automatically called when you call getExtent; Max
-        compressed may slightly overrun because we don't know the size
-        of compressed extents until we read them. nthreads == -1 ==>
-        use # cpus */
+        be automatically called when you call getExtent.  Compressed
+        extents are limited by the process-wide budget in
+        dataseries::UnpackPool, which is raised to at least
+        prefetch_max_compressed; it may slightly overrun because we don't
+        know the size of compressed extents until we read them.  Unpacking
+        happens on the shared UnpackPool threads; n_unpack_threads sets
+        the size of that pool if it has not yet started, -1 ==> use #
+        cpus. */
     virtual void startPrefetching(unsigned prefetch_max_compressed = 8 * 1024 * 1024,
                                   unsigned prefetch_max_unpacked = 32 * 1024 * 1024,
                                   int n_unpack_threads = -1);
+    /** call this before prefetching starts to say that only the fields
+        bound to series will be read from the returned extents.  Extents
+        whose type is pack_layout="columns" will then only have those
+        columns unpacked, see Extent::unpackData(); the other fields will
+        have arbitrary values.  Has no effect on other extents. */
+    void setNeededFields(const ExtentSeries &series);
+
+    /** call this before prefetching starts to have the returned extents
+        unpacked lazily, see Extent::unpackData(): each field is only
+        byte flipped, scaled and relative unpacked when an ExtentSeries
+        with that field is set to the extent.  Only for consumers that
+        read the extents through fields, one thread at a time; an
+        extent passed on to several threads at once needs
+        Extent::unpackAllFields() first, as RowAnalysisModule does for
+        its parallel workers. */
+    void setLazyUnpack(bool lazy);
+
     /** call this to start the index source module over again from the 
         beginning */
     virtual void resetPos();
@@ -95,20 +113,28 @@ class IndexSourceModule : public SourceModule {
 
     struct WaitStats {
         uint64_t nextents, consumer, compressed_downstream_full;
-        uint64_t unpack_no_upstream, unpack_downstream_full;
-        uint64_t unpack_yield_front, unpack_yield_ready;
-        uint64_t skip_unpack_signal;
+        uint64_t unpack_downstream_full;
 
         Stats active_unpack_stats;
         int active_unpackers;
         void lockedUpdateActive() {
             active_unpack_stats.add(active_unpackers);
         }
+
+        /// compressed bytes read, and wall time with at least one read outstanding
+        uint64_t read_bytes;
+        double read_busy_seconds;
+        /// number of reads outstanding for this module as each read is issued
+        Stats read_queue_depth;
+        /// achieved read bandwidth in bytes/second while reading
+        double readBandwidth() const {
+            return read_busy_seconds > 0 ? read_bytes / read_busy_seconds : 0;
+        }
+
         WaitStats()
                 : nextents(0), consumer(0), compressed_downstream_full(0),
-                  unpack_no_upstream(0), unpack_downstream_full(0),
-                  unpack_yield_front(0), unpack_yield_ready(0),
-                  skip_unpack_signal(0), active_unpackers(0)
+                  unpack_downstream_full(0), active_unpackers(0),
+                  read_bytes(0), read_busy_seconds(0)
         { }
     };
 
@@ -116,23 +142,28 @@ class IndexSourceModule : public SourceModule {
     bool getWaitStats(WaitStats &stats);
 
     /** use readCompressed() to create this structure, it will unlock
-        the mutex while doing the work to get the compressed data */
+        the mutex while doing the work to get the compressed data, or 
+        return with read_pending set if the read is asynchronous. */
     struct PrefetchExtent {
         Extent::ByteArray bytes;
         ExtentType::Ptr type;
         Extent::Ptr unpacked;
-        bool need_bitflip;
+        bool need_bitflip, read_pending;
         std::string uncompressed_type, extent_source;
         int64_t extent_source_offset;
         PrefetchExtent() 
-                : type(), unpacked(), need_bitflip(false), extent_source_offset(-1) { }
+                : type(), unpacked(), need_bitflip(false), read_pending(false),
+                  extent_source_offset(-1) { }
     };
 
   protected:
     bool startedPrefetching() { return prefetch != NULL; }
 
     /** utility function to read compressed data, it will unlock and relock
-        the mutex associated with prefetching */
+        the mutex associated with prefetching.  If asynchronous reads are
+        enabled, it instead queues the read with dataseries::AsyncExtentReader
+        and returns immediately; the source may be deleted before the read
+        completes. */
     PrefetchExtent *readCompressed(DataSeriesSource *dss,
                                    off64_t offset, 
                                    const std::string &uncompressed_type);
@@ -154,11 +185,16 @@ class IndexSourceModule : public SourceModule {
     void lockedStartThreads();
 
     friend class IndexSourceModuleCompressedPrefetchThread;
-    friend class IndexSourceModuleUnpackThread;
     void compressedPrefetchThread();
-    void unpackThread();
+    void lockedSubmitUnpacks();
+    void unpackJob(PrefetchExtent *pe, uint32_t unpacked_size);
+    void readDone(PrefetchExtent *pe);
+    void lockedReadStarted();
+    void lockedReadFinished(size_t nbytes);
 
     bool getting_extent;
+    std::vector<std::string> needed_fields; // empty ==> all
+    bool lazy_unpack;
 
     struct Queue {
         Queue(unsigned _limit) : cur(0), limit(_limit) { }
@@ -200,17 +236,22 @@ class IndexSourceModule : public SourceModule {
     // moved into the parent class, the locking can be fixed up.
 
     struct PrefetchInfo {
+        // the limit on compressed is unused, the budget is in UnpackPool
         Queue compressed, unpacked;
         WaitStats stats;
         PThread *compressed_prefetch_thread;
-        std::vector<PThread *> unpack_threads;
         PThreadMutex mutex;
-        PThreadCond compressed_cond, unpack_cond, ready_cond;
+        PThreadCond compressed_cond, ready_cond;
         bool source_done;
         uint32_t abort_prefetching; // number of threads remaining to abort 
+        uint32_t outstanding_unpacks; // jobs submitted to the UnpackPool
+        uint32_t outstanding_reads; // reads submitted to the AsyncExtentReader
+        struct timeval read_busy_start; // valid if outstanding_reads > 0
 
         PrefetchInfo(unsigned cmm, unsigned tum) 
-                : compressed(cmm), unpacked(tum), source_done(false), abort_prefetching(0)
+                : compressed(cmm), unpacked(tum), compressed_prefetch_thread(NULL),
+                  source_done(false), abort_prefetching(0), outstanding_unpacks(0),
+                  outstanding_reads(0)
         { }
 
         bool allDone() {
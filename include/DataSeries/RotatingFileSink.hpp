@@ -39,12 +39,12 @@ namespace dataseries {
             continue to be used until a rotation is completed, i.e. a call to
             changeFile(something); waitForCanChange(); Note, it is safe to call the canChangeFile,
             getNewFilename, and changeFile methods while in the callback, but it is not safe to
-            call the other operations because that could block up the writer thread which would
-            result in blocking up the queue in the data series file. Also note that the callback
-            may be called on extents written to a file that is no longer current since rotation has
-            already occurred.  Therefore, if you are going to rotate based on extent position, then
-            you should also limit rotation to some frequency, and/or check that the current file is
-            large before re-rotating. */
+            call the other operations because that could block up the SinkPool thread writing the
+            file which would result in blocking up the queue in the data series file. Also note
+            that the callback may be called on extents written to a file that is no longer current
+            since rotation has already occurred.  Therefore, if you are going to rotate based on
+            extent position, then you should also limit rotation to some frequency, and/or check
+            that the current file is large before re-rotating. */
         void setExtentWriteCallback(const DataSeriesSink::ExtentWriteCallback &callback);
 
         /** Complete the transition to a new sink (if any), and flush out the current data series
@@ -16,6 +16,7 @@
 
 class DSExpr;
 class SequenceModule;
+class TypeIndexModule;
 
 /** \brief Single series analysis handling each row in order.  
 
@@ -85,6 +86,16 @@ class RowAnalysisModule : public DataSeriesModule {
      */
     void setWhereExpr(const std::string &where_expression);
 
+    /** \brief let the module supplying our extents skip ones that can't match
+     *
+     * Passes the where expression to from, which can then skip extents
+     * whose min/max statistics show that no row matches.  Only valid if
+     * nothing else that reads from from needs those extents, e.g. another
+     * analysis module later in the same sequence.
+     *
+     * @return true if the expression was passed down */
+    bool pushWhereExprDown(TypeIndexModule &from);
+
     /** \brief iterate across the sequence printing results if possible.
      * Tries to dynamically case each module in the sequence to a
      * RowAnalysisModule.  If it does not succeed, it ignores the
@@ -95,15 +106,62 @@ class RowAnalysisModule : public DataSeriesModule {
      * @return the number of modules that could not be printed */
     static int printAllResults(SequenceModule &sequence, int expected_nonprintable = -1);
 
+    /** \brief State for processing rows on one worker thread; see enableParallel() */
+    class ThreadState {
+      public:
+        virtual ~ThreadState();
+        /** process the current row of the series passed to newThreadState() */
+        virtual void processRow() = 0;
+    };
+
+    /** \brief process extents on worker threads
+     *
+     * Each extent is handed to one of nthreads worker threads (-1 ==> #
+     * cpus), each of which processes rows into its own ThreadState; the
+     * states are merged into the module before completeProcessing() is
+     * called.  Extents are returned by getSharedExtent() while they are
+     * still being processed, so later modules must not modify them.  Rows
+     * are not processed in order, so this only makes sense for modules
+     * whose result does not depend on the order.  newExtentHook(),
+     * firstExtent() and prepareForProcessing() are still called on the
+     * calling thread.  Has no effect unless the module implements
+     * newThreadState(); must be called before the first extent. */
+    void enableParallel(int nthreads = -1);
+
     uint64_t processed_rows, ignored_rows;
 
   protected:
+    /** Called once per worker thread after prepareForProcessing() if
+        enableParallel() was called; returns state whose fields are in
+        series, or NULL (the default) if the module can only process rows
+        serially. */
+    virtual ThreadState *newThreadState(ExtentSeries &series);
+
+    /** Merge the state from one worker thread into this module; called on
+        the calling thread, in worker order, once all extents have been
+        processed. */
+    virtual void mergeThreadState(ThreadState &state);
+
     ExtentSeries series;
     DataSeriesModule &source;
     bool prepared;
 
     std::string where_expr_str;
     DSExpr *where_expr;
+
+  private:
+    friend class RowAnalysisWorker;
+    struct ParallelInfo;
+
+    void startParallel(const Extent &e);
+    void finishParallel(bool merge);
+    void processExtent(ExtentSeries &in, DSExpr *where, ThreadState *state,
+                       uint64_t &processed, uint64_t &ignored);
+    void workerThread(unsigned worker_num);
+
+    ExtentSeries::typeCompatibilityT type_compatibility;
+    int parallel_threads; // 0 ==> serial
+    ParallelInfo *parallel; // NULL until the first extent in parallel mode
 };
 
 #endif
@@ -17,6 +17,7 @@
 
 #include <DataSeries/Extent.hpp>
 
+class ExtentSeries;
 class Field;
 class FixedField;
 class Variable32Field;
@@ -128,6 +129,11 @@ namespace dataseries {
             DEBUG_SINVARIANT(extent == them.extent);
             return row_offset >= them.row_offset;
         }
+
+        /// Offset of the row in bytes from the start of the extent's fixed data
+        uint32_t fixedOffset() const {
+            return row_offset;
+        }
         
       private:
         uint8_t *rowPos(const Extent &e) const {
@@ -135,6 +141,7 @@ namespace dataseries {
             DEBUG_SINVARIANT(e.insideExtentFixed(ret));
             return ret;
         }
+        friend class ::ExtentSeries;
         friend class ::Field;
         friend class ::FixedField;
         friend class ::Variable32Field;
@@ -0,0 +1,108 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Process-wide pool of threads that pack and write extents for DataSeriesSinks
+*/
+
+#ifndef DATASERIES_SINKPOOL_HPP
+#define DATASERIES_SINKPOOL_HPP
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <map>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <Lintel/PThread.hpp>
+
+class DataSeriesSink;
+
+namespace dataseries {
+    /** \brief Compression and write threads shared by all DataSeriesSinks in a process.
+
+        A sink used to start its own compressor threads and a writer thread,
+        so programs that keep several sinks open (RotatingFileSink during a
+        rotation, converters that split their output into several files)
+        ran many times more threads than cores.  Sinks now queue their
+        extents here instead.  Each queued extent is one job; workers take
+        jobs from the sinks round-robin, so a sink that queues extents
+        quickly can not starve the others.  Extents are still written to
+        each file in the order they were queued: whichever worker finds
+        the oldest extents of a sink packed writes them, while other
+        workers keep packing.
+
+        The pool also enforces a process-wide limit on the bytes of extents
+        that have been queued but not yet written.  A sink that queues an
+        extent blocks while the pool is over the limit, or while it has
+        2 * nThreads() extents of its own outstanding, unless it has
+        nothing outstanding, which guarantees that every sink can always
+        make progress. */
+    class SinkPool : boost::noncopyable {
+      public:
+        /** Returns the pool, creating it on first use.  The pool lives
+            until the process exits. */
+        static SinkPool &instance();
+
+        /** Sets the number of worker threads; -1 means use min(# cpus,
+            MAX_THREADS/2).  Only has an effect before the first sink is
+            opened. */
+        void setThreadCount(int nthreads);
+
+        /** Returns the number of worker threads, starting them if needed. */
+        size_t nThreads();
+
+        /** Sets the limit on bytes queued in all sinks but not yet written;
+            the default is 256 MiB. */
+        void setMaxBytesInProgress(size_t nbytes);
+
+        size_t getMaxBytesInProgress();
+
+        /// \cond INTERNAL_ONLY
+        // Used by DataSeriesSink; the sink's mutex may be held when calling
+        // these except for waitToQueue() and removeSink(), never the other way around.
+        void addSink(DataSeriesSink *sink);
+        void removeSink(DataSeriesSink *sink);
+        void queued(DataSeriesSink *sink, size_t nbytes);
+        void written(DataSeriesSink *sink, size_t nextents, size_t nbytes);
+        void waitToQueue(DataSeriesSink *sink);
+
+        void workerThread();
+        /// \endcond
+
+      private:
+        SinkPool();
+        ~SinkPool();
+
+        struct SinkState {
+            uint32_t jobs; // extents queued but not taken by a worker
+            uint32_t running; // workers currently packing or writing for the sink
+            uint32_t outstanding; // extents queued but not written
+            bool removing;
+            SinkState() : jobs(0), running(0), outstanding(0), removing(false) { }
+        };
+        typedef std::map<DataSeriesSink *, SinkState> SinkMap;
+
+        void lockedStartThreads();
+        SinkMap::iterator lockedNextSink();
+        SinkState &lockedState(DataSeriesSink *sink);
+
+        int requested_threads;
+        std::vector<PThread *> workers;
+
+        // protects everything below, and the worker vector once threads are started
+        PThreadMutex mutex;
+        PThreadCond work_cond, budget_cond, idle_cond;
+        SinkMap sinks;
+        DataSeriesSink *last_sink; // the last sink a worker took a job from
+        size_t max_bytes_in_progress, bytes_in_progress;
+    };
+}
+
+#endif
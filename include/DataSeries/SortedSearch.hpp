@@ -0,0 +1,276 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Binary search over a column that is sorted in an extent.
+
+    lowerBound, upperBound and equalRange work like the STL algorithms of
+    the same name, with the rows of an extent as the sequence and the
+    values of one field as the keys; the results are SEP_RowOffsets, which
+    can be used with the field accessors that take an extent and row
+    offset, or passed to ExtentSeries::setRowOffset().  The column must be
+    non-decreasing in the extent; DataSeriesSource::extentSortedBy() says
+    whether the writer recorded that for an extent (see
+    DataSeriesSink::recordMinMax()).  Null values compare as the field's
+    default value.
+
+    Int32Field, Int64Field, DoubleField, ByteField and non-nullable
+    TFixedField columns that aren't nullable in the extent's type are read
+    directly out of the fixed data; Variable32Field compares bytes against
+    a string.  Any other field with val(extent, row_offset), e.g. a
+    GeneralField searched with a GeneralValue, goes through that accessor.
+    DoubleField values are searched for as absval() returns them, so a
+    column with a non-zero opt_doublebase (see
+    DoubleField::flag_allownonzerobase) is searched by its absolute values.
+    The typed searches unpack their field first if the extent was unpacked
+    lazily (see Extent::unpackField()); a search through any other field's
+    accessor needs the field unpacked by the caller.
+
+    @code
+    pair<SEP_RowOffset, SEP_RowOffset> range(equalRange(*e, timestamp, when));
+    for (SEP_RowOffset i = range.first; i != range.second; i.advance(1, e.get())) { ... }
+    @endcode
+*/
+
+#ifndef DATASERIES_SORTEDSEARCH_HPP
+#define DATASERIES_SORTEDSEARCH_HPP
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include <DataSeries/ByteField.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/ExtentSeries.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/TFixedField.hpp>
+#include <DataSeries/Variable32Field.hpp>
+
+namespace dataseries {
+    namespace detail {
+        // Binary searches over row numbers [0, nrows), using column.less(row, value)
+        // for "the row's value is < value", and column.greater(row, value) for ">".
+        template<class Column, typename T>
+        int32_t lowerBoundRow(const Column &column, int32_t nrows, const T &value) {
+            int32_t first = 0;
+            while (nrows > 0) {
+                int32_t half = nrows / 2;
+                if (column.less(first + half, value)) {
+                    first += half + 1;
+                    nrows -= half + 1;
+                } else {
+                    nrows = half;
+                }
+            }
+            return first;
+        }
+
+        template<class Column, typename T>
+        int32_t upperBoundRow(const Column &column, int32_t nrows, const T &value) {
+            int32_t first = 0;
+            while (nrows > 0) {
+                int32_t half = nrows / 2;
+                if (column.greater(first + half, value)) {
+                    nrows = half;
+                } else {
+                    first += half + 1;
+                    nrows -= half + 1;
+                }
+            }
+            return first;
+        }
+
+        inline int32_t extentRows(const Extent &e) {
+            return e.fixeddata.size() / e.getTypePtr()->fixedrecordsize();
+        }
+
+        // Reads through the field's val(extent, row_offset); handles nulls and GeneralField.
+        template<class FieldT> class RowOffsetColumn {
+          public:
+            RowOffsetColumn(const Extent &e, const FieldT &field)
+                : e(e), field(field), first(0, &e) { }
+
+            template<typename T> bool less(int32_t row, const T &value) const {
+                return field.val(e, SEP_RowOffset(first, row, e)) < value;
+            }
+            template<typename T> bool greater(int32_t row, const T &value) const {
+                return value < field.val(e, SEP_RowOffset(first, row, e));
+            }
+
+          private:
+            const Extent &e;
+            const FieldT &field;
+            const SEP_RowOffset first;
+        };
+
+        // Reads a non-nullable fixed field straight out of the fixed data.
+        template<typename V> class RawFixedColumn {
+          public:
+            RawFixedColumn(const Extent &e, const FixedField &field)
+                : base(e.fixeddata.begin() + field.getOffset()),
+                  stride(e.getTypePtr()->fixedrecordsize()) {
+                e.unpackField(field.getName());
+            }
+
+            V at(int32_t row) const {
+                return *reinterpret_cast<const V *>(base + static_cast<size_t>(row) * stride);
+            }
+            template<typename T> bool less(int32_t row, const T &value) const {
+                return at(row) < value;
+            }
+            template<typename T> bool greater(int32_t row, const T &value) const {
+                return value < at(row);
+            }
+
+          private:
+            const uint8_t *base;
+            const size_t stride;
+        };
+
+        // Compares variable32 values bytewise, the same order as std::string.
+        class Variable32Column {
+          public:
+            Variable32Column(const Extent &e, const Variable32Field &field)
+                : e(e), field(field), first(0, &e) {
+                e.unpackField(field.getName());
+            }
+
+            int compare(int32_t row, const std::string &value) const {
+                SEP_RowOffset offset(first, row, e);
+                size_t size = field.size(e, offset);
+                int ret = memcmp(field.val(e, offset), value.data(), std::min(size, value.size()));
+                if (ret != 0) {
+                    return ret;
+                }
+                return size < value.size() ? -1 : (size > value.size() ? 1 : 0);
+            }
+            bool less(int32_t row, const std::string &value) const {
+                return compare(row, value) < 0;
+            }
+            bool greater(int32_t row, const std::string &value) const {
+                return compare(row, value) > 0;
+            }
+
+          private:
+            const Extent &e;
+            const Variable32Field &field;
+            const SEP_RowOffset first;
+        };
+
+        // Picks the column reader for a field type; specialized below for the typed fast paths.
+        template<class FieldT> struct SortedSearch {
+            template<typename T>
+            static int32_t lower(const Extent &e, const FieldT &field, const T &value) {
+                return lowerBoundRow(RowOffsetColumn<FieldT>(e, field), extentRows(e), value);
+            }
+            template<typename T>
+            static int32_t upper(const Extent &e, const FieldT &field, const T &value) {
+                return upperBoundRow(RowOffsetColumn<FieldT>(e, field), extentRows(e), value);
+            }
+        };
+
+        template<class FieldT, typename V> struct FixedSortedSearch {
+            static int32_t lower(const Extent &e, const FieldT &field, V value) {
+                if (field.isNullable()) {
+                    e.unpackField(field.getName());
+                    return lowerBoundRow(RowOffsetColumn<FieldT>(e, field), extentRows(e), value);
+                }
+                return lowerBoundRow(RawFixedColumn<V>(e, field), extentRows(e), value);
+            }
+            static int32_t upper(const Extent &e, const FieldT &field, V value) {
+                if (field.isNullable()) {
+                    e.unpackField(field.getName());
+                    return upperBoundRow(RowOffsetColumn<FieldT>(e, field), extentRows(e), value);
+                }
+                return upperBoundRow(RawFixedColumn<V>(e, field), extentRows(e), value);
+            }
+        };
+
+        template<> struct SortedSearch<Int32Field>
+            : FixedSortedSearch<Int32Field, int32_t> { };
+        template<> struct SortedSearch<Int64Field>
+            : FixedSortedSearch<Int64Field, int64_t> { };
+        // The stored values are relative to the column's base in the extent's type.
+        template<> struct SortedSearch<DoubleField> {
+            static int32_t lower(const Extent &e, const DoubleField &field, double value) {
+                return FixedSortedSearch<DoubleField, double>::lower(e, field,
+                                                                    relative(e, field, value));
+            }
+            static int32_t upper(const Extent &e, const DoubleField &field, double value) {
+                return FixedSortedSearch<DoubleField, double>::upper(e, field,
+                                                                    relative(e, field, value));
+            }
+            static double relative(const Extent &e, const DoubleField &field, double value) {
+                return value - e.getTypePtr()->getDoubleBase(field.getName());
+            }
+        };
+        template<> struct SortedSearch<ByteField>
+            : FixedSortedSearch<ByteField, uint8_t> { };
+        template<typename V> struct SortedSearch< TFixedField<V, false> >
+            : FixedSortedSearch<TFixedField<V, false>, V> { };
+
+        template<> struct SortedSearch<Variable32Field> {
+            static int32_t lower(const Extent &e, const Variable32Field &field,
+                                 const std::string &value) {
+                return lowerBoundRow(Variable32Column(e, field), extentRows(e), value);
+            }
+            static int32_t upper(const Extent &e, const Variable32Field &field,
+                                 const std::string &value) {
+                return upperBoundRow(Variable32Column(e, field), extentRows(e), value);
+            }
+        };
+
+        inline SEP_RowOffset rowOffset(const Extent &e, int32_t row) {
+            return SEP_RowOffset(row * e.getTypePtr()->fixedrecordsize(), &e);
+        }
+    }
+
+    /** Returns the first row of e whose value of field is not less than value,
+        or the end of the extent if there is none. */
+    template<class FieldT, typename T>
+    SEP_RowOffset lowerBound(const Extent &e, const FieldT &field, const T &value) {
+        return detail::rowOffset(e, detail::SortedSearch<FieldT>::lower(e, field, value));
+    }
+
+    /** Returns the first row of e whose value of field is greater than value,
+        or the end of the extent if there is none. */
+    template<class FieldT, typename T>
+    SEP_RowOffset upperBound(const Extent &e, const FieldT &field, const T &value) {
+        return detail::rowOffset(e, detail::SortedSearch<FieldT>::upper(e, field, value));
+    }
+
+    /** Returns [lowerBound, upperBound), the rows of e whose value of field is
+        equal to value. */
+    template<class FieldT, typename T>
+    std::pair<SEP_RowOffset, SEP_RowOffset>
+    equalRange(const Extent &e, const FieldT &field, const T &value) {
+        int32_t lower = detail::SortedSearch<FieldT>::lower(e, field, value);
+        int32_t upper = detail::SortedSearch<FieldT>::upper(e, field, value);
+        return std::make_pair(detail::rowOffset(e, lower), detail::rowOffset(e, upper));
+    }
+
+    /** Moves series to lowerBound() in its current extent; returns false, leaving
+        the series at the end of the extent, if every row is less than value. */
+    template<class FieldT, typename T>
+    bool seekLowerBound(ExtentSeries &series, const FieldT &field, const T &value) {
+        series.setRowOffset(lowerBound(series.getExtentRef(), field, value));
+        return series.morerecords();
+    }
+
+    /** Moves series to upperBound() in its current extent; returns false, leaving
+        the series at the end of the extent, if no row is greater than value. */
+    template<class FieldT, typename T>
+    bool seekUpperBound(ExtentSeries &series, const FieldT &field, const T &value) {
+        series.setRowOffset(upperBound(series.getExtentRef(), field, value));
+        return series.morerecords();
+    }
+}
+
+#endif
@@ -13,6 +13,10 @@
 #ifndef __DATASERIES_TYPEINDEXMODULE_H
 #define __DATASERIES_TYPEINDEXMODULE_H
 
+#include <map>
+#include <set>
+
+#include <DataSeries/DSExpr.hpp>
 #include <DataSeries/IndexSourceModule.hpp>
 
 /** \brief Source module that returns extents matching a particular type
@@ -20,9 +24,16 @@
  * Each DataSeries file contains an index that tells the type and
  * offset of every extent in that file.  This source module takes an
  * extent type match; if the match type is empty, this returns all of
- * the extents, and otherwise, chooses a type using
+ * the extents except the "DataSeries: ExtentMinMax" statistics, and
+ * otherwise, chooses a type using
  * ExtentTypeLibrary::getTypeMatch, and returns all of the extents
- * which have the same type. */
+ * which have the same type.
+ *
+ * Range predicates added with addRangePredicate() are checked against
+ * the per-extent statistics written by DataSeriesSink::recordMinMax();
+ * extents that can not contain a matching row are skipped without
+ * being read.  Extents without statistics for a column are always
+ * returned, so the caller still has to apply its own filter. */
 class TypeIndexModule : public IndexSourceModule {
   public:
     typedef boost::shared_ptr<TypeIndexModule> Ptr;
@@ -41,6 +52,35 @@ class TypeIndexModule : public IndexSourceModule {
     void addSource(const std::string &filename);
     bool haveSources() { return !inputFiles.empty(); }
 
+    /** Open up to nfiles of the files after the one being read ahead of
+        time on the dataseries::UnpackPool threads, so that reading the
+        headers, type libraries and index extents of the next files
+        overlaps with reading extents from the current one; over many
+        small files the opens otherwise dominate.  0 opens each file when
+        it is reached.  The default is 8. */
+    void setOpenAhead(unsigned nfiles);
+
+    /** Only return extents that may have a row with min <= column <= max.
+        Multiple predicates are and'ed together. */
+    void addRangePredicate(const std::string &column, double min, double max);
+
+    /** As above, but for a variable32 column. */
+    void addRangePredicate(const std::string &column, const std::string &min,
+                           const std::string &max);
+
+    /** Add range predicates for the comparisons between a field and a
+        constant that are and'ed together in the DSExpr where_expr (see
+        DSExpr::conjunctiveRanges); the rest of the expression is
+        ignored.  The expression is parsed once the matching type is known,
+        and is ignored if type_match is empty.  Returns false, doing
+        nothing, if prefetching has already started. */
+    bool addWherePredicates(const std::string &where_expr);
+
+    /** Number of extents skipped because of the range predicates */
+    uint64_t skippedExtents() {
+        return skipped_extents;
+    }
+
     void sameInputFiles(TypeIndexModule &from) {
         inputFiles = from.inputFiles;
     }
@@ -63,11 +103,32 @@ class TypeIndexModule : public IndexSourceModule {
 
   private:
     const ExtentType::Ptr matchType(); // May return NULL
+    void lockedFindSkippable();
+
+    struct OpenSlot {
+        DataSeriesSource *source; // NULL until opened
+        bool claimed; // an open job or takeSource() is opening the file
+        OpenSlot() : source(NULL), claimed(false) { }
+    };
+    DataSeriesSource *takeSource(unsigned file);
+    void openJob(unsigned file, const std::string &filename);
+    void resetOpens();
+
+    std::vector<DSExpr::FieldRange> predicates;
+    std::vector<std::string> where_exprs; // parsed into predicates once we have my_type
+    std::set<int64_t> skip_offsets; // for cur_source
+    uint64_t skipped_extents;
 
     unsigned int cur_file;
     DataSeriesSource *cur_source;
     std::vector<std::string> inputFiles;
     ExtentType::Ptr my_type;
+
+    // Protects next_open, outstanding_opens and opens; open jobs only touch those.
+    PThreadMutex open_mutex;
+    PThreadCond open_cond;
+    unsigned open_ahead, next_open, outstanding_opens;
+    std::map<unsigned, OpenSlot> opens; // by index in inputFiles
 };
 
 #endif
@@ -0,0 +1,115 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Process-wide pool of threads for unpacking extents
+*/
+
+#ifndef DATASERIES_UNPACKPOOL_HPP
+#define DATASERIES_UNPACKPOOL_HPP
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
+namespace dataseries {
+    /** \brief Work-stealing executor shared by all IndexSourceModules in a process.
+
+        Each worker thread has its own queue of jobs; submitted jobs are
+        spread round-robin across the queues, and a worker whose queue is
+        empty steals from the back of the other queues.  Jobs can complete
+        in any order, so submitters are responsible for putting the results
+        back in order (IndexSourceModule does this with its unpacked queue).
+
+        The pool also tracks a process-wide budget for compressed extents
+        that have been read but not yet unpacked.  Submitters are expected
+        to stop reading while the pool is over budget, unless they have
+        nothing in flight themselves, which guarantees that every reader
+        can always make progress. */
+    class UnpackPool : boost::noncopyable {
+      public:
+        typedef boost::function<void ()> Job;
+
+        /** Returns the pool, creating it on first use.  The pool lives
+            until the process exits. */
+        static UnpackPool &instance();
+
+        /** Sets the number of worker threads; -1 means use min(# cpus,
+            MAX_THREADS/2).  Only has an effect before the first job is
+            submitted. */
+        void setThreadCount(int nthreads);
+
+        /** Queue a job to be run on one of the worker threads. */
+        void submit(const Job &job);
+
+        /** Raise the compressed budget to at least nbytes. */
+        void raiseCompressedBudget(size_t nbytes);
+
+        /** Sets the compressed budget to exactly nbytes. */
+        void setCompressedBudget(size_t nbytes);
+
+        /** Returns true if more compressed data can be read. */
+        bool underCompressedBudget();
+
+        /** Account for nbytes of compressed data being read/unpacked. */
+        void reserveCompressed(size_t nbytes);
+        void releaseCompressed(size_t nbytes);
+
+        /** Returns the compressed bytes currently accounted for. */
+        size_t compressedUsed();
+
+        /** Returns a token to pass to waitForCompressedBudget(); get it
+            while holding whatever lock protects the caller's abort flag. */
+        uint64_t budgetGeneration();
+
+        /** Blocks until the pool is under budget or wakeBudgetWaiters() has
+            been called since generation was obtained. */
+        void waitForCompressedBudget(uint64_t generation);
+
+        /** Wakes up all waitForCompressedBudget() callers, e.g. so a
+            closing module can stop its reader. */
+        void wakeBudgetWaiters();
+
+        size_t nThreads() {
+            return workers.size();
+        }
+
+        /// \cond INTERNAL_ONLY
+        void workerThread(unsigned worker_num);
+        /// \endcond
+
+      private:
+        UnpackPool();
+        ~UnpackPool();
+
+        struct Worker {
+            PThreadMutex mutex; // ordered after UnpackPool::mutex
+            Deque<Job> jobs;
+            PThread *thread;
+            Worker() : mutex(), jobs(), thread(NULL) { }
+        };
+
+        void lockedStartThreads();
+        bool tryGetJob(unsigned worker_num, Job &job);
+
+        std::vector<Worker *> workers;
+        int requested_threads;
+
+        // protects everything below, and the worker vector once threads are started
+        PThreadMutex mutex;
+        PThreadCond work_cond, budget_cond;
+        uint64_t pending_jobs, next_worker;
+        size_t compressed_budget, compressed_used;
+        uint64_t budget_generation;
+    };
+}
+
+#endif
@@ -145,6 +145,37 @@ class Variable32Field : public Field {
         clear(e, rowPos(e, row_offset));
     }
 
+    /** For a pack_dictionary field, returns the dictionary of the current extent (see
+        Extent::Dictionary), or NULL if there isn't one, e.g. because the extent wasn't read
+        from a file or has been modified since.  Look it up once per extent, and use the
+        codes to group or compare rows without looking at the values. */
+    const Extent::Dictionary *dictionary() const {
+        return dictionary(dataseries.getExtentRef());
+    }
+
+    const Extent::Dictionary *dictionary(const Extent &e) const {
+        return dictionary_field ? e.getDictionary(offset_pos) : NULL;
+    }
+
+    /** The dictionary code of the value in the current row; dictionary() must not be NULL.
+        Equal values have equal codes, and code 0 is the empty (or null) value. */
+    int32 dictionaryCode() const {
+        const Extent &e(dataseries.getExtentRef());
+        const Extent::Dictionary *dict = dictionary(e);
+        DEBUG_SINVARIANT(dict != NULL);
+        return dict->codes[(rowPos() - e.fixeddata.begin()) / e.getTypePtr()->fixedrecordsize()];
+    }
+
+    /** The value with code in the dictionary of the current extent. */
+    std::string dictionaryValue(int32 code) const {
+        const Extent &e(dataseries.getExtentRef());
+        const Extent::Dictionary *dict = dictionary(e);
+        DEBUG_SINVARIANT(dict != NULL && code >= 0 && code < dict->nValues());
+        int32 varoffset = dict->value_offsets[code];
+        return std::string(reinterpret_cast<const char *>(val(e.variabledata, varoffset)),
+                           size(e.variabledata, varoffset));
+    }
+
     bool equal(const std::string &to) {
         if (isNull()) {
             return false;
@@ -170,6 +201,9 @@ class Variable32Field : public Field {
     friend class GF_Variable32;
 
     void clear(Extent &e, uint8_t *row_offset) {
+        if (dictionary_field) {
+            e.dropDictionary(offset_pos);
+        }
         byte *fixed_data_ptr = row_offset + offset_pos;
         DEBUG_SINVARIANT(e.insideExtentFixed(fixed_data_ptr));
         *reinterpret_cast<int32_t *>(fixed_data_ptr) = 0;
@@ -233,7 +267,7 @@ class Variable32Field : public Field {
         return size + (12 - (size % 8)) % 8;
     }
     int offset_pos;
-    bool unique;
+    bool unique, dictionary_field;
 
   private:
     const byte *val(const Extent &e, uint8_t *row_pos) const {
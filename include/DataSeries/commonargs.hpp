@@ -18,14 +18,17 @@ struct commonPackingArgs {
     int compress_level;
     int compress_modes;
     int extent_size;
+    bool adaptive_compression;
     commonPackingArgs() 
             : compress_level(9), 
               compress_modes(Extent::compress_all), 
-              extent_size(-1)
+              extent_size(-1),
+              adaptive_compression(false)
     { }
 };
 
 // ignores unrecognized arguments, stops getting arguments at a --
+// also sets DataSeriesSink's default compression policy
 void getPackingArgs(int *argc, char *argv[], commonPackingArgs *commonArgs);
 const std::string packingOptions();
 
@@ -381,6 +381,7 @@ class WorldCupSimpleAnalysis : public RowAnalysisModule {
 int main(int argc, char *argv[]) {
     TypeIndexModule *source 
             = new TypeIndexModule("Log::Web::WorldCup::Custom");
+    source->setLazyUnpack(true); // the analysis only reads through its fields
 
     INVARIANT(argc >= 2 && strcmp(argv[1], "-h") != 0,
               boost::format("Usage: %s <file...>\n") % argv[0]);
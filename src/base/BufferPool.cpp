@@ -0,0 +1,198 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <Lintel/LintelLog.hpp>
+#include <Lintel/StringUtil.hpp>
+
+#include <DataSeries/BufferPool.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+// four size classes per power of two from min_pooled_size to max_pooled_size
+static const int classes_per_doubling = 4;
+static const int nclasses = 12 * classes_per_doubling + 1;
+
+struct BufferPool::ThreadCache {
+    ThreadCache() : lists(nclasses), bytes(0) { }
+    vector< vector<byte *> > lists;
+    size_t bytes;
+};
+
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
+static __thread BufferPool::ThreadCache *thread_cache;
+
+static void destroyThreadCache(void *cache) {
+    thread_cache = NULL;
+    BufferPool::instance().flushThreadCache(static_cast<BufferPool::ThreadCache *>(cache));
+}
+
+static void makeThreadCacheKey() {
+    INVARIANT(pthread_key_create(&thread_cache_key, destroyThreadCache) == 0,
+              "unable to create buffer pool thread key");
+}
+
+BufferPool &BufferPool::instance() {
+    // Deliberately never deleted, see UnpackPool::instance(); in addition
+    // ByteArrays in static objects may be destroyed after any static pool.
+    static BufferPool *pool = new BufferPool();
+    return *pool;
+}
+
+BufferPool::BufferPool()
+    : retain_limit(256 * 1024 * 1024), thread_cache_limit(0), mutex(), free_lists(nclasses),
+      shared_bytes(0), hits(0), misses(0), kept(0), freed(0), retained_bytes(0)
+{
+    SINVARIANT(classSize(nclasses - 1) == max_pooled_size);
+    const char *limit_mb = getenv("DATASERIES_BUFFER_POOL_MB");
+    if (limit_mb != NULL) {
+        retain_limit = stringToInteger<size_t>(limit_mb) * 1024 * 1024;
+    }
+    thread_cache_limit = min(retain_limit / 8, static_cast<size_t>(8 * 1024 * 1024));
+    LintelLogDebug("BufferPool", format("retaining up to %d bytes") % retain_limit);
+}
+
+BufferPool::~BufferPool() {
+    FATAL_ERROR("BufferPool should never be destroyed");
+}
+
+size_t BufferPool::classSize(int size_class) {
+    size_t base = min_pooled_size << (size_class / classes_per_doubling);
+    return base + (base / classes_per_doubling) * (size_class % classes_per_doubling);
+}
+
+int BufferPool::sizeClass(size_t nbytes) {
+    int size_class = 0;
+    while (classSize(size_class) < nbytes) {
+        ++size_class;
+    }
+    return size_class;
+}
+
+BufferPool::ThreadCache *BufferPool::threadCache() {
+    if (thread_cache == NULL) {
+        pthread_once(&thread_cache_once, makeThreadCacheKey);
+        thread_cache = new ThreadCache();
+        INVARIANT(pthread_setspecific(thread_cache_key, thread_cache) == 0,
+                  "unable to set buffer pool thread cache");
+    }
+    return thread_cache;
+}
+
+BufferPool::byte *BufferPool::allocate(size_t nbytes, size_t &capacity) {
+    if (nbytes < min_pooled_size || nbytes > max_pooled_size) {
+        capacity = nbytes;
+        return new byte[nbytes];
+    }
+    int size_class = sizeClass(nbytes);
+    capacity = classSize(size_class);
+    if (retain_limit > 0) {
+        ThreadCache *cache = threadCache();
+        byte *ret = NULL;
+        if (!cache->lists[size_class].empty()) {
+            ret = cache->lists[size_class].back();
+            cache->lists[size_class].pop_back();
+            cache->bytes -= capacity;
+        } else {
+            PThreadScopedLock lock(mutex);
+            if (!free_lists[size_class].empty()) {
+                ret = free_lists[size_class].back();
+                free_lists[size_class].pop_back();
+                shared_bytes -= capacity;
+            }
+        }
+        if (ret != NULL) {
+            __sync_fetch_and_add(&hits, 1);
+            __sync_fetch_and_sub(&retained_bytes, capacity);
+            return ret;
+        }
+    }
+    __sync_fetch_and_add(&misses, 1);
+    return new byte[capacity];
+}
+
+void BufferPool::release(byte *buffer, size_t capacity) {
+    if (capacity < min_pooled_size || capacity > max_pooled_size) {
+        delete [] buffer;
+        return;
+    }
+    int size_class = sizeClass(capacity);
+    if (classSize(size_class) != capacity // not from allocate()
+        || retained_bytes + capacity > retain_limit) {
+        __sync_fetch_and_add(&freed, 1);
+        delete [] buffer;
+        return;
+    }
+    __sync_fetch_and_add(&kept, 1);
+    __sync_fetch_and_add(&retained_bytes, capacity);
+    ThreadCache *cache = threadCache();
+    if (cache->bytes + capacity <= thread_cache_limit) {
+        cache->lists[size_class].push_back(buffer);
+        cache->bytes += capacity;
+    } else {
+        PThreadScopedLock lock(mutex);
+        free_lists[size_class].push_back(buffer);
+        shared_bytes += capacity;
+    }
+}
+
+void BufferPool::flushThreadCache(ThreadCache *cache) {
+    {
+        PThreadScopedLock lock(mutex);
+        for (int i = 0; i < nclasses; ++i) {
+            free_lists[i].insert(free_lists[i].end(), cache->lists[i].begin(),
+                                 cache->lists[i].end());
+        }
+        shared_bytes += cache->bytes;
+    }
+    delete cache;
+}
+
+void BufferPool::setRetainLimit(size_t nbytes) {
+    PThreadScopedLock lock(mutex);
+    retain_limit = nbytes;
+    thread_cache_limit = min(retain_limit / 8, static_cast<size_t>(8 * 1024 * 1024));
+    lockedTrim();
+}
+
+void BufferPool::lockedTrim() {
+    // free the largest buffers first; buffers in thread caches stay until reused or the thread
+    // exits
+    for (int i = nclasses - 1; i >= 0 && retained_bytes > retain_limit; --i) {
+        while (!free_lists[i].empty() && retained_bytes > retain_limit) {
+            delete [] free_lists[i].back();
+            free_lists[i].pop_back();
+            shared_bytes -= classSize(i);
+            __sync_fetch_and_sub(&retained_bytes, classSize(i));
+            __sync_fetch_and_add(&freed, 1);
+        }
+    }
+}
+
+BufferPool::Stats BufferPool::getStats() {
+    Stats ret;
+    ret.hits = hits;
+    ret.misses = misses;
+    ret.kept = kept;
+    ret.freed = freed;
+    ret.retained_bytes = retained_bytes;
+    return ret;
+}
+
+}
@@ -3,9 +3,13 @@
 #include <sys/time.h>
 #include <fcntl.h>
 
+#include <boost/foreach.hpp>
+
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/HashFns.hpp>
 
+#include <DataSeries/GeneralField.hpp>
+
 dataseries::IExtentSink::~IExtentSink() { }
 
 using namespace std;
@@ -17,82 +21,36 @@ using boost::format;
 // It is declared in Extent.hpp.
 const int MAX_THREADS = 32;
 
-class DataSeriesSinkPThreadCompressor : public PThread {
-  public:
-    DataSeriesSinkPThreadCompressor(DataSeriesSink *_mine)
-    : mine(_mine) { }
-
-    virtual ~DataSeriesSinkPThreadCompressor() { }
-
-    virtual void *run() {
-        mine->compressorThread();
-        return NULL;
-    }
-    DataSeriesSink *mine;
-};
-
-class DataSeriesSinkPThreadWriter : public PThread {
-  public:
-    DataSeriesSinkPThreadWriter(DataSeriesSink *_mine)
-    : mine(_mine) { }
-
-    virtual ~DataSeriesSinkPThreadWriter() { }
-
-    virtual void *run() {
-        mine->writerThread();
-        return NULL;
-    }
-    DataSeriesSink *mine;
-};
-
 int DataSeriesSink::compressor_count = -1;
-
-void DataSeriesSink::WorkerInfo::startThreads(PThreadScopedLock &lock, DataSeriesSink *sink) {
-    int pthread_count = compressor_count;
-    if (pthread_count == -1) {
-        pthread_count = min( PThreadMisc::getNCpus(), MAX_THREADS / 2);
-    }
-    
-    for (int i=0; i < pthread_count; ++i) {
-        compressors.push_back(new DataSeriesSinkPThreadCompressor(sink));
-        compressors.back()->start();
-    }
-    if (compressors.empty()) {
-        writer = NULL;
-    } else {
-        writer = new DataSeriesSinkPThreadWriter(sink);
-        writer->start();
+DataSeriesSink::CompressionPolicy DataSeriesSink::default_compression_policy 
+    = DataSeriesSink::CompressTryAll;
+const uint32_t DataSeriesSink::adaptive_probe_interval;
+const double DataSeriesSink::adaptive_drift_ratio = 1.1;
+
+void DataSeriesSink::WorkerInfo::attach(DataSeriesSink *sink) {
+    SINVARIANT(pooled == NULL);
+    if (compressor_count != 0) {
+        dataseries::SinkPool::instance().addSink(sink);
+        pooled = sink;
     }
 }
 
-void DataSeriesSink::WorkerInfo::stopThreads(PThreadScopedLock &lock) {
+// Waits for the pool to write everything that was queued, and detaches from it.
+void DataSeriesSink::WorkerInfo::detach(PThreadScopedLock &lock, PThreadMutex &mutex) {
     keep_going = false;
-    
-    available_work_cond.broadcast();
-    available_write_cond.broadcast();
-
-    PThreadScopedUnlock unlock(lock);
-
-    for (vector<PThread *>::iterator i = compressors.begin();
-         i != compressors.end(); ++i) {
-        (**i).join();
-        delete *i;
+    if (pooled == NULL) {
+        return;
     }
-    compressors.clear();
-    writer->join();
-    delete writer;
-    writer = NULL;
-}
-
-void DataSeriesSink::WorkerInfo::setMaxBytesInProgress(PThreadMutex &mutex, size_t nbytes) {
-    PThreadScopedLock lock(mutex);
-    if (nbytes > max_bytes_in_progress) {
-        // May be able to get both more work and more things queued.
-        available_work_cond.broadcast();
-        available_queue_cond.broadcast();
+    // writeOutPending() takes the extents off pending_work before it drops the lock to write
+    // them, and only reports them to the pool as written afterwards, so wait for that too.
+    while (!pending_work.empty() || writing) {
+        available_queue_cond.wait(mutex);
     }
-    max_bytes_in_progress = nbytes;
-}    
+    DataSeriesSink *sink = pooled;
+    pooled = NULL;
+    PThreadScopedUnlock unlock(lock);
+    dataseries::SinkPool::instance().removeSink(sink);
+}
 
 void DataSeriesSink::WorkerInfo::flushPending(PThreadMutex &mutex) {
     PThreadScopedLock lock(mutex);
@@ -104,15 +62,17 @@ void DataSeriesSink::WorkerInfo::flushPending(PThreadMutex &mutex) {
 
 DataSeriesSink::DataSeriesSink(int compression_modes, int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(), 
-          worker_info(256*1024*1024), filename()
+          compression_level(compression_level),
+          compression_policy(default_compression_policy), adaptive_state(), minmax_columns(),
+          writer_info(), worker_info(), filename()
 { }
 
 DataSeriesSink::DataSeriesSink(const string &filename, int compression_modes,
                                int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(),
-          worker_info(256*1024*1024), filename()
+          compression_level(compression_level),
+          compression_policy(default_compression_policy), adaptive_state(), minmax_columns(),
+          writer_info(), worker_info(), filename()
 {
     open(filename);
 }
@@ -154,9 +114,10 @@ void DataSeriesSink::open(const string &in_filename) {
     doublecheck = Double::NaN;
     checkedWrite(&doublecheck,8);
     writer_info.index_series.newExtent();
+    writer_info.minmax_series.newExtent();
     writer_info.cur_offset = 2*4 + 4*8;
     worker_info.keep_going = true;
-    worker_info.startThreads(lock, this);
+    worker_info.attach(this);
 }
 
 void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
@@ -166,10 +127,13 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
               "error: never wrote the extent type library?!");
     INVARIANT(writer_info.cur_offset >= 0, "error: close called twice?!");
 
-    worker_info.stopThreads(lock);
+    worker_info.detach(lock, mutex);
     writer_info.writeOutPending(lock, worker_info);
 
     SINVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0);
+    if (writer_info.minmax_series.getExtentRef().nRecords() > 0) {
+        lockedWriteTrailingExtent(lock, writer_info.minmax_series.getSharedExtent());
+    }
     ExtentType::int64 index_offset = writer_info.cur_offset;
     
     // Special case handling of record for index series; this will
@@ -180,23 +144,8 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     writer_info.field_extentOffset.set(writer_info.cur_offset);
     writer_info.field_extentType.set(writer_info.index_series.getTypePtr()->getName());
 
-    worker_info.bytes_in_progress += writer_info.index_series.getExtentRef().size();
-    worker_info.pending_work.push_back
-            (new ToCompress(writer_info.index_series.getSharedExtent(), NULL));
-    worker_info.pending_work.front()->in_progress = true;
-    lockedProcessToCompress(lock, worker_info.pending_work.front());
-
-    SINVARIANT(worker_info.bytes_in_progress 
-               == worker_info.pending_work.front()->compressed.size());
-    SINVARIANT(worker_info.pending_work.size() == 1);
-    SINVARIANT(worker_info.pending_work.front()->readyToWrite());
-    uint32_t packed_size = worker_info.pending_work.front()->compressed.size();
-
-    writer_info.writeOutPending(lock, worker_info);
-
-    INVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0, 
-              format("bad %d %d") % worker_info.pending_work.empty()
-              % worker_info.bytes_in_progress);
+    uint32_t packed_size 
+        = lockedWriteTrailingExtent(lock, writer_info.index_series.getSharedExtent());
 
     char *tail = new char[7*4];
     INVARIANT((reinterpret_cast<unsigned long>(tail) % 8) == 0, 
@@ -222,12 +171,36 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     writer_info.cur_offset = -1;
     writer_info.chained_checksum = 0;
     writer_info.index_series.clearExtent();
+    writer_info.minmax_series.clearExtent();
     if (to_update != NULL) {
         *to_update += stats;
     }
     stats.reset();
 }
 
+// Packs and writes an extent after the writer thread has been stopped;
+// returns the packed size.
+uint32_t DataSeriesSink::lockedWriteTrailingExtent(PThreadScopedLock &lock, Extent::Ptr e) {
+    SINVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0);
+    worker_info.bytes_in_progress += e->size();
+    worker_info.pending_work.push_back(new ToCompress(e, NULL));
+    worker_info.pending_work.front()->in_progress = true;
+    lockedProcessToCompress(lock, worker_info.pending_work.front());
+
+    SINVARIANT(worker_info.bytes_in_progress 
+               == worker_info.pending_work.front()->compressed.size());
+    SINVARIANT(worker_info.pending_work.size() == 1);
+    SINVARIANT(worker_info.pending_work.front()->readyToWrite());
+    uint32_t packed_size = worker_info.pending_work.front()->compressed.size();
+
+    writer_info.writeOutPending(lock, worker_info);
+
+    INVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0, 
+              format("bad %d %d") % worker_info.pending_work.empty()
+              % worker_info.bytes_in_progress);
+    return packed_size;
+}
+
 void DataSeriesSink::rotate(const string &new_filename, const ExtentTypeLibrary &library,
                             bool do_fsync, Stats *to_update) {
     FATAL_ERROR("unimplemented");
@@ -253,6 +226,19 @@ void DataSeriesSink::writeExtent(Extent &e, Stats *stats) {
     queueWriteExtent(we, stats);
 }
 
+void DataSeriesSink::recordMinMax(const ExtentType::Ptr &type, const vector<string> &columns) {
+    INVARIANT(!writer_info.wrote_library, "must call recordMinMax before writeExtentLibrary");
+    SINVARIANT(type != NULL);
+    BOOST_FOREACH(const string &column, columns) {
+        ExtentType::fieldType ft = type->getFieldType(column);
+        INVARIANT(ft != ExtentType::ft_fixedwidth && ft != ExtentType::ft_unknown,
+                  format("can't record min/max for %s field %s in %s") 
+                  % ExtentType::fieldTypeString(ft) % column % type->getName());
+    }
+    vector<string> &to(minmax_columns[type]);
+    to.insert(to.end(), columns.begin(), columns.end());
+}
+
 void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
     INVARIANT(!writer_info.wrote_library, "Can only write extent library once");
     ExtentSeries type_extent_series(ExtentType::getDataSeriesXMLTypePtr());
@@ -279,6 +265,11 @@ void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
                     % et->getName() << endl;
         }
     }
+    if (!minmax_columns.empty()) {
+        // Written so that readers that don't know the type can still print it.
+        type_extent_series.newRecord();
+        typevar.set(ExtentType::getDataSeriesMinMaxTypePtr()->getXmlDescriptionString());
+    }
     queueWriteExtent(type_extent_series.getSharedExtent(), NULL);
 
     PThreadScopedLock lock(mutex);
@@ -325,6 +316,13 @@ void DataSeriesSink::verifyTail(ExtentType::byte *tail,
 void DataSeriesSink::setCompressorCount(int count) {
     INVARIANT(count >= -1, "?");
     compressor_count = count;
+    if (count != 0) {
+        dataseries::SinkPool::instance().setThreadCount(count);
+    }
+}
+
+void DataSeriesSink::setDefaultCompressionPolicy(CompressionPolicy policy) {
+    default_compression_policy = policy;
 }
 
 void DataSeriesSink::queueWriteExtent(Extent::Ptr e, Stats *to_update) {
@@ -335,31 +333,24 @@ void DataSeriesSink::queueWriteExtent(Extent::Ptr e, Stats *to_update) {
     INVARIANT(worker_info.keep_going, "got to qWE after call to close()??");
     INVARIANT(writer_info.cur_offset > 0, "queueWriteExtent on closed file");
     LintelLogDebug("DataSeriesSink", format("queueWriteExtent(%d bytes)") % e->size());
-    worker_info.bytes_in_progress += e->size(); // putting this into ToCompress erases e
+    size_t extent_size = e->size();
+    worker_info.bytes_in_progress += extent_size;
     worker_info.pending_work.push_back(new ToCompress(e, to_update));
 
-    if (worker_info.compressors.empty()) {
-        SINVARIANT(worker_info.pending_work.size() == 1 && worker_info.bytes_in_progress == 0);
+    if (worker_info.pooled == NULL) {
+        SINVARIANT(worker_info.pending_work.size() == 1 
+                   && worker_info.bytes_in_progress == extent_size);
         worker_info.pending_work.front()->in_progress = true;
-        worker_info.bytes_in_progress += e->size();
         lockedProcessToCompress(lock, worker_info.pending_work.front());
-        worker_info.pending_work.front()->in_progress = false;
         writer_info.writeOutPending(lock, worker_info);
         SINVARIANT(worker_info.bytes_in_progress == 0);
         return;
     } 
         
-    worker_info.available_work_cond.signal();
-    LintelLogDebug("DataSeriesSink", format("qwe wait? %d %d\n") % worker_info.bytes_in_progress
-                   % worker_info.pending_work.size());
-    while (!worker_info.canQueueWork()) {
-        INVARIANT(worker_info.keep_going, "got to qWE after call to close()??");
-        INVARIANT(writer_info.cur_offset > 0, "queueWriteExtent on closed file");
-        LintelLogDebug("DataSeriesSink", format("after queueWriteExtent %d >= %d || %d >= %d")
-                       % worker_info.bytes_in_progress % worker_info.max_bytes_in_progress 
-                       % worker_info.pending_work.size() % (2 * worker_info.compressors.size()));
-        worker_info.available_queue_cond.wait(mutex);
-    }
+    dataseries::SinkPool &pool(dataseries::SinkPool::instance());
+    pool.queued(this, extent_size);
+    PThreadScopedUnlock unlock(lock);
+    pool.waitToQueue(this);
 }
 
 
@@ -378,7 +369,7 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
         worker_info.pending_work.pop_front();
     }
     
-    size_t bytes_written = 0;
+    size_t bytes_written = 0, nwritten = to_write.size(), queued_size = 0;
     {
         ExtentWriteCallback ewc(extent_write_callback);
         PThreadScopedUnlock unlock(lock);
@@ -396,11 +387,13 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
             index_series.newRecord();
             field_extentOffset.set(cur_offset);
             field_extentType.set(tc->extent->getTypePtr()->getName());
+            addMinMaxRows(tc->minmax);
             
             checkedWrite(tc->compressed.begin(), tc->compressed.size());
             cur_offset += tc->compressed.size();
             chained_checksum = lintel::BobJenkinsHashMix3(tc->checksum, chained_checksum, 1972);
             bytes_written += tc->compressed.size();
+            queued_size += tc->queued_size;
             delete tc;
         }
     }
@@ -410,9 +403,93 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
     worker_info.bytes_in_progress -= bytes_written;
     LintelLogDebug("DataSeriesSink", format("qwe broadcast wop? %d %d")
                    % worker_info.bytes_in_progress % worker_info.pending_work.size());
-    if (worker_info.canQueueWork()) {
-        // Don't say there is free space until we actually finished writing.
-        worker_info.available_queue_cond.broadcast();
+    // Don't say there is free space until we actually finished writing.
+    if (worker_info.pooled != NULL && nwritten > 0) {
+        dataseries::SinkPool::instance().written(worker_info.pooled, nwritten, queued_size);
+    }
+    worker_info.available_queue_cond.broadcast();
+}
+
+void DataSeriesSink::WriterInfo::addMinMaxRows(const vector<ColumnMinMax> &minmax) {
+    BOOST_FOREACH(const ColumnMinMax &c, minmax) {
+        minmax_series.newRecord();
+        minmax_offset.set(cur_offset);
+        minmax_column.set(c.column);
+        minmax_sorted.set(c.sorted);
+        if (c.is_string) {
+            minmax_min.setNull();
+            minmax_max.setNull();
+            minmax_min_string.set(c.min_string);
+            minmax_max_string.set(c.max_string);
+        } else {
+            minmax_min.set(c.min);
+            minmax_max.set(c.max);
+            minmax_min_string.setNull();
+            minmax_max_string.setNull();
+        }
+    }
+}
+
+// Computes the statistics for recordMinMax(); values are read the same way
+// that DSExpr reads them so that a reader can compare a where clause
+// directly against them.  NaNs are ignored since they never satisfy a
+// range, but make the column unsorted; columns with nulls are left out.
+// Sortedness is checked on the exact values, not the doubles, since
+// int64 values can collide when converted.
+void DataSeriesSink::computeMinMax(const Extent::Ptr &e, const vector<string> &columns,
+                                   vector<ColumnMinMax> &into) {
+    if (e->nRecords() == 0) {
+        return;
+    }
+    BOOST_FOREACH(const string &column, columns) {
+        ExtentSeries series(e);
+        GeneralField::Ptr field(GeneralField::make(series, column));
+        ColumnMinMax c;
+        c.column = column;
+        c.is_string = field->getType() == ExtentType::ft_variable32;
+        c.min = Double::Inf;
+        c.max = -Double::Inf;
+        c.sorted = true;
+        bool any_null = false, first = true;
+        GeneralValue prev;
+        for (; series.morerecords(); ++series) {
+            if (field->isNull()) {
+                any_null = true;
+                break;
+            }
+            if (c.sorted) {
+                GeneralValue cur(*field);
+                if (!first && cur < prev) {
+                    c.sorted = false;
+                }
+                prev = cur;
+            }
+            if (c.is_string) {
+                string v(GeneralValue(*field).valString());
+                if (first || v < c.min_string) {
+                    c.min_string = v;
+                }
+                if (first || v > c.max_string) {
+                    c.max_string = v;
+                }
+                first = false;
+            } else {
+                double v = field->valDouble();
+                if (v != v) {
+                    c.sorted = false;
+                }
+                first = false;
+                if (v < c.min) {
+                    c.min = v;
+                }
+                if (v > c.max) {
+                    c.max = v;
+                }
+            }
+        }
+        if (!any_null && (c.is_string || c.min <= c.max)) {
+            into.push_back(c);
+        }
     }
 }
 
@@ -463,22 +540,32 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
     INVARIANT(work->in_progress, "??");
     INVARIANT(writer_info.cur_offset > 0,"Error: processToCompress on closed file\n");
 
+    bool probe = true;
+    int modes = lockedChooseCompressionModes(work->extent->getTypePtr(), probe);
+    double pack_extent_time = 0;
+    map<ExtentType::Ptr, vector<string> >::iterator minmax 
+        = minmax_columns.find(work->extent->getTypePtr());
+
     Stats tmp;
     {
         PThreadScopedUnlock unlock(lock);
 
+        if (minmax != minmax_columns.end()) {
+            computeMinMax(work->extent, minmax->second, work->minmax);
+        }
+
         size_t nrecords = work->extent->nRecords();
         struct timespec pack_start, pack_end;
         get_thread_cputime(pack_start);
 
         uint32_t headersize, fixedsize, variablesize;
-        work->checksum = work->extent->packData(work->compressed, compression_modes,
+        work->checksum = work->extent->packData(work->compressed, modes,
                                                 compression_level, &headersize,
                                                 &fixedsize, &variablesize);
         get_thread_cputime(pack_end);
 
-        double pack_extent_time = (pack_end.tv_sec - pack_start.tv_sec) 
-                                  + (pack_end.tv_nsec - pack_start.tv_nsec)*1e-9;
+        pack_extent_time = (pack_end.tv_sec - pack_start.tv_sec) 
+                           + (pack_end.tv_nsec - pack_start.tv_nsec)*1e-9;
     
         INVARIANT(pack_extent_time >= 0, format("get_thread_cputime broken? %d.%d - %d.%d = %.9g")
                   % pack_end.tv_sec % pack_end.tv_nsec 
@@ -496,6 +583,9 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
 
         SINVARIANT(work->extent->size() == uncompressed_size);
     }
+    tmp.pack_time_saved = lockedUpdateAdaptiveState(work->extent->getTypePtr(), probe,
+                                                    work->compressed, uncompressed_size,
+                                                    pack_extent_time);
     // update stats, have to do this before we complete the extent
     // as otherwise the work pointer could vanish under us
 
@@ -515,64 +605,78 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
     worker_info.bytes_in_progress += work->compressed.size(); // add in the compressed bits
 }
 
-void  DataSeriesSink::compressorThread()  {
-#if 0
-    // This didn't seem to have any actual effect; it should have let the
-    // copy thread run at 100%, but it didn't seem to have that effect.
-    int policy = -1;
-    struct sched_param param;
-
-    SINVARIANT(pthread_getschedparam(pthread_self(), &policy, &param) == 0);
+// pack_layout="columns" extents pick an algorithm per column, which the single fixed mode
+// in the extent header doesn't record, so they always try everything.
+static bool adaptiveLayout(const ExtentType::Ptr &type) {
+    return type->getPackLayout() != ExtentType::LayoutColumns;
+}
 
-    int minprio = sched_get_priority_max(policy);
-    if (param.sched_priority > minprio) {
-        param.sched_priority = minprio;
-        SINVARIANT(pthread_setschedparam(pthread_self(), policy, &param) == 0);
+int DataSeriesSink::lockedChooseCompressionModes(const ExtentType::Ptr &type, bool &probe) {
+    probe = true;
+    if (compression_policy == CompressTryAll || !adaptiveLayout(type)) {
+        return compression_modes;
     }
-#endif
-
-    PThreadScopedLock lock(mutex);
-    while (true) {
-        ToCompress *work = NULL;
-        for (Deque<ToCompress *>::iterator i = worker_info.pending_work.begin();
-            i != worker_info.pending_work.end(); ++i) {
-            if ((**i).in_progress == false && (**i).compressed.size() == 0) {
-                work = *i;
-                work->in_progress = true;
-                break;
-            }
-        }
-        if (work == NULL) {
-            if (!worker_info.keep_going) { 
-                break; // only stop if there is no work to do.
-            }
-            worker_info.available_work_cond.wait(mutex);
-        } else {
-            lockedProcessToCompress(lock, work);
+    AdaptiveCompressState &state(adaptive_state[type]);
+    if (!state.probed || state.extents_since_probe >= adaptive_probe_interval) {
+        state.extents_since_probe = 0;
+        return compression_modes;
+    }
+    probe = false;
+    ++state.extents_since_probe;
+    // Mode 0 (none) has a zero flag, so if nothing compressed on the
+    // probe we don't try anything until the next one.
+    return Extent::compression_algs[state.fixed_mode].compress_flag 
+        | Extent::compression_algs[state.variable_mode].compress_flag;
+}
 
-            LintelLogDebug("DataSeriesSink", format("qwe broadcast compr? %d %d\n")
-                           % worker_info.bytes_in_progress % worker_info.pending_work.size());
-    
-            if (worker_info.canQueueWork()) { // just freed up space.
-                worker_info.available_queue_cond.broadcast();
-            }
-            SINVARIANT(!worker_info.pending_work.empty());
-            if (worker_info.frontReadyToWrite()) {
-                worker_info.available_write_cond.signal();
-            }
-        }
+// Returns the estimated pack time saved by not probing this extent.
+double DataSeriesSink::lockedUpdateAdaptiveState(const ExtentType::Ptr &type, bool probe,
+                                                 const Extent::ByteArray &compressed,
+                                                 size_t unpacked_size, double pack_time) {
+    if (compression_policy == CompressTryAll || !adaptiveLayout(type) || unpacked_size == 0) {
+        return 0;
     }
+    AdaptiveCompressState &state(adaptive_state[type]);
+    double ratio = static_cast<double>(compressed.size()) / unpacked_size;
+    if (probe) {
+        state.probed = true;
+        state.fixed_mode = compressed[6*4];
+        state.variable_mode = compressed[6*4+1];
+        state.probe_ratio = ratio;
+        state.probe_time_per_byte = pack_time / unpacked_size;
+        return 0;
+    } 
+    if (ratio > state.probe_ratio * adaptive_drift_ratio) {
+        LintelLogDebug("DataSeriesSink", format("compression ratio for %s drifted %.3g -> %.3g,"
+                                                " re-probing") % type->getName() 
+                       % state.probe_ratio % ratio);
+        state.extents_since_probe = adaptive_probe_interval;
+    }
+    return max(0.0, state.probe_time_per_byte * unpacked_size - pack_time);
 }
 
-void DataSeriesSink::writerThread() {
+// Called by a SinkPool thread for each queued extent.
+void DataSeriesSink::packAndWriteOne() {
     PThreadScopedLock lock(mutex);
-    while (worker_info.keep_going) {
-        if (worker_info.frontReadyToWrite()) {
-            writer_info.writeOutPending(lock, worker_info);
-        } else {
-            worker_info.available_write_cond.wait(mutex);
+    ToCompress *work = NULL;
+    for (Deque<ToCompress *>::iterator i = worker_info.pending_work.begin();
+         i != worker_info.pending_work.end(); ++i) {
+        if ((**i).in_progress == false && (**i).compressed.size() == 0) {
+            work = *i;
+            break;
         }
     }
+    SINVARIANT(work != NULL); // one job is queued for each extent
+    work->in_progress = true;
+    lockedProcessToCompress(lock, work);
+
+    // Another thread may be writing, in which case it will pick up this extent once it
+    // finishes; otherwise write everything that is ready, in order.
+    while (!worker_info.writing && worker_info.frontReadyToWrite()) {
+        worker_info.writing = true;
+        writer_info.writeOutPending(lock, worker_info);
+        worker_info.writing = false;
+    }
 }
 
 void DataSeriesSink::Stats::reset() {
@@ -585,6 +689,7 @@ void DataSeriesSink::Stats::reset() {
     unpacked_size = unpacked_fixed = unpacked_variable = 
             unpacked_variable_raw = packed_size = nrecords = 0;
     pack_time = 0;
+    pack_time_saved = 0;
 }
 
 DataSeriesSink::Stats::~Stats() {
@@ -610,6 +715,7 @@ DataSeriesSink::Stats &DataSeriesSink::Stats::operator+=(const DataSeriesSink::S
     nrecords += from.nrecords;
     INVARIANT(from.pack_time >= 0, format("from.pack_time = %.6g < 0") % from.pack_time);
     pack_time += from.pack_time;
+    pack_time_saved += from.pack_time_saved;
     return *this;
 }
 
@@ -628,6 +734,7 @@ DataSeriesSink::Stats &DataSeriesSink::Stats::operator-=(const DataSeriesSink::S
     packed_size -= from.packed_size;
     nrecords -= from.nrecords;
     pack_time -= from.pack_time;
+    pack_time_saved -= from.pack_time_saved;
 
     return *this;
 }
@@ -682,4 +789,7 @@ void DataSeriesSink::Stats::printText(ostream &to, const string &extent_type) {
     to << format("  unpacked: %d = %d (fixed) + %d (variable, %d raw)\n")
             % unpacked_size % unpacked_fixed % unpacked_variable % unpacked_variable_raw;
     to << format("  packed size: %d; pack time: %.3f\n") % packed_size % pack_time;
+    if (pack_time_saved > 0) {
+        to << format("  adaptive compression saved ~%.3f of pack time\n") % pack_time_saved;
+    }
 }
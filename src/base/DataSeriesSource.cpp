@@ -10,6 +10,7 @@
 */
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -17,14 +18,19 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 
+#include <list>
+#include <map>
 #include <ostream>
 
+#include <boost/foreach.hpp>
 #include <boost/static_assert.hpp>
 
 #include <Lintel/Double.hpp>
 #include <Lintel/FileUtil.hpp>
 #include <Lintel/HashTable.hpp>
 #include <Lintel/LintelLog.hpp>
+#include <Lintel/PThread.hpp>
+#include <Lintel/StringUtil.hpp>
 
 #include <DataSeries/DataSeriesFile.hpp>
 #include <DataSeries/ExtentField.hpp>
@@ -45,9 +51,122 @@ using boost::format;
 #define O_LARGEFILE 0
 #endif
 
+struct DataSeriesSource::MappedFile {
+    MappedFile(byte *base, size_t size) : base(base), size(size) { }
+    ~MappedFile() {
+        CHECKED(munmap(base, size) == 0, format("munmap failed: %s") % strerror(errno));
+    }
+    byte *base;
+    size_t size;
+};
+
+// Everything read from the start and end of a file when it is opened; see
+// setMetadataCacheFiles().  Shared between sources once it is built, so
+// never modified.
+struct DataSeriesSource::Metadata {
+    vector<ExtentType::Ptr> types; // from the type extent
+    bool need_bitflip;
+    off64_t first_extent_offset;
+    Extent::Ptr index_extent;
+};
+
+class DataSeriesSource::MetadataCache {
+  public:
+    MetadataCache() : mutex(), max_files(initialMaxFiles()), lru(), files() { }
+
+    MetadataPtr lookup(const string &filename, off64_t size, int64_t mtime_nanosec) {
+        PThreadScopedLock lock(mutex);
+        Files::iterator i = files.find(Key(filename, make_pair(size, mtime_nanosec)));
+        if (i == files.end()) {
+            return MetadataPtr();
+        }
+        lru.splice(lru.end(), lru, i->second);
+        return i->second->second;
+    }
+
+    void insert(const string &filename, off64_t size, int64_t mtime_nanosec,
+                MetadataPtr metadata) {
+        PThreadScopedLock lock(mutex);
+        if (max_files == 0) {
+            return;
+        }
+        Key key(filename, make_pair(size, mtime_nanosec));
+        Files::iterator i = files.find(key);
+        if (i != files.end()) { // opened by two sources at once
+            lru.erase(i->second);
+            files.erase(i);
+        }
+        files[key] = lru.insert(lru.end(), make_pair(key, metadata));
+        lockedTrim();
+    }
+
+    void setMaxFiles(size_t max) {
+        PThreadScopedLock lock(mutex);
+        max_files = max;
+        lockedTrim();
+    }
+
+  private:
+    typedef pair<string, pair<off64_t, int64_t> > Key; // (filename, (size, mtime))
+    typedef list< pair<Key, MetadataPtr> > Lru; // least recently used first
+    typedef map<Key, Lru::iterator> Files;
+
+    static size_t initialMaxFiles() {
+        const char *env = getenv("DATASERIES_METADATA_CACHE_FILES");
+        if (env == NULL) {
+            return 32768;
+        }
+        int32_t ret = stringToInteger<int32_t>(env);
+        INVARIANT(ret >= 0, format("DATASERIES_METADATA_CACHE_FILES=%s is negative") % env);
+        return ret;
+    }
+
+    void lockedTrim() {
+        // Modified files leave stale entries behind, they age out of the lru.
+        while (files.size() > max_files) {
+            files.erase(lru.front().first);
+            lru.pop_front();
+        }
+    }
+
+    PThreadMutex mutex;
+    size_t max_files;
+    Lru lru;
+    Files files;
+};
+
+DataSeriesSource::MetadataCache &DataSeriesSource::metadataCache() {
+    // Deliberately never deleted, sources may be opened during static destruction.
+    static MetadataCache *cache = new MetadataCache();
+    return *cache;
+}
+
+void DataSeriesSource::setMetadataCacheFiles(size_t max_files) {
+    metadataCache().setMaxFiles(max_files);
+}
+
+static DataSeriesSource::ReadMode readModeFromEnv() {
+    const char *mode = getenv("DATASERIES_READ_MODE");
+    if (mode == NULL || strcmp(mode, "pread") == 0) {
+        return DataSeriesSource::ReadPread;
+    } else if (strcmp(mode, "mmap") == 0) {
+        return DataSeriesSource::ReadMmap;
+    } else {
+        FATAL_ERROR(format("DATASERIES_READ_MODE='%s' is not one of pread, mmap") % mode);
+    }
+}
+
+DataSeriesSource::ReadMode DataSeriesSource::default_read_mode = readModeFromEnv();
+
+void DataSeriesSource::setDefaultReadMode(ReadMode mode) {
+    default_read_mode = mode;
+}
+
 DataSeriesSource::DataSeriesSource(const string &filename, bool read_index, bool check_tail)
         : index_extent(), filename(filename), fd(-1), cur_offset(0), read_index(read_index),
-          check_tail(check_tail), mtime_nanosec(0)
+          check_tail(check_tail), mtime_nanosec(0), read_mode(default_read_mode),
+          mapped(), shared_fd(), advised_until(0), read_minmax(false), minmax_extent(),
+          sorted_columns()
 {
     mylibrary.registerType(ExtentType::getDataSeriesXMLTypePtr());
     mylibrary.registerType(ExtentType::getDataSeriesIndexTypeV0Ptr());
@@ -65,6 +184,22 @@ DataSeriesSource::~DataSeriesSource() {
 void DataSeriesSource::closefile() {
     CHECKED(close(fd) == 0, format("close failed: %s") % strerror(errno));
     fd = -1;
+    mapped.reset(); // outstanding views keep the mapping alive
+    shared_fd.reset(); // as do outstanding asynchronous reads
+}
+
+DataSeriesSource::SharedFd::~SharedFd() {
+    CHECKED(close(fd) == 0, format("close failed: %s") % strerror(errno));
+}
+
+DataSeriesSource::SharedFdPtr DataSeriesSource::sharedFd() {
+    INVARIANT(isactive(), "can't share the descriptor of a closed source");
+    if (shared_fd == NULL) {
+        int dup_fd = dup(fd);
+        INVARIANT(dup_fd >= 0, format("dup of fd for %s failed: %s") % filename % strerror(errno));
+        shared_fd.reset(new SharedFd(dup_fd));
+    }
+    return shared_fd;
 }
 
 void DataSeriesSource::reopenfile() {
@@ -76,20 +211,56 @@ void DataSeriesSource::reopenfile() {
     struct stat stat_buf;
     int error = fstat(fd, &stat_buf);
     INVARIANT(error == 0, format("error on file '%s' for stat: %s") % filename % strerror(errno));
+    if (read_mode == ReadMmap) {
+        mapFile(stat_buf.st_size);
+    }
     if (lintel::modifyTimeNanoSec(stat_buf) != mtime_nanosec) {
-        checkHeader();
-        readTypeExtent();
-        readTailIndex();
         mtime_nanosec = lintel::modifyTimeNanoSec(stat_buf);
+        readMetadata(stat_buf.st_size);
     }      
 }
 
+void DataSeriesSource::readMetadata(off64_t file_size) {
+    // Without the index the tail may not be checked, so what we would cache is incomplete.
+    MetadataPtr metadata;
+    if (read_index) {
+        metadata = metadataCache().lookup(filename, file_size, mtime_nanosec);
+    }
+    if (metadata == NULL) {
+        metadata.reset(new Metadata());
+        checkHeader();
+        readTypeExtent(metadata->types);
+        readTailIndex();
+        metadata->need_bitflip = need_bitflip;
+        metadata->first_extent_offset = cur_offset;
+        metadata->index_extent = index_extent;
+        if (read_index) {
+            metadataCache().insert(filename, file_size, mtime_nanosec, metadata);
+        }
+        return;
+    }
+
+    LintelLogDebug("DataSeriesSource", format("metadata cache hit on %s") % filename);
+    BOOST_FOREACH(const ExtentType::Ptr &type, metadata->types) {
+        // a reopen after a modification may find the types already registered
+        if (mylibrary.getTypeByNamePtr(type->getName(), true) != type) {
+            mylibrary.registerType(type);
+        }
+    }
+    need_bitflip = metadata->need_bitflip;
+    cur_offset = metadata->first_extent_offset;
+    index_extent = metadata->index_extent;
+    read_minmax = false;
+    minmax_extent.reset();
+    sorted_columns.clear();
+}
+
 void DataSeriesSource::checkHeader() {
     cur_offset = 0;
     Extent::ByteArray data;
     const int file_header_size = 2*4 + 4*8;
     data.resize(file_header_size);
-    Extent::checkedPread(fd,0,data.begin(),file_header_size);
+    readBytes(0, data.begin(), file_header_size);
     cur_offset = file_header_size;
     INVARIANT(data[0] == 'D' && data[1] == 'S' &&
               data[2] == 'v' && data[3] == '1',
@@ -121,9 +292,9 @@ void DataSeriesSource::checkHeader() {
               "NaN double check failed");
 }
 
-void DataSeriesSource::readTypeExtent() {
+void DataSeriesSource::readTypeExtent(vector<ExtentType::Ptr> &types) {
     Extent::ByteArray extentdata;
-    INVARIANT(Extent::preadExtent(fd,cur_offset,extentdata,need_bitflip),
+    INVARIANT(preadCompressed(cur_offset,extentdata),
               "Invalid file, must have a first extent");
     Extent::Ptr e(new Extent(mylibrary,extentdata,need_bitflip));
     INVARIANT(e->type == ExtentType::getDataSeriesXMLTypePtr(),
@@ -133,7 +304,7 @@ void DataSeriesSource::readTypeExtent() {
     Variable32Field typevar(type_extent_series,"xmltype");
     for (;type_extent_series.morerecords(); ++type_extent_series) {
         string v = typevar.stringval();
-        mylibrary.registerTypePtr(v);
+        types.push_back(mylibrary.registerTypePtr(v));
     }
 }
 
@@ -151,7 +322,7 @@ void DataSeriesSource::readTailIndex() {
         off64_t tailoffset = ds_file_stats.st_size-7*4;
         INVARIANT(tailoffset > 0, "file is too small to be a dataseries file??");
         byte tail[7*4];
-        Extent::checkedPread(fd,tailoffset,tail,7*4);
+        readBytes(tailoffset,tail,7*4);
         DataSeriesSink::verifyTail(tail,need_bitflip,filename);
         if (need_bitflip) {
             Extent::flip4bytes(tail+4);
@@ -164,17 +335,64 @@ void DataSeriesSource::readTailIndex() {
                   % tailoffset % packedsize % indexoffset);
     }
     index_extent.reset();
+    read_minmax = false;
+    minmax_extent.reset();
+    sorted_columns.clear();
     if (read_index) {
         index_extent.reset(preadExtent(indexoffset));
         INVARIANT(index_extent != NULL, "index extent read failed");
     }
 }    
 
+Extent::Ptr DataSeriesSource::minMaxExtent() {
+    INVARIANT(isactive(), "can't read the min/max extent of a closed source");
+    if (read_minmax) {
+        return minmax_extent;
+    }
+    read_minmax = true;
+    if (index_extent == NULL) {
+        return minmax_extent;
+    }
+    const string &minmax_name(ExtentType::getDataSeriesMinMaxTypePtr()->getName());
+    off64_t minmax_offset = -1;
+    {
+        ExtentSeries index(index_extent);
+        Int64Field offset(index, "offset");
+        Variable32Field type(index, "extenttype");
+        for (; index.morerecords(); ++index) {
+            if (type.equal(minmax_name)) {
+                minmax_offset = offset.val();
+            }
+        }
+    }
+    if (minmax_offset < 0) {
+        return minmax_extent; // written without recordMinMax()
+    }
+    minmax_extent.reset(preadExtent(minmax_offset));
+    INVARIANT(minmax_extent != NULL, format("unable to read min/max extent of %s") % filename);
+
+    ExtentSeries s(minmax_extent);
+    Int64Field offset(s, "offset");
+    Variable32Field column(s, "column");
+    BoolField sorted(s, "sorted");
+    for (; s.morerecords(); ++s) {
+        if (sorted.val()) {
+            sorted_columns.insert(make_pair(offset.val(), column.stringval()));
+        }
+    }
+    return minmax_extent;
+}
+
+bool DataSeriesSource::extentSortedBy(off64_t extent_offset, const string &column) {
+    minMaxExtent();
+    return sorted_columns.find(make_pair(extent_offset, column)) != sorted_columns.end();
+}
+
 Extent *DataSeriesSource::preadExtent(off64_t &offset, unsigned *compressedSize) {
     Extent::ByteArray extentdata;
     
     off64_t save_offset = offset;
-    if (Extent::preadExtent(fd, offset, extentdata, need_bitflip) == false) {
+    if (preadCompressed(offset, extentdata) == false) {
         return NULL;
     }
     if (compressedSize) *compressedSize = extentdata.size();
@@ -186,3 +404,79 @@ Extent *DataSeriesSource::preadExtent(off64_t &offset, unsigned *compressedSize)
     return ret;
 }
 
+
+void DataSeriesSource::mapFile(size_t file_size) {
+    SINVARIANT(mapped == NULL && fd >= 0);
+    advised_until = 0;
+    if (file_size == 0) {
+        return; // mmap rejects empty mappings; checkHeader will complain
+    }
+    void *base = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        // e.g. a filesystem that doesn't support mmap; pread still works.
+        LintelLogDebug("DataSeriesSource", format("mmap of %s failed (%s), using pread")
+                       % filename % strerror(errno));
+        return;
+    }
+    mapped.reset(new MappedFile(static_cast<byte *>(base), file_size));
+    // Errors from madvise only cost performance, so they are ignored.
+    (void)madvise(base, file_size, MADV_SEQUENTIAL);
+}
+
+void DataSeriesSource::readBytes(off64_t offset, byte *into, size_t amount) {
+    if (mapped == NULL) {
+        Extent::checkedPread(fd, offset, into, amount);
+    } else {
+        INVARIANT(offset >= 0 && static_cast<uint64_t>(offset) + amount <= mapped->size,
+                  format("partial read %d bytes at %d of %s") % amount % offset % filename);
+        memcpy(into, mapped->base + offset, amount);
+    }
+}
+
+bool DataSeriesSource::mappedExtent(off64_t &offset, Extent::ByteArray &into) {
+    INVARIANT(offset >= 0 && static_cast<uint64_t>(offset) <= mapped->size,
+              format("offset %d is past the end of %s") % offset % filename);
+    if (static_cast<uint64_t>(offset) == mapped->size) {
+        into.clear();
+        return false;
+    }
+    // Copy the prefix since verifying a tail may need to look at it.
+    byte prefix[Extent::packed_prefix_size];
+    readBytes(offset, prefix, Extent::packed_prefix_size);
+    uint64_t extentsize = Extent::packedExtentSize(prefix, need_bitflip);
+    if (extentsize == 0) {
+        into.clear();
+        return false;
+    }
+    INVARIANT(static_cast<uint64_t>(offset) + extentsize <= mapped->size,
+              format("partial read of extent at %d of %s") % offset % filename);
+
+    byte *begin = mapped->base + offset;
+    if (need_bitflip) {
+        if (into.isView()) {
+            into.clear();
+        }
+        into.resize(extentsize, false);
+        memcpy(into.begin(), begin, extentsize);
+    } else {
+        into.setView(begin, begin + extentsize, mapped);
+    }
+    offset += extentsize;
+    adviseReadahead(offset);
+    return true;
+}
+
+void DataSeriesSource::adviseReadahead(off64_t offset) {
+    // Re-advise once we are half way through the previous window, so the
+    // kernel always has at least half the window in flight.
+    if (static_cast<uint64_t>(offset) + mmap_readahead / 2 < static_cast<uint64_t>(advised_until)
+        || static_cast<uint64_t>(offset) >= mapped->size) {
+        return;
+    }
+    static const size_t page_size = getpagesize();
+    uint64_t start = offset - offset % page_size;
+    uint64_t end = min(static_cast<uint64_t>(mapped->size), 
+                       static_cast<uint64_t>(offset) + mmap_readahead);
+    (void)madvise(mapped->base + start, end - start, MADV_WILLNEED);
+    advised_until = end;
+}
@@ -16,6 +16,7 @@
 #   include <malloc.h>
 #endif
 
+#include <algorithm>
 #include <iostream>
 
 #include <boost/limits.hpp>
@@ -70,12 +71,14 @@ extern "C" {
 
 #define DS_RAW_EXTENT_PTR_DEPRECATED /* allowed */
 
+#include <DataSeries/BufferPool.hpp>
 #include <DataSeries/Extent.hpp>
 #include <DataSeries/ExtentField.hpp>
 #include <DataSeries/DataSeriesFile.hpp>
 
 using namespace std;
 using boost::format;
+using dataseries::BufferPool;
 
 extern "C" {
     char *dataseriesVersion() {
@@ -109,23 +112,30 @@ void Extent::ByteArray::initMallocTuning() {
 }
 
 Extent::ByteArray::~ByteArray() {
-    delete [] beginV;
+    if (!isView() && beginV != NULL) {
+        BufferPool::instance().release(beginV, maxV - beginV);
+    }
 }
 
 void Extent::ByteArray::clear() {
-    delete [] beginV;
+    if (isView()) {
+        view_owner.reset();
+    } else if (beginV != NULL) {
+        BufferPool::instance().release(beginV, maxV - beginV);
+    }
     beginV = endV = maxV = NULL;
 }
 
 void Extent::ByteArray::reserve(size_t reserve_bytes) {
-    if (reserve_bytes <= static_cast<size_t>(maxV - beginV)) {
+    if (!isView() && reserve_bytes <= static_cast<size_t>(maxV - beginV)) {
         return; // have enough already;
     }
     if (!did_init_malloc_tuning) {
         initMallocTuning();
     }
     size_t oldsize = size();
-    byte *newV = new byte [reserve_bytes];
+    size_t capacity;
+    byte *newV = BufferPool::instance().allocate(reserve_bytes, capacity);
 
     size_t expect_align = 8;
     if (reserve_bytes == 4) { expect_align = 4; }
@@ -135,10 +145,10 @@ void Extent::ByteArray::reserve(size_t reserve_bytes) {
               format("internal error, misaligned malloc(%d) return %d mod %d\n")
               % reserve_bytes % actual_align % expect_align);
     memcpy(newV,beginV,oldsize);
-    delete [] beginV;
+    clear();
     beginV = newV;
     endV = newV + oldsize;
-    maxV = newV + reserve_bytes;    
+    maxV = newV + capacity;
 }
 
 
@@ -154,6 +164,8 @@ void Extent::ByteArray::copyResize(size_t newsize, bool zero_it) {
 }
 
 
+Extent::UnpackStrategy Extent::unpack_strategy = Extent::UnpackByColumn;
+
 static bool did_checks_init = false;
 static bool preuncompress_check = true;
 static bool postuncompress_check = true;
@@ -216,7 +228,9 @@ void Extent::init() {
     *(int32 *)variabledata.begin() = 0;
     extent_source = in_memory_str;
     extent_source_offset = -1;
-
+    pending_fields.clear();
+    npending_fields = 0;
+    pending_fix_endianness = false;
 }
 
 
@@ -281,9 +295,23 @@ void Extent::swap(Extent &with) {
     INVARIANT(with.type == type, "can't swap between incompatible types");
     fixeddata.swap(with.fixeddata);
     variabledata.swap(with.variabledata);
+    dictionaries.swap(with.dictionaries);
+    pending_fields.swap(with.pending_fields);
+    std::swap(npending_fields, with.npending_fields);
+    std::swap(pending_fix_endianness, with.pending_fix_endianness);
+}
+
+void Extent::dropDictionary(int32 field_offset) {
+    for (vector<Dictionary>::iterator i = dictionaries.begin(); i != dictionaries.end(); ++i) {
+        if (i->field_offset == field_offset) {
+            dictionaries.erase(i);
+            return;
+        }
+    }
 }
 
 void Extent::createRecords(unsigned int nrecords) {
+    unpackAllFields(); // the new records aren't packed
     fixeddata.resize(fixeddata.size() + nrecords * type->rep.fixed_record_size);
 }    
 
@@ -313,6 +341,19 @@ class variableDuplicateEliminate_Hash {
     }
 };
 
+// Values of one pack_dictionary field seen so far while packing.
+struct dictionaryEntry : variableDuplicateEliminate {
+    ExtentType::int32 code;
+    dictionaryEntry(ExtentType::byte *a) : variableDuplicateEliminate(a), code(0) { }
+};
+
+struct packDictionary {
+    HashTable<dictionaryEntry, variableDuplicateEliminate_Hash, 
+              variableDuplicateEliminate_Equal> values;
+    vector<ExtentType::int32> value_offsets; // code -> packed offset; code 0 is ""
+    packDictionary() : values(), value_offsets(1, 0) { }
+};
+
 static bool compactIsNull(const ExtentType::byte *fixed_record, 
                           const ExtentType::nullCompactInfo &f) {
     DEBUG_INVARIANT(f.null_bitmask != 0 || f.null_offset == 0, "?");
@@ -323,13 +364,255 @@ static bool compactIsNull(const ExtentType::byte *fixed_record,
     }
 }
 
+// pack_int_encoding columns are stored after the compacted records, aligned to 8 bytes, in
+// int_encoded_compact_info order.  Each column is an IntColumnHeader followed by the values,
+// padded to 8 bytes.  Frame of reference columns have 8 more zero bytes so that decoding can
+// always load 8 bytes.  The bit packed and varint values are little endian byte streams; the
+// header, and the values of a column stored plain, are in the writer's byte order.
+struct IntColumnHeader {
+    uint8_t encoding; // ExtentType::IntEncoding; IntEncodingNone for plain values
+    uint8_t bit_width; // frame of reference only
+    uint16_t unused;
+    uint32_t payload_size; // bytes of values, without the padding
+    int64_t base; // frame of reference only
+};
+
+// Wider frame of reference values could need more than an 8 byte load, and would barely
+// be smaller than the plain values anyway.
+static const unsigned max_frame_of_reference_width = 56;
+
+static inline size_t roundup8(size_t size) {
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static inline uint64_t load8le(const ExtentType::byte *from) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t ret;
+    memcpy(&ret, from, 8);
+    return ret;
+#else
+    uint64_t ret = 0;
+    for (int i = 7; i >= 0; --i) {
+        ret = (ret << 8) | from[i];
+    }
+    return ret;
+#endif
+}
+
+// Space needed to unpack the encoded columns after the compacted records.
+static size_t maxIntColumnsSize(const vector<ExtentType::nullCompactInfo> &int_encoded,
+                                size_t nrecords) {
+    if (int_encoded.empty()) {
+        return 0;
+    }
+    size_t ret = 8; // alignment after the records
+    typedef vector<ExtentType::nullCompactInfo>::const_iterator nciiT;
+    for (nciiT i = int_encoded.begin(); i != int_encoded.end(); ++i) {
+        ret += sizeof(IntColumnHeader) + nrecords * i->size + 8 + 8;
+    }
+    return ret;
+}
+
+template<class T> static void encodeIntColumn(const Extent::ByteArray &records, 
+                                              size_t record_size, size_t offset,
+                                              ExtentType::IntEncoding encoding,
+                                              Extent::ByteArray &into) {
+    const size_t nrecords = records.size() / record_size;
+    IntColumnHeader header;
+    memset(&header, 0, sizeof(header));
+    header.encoding = encoding;
+    vector<uint8_t> payload;
+    if (encoding == ExtentType::IntEncodingFrameOfReference && nrecords > 0) {
+        T min_v = *reinterpret_cast<const T *>(records.begin() + offset), max_v = min_v;
+        for (const ExtentType::byte *rec = records.begin(); rec < records.end(); 
+             rec += record_size) {
+            T v = *reinterpret_cast<const T *>(rec + offset);
+            min_v = min(min_v, v);
+            max_v = max(max_v, v);
+        }
+        uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max_v)) 
+            - static_cast<uint64_t>(static_cast<int64_t>(min_v));
+        unsigned width = range == 0 ? 0 : 64 - __builtin_clzll(range);
+        if (width <= max_frame_of_reference_width) {
+            header.base = min_v;
+            header.bit_width = width;
+            payload.reserve((nrecords * width + 7) / 8);
+            uint64_t bits = 0;
+            unsigned nbits = 0;
+            for (const ExtentType::byte *rec = records.begin(); rec < records.end(); 
+                 rec += record_size) {
+                bits |= (static_cast<uint64_t>(*reinterpret_cast<const T *>(rec + offset))
+                         - static_cast<uint64_t>(header.base)) << nbits;
+                for (nbits += width; nbits >= 8; nbits -= 8) {
+                    payload.push_back(static_cast<uint8_t>(bits));
+                    bits >>= 8;
+                }
+            }
+            if (nbits > 0) {
+                payload.push_back(static_cast<uint8_t>(bits));
+            }
+        } else {
+            header.encoding = ExtentType::IntEncodingNone;
+        }
+    } else if (encoding == ExtentType::IntEncodingZigZagDelta) {
+        int64_t prev = 0;
+        for (const ExtentType::byte *rec = records.begin(); rec < records.end(); 
+             rec += record_size) {
+            int64_t v = *reinterpret_cast<const T *>(rec + offset);
+            int64_t delta = static_cast<int64_t>(static_cast<uint64_t>(v) 
+                                                 - static_cast<uint64_t>(prev));
+            prev = v;
+            uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) 
+                ^ static_cast<uint64_t>(delta >> 63);
+            for (; zigzag >= 0x80; zigzag >>= 7) {
+                payload.push_back(static_cast<uint8_t>(zigzag | 0x80));
+            }
+            payload.push_back(static_cast<uint8_t>(zigzag));
+        }
+    }
+    if (header.encoding != ExtentType::IntEncodingNone 
+        && payload.size() >= nrecords * sizeof(T)) {
+        header.encoding = ExtentType::IntEncodingNone; // values don't suit the encoding
+    }
+    if (header.encoding == ExtentType::IntEncodingNone) {
+        header.bit_width = 0;
+        header.base = 0;
+        payload.resize(nrecords * sizeof(T));
+        uint8_t *to = nrecords > 0 ? &payload[0] : NULL;
+        for (const ExtentType::byte *rec = records.begin(); rec < records.end(); 
+             rec += record_size, to += sizeof(T)) {
+            memcpy(to, rec + offset, sizeof(T));
+        }
+    }
+    header.payload_size = payload.size();
+
+    size_t pos = into.size();
+    size_t column_size = sizeof(header) + roundup8(payload.size()) 
+        + (header.encoding == ExtentType::IntEncodingFrameOfReference ? 8 : 0);
+    into.resize(pos + column_size, true);
+    memcpy(into.begin() + pos, &header, sizeof(header));
+    if (!payload.empty()) {
+        memcpy(into.begin() + pos + sizeof(header), &payload[0], payload.size());
+    }
+}
+
+void Extent::encodeIntColumns(const Extent::ByteArray &records, Extent::ByteArray &into) {
+    typedef vector<ExtentType::nullCompactInfo>::const_iterator nciiT;
+    for (nciiT i = type->rep.int_encoded_compact_info.begin(); 
+         i != type->rep.int_encoded_compact_info.end(); ++i) {
+        ExtentType::IntEncoding encoding = type->rep.field_info[i->field_num].int_encoding;
+        if (i->type == ExtentType::ft_int32) {
+            encodeIntColumn<int32_t>(records, type->rep.fixed_record_size, i->offset,
+                                     encoding, into);
+        } else {
+            DEBUG_SINVARIANT(i->type == ExtentType::ft_int64);
+            encodeIntColumn<int64_t>(records, type->rep.fixed_record_size, i->offset,
+                                     encoding, into);
+        }
+    }
+}
+
+template<class T> static inline void storeIntSlot(ExtentType::byte *to, uint64_t v, 
+                                                  bool fix_endianness) {
+    T tmp = static_cast<T>(v);
+    *reinterpret_cast<T *>(to) = tmp;
+    if (fix_endianness) { // the records are still in the writer's byte order
+        if (sizeof(T) == 4) {
+            Extent::flip4bytes(to);
+        } else {
+            Extent::flip8bytes(to);
+        }
+    }
+}
+
+// Decodes a column into the records, returns the position of the next column.
+template<class T> static const ExtentType::byte *
+decodeIntColumn(Extent::ByteArray &records, size_t record_size, size_t offset,
+                const ExtentType::byte *from, const ExtentType::byte *from_end,
+                bool fix_endianness, const string &field_name) {
+    typedef ExtentType::byte byte;
+    INVARIANT(from + sizeof(IntColumnHeader) <= from_end,
+              format("error unpacking, missing encoded column %s") % field_name);
+    IntColumnHeader header;
+    memcpy(&header, from, sizeof(header));
+    if (fix_endianness) {
+        header.payload_size = Extent::flip4bytes(header.payload_size);
+        Extent::flip8bytes(reinterpret_cast<byte *>(&header.base));
+    }
+    const byte *payload = from + sizeof(header);
+    const byte *payload_end = payload + header.payload_size;
+    const byte *next = payload + roundup8(header.payload_size) 
+        + (header.encoding == ExtentType::IntEncodingFrameOfReference ? 8 : 0);
+    INVARIANT(next <= from_end, format("error unpacking, encoded column %s truncated")
+              % field_name);
+    const size_t nrecords = records.size() / record_size;
+    byte *rec = records.begin() + offset;
+    if (header.encoding == ExtentType::IntEncodingNone) {
+        INVARIANT(header.payload_size == nrecords * sizeof(T),
+                  format("error unpacking, bad size for column %s") % field_name);
+        for (; payload < payload_end; payload += sizeof(T), rec += record_size) {
+            memcpy(rec, payload, sizeof(T));
+        }
+    } else if (header.encoding == ExtentType::IntEncodingFrameOfReference) {
+        const unsigned width = header.bit_width;
+        INVARIANT(width <= max_frame_of_reference_width 
+                  && header.payload_size == (nrecords * width + 7) / 8,
+                  format("error unpacking, bad size for column %s") % field_name);
+        const uint64_t mask = width == 0 ? 0 : ~static_cast<uint64_t>(0) >> (64 - width);
+        const uint64_t base = header.base;
+        uint64_t bit_pos = 0;
+        for (size_t i = 0; i < nrecords; ++i, rec += record_size, bit_pos += width) {
+            uint64_t v = (load8le(payload + (bit_pos >> 3)) >> (bit_pos & 7)) & mask;
+            storeIntSlot<T>(rec, base + v, fix_endianness);
+        }
+    } else if (header.encoding == ExtentType::IntEncodingZigZagDelta) {
+        uint64_t prev = 0;
+        for (size_t i = 0; i < nrecords; ++i, rec += record_size) {
+            uint64_t zigzag = 0;
+            for (unsigned shift = 0; ; shift += 7) {
+                INVARIANT(payload < payload_end && shift < 64,
+                          format("error unpacking, bad varint in column %s") % field_name);
+                zigzag |= static_cast<uint64_t>(*payload & 0x7F) << shift;
+                if ((*payload++ & 0x80) == 0) {
+                    break;
+                }
+            }
+            prev += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+            storeIntSlot<T>(rec, prev, fix_endianness);
+        }
+        INVARIANT(payload == payload_end, 
+                  format("error unpacking, extra data in column %s") % field_name);
+    } else {
+        FATAL_ERROR(format("error unpacking, unknown encoding %d for column %s")
+                    % static_cast<int>(header.encoding) % field_name);
+    }
+    return next;
+}
+
+const ExtentType::byte *Extent::decodeIntColumns(Extent::ByteArray &records, const byte *from,
+                                                 const byte *from_end, bool fix_endianness) {
+    typedef vector<ExtentType::nullCompactInfo>::const_iterator nciiT;
+    for (nciiT i = type->rep.int_encoded_compact_info.begin(); 
+         i != type->rep.int_encoded_compact_info.end(); ++i) {
+        const string &name(type->rep.field_info[i->field_num].name);
+        if (i->type == ExtentType::ft_int32) {
+            from = decodeIntColumn<int32_t>(records, type->rep.fixed_record_size, i->offset,
+                                            from, from_end, fix_endianness, name);
+        } else {
+            from = decodeIntColumn<int64_t>(records, type->rep.fixed_record_size, i->offset,
+                                            from, from_end, fix_endianness, name);
+        }
+    }
+    return from;
+}
+
 static const bool debug_compact = false;
 void Extent::compactNulls(Extent::ByteArray &fixed_coded) {
     if (debug_compact) {
         cout << format("compacting %s\n")
                 % hexstring(string((char *)fixed_coded.begin(), fixed_coded.size()));
     }
-    INVARIANT(type->getPackNullCompact() == ExtentType::CompactNonBool, "bad");
+    INVARIANT(type->rep.compact_records, "bad");
     Extent::ByteArray into;
     into.resize(fixed_coded.size(), false); // no need to fill in
 
@@ -339,7 +622,6 @@ void Extent::compactNulls(Extent::ByteArray &fixed_coded) {
     // lots of nullable booleans it could become worth it.
 
     byte *cur = into.begin();
-    INVARIANT(type->rep.bool_bytes > 0, "?");
     for (byte *fixed_record = fixed_coded.begin();
         fixed_record != fixed_coded.end(); 
         fixed_record += type->rep.fixed_record_size) {
@@ -509,11 +791,13 @@ copySome:
     return from;
 }
 
-void Extent::uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size) {
-    INVARIANT(type->getPackNullCompact() == ExtentType::CompactNonBool, "bad");
+void Extent::uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size, int32_t nrecords,
+                            bool fix_endianness) {
+    INVARIANT(type->rep.compact_records, "bad");
     Extent::ByteArray into;
     INVARIANT(static_cast<size_t>(size) <= fixed_coded.size(), "internal"); 
-    into.resize(fixed_coded.size(), true); // need to zero fill padding
+    // need to zero fill padding; fixed_coded may also have room for the encoded columns
+    into.resize(static_cast<size_t>(nrecords) * type->rep.fixed_record_size, true);
     // TODO: benchmark doing the partial zero fills during the copy
     // loop; may or may not be faster especially given we have to
     // zero fill null values.
@@ -527,12 +811,13 @@ void Extent::uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size) {
     const byte *from_end = fixed_coded.begin() + size;
     byte *to = into.begin();
     size = into.size(); 
-    INVARIANT(type->rep.bool_bytes > 0, "?");
     // If we want to not potentially seg fault on bad input, then we
     // need to turn the from debug invariants into invariants and
     // check that we aren't running off the end early.  The invariant
-    // at the end will catch it overall, so we still can't go "wrong"
-    while (from < from_end && to < into.end()) {
+    // at the end will catch it overall, so we still can't go "wrong".
+    // A record can compact to nothing if all its fields are encoded.
+    while (to < into.end()) {
+        INVARIANT(from <= from_end, "error unpacking, compacted records truncated");
         if (debug_compact) {
             cout << format("uncompact from@%d/%d to@%d row %d/%d\n")
                     % (from - fixed_coded.begin()) % (from_end - fixed_coded.begin())
@@ -560,6 +845,10 @@ void Extent::uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size) {
 
         to += type->rep.fixed_record_size;
     }
+    if (!type->rep.int_encoded_compact_info.empty()) {
+        from = fixed_coded.begin() + roundup8(from - fixed_coded.begin());
+        from = decodeIntColumns(into, from, from_end, fix_endianness);
+    }
     INVARIANT(from == from_end && to == into.end(), "internal");
     fixed_coded.swap(into);
     if (debug_compact) {
@@ -568,6 +857,200 @@ void Extent::uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size) {
     }
 }
 
+// pack_layout="columns": the fixed data is an int32 count of the columns, a
+// LayoutColumnHeader per column, and then each column compressed separately, aligned to 4
+// bytes.  The directory isn't compressed, the fixed compression mode in the extent header
+// is always compress_mode_none.  The extent's hash covers the column hashes rather than the
+// records, so that a partial unpack can verify the columns it reads.
+struct LayoutColumnHeader {
+    int32_t compressed_size;
+    uint32_t bjhash; // of the uncompressed column, in the writer's byte order
+    uint8_t mode; // compression
+    uint8_t unused[3];
+};
+
+static inline size_t roundup4(size_t size) {
+    return (size + 3) & ~static_cast<size_t>(3);
+}
+
+template<class T> static void gatherColumn(const Extent::ByteArray &records, size_t record_size,
+                                           int32_t offset, ExtentType::byte *into) {
+    T *to = reinterpret_cast<T *>(into);
+    for (const ExtentType::byte *rec = records.begin() + offset; rec < records.end(); 
+         rec += record_size, ++to) {
+        *to = *reinterpret_cast<const T *>(rec);
+    }
+}
+
+template<class T> static void scatterColumn(const ExtentType::byte *from, 
+                                            Extent::ByteArray &records, size_t record_size,
+                                            int32_t offset) {
+    const T *v = reinterpret_cast<const T *>(from);
+    for (ExtentType::byte *rec = records.begin() + offset; rec < records.end(); 
+         rec += record_size, ++v) {
+        *reinterpret_cast<T *>(rec) = *v;
+    }
+}
+
+uint32_t Extent::packColumns(const Extent::ByteArray &records, uint32_t compression_modes,
+                             uint32_t compression_level, Extent::ByteArray &into) {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t nrecords = records.size() / rep.fixed_record_size;
+    const size_t ncolumns = rep.layout_columns.size();
+    vector<LayoutColumnHeader> headers(ncolumns); // zeroed
+    vector<Extent::ByteArray *> compressed(ncolumns);
+    vector<uint32_t> hashes(ncolumns);
+    size_t into_size = 4 + ncolumns * sizeof(LayoutColumnHeader);
+    Extent::ByteArray column;
+    for (size_t i = 0; i < ncolumns; ++i) {
+        const ExtentType::ParsedRepresentation::layoutColumn &layout(rep.layout_columns[i]);
+        column.resize(nrecords * layout.size, false);
+        switch (layout.size) 
+            {
+            case 1: gatherColumn<uint8_t>(records, rep.fixed_record_size, layout.offset,
+                                          column.begin()); break;
+            case 4: gatherColumn<uint32_t>(records, rep.fixed_record_size, layout.offset,
+                                           column.begin()); break;
+            case 8: gatherColumn<uint64_t>(records, rep.fixed_record_size, layout.offset,
+                                           column.begin()); break;
+            default: // fixedwidth
+                for (size_t j = 0; j < nrecords; ++j) {
+                    memcpy(column.begin() + j * layout.size,
+                           records.begin() + j * rep.fixed_record_size + layout.offset,
+                           layout.size);
+                }
+            }
+        hashes[i] = lintel::bobJenkinsHash(1972, column.begin(), column.size());
+        compressed[i] = compressBytes(column.begin(), column.size(), compression_modes,
+                                      compression_level, &headers[i].mode);
+        headers[i].compressed_size = compressed[i]->size();
+        headers[i].bjhash = hashes[i];
+        into_size += roundup4(compressed[i]->size());
+    }
+
+    into.resize(into_size, true); // zeroes the alignment padding
+    byte *to = into.begin();
+    *reinterpret_cast<int32 *>(to) = ncolumns;
+    to += 4;
+    memcpy(to, &headers[0], ncolumns * sizeof(LayoutColumnHeader));
+    to += ncolumns * sizeof(LayoutColumnHeader);
+    for (size_t i = 0; i < ncolumns; ++i) {
+        memcpy(to, compressed[i]->begin(), compressed[i]->size());
+        to += roundup4(compressed[i]->size());
+        delete compressed[i];
+    }
+    SINVARIANT(to == into.end());
+    return lintel::bobJenkinsHash(1972, &hashes[0], 4 * ncolumns);
+}
+
+// Marks the columns needed to unpack only_fields (all of them if it is NULL), including
+// the base fields of pack_relative fields and the null flags; returns true if the
+// variable data is needed.
+bool Extent::neededColumns(const vector<string> *only_fields, vector<bool> &columns) const {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    if (only_fields == NULL) {
+        columns.assign(rep.layout_columns.size(), true);
+        return true;
+    }
+    vector<bool> fields(rep.field_info.size(), false);
+    for (vector<string>::const_iterator i = only_fields->begin(); 
+         i != only_fields->end(); ++i) {
+        int field_num = ExtentType::getColumnNumber(rep, *i); // -1 for fields the type lacks
+        if (field_num >= 0) {
+            fields[field_num] = true;
+        }
+    }
+    for (bool changed = true; changed; ) { // relative to relative fields chain
+        changed = false;
+        for (unsigned j = 0; j < rep.pack_other_relative.size(); ++j) {
+            const ExtentType::pack_other_relativeT &por(rep.pack_other_relative[j]);
+            if (fields[por.field_num] && !fields[por.base_field_num]) {
+                fields[por.base_field_num] = true;
+                changed = true;
+            }
+        }
+    }
+    bool ret = false;
+    columns.assign(rep.layout_columns.size(), false);
+    for (unsigned i = 0; i < rep.field_info.size(); ++i) {
+        const ExtentType::fieldInfo &field(rep.field_info[i]);
+        if (!fields[i]) {
+            continue;
+        }
+        columns[field.layout_column] = true;
+        if (field.null_fieldnum >= 0) {
+            columns[rep.field_info[field.null_fieldnum].layout_column] = true;
+        }
+        if (field.type == ExtentType::ft_variable32) {
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+// Fills in the needed columns of fixeddata, which must be zeroed and sized for the records.
+// Returns the hash of the column hashes.
+uint32_t Extent::unpackColumns(byte *from, int32 from_size, bool fix_endianness,
+                               const vector<bool> &columns) {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t nrecords = fixeddata.size() / rep.fixed_record_size;
+    const size_t ncolumns = rep.layout_columns.size();
+    SINVARIANT(columns.size() == ncolumns);
+    INVARIANT(from_size >= 4 && static_cast<size_t>(from_size) 
+              >= 4 + ncolumns * sizeof(LayoutColumnHeader), "Invalid extent data, too small");
+    int32 file_ncolumns = *reinterpret_cast<int32 *>(from);
+    if (fix_endianness) {
+        file_ncolumns = flip4bytes(file_ncolumns);
+    }
+    INVARIANT(file_ncolumns == static_cast<int32>(ncolumns),
+              format("error unpacking, %d columns != %d in type %s")
+              % file_ncolumns % ncolumns % rep.name);
+    LayoutColumnHeader *headers = reinterpret_cast<LayoutColumnHeader *>(from + 4);
+    byte *column_begin = from + 4 + ncolumns * sizeof(LayoutColumnHeader);
+    byte *end = from + from_size;
+    vector<uint32_t> hashes(ncolumns);
+    Extent::ByteArray column;
+    for (size_t i = 0; i < ncolumns; ++i) {
+        LayoutColumnHeader &header(headers[i]);
+        if (fix_endianness) {
+            header.compressed_size = flip4bytes(header.compressed_size);
+            header.bjhash = flip4bytes(header.bjhash);
+        }
+        hashes[i] = header.bjhash;
+        INVARIANT(header.compressed_size >= 0 && header.compressed_size <= end - column_begin,
+                  format("error unpacking, bad size %d for column %d")
+                  % header.compressed_size % i);
+        if (columns[i]) {
+            const ExtentType::ParsedRepresentation::layoutColumn &layout(rep.layout_columns[i]);
+            int32 column_size = nrecords * layout.size;
+            column.resize(column_size, false);
+            int32 uncompressed_size = uncompressBytes(column.begin(), column_begin, header.mode,
+                                                      column_size, header.compressed_size);
+            INVARIANT(uncompressed_size == column_size, "error unpacking, short column");
+            INVARIANT(!postuncompress_check || header.bjhash
+                      == lintel::bobJenkinsHash(1972, column.begin(), column_size),
+                      format("column %d (offset %d) hash check failed") % i % layout.offset);
+            switch (layout.size) 
+                {
+                case 1: scatterColumn<uint8_t>(column.begin(), fixeddata,
+                                               rep.fixed_record_size, layout.offset); break;
+                case 4: scatterColumn<uint32_t>(column.begin(), fixeddata,
+                                                rep.fixed_record_size, layout.offset); break;
+                case 8: scatterColumn<uint64_t>(column.begin(), fixeddata,
+                                                rep.fixed_record_size, layout.offset); break;
+                default: // fixedwidth
+                    for (size_t j = 0; j < nrecords; ++j) {
+                        memcpy(fixeddata.begin() + j * rep.fixed_record_size + layout.offset,
+                               column.begin() + j * layout.size, layout.size);
+                    }
+                }
+        }
+        column_begin += roundup4(header.compressed_size);
+    }
+    INVARIANT(column_begin == end, "Invalid extent data, column sizes don't match");
+    return lintel::bobJenkinsHash(1972, &hashes[0], 4 * ncolumns);
+}
+
 static const uint32_t max_packed_size = 512*1024*1024;
 
 static const unsigned variable_sizes_batch_size = 1024;
@@ -578,6 +1061,7 @@ static const unsigned variable_sizes_batch_size = 1024;
 uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes, 
                           uint32_t compression_level, uint32_t *header_packed, 
                           uint32_t *fixed_packed, uint32_t *variable_packed) {
+    unpackAllFields();
     // Don't need to zero the coded arrays as we will be filling them
     // all in.
     Extent::ByteArray fixed_coded;
@@ -590,6 +1074,15 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
             variableDuplicateEliminate_Hash, 
             variableDuplicateEliminate_Equal> vardupelim;
 
+    // The variable32 fields of pack_dictionary fields hold a code rather than an offset; the
+    // code -> offset tables are appended to the variable data in dictionary_field_columns
+    // order, and decodeDictionaries() turns the codes back into offsets.
+    vector<packDictionary> dictionaries(type->rep.dictionary_field_columns.size());
+    vector<int> dictionary_num(type->rep.field_info.size(), -1);
+    for (unsigned i = 0; i < type->rep.dictionary_field_columns.size(); ++i) {
+        dictionary_num[type->rep.dictionary_field_columns[i]] = i;
+    }
+
     memcpy(fixed_coded.begin(), fixeddata.begin(), fixeddata.size());
     vector<bool> warnings;
     warnings.resize(type->rep.field_info.size(),false);
@@ -606,7 +1099,7 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     byte *variable_data_pos = variable_coded.begin();
     *(int32 *)variable_data_pos = 0;
     variable_data_pos += 4;
-    bool null_compact = type->getPackNullCompact() != ExtentType::CompactNo;
+    bool null_compact = type->rep.compact_records;
     for (Extent::ByteArray::iterator fixed_record = fixed_coded.begin();
         fixed_record != fixed_coded.end(); 
         fixed_record += type->rep.fixed_record_size) {
@@ -646,6 +1139,13 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
                 ExtentType::byte *raw = static_cast<unsigned char *>(fixed_record + j->offset);
                 *reinterpret_cast<int64_t *>(raw) = 0;
             }
+
+            for (nciiT j = type->rep.int_encoded_compact_info.begin(); 
+                j != type->rep.int_encoded_compact_info.end(); ++j) {
+                if (!compactIsNull(fixed_record, *j)) 
+                    continue;
+                memset(fixed_record + j->offset, 0, j->size);
+            }
         }
 
         // pack variable sized fields ...
@@ -656,7 +1156,27 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
             Variable32Field::selfcheck(variabledata, varoffset);
             int32 size = Variable32Field::size(variabledata, varoffset);
             int32 roundup = Variable32Field::roundupSize(size);
-            if (size == 0) {
+            if (dictionary_num[field] >= 0) {
+                packDictionary &dict(dictionaries[dictionary_num[field]]);
+                int32 code = 0;
+                if (size == 0) {
+                    SINVARIANT(varoffset == 0);
+                } else {
+                    dictionaryEntry v(variabledata.begin() + varoffset);
+                    dictionaryEntry *entry = dict.values.lookup(v);
+                    if (entry != NULL) {
+                        code = entry->code;
+                    } else {
+                        memcpy(variable_data_pos, variabledata.begin() + varoffset, 4 + roundup);
+                        v.varbits = variable_data_pos;
+                        v.code = code = dict.value_offsets.size();
+                        dict.value_offsets.push_back(variable_data_pos - variable_coded.begin());
+                        dict.values.add(v);
+                        variable_data_pos += 4 + roundup;
+                    }
+                }
+                *(int32 *)(fixed_record + offset) = code;
+            } else if (size == 0) {
                 SINVARIANT(varoffset == 0);
             } else {
                 int32 packed_varoffset = -1;
@@ -796,14 +1316,55 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     // reversable, especially the scaling conversion which is
     // deliberately not precisely reversable
     SINVARIANT(fixed_coded.size() == type->rep.fixed_record_size * nrecords);
-    uint32_t bjhash = lintel::bobJenkinsHash(1972, fixed_coded.begin(),
-                                             type->rep.fixed_record_size * nrecords);
+    const bool layout_columns = type->rep.pack_layout == ExtentType::LayoutColumns;
+    Extent::ByteArray columns_coded;
+    uint32_t bjhash;
+    if (layout_columns) {
+        bjhash = packColumns(fixed_coded, compression_modes, compression_level, columns_coded);
+    } else {
+        bjhash = lintel::bobJenkinsHash(1972, fixed_coded.begin(),
+                                        type->rep.fixed_record_size * nrecords);
+    }
 
-    if (type->getPackNullCompact() != ExtentType::CompactNo) {
+    if (type->rep.compact_records) {
         // do this after we do the fixed hash, so the checksum will
         // verify this is reversable.
+        Extent::ByteArray int_columns;
+        if (!type->rep.int_encoded_compact_info.empty()) {
+            encodeIntColumns(fixed_coded, int_columns);
+        }
 
         compactNulls(fixed_coded);
+
+        if (!type->rep.int_encoded_compact_info.empty()) {
+            size_t columns_pos = roundup8(fixed_coded.size());
+            fixed_coded.resize(columns_pos + int_columns.size(), true); // zeroes the padding
+            memcpy(fixed_coded.begin() + columns_pos, int_columns.begin(), int_columns.size());
+            // unpackData only has room for the largest possible encoded columns
+            SINVARIANT(fixed_coded.size() <= nrecords * type->rep.fixed_record_size
+                       + maxIntColumnsSize(type->rep.int_encoded_compact_info, nrecords));
+        }
+    }
+
+    if (!dictionaries.empty()) {
+        size_t used = variable_data_pos - variable_coded.begin();
+        size_t table_bytes = 0;
+        for (unsigned i = 0; i < dictionaries.size(); ++i) {
+            table_bytes += 4 + Variable32Field::roundupSize(4 * dictionaries[i].value_offsets.size());
+        }
+        if (used + table_bytes > variable_coded.size()) {
+            variable_coded.resize(used + table_bytes, false);
+        }
+        variable_data_pos = variable_coded.begin() + used;
+        for (unsigned i = 0; i < dictionaries.size(); ++i) {
+            const vector<int32> &table(dictionaries[i].value_offsets);
+            int32 size = 4 * table.size();
+            int32 roundup = Variable32Field::roundupSize(size);
+            *(int32 *)variable_data_pos = size;
+            memcpy(variable_data_pos + 4, &table[0], size);
+            memset(variable_data_pos + 4 + size, 0, roundup - size);
+            variable_data_pos += 4 + roundup;
+        }
     }
 
     SINVARIANT(static_cast<size_t>(variable_data_pos - variable_coded.begin()) 
@@ -829,10 +1390,16 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     variable_sizes.resize(0);
 
     byte compressed_fixed_mode;
-    Extent::ByteArray *compressed_fixed 
-            = compressBytes(fixed_coded.begin(),fixed_coded.size(),
-                            compression_modes, compression_level,
-                            &compressed_fixed_mode);
+    Extent::ByteArray *compressed_fixed;
+    if (layout_columns) { // already compressed
+        compressed_fixed = new Extent::ByteArray;
+        compressed_fixed->swap(columns_coded);
+        compressed_fixed_mode = compress_mode_none;
+    } else {
+        compressed_fixed = compressBytes(fixed_coded.begin(),fixed_coded.size(),
+                                         compression_modes, compression_level,
+                                         &compressed_fixed_mode);
+    }
     byte compressed_variable_mode;
     Extent::ByteArray *compressed_variable;
     // beginning at 4 bytes into the array avoids packing the 0 bytes at the beginning of the
@@ -1271,7 +1838,8 @@ const string Extent::getPackedExtentType(const Extent::ByteArray &from) {
     return type_name;
 }
 
-void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
+void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness,
+                        const vector<string> *only_fields, bool lazy) {
     if (!did_checks_init) {
         setReadChecksFromEnv();
     }
@@ -1280,6 +1848,8 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
 
     TIME_UNPACKING(Clock::Tdbl time_start = Clock::tod());
     INVARIANT(from.size() > (6*4+2), "Invalid extent data, too small.");
+    pending_fields.clear();
+    npending_fields = 0;
 
     uLong adler32sum = adler32(0L, Z_NULL, 0);
     if (preuncompress_check) {
@@ -1320,35 +1890,67 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
     INVARIANT(header_len + rounded_fixed + rounded_variable == from.size(),
               "Invalid extent data");
 
-    fixeddata.resize(nrecords * type->rep.fixed_record_size, false);
-
-    int32 fixed_uncompressed_size
-            = uncompressBytes(fixeddata.begin(),compressed_fixed_begin,
-                              compressed_fixed_mode,
-                              nrecords * type->rep.fixed_record_size,
-                              compressed_fixed_size);
-    if (type->getPackNullCompact() != ExtentType::CompactNo) {
-        uncompactNulls(fixeddata, fixed_uncompressed_size);
+    uint32_t bjhash = 0;
+    bool need_variable = true;
+    if (type->rep.pack_layout == ExtentType::LayoutColumns) {
+        INVARIANT(compressed_fixed_mode == compress_mode_none,
+                  "error unpacking, columns are compressed separately");
+        vector<bool> columns;
+        need_variable = neededColumns(only_fields, columns);
+        // zeroes the padding, and any columns that we skip.
+        fixeddata.resize(0);
+        fixeddata.resize(nrecords * type->rep.fixed_record_size, true);
+        bjhash = unpackColumns(compressed_fixed_begin, compressed_fixed_size, fix_endianness,
+                               columns);
+    } else {
+        // The encoded int columns are after the compacted records, so may need a little more
+        // room
+        size_t fixed_space = nrecords * type->rep.fixed_record_size 
+            + maxIntColumnsSize(type->rep.int_encoded_compact_info, nrecords);
+        fixeddata.resize(fixed_space, false);
+
+        int32 fixed_uncompressed_size
+                = uncompressBytes(fixeddata.begin(),compressed_fixed_begin,
+                                  compressed_fixed_mode, fixed_space,
+                                  compressed_fixed_size);
+        if (type->rep.compact_records) {
+            uncompactNulls(fixeddata, fixed_uncompressed_size, nrecords, fix_endianness);
+        }
+        INVARIANT(fixed_uncompressed_size == nrecords * type->rep.fixed_record_size,
+                  "internal");
+        if (postuncompress_check) {
+            bjhash = lintel::bobJenkinsHash(1972, fixeddata.begin(), fixeddata.size());
+        }
     }
-    INVARIANT(fixed_uncompressed_size == nrecords * type->rep.fixed_record_size, "internal");
     
-    variabledata.resize(variable_size, false);
     INVARIANT(variable_size >= 4, "error unpacking, invalid variable size");
+    if (!need_variable) {
+        variable_size = 4; // just the empty string that all the fields will refer to
+    }
+    variabledata.resize(variable_size, false);
     *(int32 *)variabledata.begin() = 0;
-    int32 variable_uncompressed_size
-            = uncompressBytes(variabledata.begin()+4, compressed_variable_begin,
-                              compressed_variable_mode,
-                              variable_size-4, compressed_variable_size);
-    INVARIANT(variable_uncompressed_size == variable_size - 4, "internal");
-    uint32_t bjhash = 0;
+    if (need_variable) {
+        int32 variable_uncompressed_size
+                = uncompressBytes(variabledata.begin()+4, compressed_variable_begin,
+                                  compressed_variable_mode,
+                                  variable_size-4, compressed_variable_size);
+        INVARIANT(variable_uncompressed_size == variable_size - 4, "internal");
+    }
     if (postuncompress_check) {
-        bjhash = lintel::bobJenkinsHash(1972, fixeddata.begin(), fixeddata.size());
         bjhash = lintel::bobJenkinsHash(bjhash, variabledata.begin(), variabledata.size());
     }
     vector<int32> variable_sizes;
     variable_sizes.reserve(variable_sizes_batch_size);
+    // The dictionary tables are the last entries, see packData.
+    const size_t ndictionaries = type->rep.dictionary_field_columns.size();
+    vector<byte *> dictionary_tables(ndictionaries);
+    size_t nentries = 0;
     byte *endvarpos = variabledata.begin() + variabledata.size();
     for (byte *curvarpos = &variabledata[4];curvarpos != endvarpos;) {
+        if (ndictionaries > 0) {
+            dictionary_tables[nentries % ndictionaries] = curvarpos;
+            ++nentries;
+        }
         int32 size = *(int32 *)curvarpos;
         if (postuncompress_check) {
             variable_sizes.push_back(size);
@@ -1372,10 +1974,38 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
    
     variable_sizes.resize(0);
 
-    INVARIANT(postuncompress_check == false 
+    // Without the variable data, only the columns could be checked, by unpackColumns.
+    INVARIANT(postuncompress_check == false || !need_variable
               || *(int32 *)(from.begin() + 5*4) == (int32)bjhash,
               "final partially unpacked hash check failed");
     
+    TIME_UNPACKING(Clock::Tdbl time_postuc = Clock::tod());
+    INVARIANT(fixeddata.size() == static_cast<size_t>(nrecords) * type->rep.fixed_record_size,
+              "internal error");
+    if (lazy) {
+        startLazyUnpack(fix_endianness);
+    } else if (unpack_strategy == UnpackByRow) {
+        unpackFieldsByRow(fix_endianness);
+    } else {
+        unpackFieldsByColumn(fix_endianness);
+    }
+    dictionaries.clear();
+    if (ndictionaries > 0 && need_variable) {
+        INVARIANT(nentries >= ndictionaries, "error unpacking, missing dictionary tables");
+        rotate(dictionary_tables.begin(), dictionary_tables.begin() + nentries % ndictionaries,
+               dictionary_tables.end());
+        decodeDictionaries(dictionary_tables, fix_endianness);
+    }
+    TIME_UNPACKING(Clock::Tdbl time_done = Clock::tod();
+                   printf("%d records, unpackcheck %.6g; uncompress %.6g; unpack %.6g\n",
+                          nrecords,
+                          time_upc - time_start,
+                          time_postuc - time_upc,
+                          time_done - time_postuc));
+}
+
+void Extent::unpackFieldsByRow(bool fix_endianness) {
+    const int32 nrecords = fixeddata.size() / type->rep.fixed_record_size;
     vector<ExtentType::pack_self_relativeT> psr_copy 
             = type->rep.pack_self_relative;
     for (unsigned int j=0;j<type->rep.pack_self_relative.size();++j) {
@@ -1385,7 +2015,6 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
                    psr_copy[j].int32_prev_v == 0 &&
                    psr_copy[j].int64_prev_v == 0);
     }
-    TIME_UNPACKING(Clock::Tdbl time_postuc = Clock::tod());
     int record_count = 0;
     // 2004-09-26: each one of these is worth a small speedup, 0.5-1%
     // or so I'd guess, while not inherently worth it, the fix was
@@ -1397,7 +2026,7 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
     const size_t type_pack_self_relative_size = psr_copy.size();
     const size_t type_pack_other_relative_size 
             = type->rep.pack_other_relative.size();
-    const bool null_compact = type->getPackNullCompact() != ExtentType::CompactNo;
+    const bool null_compact = type->rep.compact_records;
     for (ExtentSeries::iterator pos(this); pos.morerecords(); ++pos) {
         ++record_count;
         if (fix_endianness) {
@@ -1427,6 +2056,9 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
         if (unpack_variable32_check) {
             for (unsigned int j=0;j<type_variable32_field_columns_size;j++) {
                 int field = type->rep.variable32_field_columns[j];
+                if (type->rep.field_info[field].dictionary) {
+                    continue; // still a code, checked by decodeDictionaries
+                }
                 int32 offset = type->rep.field_info[field].offset;
                 int32 varoffset 
                         = Variable32Field::getVarOffset(pos.record_start(), 
@@ -1533,12 +2165,328 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
         }
     }   
     INVARIANT(record_count == nrecords,"internal error");
-    TIME_UNPACKING(Clock::Tdbl time_done = Clock::tod();
-                   printf("%d records, unpackcheck %.6g; uncompress %.6g; unpack %.6g\n",
-                          nrecords,
-                          time_upc - time_start,
-                          time_postuc - time_upc,
-                          time_done - time_postuc));
+}
+
+// Column-at-a-time unpacking.  Each transform is applied as a single
+// strided pass over one column of fixeddata, which keeps the inner
+// loops free of the per-field switch statements and lets the compiler
+// unroll (and for the scale/flip passes vectorize) them.  The passes
+// are run in the same order as the per-row code applies them to each
+// record, and each pass only reads values produced by earlier passes,
+// so the resulting bytes are identical to unpackFieldsByRow.
+
+namespace {
+    typedef ExtentType::byte byte;
+
+    void columnFlip4(byte *begin, byte *end, size_t stride, int32_t offset) {
+        for (byte *rec = begin + offset; rec < end; rec += stride) {
+            *reinterpret_cast<uint32_t *>(rec) 
+                    = Extent::flip4bytes(*reinterpret_cast<uint32_t *>(rec));
+        }
+    }
+
+    void columnFlip8(byte *begin, byte *end, size_t stride, int32_t offset) {
+        for (byte *rec = begin + offset; rec < end; rec += stride) {
+            Extent::flip8bytes(rec);
+        }
+    }
+
+    void columnScale(byte *begin, byte *end, size_t stride, int32_t offset, double scale) {
+        for (byte *rec = begin + offset; rec < end; rec += stride) {
+            *reinterpret_cast<double *>(rec) *= scale;
+        }
+    }
+
+    // Nulls are left as 0 and do not update the running value, see packData.
+    template<typename T>
+    void columnSelfRelative(byte *begin, byte *end, size_t stride, int32_t offset,
+                            const ExtentType::nullCompactInfo *nci) {
+        T prev = 0;
+        if (nci == NULL) {
+            for (byte *rec = begin; rec < end; rec += stride) {
+                T *v = reinterpret_cast<T *>(rec + offset);
+                prev += *v;
+                *v = prev;
+            }
+        } else {
+            for (byte *rec = begin; rec < end; rec += stride) {
+                if (compactIsNull(rec, *nci)) {
+                    continue;
+                }
+                T *v = reinterpret_cast<T *>(rec + offset);
+                prev += *v;
+                *v = prev;
+            }
+        }
+    }
+
+    void columnSelfRelativeDouble(byte *begin, byte *end, size_t stride, int32_t offset,
+                                  const ExtentType::nullCompactInfo *nci,
+                                  double multiplier, double scale) {
+        double prev = 0;
+        for (byte *rec = begin; rec < end; rec += stride) {
+            if (nci != NULL && compactIsNull(rec, *nci)) {
+                continue;
+            }
+            double *v = reinterpret_cast<double *>(rec + offset);
+            prev = round((*v + prev) * multiplier) * scale;
+            *v = prev;
+        }
+    }
+
+    template<typename T>
+    void columnOtherRelative(byte *begin, byte *end, size_t stride, int32_t offset,
+                             int32_t base_offset, const ExtentType::nullCompactInfo *nci) {
+        for (byte *rec = begin; rec < end; rec += stride) {
+            if (nci != NULL && compactIsNull(rec, *nci)) {
+                continue;
+            }
+            *reinterpret_cast<T *>(rec + offset) += *reinterpret_cast<T *>(rec + base_offset);
+        }
+    }
+}
+
+void Extent::unpackFieldsByColumn(bool fix_endianness) {
+    // Each field's own transforms only read that field (and its null flag), so they can be
+    // done a field at a time; other-relative fields read their base, so come after all of them.
+    for (uint32_t j = 0; j < type->rep.field_info.size(); ++j) {
+        unpackFieldColumn(j, fix_endianness);
+    }
+    for (uint32_t j = 0; j < type->rep.pack_other_relative.size(); ++j) {
+        unpackOtherRelative(j);
+    }
+}
+
+// Everything but pack_other_relative for one field, in the order unpackFieldsByRow does it.
+void Extent::unpackFieldColumn(uint32_t field_num, bool fix_endianness) const {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t stride = rep.fixed_record_size;
+    byte *begin = fixeddata.begin();
+    byte *end = fixeddata.end();
+    const ExtentType::fieldInfo &field(rep.field_info[field_num]);
+
+    if (fix_endianness) {
+        switch(field.type) 
+        {
+            case ExtentType::ft_bool: 
+            case ExtentType::ft_byte:
+            case ExtentType::ft_fixedwidth:
+                break;
+            case ExtentType::ft_int32:
+            case ExtentType::ft_variable32:
+                columnFlip4(begin, end, stride, field.offset);
+                break;
+            case ExtentType::ft_int64:
+            case ExtentType::ft_double:
+                columnFlip8(begin, end, stride, field.offset);
+                break;
+            default:
+                FATAL_ERROR(format("unknown field type %d for fix_endianness") % field.type);
+                break;
+        }
+    }
+
+    // dictionary codes are checked by decodeDictionaries
+    if (unpack_variable32_check && field.type == ExtentType::ft_variable32 && !field.dictionary) {
+        // only Extent can get at the offsets, so unlike the other passes this one is inline
+        for (byte *rec = begin; rec < end; rec += stride) {
+            int32_t varoffset = Variable32Field::getVarOffset(rec, field.offset);
+            Variable32Field::selfcheck(variabledata, varoffset);
+        }
+    }
+
+    // Unpacking is done in the reverse order as packing.
+
+    for (unsigned j = 0; j < rep.pack_scale.size(); ++j) {
+        if (rep.pack_scale[j].field_num == static_cast<int>(field_num)) {
+            INVARIANT(field.type == ExtentType::ft_double,
+                      "internal error, scaled only supported for ft_double");
+            columnScale(begin, end, stride, field.offset, rep.pack_scale[j].scale);
+        }
+    }
+
+    const ExtentType::nullCompactInfo *nci 
+        = rep.compact_records ? field.null_compact_info : NULL;
+    for (unsigned j = 0; j < rep.pack_self_relative.size(); ++j) {
+        const ExtentType::pack_self_relativeT &psr(rep.pack_self_relative[j]);
+        SINVARIANT(psr.field_num < rep.field_info.size());
+        if (psr.field_num != field_num) {
+            continue;
+        }
+        switch(field.type) 
+        {
+            case ExtentType::ft_double:
+                columnSelfRelativeDouble(begin, end, stride, field.offset, nci,
+                                         psr.multiplier, psr.scale);
+                break;
+            case ExtentType::ft_int32:
+                columnSelfRelative<int32>(begin, end, stride, field.offset, nci);
+                break;
+            case ExtentType::ft_int64:
+                columnSelfRelative<int64>(begin, end, stride, field.offset, nci);
+                break;
+            default:
+                FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
+                            % field.type % field.name
+                            % psr.field_num % field.offset % rep.name);
+        }
+    }
+}
+
+// Adds the base of pack_other_relative[j] into its field; the base must be as
+// unpackFieldsByRow would have it at that point.
+void Extent::unpackOtherRelative(uint32_t j) const {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t stride = rep.fixed_record_size;
+    byte *begin = fixeddata.begin();
+    byte *end = fixeddata.end();
+    const ExtentType::pack_other_relativeT &por(rep.pack_other_relative[j]);
+    const ExtentType::fieldInfo &field(rep.field_info[por.field_num]);
+    const ExtentType::nullCompactInfo *nci 
+        = rep.compact_records ? field.null_compact_info : NULL;
+    int32 base_offset = rep.field_info[por.base_field_num].offset;
+    switch(field.type)
+    {
+        case ExtentType::ft_double:
+            columnOtherRelative<double>(begin, end, stride, field.offset, base_offset, nci);
+            break;
+        case ExtentType::ft_int32:
+            columnOtherRelative<int32>(begin, end, stride, field.offset, base_offset, nci);
+            break;
+        case ExtentType::ft_int64:
+            columnOtherRelative<int64>(begin, end, stride, field.offset, base_offset, nci);
+            break;
+        default:
+            FATAL_ERROR("Internal error");
+    }
+}
+
+// Lazy unpacking.  A field is unpacked on its own with unpackFieldColumn(),
+// and a pack_other_relative field then adds its base, which has to be
+// finished first.  ExtentType only allows a base that is declared before the
+// field, so the base's own pack_other_relative entry, if any, comes earlier
+// in the list, as in unpackFieldsByRow.
+
+int Extent::otherRelativeIndex(int field_num) const {
+    for (unsigned j = 0; j < type->rep.pack_other_relative.size(); ++j) {
+        if (type->rep.pack_other_relative[j].field_num == field_num) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+void Extent::startLazyUnpack(bool fix_endianness) {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    pending_fix_endianness = fix_endianness;
+    pending_fields.assign(rep.field_info.size(), false);
+    for (uint32_t j = 0; j < rep.field_info.size(); ++j) {
+        const ExtentType::fieldInfo &field(rep.field_info[j]);
+        bool flip = fix_endianness && field.type != ExtentType::ft_bool 
+            && field.type != ExtentType::ft_byte && field.type != ExtentType::ft_fixedwidth;
+        bool check = unpack_variable32_check && field.type == ExtentType::ft_variable32;
+        pending_fields[j] = flip || check;
+    }
+    for (unsigned j = 0; j < rep.pack_scale.size(); ++j) {
+        pending_fields[rep.pack_scale[j].field_num] = true;
+    }
+    for (unsigned j = 0; j < rep.pack_self_relative.size(); ++j) {
+        pending_fields[rep.pack_self_relative[j].field_num] = true;
+    }
+    for (unsigned j = 0; j < rep.pack_other_relative.size(); ++j) {
+        pending_fields[rep.pack_other_relative[j].field_num] = true;
+    }
+    // decodeDictionaries needs the codes
+    for (unsigned j = 0; j < rep.dictionary_field_columns.size(); ++j) {
+        uint32_t field_num = rep.dictionary_field_columns[j];
+        if (pending_fields[field_num]) {
+            unpackFieldColumn(field_num, fix_endianness);
+            pending_fields[field_num] = false;
+        }
+    }
+    npending_fields = count(pending_fields.begin(), pending_fields.end(), true);
+    if (npending_fields == 0) {
+        pending_fields.clear();
+    }
+}
+
+void Extent::unpackPendingField(const string &name) const {
+    int field_num = ExtentType::getColumnNumber(type->rep, name);
+    if (field_num >= 0) {
+        unpackPendingField(field_num);
+        if (npending_fields == 0) {
+            pending_fields.clear();
+        }
+    }
+}
+
+void Extent::unpackPendingField(uint32_t field_num) const {
+    SINVARIANT(field_num < pending_fields.size());
+    if (!pending_fields[field_num]) {
+        return;
+    }
+    unpackFieldColumn(field_num, pending_fix_endianness);
+    int j = otherRelativeIndex(field_num);
+    if (j >= 0) {
+        int base_field_num = type->rep.pack_other_relative[j].base_field_num;
+        SINVARIANT(otherRelativeIndex(base_field_num) < j);
+        unpackPendingField(base_field_num);
+        unpackOtherRelative(j);
+    }
+    pending_fields[field_num] = false;
+    --npending_fields;
+}
+
+void Extent::unpackPendingFields() const {
+    for (uint32_t j = 0; j < pending_fields.size(); ++j) {
+        unpackPendingField(j);
+    }
+    SINVARIANT(npending_fields == 0);
+    pending_fields.clear();
+}
+
+void Extent::decodeDictionaries(const vector<byte *> &tables, bool fix_endianness) {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t stride = rep.fixed_record_size;
+    SINVARIANT(tables.size() == rep.dictionary_field_columns.size());
+    dictionaries.resize(tables.size());
+    for (unsigned j = 0; j < tables.size(); ++j) {
+        const ExtentType::fieldInfo &field(rep.field_info[rep.dictionary_field_columns[j]]);
+        Dictionary &dict(dictionaries[j]);
+        dict.field_offset = field.offset;
+
+        int32 table_size = *reinterpret_cast<int32 *>(tables[j]);
+        INVARIANT(table_size >= 4 && table_size % 4 == 0,
+                  format("error unpacking, bad dictionary table size %d for %s")
+                  % table_size % field.name);
+        dict.value_offsets.resize(table_size / 4);
+        memcpy(&dict.value_offsets[0], tables[j] + 4, table_size);
+        if (fix_endianness) {
+            for (vector<int32>::iterator i = dict.value_offsets.begin();
+                 i != dict.value_offsets.end(); ++i) {
+                *i = flip4bytes(*i);
+            }
+        }
+        INVARIANT(dict.value_offsets[0] == 0, "error unpacking, dictionary code 0 is not empty");
+        if (unpack_variable32_check) {
+            for (vector<int32>::iterator i = dict.value_offsets.begin();
+                 i != dict.value_offsets.end(); ++i) {
+                Variable32Field::selfcheck(variabledata, *i);
+            }
+        }
+
+        const int32 nvalues = dict.nValues();
+        dict.codes.resize(fixeddata.size() / stride);
+        vector<int32>::iterator code = dict.codes.begin();
+        for (byte *rec = fixeddata.begin(); rec < fixeddata.end(); rec += stride, ++code) {
+            int32 *slot = reinterpret_cast<int32 *>(rec + field.offset);
+            INVARIANT(*slot >= 0 && *slot < nvalues,
+                      format("error unpacking, dictionary code %d out of range for %s")
+                      % *slot % field.name);
+            *code = *slot;
+            *slot = dict.value_offsets[*slot];
+        }
+    }
 }
 
 uint32_t
@@ -1565,25 +2513,19 @@ bool Extent::checkedPread(int fd, off64_t offset, byte *into, int amount, bool e
     return true;
 }
 
-bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
-    int prefix_size = 6*4 + 4*1;
-    into.resize(prefix_size, false);
-    if (checkedPread(fd,offset,into.begin(),prefix_size, true) == false) {
-        into.resize(0);
-        return false;
-    }
-    offset += prefix_size;
-    byte *l = into.begin();
+uint64_t Extent::packedExtentSize(byte *prefix, bool need_bitflip) {
+    const int prefix_size = packed_prefix_size;
+    byte *l = prefix;
     int32_t compressed_fixed = *(int32_t *)l; l += 4;
     int32_t compressed_variable = *(int32_t *)l; l += 4;
-    int32 typenamelen = into[6*4+2];
+    int32 typenamelen = prefix[6*4+2];
     if (need_bitflip) {
         compressed_fixed = flip4bytes(compressed_fixed);
         compressed_variable = flip4bytes(compressed_variable);
     }
     if (compressed_fixed == -1) {
-        DataSeriesSink::verifyTail(into.begin(), need_bitflip,"*unknown*");
-        return false;
+        DataSeriesSink::verifyTail(prefix, need_bitflip,"*unknown*");
+        return 0;
     }
     INVARIANT(compressed_fixed >= 0 && compressed_variable >= 0
               && typenamelen >= 0, "Error reading extent");
@@ -1599,6 +2541,21 @@ bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool
     extentsize += (4 - extentsize % 4) % 4;
     LintelLogDebug("Extent/size", format("%d %d %d %d ~= %d") % prefix_size % typenamelen
                    % compressed_fixed % compressed_variable % extentsize);
+    return extentsize;
+}
+
+bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
+    int prefix_size = packed_prefix_size;
+    into.resize(prefix_size, false);
+    if (checkedPread(fd,offset,into.begin(),prefix_size, true) == false) {
+        into.resize(0);
+        return false;
+    }
+    offset += prefix_size;
+    uint64_t extentsize = packedExtentSize(into.begin(), need_bitflip);
+    if (extentsize == 0) {
+        return false;
+    }
     into.resize(extentsize, false);
     checkedPread(fd, offset, into.begin() + prefix_size, 
                  extentsize - prefix_size);
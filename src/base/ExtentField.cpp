@@ -26,6 +26,9 @@ void Field::setFieldName(const string &new_name) {
     if (dataseries.getTypePtr() != NULL) {
         newExtentType();
     }
+    if (dataseries.my_extent != NULL) {
+        dataseries.my_extent->unpackField(fieldname);
+    }
 }
 
 void Field::newExtentType() {
@@ -112,7 +115,7 @@ Variable32Field::Variable32Field(ExtentSeries &_dataseries,
                                  const std::string &_default_value,
                                  bool auto_add) 
 : Field(_dataseries,field,flags), default_value(_default_value), 
-    offset_pos(-1), unique(false)
+    offset_pos(-1), unique(false), dictionary_field(false)
 { 
     if (auto_add) {
         dataseries.addField(*this);
@@ -123,6 +126,7 @@ void Variable32Field::newExtentType() {
     Field::newExtentType();
     offset_pos = dataseries.getTypePtr()->getOffset(getName());
     unique = dataseries.getTypePtr()->getUnique(getName());
+    dictionary_field = dataseries.getTypePtr()->getDictionary(getName());
     INVARIANT(dataseries.getTypePtr()->getFieldType(getName()) 
               == ExtentType::ft_variable32,
               format("mismatch on field types for field named %s in type %s")
@@ -140,6 +144,9 @@ void Variable32Field::allocateSpace(Extent &e, uint8_t *row_pos, uint32_t data_s
         clear(e, row_pos);
         return;
     }
+    if (dictionary_field) {
+        e.dropDictionary(offset_pos);
+    }
     int32_t roundup = roundupSize(data_size);
     DEBUG_SINVARIANT((roundup+4) % 8 == 0);
                     
@@ -179,6 +186,9 @@ void Variable32Field::partialSet(Extent &e, uint8_t *row_pos,
     }
     SINVARIANT(data_size <= static_cast<uint32_t>(numeric_limits<int32_t>::max()));
     SINVARIANT(offset <= static_cast<uint32_t>(numeric_limits<int32_t>::max()));
+    if (dictionary_field) {
+        e.dropDictionary(offset_pos); // the value may be shared by other rows
+    }
 
     // TODO: this is almost like rawval() in fixedfield; think about unifying?
     int32_t varoffset = *reinterpret_cast<int32_t *>(row_pos + offset_pos);
@@ -103,6 +103,11 @@ void ExtentSeries::setExtent(Extent *e) {
     if (e != NULL && e->type != type) {
         setType(e->type);
     }
+    if (e != NULL && e->hasPendingFields()) {
+        for (vector<Field *>::iterator i = my_fields.begin(); i != my_fields.end(); ++i) {
+            e->unpackField((**i).getName());
+        }
+    }
 }
 
 void ExtentSeries::setExtent(Extent::Ptr e) {
@@ -129,6 +134,9 @@ void ExtentSeries::addField(Field &field) {
         field.newExtentType();
     }
     my_fields.push_back(&field);
+    if (my_extent != NULL) {
+        my_extent->unpackField(field.getName());
+    }
 }
 
 void ExtentSeries::removeField(Field &field, bool must_exist) {
@@ -144,6 +152,15 @@ void ExtentSeries::removeField(Field &field, bool must_exist) {
     SINVARIANT(!must_exist || found);
 }
 
+vector<string> ExtentSeries::getFieldNames() const {
+    vector<string> ret;
+    ret.reserve(my_fields.size());
+    for (vector<Field *>::const_iterator i = my_fields.begin(); i != my_fields.end(); ++i) {
+        ret.push_back((*i)->getName());
+    }
+    return ret;
+}
+
 void ExtentSeries::iterator::setPos(const void *in_new_pos) {
     const byte *new_pos = static_cast<const byte *>(in_new_pos);
     byte *cur_begin = cur_extent->fixeddata.begin();
@@ -36,6 +36,21 @@ const string dataseries_index_type_v0_xml =
         "  <field type=\"variable32\" name=\"extenttype\" />\n"
         "</ExtentType>\n";
 
+// One row per column per extent written by a DataSeriesSink that was asked
+// to recordMinMax(); numeric columns fill in min/max, variable32 columns
+// fill in min_string/max_string; sorted is true if the column is
+// non-decreasing in the extent.
+const string dataseries_minmax_type_xml =
+        "<ExtentType name=\"DataSeries: ExtentMinMax\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"offset\" />\n"
+        "  <field type=\"variable32\" name=\"column\" pack_unique=\"yes\" />\n"
+        "  <field type=\"double\" name=\"min\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"max\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"min_string\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"max_string\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"bool\" name=\"sorted\" />\n"
+        "</ExtentType>\n";
+
 // The following is here as we are working out what the next version
 // of the extent index should look like; I think we will be able to
 // get away with putting it into the xmltype index and hence be able 
@@ -68,6 +83,7 @@ const string dataseries_index_type_v1_xml =
 
 const ExtentType::Ptr ExtentType::dataseries_xml_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_xml_type_xml));
 const ExtentType::Ptr ExtentType::dataseries_index_type_v0(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_index_type_v0_xml));
+const ExtentType::Ptr ExtentType::dataseries_minmax_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_minmax_type_xml));
 
 string ExtentType::strGetXMLProp(xmlNodePtr cur, const string &option_name, bool empty_ok) {
     xmlChar *option = xmlGetProp(cur, reinterpret_cast<const xmlChar *>(option_name.c_str()));
@@ -290,10 +306,25 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
         }
     }
 
+    ret.pack_layout = LayoutRows;
+    {
+        string layout_opt = strGetXMLProp(cur, "pack_layout");
+        if (!layout_opt.empty()) {
+            if (layout_opt == "rows") {
+                ret.pack_layout = LayoutRows;
+            } else if (layout_opt == "columns") {
+                ret.pack_layout = LayoutColumns;
+            } else {
+                FATAL_ERROR(format("Unknown pack_layout value '%s', expect rows or columns")
+                            % layout_opt);
+            }
+        }
+    }
+
     for (xmlAttr *prop = cur->properties; prop != NULL; prop = prop->next) {
         string opt(reinterpret_cast<const char *>(prop->name));
         if (opt == "pack_null_compact" || opt == "pack_pad_record"
-            || opt == "pack_field_ordering") {
+            || opt == "pack_field_ordering" || opt == "pack_layout") {
             // ok
         } else {
             INVARIANT(!prefixequal(opt, "pack_"),
@@ -341,6 +372,10 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
                 // ok
             } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_unique") == 0) {
                 // ok
+            } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_dictionary") == 0) {
+                // ok
+            } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_int_encoding") == 0) {
+                // ok
             } else if (xmlStrcmp(prop->name,(const xmlChar *)"opt_doublebase") == 0) {
                 // ok
             } else if (xmlStrcmp(prop->name,(const xmlChar *)"opt_nullable") == 0) {
@@ -404,14 +439,40 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
         LintelLogDebug("ExtentType::XMLDecode", boost::format("  field type='%s', name='%s'\n") % type_str % info.name);
 
         string pack_unique = strGetXMLProp(cur, "pack_unique");
+        string pack_dictionary = strGetXMLProp(cur, "pack_dictionary");
         if (info.type == ft_variable32) {
             ret.variable32_field_columns.push_back(ret.field_info.size());
             info.unique = parseYesNo(cur, "pack_unique", false);
+            info.dictionary = parseYesNo(cur, "pack_dictionary", false);
+            INVARIANT(!(info.unique && info.dictionary),
+                      boost::format("field %s: pack_dictionary already eliminates duplicates,"
+                                    " it can't be combined with pack_unique") % info.name);
+            if (info.dictionary) {
+                ret.dictionary_field_columns.push_back(ret.field_info.size());
+            }
         } else {
             INVARIANT(pack_unique.empty(),
                       "pack_unique only allowed for variable32 fields");
+            INVARIANT(pack_dictionary.empty(),
+                      "pack_dictionary only allowed for variable32 fields");
         }
         
+        string pack_int_encoding = strGetXMLProp(cur, "pack_int_encoding");
+        if (!pack_int_encoding.empty()) {
+            INVARIANT(info.type == ft_int32 || info.type == ft_int64,
+                      "pack_int_encoding only allowed for int32 and int64 fields");
+            if (pack_int_encoding == "frame_of_reference") {
+                info.int_encoding = IntEncodingFrameOfReference;
+            } else if (pack_int_encoding == "zigzag_delta") {
+                info.int_encoding = IntEncodingZigZagDelta;
+            } else {
+                INVARIANT(pack_int_encoding == "none",
+                          format("Unknown pack_int_encoding value '%s' for field %s, expected"
+                                 " frame_of_reference, zigzag_delta or none")
+                          % pack_int_encoding % info.name);
+            }
+        }
+
         bool nullable = parseYesNo(cur, "opt_nullable", false);
         // Real field will go into size, so null field into size+1.
         info.null_fieldnum 
@@ -496,6 +557,9 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
             info.offset = -1;
             info.bitpos = -1;
             info.unique = false;
+            info.dictionary = false;
+            info.int_encoding = IntEncodingNone;
+            info.layout_column = -1;
             info.null_fieldnum = -1;
             info.null_compact_info = NULL;
             info.doublebase = 0;
@@ -572,6 +636,10 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
             n.null_offset = null_field.offset;
             n.null_bitmask = 1 << null_field.bitpos;
         }
+        if (field.int_encoding != IntEncodingNone) {
+            ret.int_encoded_compact_info.push_back(n);
+            continue;
+        }
         switch(n.type)
         {
             case ft_byte: case ft_fixedwidth:
@@ -598,6 +666,37 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
     ret.sortAssignNCI(ret.nonbool_compact_info_size1);
     ret.sortAssignNCI(ret.nonbool_compact_info_size4);
     ret.sortAssignNCI(ret.nonbool_compact_info_size8);
+    ret.sortAssignNCI(ret.int_encoded_compact_info);
+    // Removing the encoded fields from the records is done by the compaction
+    ret.compact_records = ret.pack_null_compact != CompactNo
+        || !ret.int_encoded_compact_info.empty();
+
+    if (ret.pack_layout == LayoutColumns) {
+        // Compaction changes the size of each record, so the columns wouldn't line up.
+        INVARIANT(!ret.compact_records, format("pack_layout=\"columns\" in type %s can not be"
+                                               " combined with pack_null_compact or"
+                                               " pack_int_encoding") % ret.name);
+        INVARIANT(!ret.field_info.empty(),
+                  format("pack_layout=\"columns\" in type %s needs fields") % ret.name);
+        map<int32, int32> column_sizes; // offset -> size; bools in the same byte share it
+        for (vector<fieldInfo>::iterator i = ret.field_info.begin();
+             i != ret.field_info.end(); ++i) {
+            column_sizes[i->offset] = i->type == ft_bool ? 1 : i->size;
+        }
+        map<int32, int> column_nums;
+        for (map<int32, int32>::iterator i = column_sizes.begin(); 
+             i != column_sizes.end(); ++i) {
+            column_nums[i->first] = ret.layout_columns.size();
+            ParsedRepresentation::layoutColumn column;
+            column.offset = i->first;
+            column.size = i->second;
+            ret.layout_columns.push_back(column);
+        }
+        for (vector<fieldInfo>::iterator i = ret.field_info.begin();
+             i != ret.field_info.end(); ++i) {
+            i->layout_column = column_nums[i->offset];
+        }
+    }
 
     return ret;
 }
@@ -675,6 +774,20 @@ bool ExtentType::getUnique(int column) const {
     return rep.field_info[column].unique;
 }
 
+bool ExtentType::getDictionary(int column) const {
+    INVARIANT(column >= 0 && column < (int)rep.field_info.size(),
+              boost::format("internal error, column %d out of range [0..%d]\n")
+              % column % (rep.field_info.size()-1));
+    return rep.field_info[column].dictionary;
+}
+
+ExtentType::IntEncoding ExtentType::getIntEncoding(int column) const {
+    INVARIANT(column >= 0 && column < (int)rep.field_info.size(),
+              boost::format("internal error, column %d out of range [0..%d]\n")
+              % column % (rep.field_info.size()-1));
+    return rep.field_info[column].int_encoding;
+}
+
 bool ExtentType::getNullable(int column) const {
     INVARIANT(column >= 0 && column < (int)rep.field_info.size(),
               boost::format("internal error, column %d out of range [0..%d]\n")
@@ -756,6 +869,8 @@ const ExtentType::Ptr ExtentTypeLibrary::getTypeByNamePtr(const string &name, bo
         return ExtentType::getDataSeriesXMLTypePtr();
     } else if (name == ExtentType::getDataSeriesIndexTypeV0Ptr()->getName()) {
         return ExtentType::getDataSeriesIndexTypeV0Ptr();
+    } else if (name == ExtentType::getDataSeriesMinMaxTypePtr()->getName()) {
+        return ExtentType::getDataSeriesMinMaxTypePtr();
     }
     NameToType::const_iterator i = name_to_type.find(name);
     if (i == name_to_type.end()) {
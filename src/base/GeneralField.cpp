@@ -1343,9 +1343,14 @@ void GF_FixedWidth::set(GeneralField *from) {
 }
 
 void GF_FixedWidth::set(const GeneralValue *from) {
-    INVARIANT(from->gvtype == ExtentType::ft_fixedwidth,
+    // variable32 values of the right width are accepted so that strings, e.g. from set(string),
+    // can fill fixedwidth fields
+    INVARIANT(from->gvtype == ExtentType::ft_fixedwidth
+              || from->gvtype == ExtentType::ft_variable32,
               "can't set GF_FixedWidth from non-fixedwidth general value");
-    SINVARIANT(from->v_variable32->size() == static_cast<size_t>(myfield.size()));
+    INVARIANT(from->v_variable32->size() == static_cast<size_t>(myfield.size()),
+              format("can't set GF_FixedWidth of size %d from a value of size %d")
+              % myfield.size() % from->v_variable32->size());
     myfield.set(from->v_variable32->data(), from->v_variable32->size());
 }
 
@@ -1453,6 +1458,7 @@ void ExtentRecordCopy::copyRecord() {
     INVARIANT(dest.morerecords(), "you forgot to create the destination record");
     INVARIANT(source.morerecords(), "you forgot to set the source record");
     if (fixed_copy_size > 0) {
+        source.my_extent->unpackAllFields(); // the copy has all the fields, not just the var32 ones
         dest.checkOffset(fixed_copy_size-1);
         memcpy(dest.pos.record_start(),source.pos.record_start(),fixed_copy_size);
         // need to do things this way because in the process of doing
@@ -1483,6 +1489,7 @@ void ExtentRecordCopy::copyRecord(const Extent &extent, const dataseries::SEP_Ro
 
     if (fixed_copy_size > 0) {
         SINVARIANT(extent.getTypePtr() == source.getTypePtr());
+        extent.unpackAllFields();
         const uint8_t *row_pos = offset.rowPos(extent);
         dest.checkOffset(fixed_copy_size-1);
         memcpy(dest.pos.record_start(), row_pos, fixed_copy_size);
@@ -0,0 +1,189 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <Lintel/LintelLog.hpp>
+
+#include <DataSeries/DataSeriesSink.hpp>
+#include <DataSeries/SinkPool.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+class SinkPoolThread : public PThread {
+  public:
+    SinkPoolThread(SinkPool &pool) : pool(pool) { }
+
+    virtual ~SinkPoolThread() { }
+
+    virtual void *run() {
+        pool.workerThread();
+        return NULL;
+    }
+    SinkPool &pool;
+};
+
+SinkPool &SinkPool::instance() {
+    // Deliberately never deleted, see UnpackPool::instance()
+    static SinkPool *pool = new SinkPool();
+    return *pool;
+}
+
+SinkPool::SinkPool()
+    : requested_threads(-1), workers(), mutex(), work_cond(), budget_cond(), idle_cond(),
+      sinks(), last_sink(NULL), max_bytes_in_progress(256 * 1024 * 1024), bytes_in_progress(0)
+{ }
+
+SinkPool::~SinkPool() {
+    FATAL_ERROR("SinkPool should never be destroyed");
+}
+
+void SinkPool::setThreadCount(int nthreads) {
+    INVARIANT(nthreads == -1 || nthreads > 0, format("invalid thread count %d") % nthreads);
+    PThreadScopedLock lock(mutex);
+    if (workers.empty()) {
+        requested_threads = nthreads;
+    }
+}
+
+size_t SinkPool::nThreads() {
+    PThreadScopedLock lock(mutex);
+    if (workers.empty()) {
+        lockedStartThreads();
+    }
+    return workers.size();
+}
+
+void SinkPool::lockedStartThreads() {
+    unsigned nthreads = requested_threads == -1
+        ? min(PThreadMisc::getNCpus(), MAX_THREADS/2) : requested_threads;
+    INVARIANT(nthreads > 0, "?");
+    for (unsigned i = 0; i < nthreads; ++i) {
+        workers.push_back(new SinkPoolThread(*this));
+        workers.back()->start();
+    }
+    LintelLogDebug("SinkPool", format("started %d sink threads") % nthreads);
+}
+
+void SinkPool::setMaxBytesInProgress(size_t nbytes) {
+    SINVARIANT(nbytes > 0);
+    PThreadScopedLock lock(mutex);
+    max_bytes_in_progress = nbytes;
+    budget_cond.broadcast();
+}
+
+size_t SinkPool::getMaxBytesInProgress() {
+    PThreadScopedLock lock(mutex);
+    return max_bytes_in_progress;
+}
+
+SinkPool::SinkState &SinkPool::lockedState(DataSeriesSink *sink) {
+    SinkMap::iterator i = sinks.find(sink);
+    INVARIANT(i != sinks.end(), "sink is not attached to the SinkPool");
+    return i->second;
+}
+
+void SinkPool::addSink(DataSeriesSink *sink) {
+    PThreadScopedLock lock(mutex);
+    if (workers.empty()) {
+        lockedStartThreads();
+    }
+    INVARIANT(sinks.find(sink) == sinks.end(), "sink added to the SinkPool twice");
+    sinks[sink] = SinkState();
+}
+
+void SinkPool::removeSink(DataSeriesSink *sink) {
+    PThreadScopedLock lock(mutex);
+    SinkState &state(lockedState(sink));
+    state.removing = true;
+    // The sink has written everything, but a worker may not have returned yet.
+    while (state.running > 0) {
+        idle_cond.wait(mutex);
+    }
+    SINVARIANT(state.jobs == 0 && state.outstanding == 0);
+    if (last_sink == sink) {
+        last_sink = NULL;
+    }
+    sinks.erase(sink);
+}
+
+void SinkPool::queued(DataSeriesSink *sink, size_t nbytes) {
+    PThreadScopedLock lock(mutex);
+    SinkState &state(lockedState(sink));
+    SINVARIANT(!state.removing);
+    ++state.jobs;
+    ++state.outstanding;
+    bytes_in_progress += nbytes;
+    work_cond.signal();
+}
+
+void SinkPool::written(DataSeriesSink *sink, size_t nextents, size_t nbytes) {
+    PThreadScopedLock lock(mutex);
+    SinkState &state(lockedState(sink));
+    SINVARIANT(state.outstanding >= nextents && bytes_in_progress >= nbytes);
+    state.outstanding -= nextents;
+    bytes_in_progress -= nbytes;
+    budget_cond.broadcast();
+}
+
+void SinkPool::waitToQueue(DataSeriesSink *sink) {
+    PThreadScopedLock lock(mutex);
+    SinkState &state(lockedState(sink));
+    while (state.outstanding > 0 && (state.outstanding >= 2 * workers.size()
+                                     || bytes_in_progress >= max_bytes_in_progress)) {
+        LintelLogDebug("SinkPool", format("waiting to queue: %d outstanding, %d >= %d bytes")
+                       % state.outstanding % bytes_in_progress % max_bytes_in_progress);
+        budget_cond.wait(mutex);
+    }
+}
+
+// Round-robin over the sinks with jobs, starting after the last one served.
+SinkPool::SinkMap::iterator SinkPool::lockedNextSink() {
+    SinkMap::iterator start = last_sink == NULL ? sinks.begin() : sinks.upper_bound(last_sink);
+    for (SinkMap::iterator i = start; i != sinks.end(); ++i) {
+        if (i->second.jobs > 0) {
+            return i;
+        }
+    }
+    for (SinkMap::iterator i = sinks.begin(); i != start; ++i) {
+        if (i->second.jobs > 0) {
+            return i;
+        }
+    }
+    return sinks.end();
+}
+
+void SinkPool::workerThread() {
+    PThreadScopedLock lock(mutex);
+    while (true) {
+        SinkMap::iterator i = lockedNextSink();
+        if (i == sinks.end()) {
+            work_cond.wait(mutex);
+            continue;
+        }
+        DataSeriesSink *sink = i->first;
+        SinkState &state(i->second); // stays valid until running drops to 0
+        --state.jobs;
+        ++state.running;
+        last_sink = sink;
+        {
+            PThreadScopedUnlock unlock(lock);
+            sink->packAndWriteOne();
+        }
+        --state.running;
+        if (state.running == 0 && state.removing) {
+            idle_cond.broadcast();
+        }
+    }
+}
+
+}
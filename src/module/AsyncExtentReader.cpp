@@ -0,0 +1,261 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <errno.h>
+#include <unistd.h>
+
+#if DATASERIES_ENABLE_URING
+#include <sys/eventfd.h>
+#include <liburing.h>
+#endif
+
+#include <Lintel/LintelLog.hpp>
+#include <Lintel/StringUtil.hpp>
+
+#include <DataSeries/AsyncExtentReader.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+class AsyncExtentReaderThread : public PThread {
+  public:
+    AsyncExtentReaderThread(AsyncExtentReader &reader, bool uring)
+        : reader(reader), uring(uring) {
+        setStackSize(256*1024); // shouldn't need much
+    }
+
+    virtual ~AsyncExtentReaderThread() { }
+
+    virtual void *run() {
+#if DATASERIES_ENABLE_URING
+        if (uring) {
+            reader.uringThread();
+            return NULL;
+        }
+#endif
+        reader.preadThread();
+        return NULL;
+    }
+    AsyncExtentReader &reader;
+    bool uring;
+};
+
+AsyncExtentReader &AsyncExtentReader::instance() {
+    // Deliberately never deleted, see UnpackPool::instance()
+    static AsyncExtentReader *reader = new AsyncExtentReader();
+    return *reader;
+}
+
+AsyncExtentReader::AsyncExtentReader()
+    : mutex(), pending_cond(), pending(), queue_depth(0), started(false), threads(),
+      uring(NULL)
+{
+    const char *depth = getenv("DATASERIES_READ_QUEUE_DEPTH");
+    if (depth != NULL) {
+        queue_depth = stringToInteger<uint32_t>(depth);
+    }
+}
+
+AsyncExtentReader::~AsyncExtentReader() {
+    FATAL_ERROR("AsyncExtentReader should never be destroyed");
+}
+
+void AsyncExtentReader::setQueueDepth(unsigned depth) {
+    PThreadScopedLock lock(mutex);
+    if (!started) {
+        queue_depth = depth;
+    }
+}
+
+void AsyncExtentReader::lockedStart() {
+    INVARIANT(queue_depth > 0, "submit() with asynchronous reads disabled");
+    started = true;
+    if (lockedStartUring()) {
+        threads.push_back(new AsyncExtentReaderThread(*this, true));
+    } else {
+        for (unsigned i = 0; i < queue_depth; ++i) {
+            threads.push_back(new AsyncExtentReaderThread(*this, false));
+        }
+    }
+    for (vector<PThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        (**i).start();
+    }
+    LintelLogDebug("AsyncExtentReader", format("queue depth %d using %s")
+                   % queue_depth % (uring == NULL ? "pread threads" : "io_uring"));
+}
+
+void AsyncExtentReader::preadThread() {
+    while (true) {
+        Request request;
+        {
+            PThreadScopedLock lock(mutex);
+            while (pending.empty()) {
+                pending_cond.wait(mutex);
+            }
+            request = pending.front();
+            pending.pop_front();
+        }
+        off64_t offset = request.offset;
+        bool ok = Extent::preadExtent(request.file->fd, offset, *request.into,
+                                      request.need_bitflip);
+        INVARIANT(ok, format("asynchronous read at %d hit the end of the file")
+                  % request.offset);
+        request.done();
+    }
+}
+
+#if DATASERIES_ENABLE_URING
+
+// The first read of each extent guesses at its size so that most extents
+// only need one read; the prefix tells us how much more to read.
+static const size_t initial_read_size = 64 * 1024;
+
+struct AsyncExtentReader::Uring {
+    struct io_uring ring;
+    int event_fd; // submit() writes here to wake up the uring thread
+    uint64_t event_buf;
+    unsigned in_flight;
+};
+
+struct AsyncExtentReader::Op {
+    explicit Op(const Request &request)
+        : request(request), have(0), want(initial_read_size), size_known(false) { }
+    Request request;
+    size_t have, want;
+    bool size_known;
+};
+
+bool AsyncExtentReader::lockedStartUring() {
+    Uring *tmp = new Uring();
+    // + 1 for the eventfd read that is always outstanding
+    int ret = io_uring_queue_init(queue_depth + 1, &tmp->ring, 0);
+    if (ret < 0) {
+        LintelLogDebug("AsyncExtentReader", format("io_uring unavailable (%s), using pread")
+                       % strerror(-ret));
+        delete tmp;
+        return false;
+    }
+    tmp->event_fd = eventfd(0, 0);
+    INVARIANT(tmp->event_fd >= 0, format("eventfd failed: %s") % strerror(errno));
+    tmp->in_flight = 0;
+    uring = tmp;
+    return true;
+}
+
+void AsyncExtentReader::uringSubmitRead(Op *op) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    SINVARIANT(sqe != NULL); // at most one sqe per op, and queue_depth ops
+    io_uring_prep_read(sqe, op->request.file->fd, op->request.into->begin() + op->have,
+                       op->want - op->have, op->request.offset + op->have);
+    io_uring_sqe_set_data(sqe, op);
+}
+
+bool AsyncExtentReader::uringAdvance(Op *op, int result) {
+    INVARIANT(result >= 0, format("asynchronous read at %d failed: %s")
+              % op->request.offset % strerror(-result));
+    Extent::ByteArray &into(*op->request.into);
+    op->have += result;
+    if (!op->size_known && op->have >= static_cast<size_t>(Extent::packed_prefix_size)) {
+        uint64_t size = Extent::packedExtentSize(into.begin(), op->request.need_bitflip);
+        INVARIANT(size > 0, format("asynchronous read at %d hit the end of the file")
+                  % op->request.offset);
+        op->size_known = true;
+        op->want = size;
+        if (op->have < op->want) {
+            into.resize(op->want, false);
+        }
+    }
+    if (op->size_known && op->have >= op->want) {
+        into.resize(op->want);
+        return true;
+    }
+    INVARIANT(result > 0, format("partial read %d of %d bytes at %d")
+              % op->have % op->want % op->request.offset);
+    uringSubmitRead(op);
+    return false;
+}
+
+void AsyncExtentReader::uringThread() {
+    bool need_event_read = true;
+    while (true) {
+        if (need_event_read) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+            SINVARIANT(sqe != NULL);
+            io_uring_prep_read(sqe, uring->event_fd, &uring->event_buf,
+                               sizeof(uring->event_buf), 0);
+            io_uring_sqe_set_data(sqe, NULL);
+            need_event_read = false;
+        }
+        {
+            PThreadScopedLock lock(mutex);
+            while (uring->in_flight < queue_depth && !pending.empty()) {
+                Op *op = new Op(pending.front());
+                pending.pop_front();
+                ++uring->in_flight;
+                op->request.into->resize(op->want, false);
+                uringSubmitRead(op);
+            }
+        }
+        int ret = io_uring_submit(&uring->ring);
+        INVARIANT(ret >= 0, format("io_uring_submit failed: %s") % strerror(-ret));
+
+        struct io_uring_cqe *cqe;
+        ret = io_uring_wait_cqe(&uring->ring, &cqe);
+        if (ret == -EINTR) {
+            continue;
+        }
+        INVARIANT(ret == 0, format("io_uring_wait_cqe failed: %s") % strerror(-ret));
+        Op *op = static_cast<Op *>(io_uring_cqe_get_data(cqe));
+        int result = cqe->res;
+        io_uring_cqe_seen(&uring->ring, cqe);
+
+        if (op == NULL) {
+            INVARIANT(result == static_cast<int>(sizeof(uring->event_buf)),
+                      format("eventfd read failed: %s") % strerror(-result));
+            need_event_read = true;
+        } else if (uringAdvance(op, result)) {
+            op->request.done();
+            delete op;
+            PThreadScopedLock lock(mutex);
+            --uring->in_flight;
+        }
+    }
+}
+
+#else
+
+bool AsyncExtentReader::lockedStartUring() {
+    return false;
+}
+
+#endif
+
+void AsyncExtentReader::submit(const Request &request) {
+    SINVARIANT(request.file != NULL && request.into != NULL);
+    PThreadScopedLock lock(mutex);
+    if (!started) {
+        lockedStart();
+    }
+    pending.push_back(request);
+#if DATASERIES_ENABLE_URING
+    if (uring != NULL) {
+        uint64_t one = 1;
+        ssize_t ret = write(uring->event_fd, &one, sizeof(one));
+        INVARIANT(ret == sizeof(one), format("eventfd write failed: %s") % strerror(errno));
+        return;
+    }
+#endif
+    pending_cond.signal();
+}
+
+}
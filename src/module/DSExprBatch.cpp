@@ -0,0 +1,631 @@
+/* -*- C++ -*-
+   (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+   See the file named COPYING for license details
+*/
+
+/** @file
+    Batch evaluation of DSExpr over whole extents
+*/
+
+#include <string.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <DataSeries/BoolField.hpp>
+#include <DataSeries/ByteField.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/Variable32Field.hpp>
+
+#include "DSExprImpl.hpp"
+
+using namespace std;
+using boost::scoped_ptr;
+
+//////////////////////////////////////////////////////////////////////
+
+// The defaults evaluate the DSExpr row by row; only the rows in the batch are evaluated so that
+// && and || keep their short circuit behavior.
+
+void DSExprImpl::Kernel::evalDouble(const Batch &batch, double *out) {
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        batch.position(i);
+        out[i] = expr->valDouble();
+    }
+}
+
+void DSExprImpl::Kernel::evalInt64(const Batch &batch, int64_t *out) {
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        batch.position(i);
+        out[i] = expr->valInt64();
+    }
+}
+
+void DSExprImpl::Kernel::evalBool(const Batch &batch, uint8_t *out) {
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        batch.position(i);
+        out[i] = expr->valBool() ? 1 : 0;
+    }
+}
+
+void DSExprImpl::Kernel::evalString(const Batch &batch, StringRef *out) {
+    string_storage.resize(batch.nrows);
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        batch.position(i);
+        string_storage[i] = expr->valString();
+    }
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        out[i].data = reinterpret_cast<const uint8_t *>(string_storage[i].data());
+        out[i].size = string_storage[i].size();
+    }
+}
+
+void DSExprImpl::Kernel::evalNull(const Batch &batch, uint8_t *out) {
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        batch.position(i);
+        out[i] = expr->isNull() ? 1 : 0;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+    using namespace DSExprImpl;
+
+    template<typename T> T *scratch(vector<T> &v, size_t n) {
+        if (v.size() < n) {
+            v.resize(n);
+        }
+        return &v[0];
+    }
+
+    class NumericConstantKernel : public Kernel {
+      public:
+        NumericConstantKernel(ExprNumericConstant *expr)
+            : Kernel(expr), val(expr->valDouble()) { }
+
+        virtual void evalDouble(const Batch &batch, double *out) {
+            fill(out, out + batch.nrows, val);
+        }
+        virtual void evalInt64(const Batch &batch, int64_t *out) {
+            fill(out, out + batch.nrows, static_cast<int64_t>(val));
+        }
+        virtual void evalBool(const Batch &batch, uint8_t *out) {
+            fill(out, out + batch.nrows, val ? 1 : 0);
+        }
+        virtual void evalNull(const Batch &batch, uint8_t *out) {
+            fill(out, out + batch.nrows, 0);
+        }
+
+      private:
+        const double val;
+    };
+
+    class StrLiteralKernel : public Kernel {
+      public:
+        StrLiteralKernel(ExprStrLiteral *expr) : Kernel(expr), val(expr->valString()) { }
+
+        virtual void evalString(const Batch &batch, StringRef *out) {
+            StringRef ref;
+            ref.data = reinterpret_cast<const uint8_t *>(val.data());
+            ref.size = val.size();
+            fill(out, out + batch.nrows, ref);
+        }
+        virtual void evalNull(const Batch &batch, uint8_t *out) {
+            fill(out, out + batch.nrows, 0);
+        }
+
+      private:
+        const string val;
+    };
+
+    /// Conversions match ExprField, i.e. GeneralField::valDouble and GeneralValue::valInt64 and
+    /// valBool; a null reads as the default of 0 in all three.
+    template<typename FieldT> class FixedFieldKernel : public Kernel {
+      public:
+        FixedFieldKernel(ExprField *expr, int flags)
+            : Kernel(expr), field(expr->getSeries(), expr->getFieldName(), flags) { }
+
+        virtual void evalDouble(const Batch &batch, double *out) {
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = static_cast<double>(field.val(*batch.extent, batch.rowOffset(i)));
+            }
+        }
+        virtual void evalInt64(const Batch &batch, int64_t *out) {
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = static_cast<int64_t>(field.val(*batch.extent, batch.rowOffset(i)));
+            }
+        }
+        virtual void evalBool(const Batch &batch, uint8_t *out) {
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = field.val(*batch.extent, batch.rowOffset(i)) ? 1 : 0;
+            }
+        }
+        virtual void evalNull(const Batch &batch, uint8_t *out) {
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = field.isNull(*batch.extent, batch.rowOffset(i)) ? 1 : 0;
+            }
+        }
+
+      private:
+        FieldT field;
+    };
+
+    class Variable32FieldKernel : public Kernel {
+      public:
+        Variable32FieldKernel(ExprField *expr)
+            : Kernel(expr), field(expr->getSeries(), expr->getFieldName(), Field::flag_nullable)
+        { }
+
+        // A null field has the default value of ""; GeneralValue also converts null to "".
+        virtual void evalString(const Batch &batch, StringRef *out) {
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                dataseries::SEP_RowOffset offset(batch.rowOffset(i));
+                out[i].data = field.val(*batch.extent, offset);
+                out[i].size = field.size(*batch.extent, offset);
+            }
+        }
+        virtual void evalNull(const Batch &batch, uint8_t *out) {
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = field.isNull(*batch.extent, batch.rowOffset(i)) ? 1 : 0;
+            }
+        }
+
+      private:
+        Variable32Field field;
+    };
+
+    class UnaryKernel : public Kernel {
+      public:
+        UnaryKernel(DSExpr *expr, Kernel *sub) : Kernel(expr), sub(sub) { }
+
+        virtual void evalNull(const Batch &batch, uint8_t *out) {
+            sub->evalNull(batch, out);
+        }
+
+      protected:
+        scoped_ptr<Kernel> sub;
+    };
+
+    class MinusKernel : public UnaryKernel {
+      public:
+        MinusKernel(DSExpr *expr, Kernel *sub) : UnaryKernel(expr, sub) { }
+
+        virtual void evalDouble(const Batch &batch, double *out) {
+            sub->evalDouble(batch, out);
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = -out[i];
+            }
+        }
+        virtual void evalInt64(const Batch &batch, int64_t *out) {
+            sub->evalInt64(batch, out);
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = -out[i];
+            }
+        }
+    };
+
+    class LnotKernel : public UnaryKernel {
+      public:
+        LnotKernel(DSExpr *expr, Kernel *sub) : UnaryKernel(expr, sub) { }
+
+        virtual void evalBool(const Batch &batch, uint8_t *out) {
+            sub->evalBool(batch, out);
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = !out[i];
+            }
+        }
+    };
+
+    class TfracToSecondsKernel : public UnaryKernel {
+      public:
+        TfracToSecondsKernel(DSExpr *expr, Kernel *sub) : UnaryKernel(expr, sub) { }
+
+        virtual void evalDouble(const Batch &batch, double *out) {
+            int64_t *tfrac = scratch(tmp, batch.nrows);
+            sub->evalInt64(batch, tfrac);
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = tfrac[i] / 4294967296.0;
+            }
+        }
+
+      private:
+        vector<int64_t> tmp;
+    };
+
+    class BinaryKernel : public Kernel {
+      public:
+        BinaryKernel(DSExpr *expr, Kernel *left, Kernel *right)
+            : Kernel(expr), left(left), right(right) { }
+
+        virtual void evalNull(const Batch &batch, uint8_t *out) {
+            left->evalNull(batch, out);
+            uint8_t *right_null = scratch(tmp_null, batch.nrows);
+            right->evalNull(batch, right_null);
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] |= right_null[i];
+            }
+        }
+
+      protected:
+        scoped_ptr<Kernel> left, right;
+        vector<uint8_t> tmp_null;
+    };
+
+    struct AddOp {
+        template<typename T> static T apply(T a, T b) { return a + b; }
+    };
+    struct SubtractOp {
+        template<typename T> static T apply(T a, T b) { return a - b; }
+    };
+    struct MultiplyOp {
+        template<typename T> static T apply(T a, T b) { return a * b; }
+    };
+    struct DivideOp {
+        template<typename T> static T apply(T a, T b) { return a / b; }
+    };
+
+    template<typename Op> class ArithmeticKernel : public BinaryKernel {
+      public:
+        ArithmeticKernel(DSExpr *expr, Kernel *left, Kernel *right)
+            : BinaryKernel(expr, left, right) { }
+
+        virtual void evalDouble(const Batch &batch, double *out) {
+            apply(batch, out, tmp_double);
+        }
+        virtual void evalInt64(const Batch &batch, int64_t *out) {
+            apply(batch, out, tmp_int64);
+        }
+
+      private:
+        void eval(Kernel &k, const Batch &batch, double *out) { k.evalDouble(batch, out); }
+        void eval(Kernel &k, const Batch &batch, int64_t *out) { k.evalInt64(batch, out); }
+
+        template<typename T> void apply(const Batch &batch, T *out, vector<T> &tmp) {
+            T *right_val = scratch(tmp, batch.nrows);
+            eval(*left, batch, out);
+            eval(*right, batch, right_val);
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                out[i] = Op::apply(out[i], right_val[i]);
+            }
+        }
+
+        vector<double> tmp_double;
+        vector<int64_t> tmp_int64;
+    };
+
+    // Numeric comparisons go through double with the Double:: tolerances, and string
+    // comparisons order the bytes the same way as std::string.
+    struct EqOp {
+        static bool doubles(double a, double b) { return Double::eq(a, b); }
+        static bool strings(int cmp) { return cmp == 0; }
+    };
+    struct NeqOp {
+        static bool doubles(double a, double b) { return !Double::eq(a, b); }
+        static bool strings(int cmp) { return cmp != 0; }
+    };
+    struct GtOp {
+        static bool doubles(double a, double b) { return Double::gt(a, b); }
+        static bool strings(int cmp) { return cmp > 0; }
+    };
+    struct LtOp {
+        static bool doubles(double a, double b) { return Double::lt(a, b); }
+        static bool strings(int cmp) { return cmp < 0; }
+    };
+    struct GeqOp {
+        static bool doubles(double a, double b) { return Double::geq(a, b); }
+        static bool strings(int cmp) { return cmp >= 0; }
+    };
+    struct LeqOp {
+        static bool doubles(double a, double b) { return Double::leq(a, b); }
+        static bool strings(int cmp) { return cmp <= 0; }
+    };
+
+    int compareStrings(const StringRef &a, const StringRef &b) {
+        int32_t common = min(a.size, b.size);
+        int cmp = common == 0 ? 0 : memcmp(a.data, b.data, common);
+        if (cmp != 0) {
+            return cmp;
+        }
+        return a.size < b.size ? -1 : (a.size > b.size ? 1 : 0);
+    }
+
+    template<typename Op> class CompareKernel : public BinaryKernel {
+      public:
+        CompareKernel(ExprBinary *expr, Kernel *left, Kernel *right)
+            : BinaryKernel(expr, left, right), either_string(expr->either_string()) { }
+
+        virtual void evalBool(const Batch &batch, uint8_t *out) {
+            if (either_string) {
+                StringRef *left_val = scratch(tmp_left_string, batch.nrows);
+                StringRef *right_val = scratch(tmp_right_string, batch.nrows);
+                left->evalString(batch, left_val);
+                right->evalString(batch, right_val);
+                for (size_t i = 0; i < batch.nrows; ++i) {
+                    out[i] = Op::strings(compareStrings(left_val[i], right_val[i])) ? 1 : 0;
+                }
+            } else {
+                double *left_val = scratch(tmp_left_double, batch.nrows);
+                double *right_val = scratch(tmp_right_double, batch.nrows);
+                left->evalDouble(batch, left_val);
+                right->evalDouble(batch, right_val);
+                for (size_t i = 0; i < batch.nrows; ++i) {
+                    out[i] = Op::doubles(left_val[i], right_val[i]) ? 1 : 0;
+                }
+            }
+        }
+
+      private:
+        const bool either_string;
+        vector<StringRef> tmp_left_string, tmp_right_string;
+        vector<double> tmp_left_double, tmp_right_double;
+    };
+
+    /// && and ||; the right side is only evaluated on the rows where the left side does not
+    /// decide the answer, just as in row by row evaluation.
+    class LogicalKernel : public BinaryKernel {
+      public:
+        LogicalKernel(DSExpr *expr, Kernel *left, Kernel *right, bool is_and)
+            : BinaryKernel(expr, left, right), is_and(is_and) { }
+
+        virtual void evalBool(const Batch &batch, uint8_t *out) {
+            left->evalBool(batch, out);
+            const uint8_t need_right = is_and ? 1 : 0;
+            right_rows.clear();
+            right_index.clear();
+            for (size_t i = 0; i < batch.nrows; ++i) {
+                if (out[i] == need_right) {
+                    right_rows.push_back(batch.rows[i]);
+                    right_index.push_back(i);
+                }
+            }
+            if (right_rows.empty()) {
+                return;
+            }
+            Batch sub(batch);
+            sub.rows = &right_rows[0];
+            sub.nrows = right_rows.size();
+            uint8_t *right_val = scratch(tmp_bool, sub.nrows);
+            right->evalBool(sub, right_val);
+            for (size_t i = 0; i < sub.nrows; ++i) {
+                out[right_index[i]] = right_val[i];
+            }
+        }
+
+      private:
+        const bool is_and;
+        vector<uint32_t> right_rows, right_index;
+        vector<uint8_t> tmp_bool;
+    };
+
+    Kernel *compileKernel(DSExpr *expr, ExtentSeries &series, bool &same_series);
+
+    Kernel *compileField(ExprField *field, ExtentSeries &series, bool &same_series) {
+        if (&field->getSeries() != &series) {
+            same_series = false;
+            return new Kernel(field);
+        }
+        switch (field->getFieldType())
+            {
+            case ExtentType::ft_bool:
+                return new FixedFieldKernel<BoolField>(field, Field::flag_nullable);
+            case ExtentType::ft_byte:
+                return new FixedFieldKernel<ByteField>(field, Field::flag_nullable);
+            case ExtentType::ft_int32:
+                return new FixedFieldKernel<Int32Field>(field, Field::flag_nullable);
+            case ExtentType::ft_int64:
+                return new FixedFieldKernel<Int64Field>(field, Field::flag_nullable);
+            case ExtentType::ft_double: // same flags as GF_Double
+                return new FixedFieldKernel<DoubleField>
+                    (field, DoubleField::flag_nullable | DoubleField::flag_allownonzerobase);
+            case ExtentType::ft_variable32:
+                return new Variable32FieldKernel(field);
+            default:
+                return new Kernel(field); // e.g. fixedwidth, errors out as with row by row
+            }
+    }
+
+    template<typename K> Kernel *compileUnary(ExprUnary *expr, ExtentSeries &series,
+                                              bool &same_series) {
+        return new K(expr, compileKernel(expr->getSubexpr(), series, same_series));
+    }
+
+    template<typename Op> Kernel *compileArithmetic(ExprBinary *expr, ExtentSeries &series,
+                                                    bool &same_series) {
+        return new ArithmeticKernel<Op>(expr, compileKernel(expr->getLeft(), series, same_series),
+                                        compileKernel(expr->getRight(), series, same_series));
+    }
+
+    template<typename Op> Kernel *compileCompare(ExprBinary *expr, ExtentSeries &series,
+                                                 bool &same_series) {
+        return new CompareKernel<Op>(expr, compileKernel(expr->getLeft(), series, same_series),
+                                     compileKernel(expr->getRight(), series, same_series));
+    }
+
+    Kernel *compileLogical(ExprBinary *expr, ExtentSeries &series, bool &same_series,
+                           bool is_and) {
+        return new LogicalKernel(expr, compileKernel(expr->getLeft(), series, same_series),
+                                 compileKernel(expr->getRight(), series, same_series), is_and);
+    }
+
+    Kernel *compileKernel(DSExpr *expr, ExtentSeries &series, bool &same_series) {
+        if (ExprNumericConstant *e = dynamic_cast<ExprNumericConstant *>(expr)) {
+            return new NumericConstantKernel(e);
+        } else if (ExprStrLiteral *e = dynamic_cast<ExprStrLiteral *>(expr)) {
+            return new StrLiteralKernel(e);
+        } else if (ExprField *e = dynamic_cast<ExprField *>(expr)) {
+            return compileField(e, series, same_series);
+        } else if (ExprMinus *e = dynamic_cast<ExprMinus *>(expr)) {
+            return compileUnary<MinusKernel>(e, series, same_series);
+        } else if (ExprLnot *e = dynamic_cast<ExprLnot *>(expr)) {
+            return compileUnary<LnotKernel>(e, series, same_series);
+        } else if (ExprFnTfracToSeconds *e = dynamic_cast<ExprFnTfracToSeconds *>(expr)) {
+            return compileUnary<TfracToSecondsKernel>(e, series, same_series);
+        } else if (ExprAdd *e = dynamic_cast<ExprAdd *>(expr)) {
+            return compileArithmetic<AddOp>(e, series, same_series);
+        } else if (ExprSubtract *e = dynamic_cast<ExprSubtract *>(expr)) {
+            return compileArithmetic<SubtractOp>(e, series, same_series);
+        } else if (ExprMultiply *e = dynamic_cast<ExprMultiply *>(expr)) {
+            return compileArithmetic<MultiplyOp>(e, series, same_series);
+        } else if (ExprDivide *e = dynamic_cast<ExprDivide *>(expr)) {
+            return compileArithmetic<DivideOp>(e, series, same_series);
+        } else if (ExprEq *e = dynamic_cast<ExprEq *>(expr)) {
+            return compileCompare<EqOp>(e, series, same_series);
+        } else if (ExprNeq *e = dynamic_cast<ExprNeq *>(expr)) {
+            return compileCompare<NeqOp>(e, series, same_series);
+        } else if (ExprGt *e = dynamic_cast<ExprGt *>(expr)) {
+            return compileCompare<GtOp>(e, series, same_series);
+        } else if (ExprLt *e = dynamic_cast<ExprLt *>(expr)) {
+            return compileCompare<LtOp>(e, series, same_series);
+        } else if (ExprGeq *e = dynamic_cast<ExprGeq *>(expr)) {
+            return compileCompare<GeqOp>(e, series, same_series);
+        } else if (ExprLeq *e = dynamic_cast<ExprLeq *>(expr)) {
+            return compileCompare<LeqOp>(e, series, same_series);
+        } else if (ExprLand *e = dynamic_cast<ExprLand *>(expr)) {
+            return compileLogical(e, series, same_series, true);
+        } else if (ExprLor *e = dynamic_cast<ExprLor *>(expr)) {
+            return compileLogical(e, series, same_series, false);
+        } else {
+            // function applications; evaluated row by row.
+            return new Kernel(expr);
+        }
+    }
+
+    /// Restores the series position, which the row by row fallbacks change.
+    class SavePosition {
+      public:
+        SavePosition(ExtentSeries &series) : series(series), pos(series.getCurPos()) { }
+        ~SavePosition() {
+            series.setCurPos(pos);
+        }
+      private:
+        ExtentSeries &series;
+        const void *pos;
+    };
+}
+
+//////////////////////////////////////////////////////////////////////
+
+DSExprBatch *DSExprBatch::compile(DSExpr *expr, ExtentSeries &series) {
+    INVARIANT(series.getTypePtr() != NULL, "series needs a type to compile an expression");
+    bool same_series = true;
+    Kernel *root = compileKernel(expr, series, same_series);
+    if (!same_series) {
+        delete root;
+        return NULL;
+    }
+    return new DSExprBatch(series, root);
+}
+
+DSExprBatch::DSExprBatch(ExtentSeries &series, Kernel *root)
+    : series(series), root(root), rows(), nonnull_rows(), selected()
+{ }
+
+DSExprBatch::~DSExprBatch() {
+    delete root;
+}
+
+void DSExprBatch::allRows() {
+    SINVARIANT(series.hasExtent());
+    size_t nrows = series.getExtentRef().nRecords();
+    // rows is always 0, 1, 2, ...; the batch uses the first nrows of it.
+    for (size_t i = rows.size(); i < nrows; ++i) {
+        rows.push_back(i);
+    }
+}
+
+namespace {
+    Batch makeBatch(ExtentSeries &series, const vector<uint32_t> &rows) {
+        Batch batch;
+        batch.series = &series;
+        batch.extent = &series.getExtentRef();
+        batch.record_size = batch.extent->getTypePtr()->fixedrecordsize();
+        batch.rows = rows.empty() ? NULL : &rows[0];
+        batch.nrows = series.getExtentRef().nRecords();
+        return batch;
+    }
+}
+
+void DSExprBatch::select(Selection &out) {
+    allRows();
+    out.clear();
+    Batch batch(makeBatch(series, rows));
+    if (batch.nrows == 0) {
+        return;
+    }
+    SavePosition save(series);
+    uint8_t *matches = scratch(selected, batch.nrows);
+    root->evalBool(batch, matches);
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        if (matches[i]) {
+            out.push_back(i);
+        }
+    }
+}
+
+template<typename T>
+void DSExprBatch::evalValues(vector<T> &out, const vector<uint8_t> *nulls,
+                             void (Kernel::*eval)(const Batch &, T *)) {
+    allRows();
+    Batch batch(makeBatch(series, rows));
+    out.resize(batch.nrows);
+    if (batch.nrows == 0) {
+        return;
+    }
+    SavePosition save(series);
+    if (nulls == NULL) {
+        (root->*eval)(batch, &out[0]);
+        return;
+    }
+    SINVARIANT(nulls->size() == batch.nrows);
+    nonnull_rows.clear();
+    for (size_t i = 0; i < batch.nrows; ++i) {
+        if (!(*nulls)[i]) {
+            nonnull_rows.push_back(i);
+        }
+    }
+    if (nonnull_rows.size() < batch.nrows) {
+        batch.rows = nonnull_rows.empty() ? NULL : &nonnull_rows[0];
+        batch.nrows = nonnull_rows.size();
+    }
+    if (batch.nrows > 0) {
+        (root->*eval)(batch, &out[0]);
+    }
+    if (batch.nrows == out.size()) {
+        return;
+    }
+    // Spread the values out to their rows; nonnull_rows[i] >= i, so working backwards never
+    // overwrites a value that hasn't been moved yet.
+    for (size_t i = batch.nrows; i > 0; --i) {
+        out[nonnull_rows[i - 1]] = out[i - 1];
+    }
+    for (size_t i = 0; i < out.size(); ++i) {
+        if ((*nulls)[i]) {
+            out[i] = 0;
+        }
+    }
+}
+
+void DSExprBatch::evalDouble(vector<double> &out, const vector<uint8_t> *nulls) {
+    evalValues(out, nulls, &Kernel::evalDouble);
+}
+
+void DSExprBatch::evalInt64(vector<int64_t> &out, const vector<uint8_t> *nulls) {
+    evalValues(out, nulls, &Kernel::evalInt64);
+}
+
+void DSExprBatch::evalBool(vector<uint8_t> &out, const vector<uint8_t> *nulls) {
+    evalValues(out, nulls, &Kernel::evalBool);
+}
+
+void DSExprBatch::evalNull(vector<uint8_t> &out) {
+    allRows();
+    Batch batch(makeBatch(series, rows));
+    out.resize(batch.nrows);
+    if (batch.nrows > 0) {
+        SavePosition save(series);
+        root->evalNull(batch, &out[0]);
+    }
+}
@@ -40,6 +40,7 @@ void DSExprImpl::ExprNumericConstant::dump(ostream &out) {
 //////////////////////////////////////////////////////////////////////
 
 DSExprImpl::ExprField::ExprField(ExtentSeries &series, const string &fieldname_)
+    : series(&series)
 { 
     // Allow for almost arbitrary fieldnames through escaping...
     if (fieldname_.find('\\', 0) != string::npos) {
@@ -169,6 +170,97 @@ DSExprImpl::ExprFunctionApplication::dump(ostream &out) {
 }
 
 
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+    using namespace DSExprImpl;
+
+    enum CompareOp { op_eq, op_lt, op_leq, op_gt, op_geq };
+
+    bool isConstant(DSExpr *expr) {
+        if (dynamic_cast<ExprNumericConstant *>(expr) != NULL
+            || dynamic_cast<ExprStrLiteral *>(expr) != NULL) {
+            return true;
+        }
+        ExprMinus *minus = dynamic_cast<ExprMinus *>(expr);
+        return minus != NULL && isConstant(minus->getSubexpr());
+    }
+
+    // Comparisons use Double::eq and friends, so widen the numeric bounds
+    // by epsilon; a slightly loose range only means less gets skipped.
+    bool fieldComparison(ExprBinary *compare, CompareOp op, DSExpr::FieldRange &range) {
+        ExprField *field = dynamic_cast<ExprField *>(compare->getLeft());
+        DSExpr *constant = compare->getRight();
+        if (field == NULL) {
+            field = dynamic_cast<ExprField *>(compare->getRight());
+            constant = compare->getLeft();
+            switch (op) {
+                case op_lt: op = op_gt; break;
+                case op_leq: op = op_geq; break;
+                case op_gt: op = op_lt; break;
+                case op_geq: op = op_leq; break;
+                default: break;
+            }
+        }
+        if (field == NULL || !isConstant(constant)) {
+            return false;
+        }
+        range.field_name = field->getFieldName();
+        range.is_string = field->getType() == DSExpr::t_String;
+        if (range.is_string != (constant->getType() == DSExpr::t_String)) {
+            return false; // would fail on evaluation anyway
+        }
+        range.min = -Double::Inf;
+        range.max = Double::Inf;
+        range.max_string_unbounded = false;
+        if (range.is_string) {
+            string v(constant->valString());
+            if (op == op_eq || op == op_gt || op == op_geq) {
+                range.min_string = v;
+            }
+            if (op == op_eq || op == op_lt || op == op_leq) {
+                range.max_string = v;
+            } else {
+                range.max_string_unbounded = true;
+            }
+        } else {
+            double v = constant->valDouble();
+            if (op == op_eq || op == op_gt || op == op_geq) {
+                range.min = v - Double::epsilon;
+            }
+            if (op == op_eq || op == op_lt || op == op_leq) {
+                range.max = v + Double::epsilon;
+            }
+        }
+        return true;
+    }
+}
+
+void DSExpr::conjunctiveRanges(DSExpr *expr, vector<FieldRange> &into) {
+    ExprLand *land = dynamic_cast<ExprLand *>(expr);
+    if (land != NULL) {
+        conjunctiveRanges(land->getLeft(), into);
+        conjunctiveRanges(land->getRight(), into);
+        return;
+    }
+    FieldRange range;
+    bool found = false;
+    if (dynamic_cast<ExprEq *>(expr) != NULL) {
+        found = fieldComparison(dynamic_cast<ExprBinary *>(expr), op_eq, range);
+    } else if (dynamic_cast<ExprLt *>(expr) != NULL) {
+        found = fieldComparison(dynamic_cast<ExprBinary *>(expr), op_lt, range);
+    } else if (dynamic_cast<ExprLeq *>(expr) != NULL) {
+        found = fieldComparison(dynamic_cast<ExprBinary *>(expr), op_leq, range);
+    } else if (dynamic_cast<ExprGt *>(expr) != NULL) {
+        found = fieldComparison(dynamic_cast<ExprBinary *>(expr), op_gt, range);
+    } else if (dynamic_cast<ExprGeq *>(expr) != NULL) {
+        found = fieldComparison(dynamic_cast<ExprBinary *>(expr), op_geq, range);
+    }
+    if (found) {
+        into.push_back(range);
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void
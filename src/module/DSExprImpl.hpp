@@ -81,9 +81,20 @@ namespace DSExprImpl {
 
         virtual void dump(ostream &out);
 
+        const string &getFieldName() const {
+            return fieldname;
+        }
+        ExtentSeries &getSeries() const {
+            return *series;
+        }
+        ExtentType::fieldType getFieldType() const {
+            return field->getType();
+        }
+
       private:
         GeneralField *field;
         string fieldname;
+        ExtentSeries *series;
     };
 
     class ExprStrLiteral : public DSExpr {
@@ -135,6 +146,10 @@ namespace DSExprImpl {
         virtual bool isNull() {
             return subexpr->isNull();
         }
+
+        DSExpr *getSubexpr() const {
+            return subexpr;
+        }
       protected:
         DSExpr *subexpr;
     };
@@ -163,6 +178,13 @@ namespace DSExprImpl {
         virtual bool isNull() {
             return left->isNull() || right->isNull();
         }
+
+        DSExpr *getLeft() const {
+            return left;
+        }
+        DSExpr *getRight() const {
+            return right;
+        }
       protected:
         DSExpr *left, *right;
     };
@@ -601,6 +623,49 @@ namespace DSExprImpl {
         DSExpr::List args;
     };
 
+    /// A string value during batch evaluation; points either into an extent or into storage
+    /// owned by the kernel that produced it, and is valid until that kernel is next evaluated.
+    struct StringRef {
+        const uint8_t *data;
+        int32_t size;
+    };
+
+    /// The rows being evaluated by a DSExprBatch.
+    struct Batch {
+        ExtentSeries *series;
+        const Extent *extent;
+        uint32_t record_size;
+        const uint32_t *rows;
+        size_t nrows;
+
+        dataseries::SEP_RowOffset rowOffset(size_t i) const {
+            return dataseries::SEP_RowOffset(rows[i] * record_size, extent);
+        }
+        /// Position series on row i so the DSExpr can be evaluated directly.
+        void position(size_t i) const {
+            series->setCurPos(extent->fixeddata.begin() + rows[i] * record_size);
+        }
+    };
+
+    /// One node of a compiled DSExprBatch.  Each eval function fills in out[0..nrows) for
+    /// batch.rows.  The default versions evaluate the original DSExpr row by row, so a kernel
+    /// only needs to override the cases it can specialize.
+    class Kernel : boost::noncopyable {
+      public:
+        Kernel(DSExpr *expr) : expr(expr) { }
+        virtual ~Kernel() { }
+
+        virtual void evalDouble(const Batch &batch, double *out);
+        virtual void evalInt64(const Batch &batch, int64_t *out);
+        virtual void evalBool(const Batch &batch, uint8_t *out);
+        virtual void evalString(const Batch &batch, StringRef *out);
+        virtual void evalNull(const Batch &batch, uint8_t *out);
+
+      protected:
+        DSExpr *expr;
+        vector<string> string_storage;
+    };
+
     class Driver {
       public:
         typedef DSExprParser::Selector Selector;
@@ -9,18 +9,325 @@
     implementation
 */
 
+#include <algorithm>
+#include <limits>
+
 #include <Lintel/AssertBoost.hpp>
+#include <Lintel/HashTable.hpp>
 #include <Lintel/StatsQuantile.hpp>
+#include <Lintel/StringUtil.hpp>
 
 #include <DataSeries/DSStatGroupByModule.hpp>
+#include <DataSeries/ExtentField.hpp>
 
 using namespace std;
 
 namespace {
     const string str_basic("basic");
     const string str_quantile("quantile");
+
+    /// One column of a group by key; appends a null marker byte and, if not
+    /// null, the value bytes, so keys are equal iff the bytes are.
+    class KeyColumn {
+      public:
+        KeyColumn(ExtentSeries &series, const string &name)
+            : type(series.getTypePtr()->getFieldType(name)), field(),
+              general(GeneralField::create(NULL, series, name))
+        {
+            switch (type) 
+                {
+                case ExtentType::ft_bool:
+                    field.reset(new BoolField(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_byte:
+                    field.reset(new ByteField(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_int32:
+                    field.reset(new Int32Field(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_int64:
+                    field.reset(new Int64Field(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_double: // same flags as GF_Double
+                    field.reset(new DoubleField(series, name, DoubleField::flag_nullable
+                                                | DoubleField::flag_allownonzerobase));
+                    break;
+                case ExtentType::ft_fixedwidth:
+                    field.reset(new FixedWidthField(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_variable32:
+                    field.reset(new Variable32Field(series, name, Field::flag_nullable)); break;
+                default:
+                    FATAL_ERROR(boost::format("unsupported type for group by column %s") % name);
+                }
+        }
+
+        ~KeyColumn() {
+            delete general;
+        }
+
+        void append(vector<uint8_t> &key) const {
+            if (field->isNull()) {
+                key.push_back(0);
+                return;
+            }
+            key.push_back(1);
+            switch (type) 
+                {
+                case ExtentType::ft_bool:
+                    key.push_back(static_cast<const BoolField &>(*field).val() ? 1 : 0);
+                    break;
+                case ExtentType::ft_byte:
+                    key.push_back(static_cast<const ByteField &>(*field).val());
+                    break;
+                case ExtentType::ft_int32:
+                    appendValue(key, static_cast<const Int32Field &>(*field).val());
+                    break;
+                case ExtentType::ft_int64:
+                    appendValue(key, static_cast<const Int64Field &>(*field).val());
+                    break;
+                case ExtentType::ft_double: {
+                    double v = static_cast<const DoubleField &>(*field).val();
+                    appendValue(key, v == 0 ? 0.0 : v); // -0 and 0 are one group
+                    break;
+                }
+                case ExtentType::ft_fixedwidth: {
+                    const FixedWidthField &f(static_cast<const FixedWidthField &>(*field));
+                    key.insert(key.end(), f.val(), f.val() + f.size());
+                    break;
+                }
+                case ExtentType::ft_variable32: {
+                    const Variable32Field &f(static_cast<const Variable32Field &>(*field));
+                    appendValue(key, f.size());
+                    key.insert(key.end(), f.val(), f.val() + f.size());
+                    break;
+                }
+                default:
+                    FATAL_ERROR("internal error, unexpected type");
+                }
+        }
+
+        const ExtentType::fieldType type;
+        boost::shared_ptr<Field> field;
+        GeneralField *general; // for the value printed for each group
+
+      private:
+        template<typename T> static void appendValue(vector<uint8_t> &key, T v) {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&v);
+            key.insert(key.end(), bytes, bytes + sizeof(T));
+        }
+    };
 }
 
+/// The groups and their statistics for one series
+class DSStatGroupByModule::Groups : boost::noncopyable {
+  public:
+    Groups(ExtentSeries &series, const string &expression, const vector<string> &groupby_names,
+           const string &stattype)
+        : series(series), expr(DSExpr::make(series, expression)), batch(NULL),
+          quantile(stattype == str_quantile), slots(16, none), stats_used(stats_chunk)
+    {
+        SINVARIANT(validStatType(stattype));
+        batch = DSExprBatch::compile(expr, series);
+        for (vector<string>::const_iterator i = groupby_names.begin();
+             i != groupby_names.end(); ++i) {
+            columns.push_back(new KeyColumn(series, *i));
+        }
+    }
+
+    ~Groups() {
+        for (vector<KeyColumn *>::iterator i = columns.begin(); i != columns.end(); ++i) {
+            delete *i;
+        }
+        if (quantile) {
+            for (vector<Group>::iterator i = groups.begin(); i != groups.end(); ++i) {
+                delete i->stat;
+            }
+        }
+        for (vector<Stats *>::iterator i = stats_chunks.begin(); i != stats_chunks.end(); ++i) {
+            delete [] *i;
+        }
+        delete batch;
+        delete expr;
+    }
+
+    /// add the current row of the series
+    void processRow() {
+        key.clear();
+        for (vector<KeyColumn *>::iterator i = columns.begin(); i != columns.end(); ++i) {
+            (**i).append(key);
+        }
+        uint32_t hash = hashKey(key.empty() ? NULL : &key[0], key.size());
+        bool added;
+        uint32_t group = findOrAdd(hash, key.empty() ? NULL : &key[0], key.size(), added);
+        if (added) {
+            for (vector<KeyColumn *>::iterator i = columns.begin(); i != columns.end(); ++i) {
+                keys.push_back(GeneralValue());
+                keys.back().set((**i).general);
+            }
+        }
+        groups[group].stat->add(value());
+    }
+
+    /// add all the groups in from, which must be for the same group by columns
+    void merge(Groups &from) {
+        SINVARIANT(from.columns.size() == columns.size() && from.quantile == quantile);
+        for (uint32_t i = 0; i < from.groups.size(); ++i) {
+            const Group &g(from.groups[i]);
+            bool added;
+            uint32_t group = findOrAdd(g.hash, from.keyBytes(g), g.key_size, added);
+            if (added) {
+                keys.insert(keys.end(), from.keys.begin() + i * columns.size(),
+                            from.keys.begin() + (i + 1) * columns.size());
+            }
+            groups[group].stat->add(*g.stat);
+        }
+    }
+
+    /// group numbers ordered by their key values
+    void sortedGroups(vector<uint32_t> &into) const {
+        into.clear();
+        for (uint32_t i = 0; i < groups.size(); ++i) {
+            into.push_back(i);
+        }
+        sort(into.begin(), into.end(), KeyLess(*this));
+    }
+
+    void printKey(ostream &to, uint32_t group) const {
+        for (size_t i = 0; i < columns.size(); ++i) {
+            if (i > 0) {
+                to << ", ";
+            }
+            to << keys[group * columns.size() + i];
+        }
+    }
+
+    Stats *stat(uint32_t group) const {
+        return groups[group].stat;
+    }
+
+  private:
+    static const uint32_t none = numeric_limits<uint32_t>::max();
+    static const uint32_t stats_chunk = 256;
+
+    struct Group {
+        uint32_t hash, key_offset, key_size;
+        Stats *stat;
+    };
+
+    struct KeyLess {
+        KeyLess(const Groups &groups) : groups(groups) { }
+        bool operator()(uint32_t a, uint32_t b) const {
+            size_t ncols = groups.columns.size();
+            return lexicographical_compare(groups.keys.begin() + a * ncols,
+                                           groups.keys.begin() + (a + 1) * ncols,
+                                           groups.keys.begin() + b * ncols,
+                                           groups.keys.begin() + (b + 1) * ncols);
+        }
+        const Groups &groups;
+    };
+
+    static uint32_t hashKey(const uint8_t *key, uint32_t key_size) {
+        return key_size == 0 ? 0 : lintel::hashBytes(key, key_size, 1972);
+    }
+
+    const uint8_t *keyBytes(const Group &g) const {
+        return g.key_size == 0 ? NULL : &key_arena[g.key_offset];
+    }
+
+    uint32_t findOrAdd(uint32_t hash, const uint8_t *key, uint32_t key_size, bool &added) {
+        size_t mask = slots.size() - 1;
+        size_t slot = hash & mask;
+        for (; slots[slot] != none; slot = (slot + 1) & mask) {
+            const Group &g(groups[slots[slot]]);
+            if (g.hash == hash && g.key_size == key_size
+                && memcmp(keyBytes(g), key, key_size) == 0) {
+                added = false;
+                return slots[slot];
+            }
+        }
+        added = true;
+        Group g;
+        g.hash = hash;
+        g.key_offset = key_arena.size();
+        g.key_size = key_size;
+        g.stat = newStat();
+        key_arena.insert(key_arena.end(), key, key + key_size);
+        slots[slot] = groups.size();
+        groups.push_back(g);
+        if (groups.size() * 2 > slots.size()) {
+            rehash();
+        }
+        return groups.size() - 1;
+    }
+
+    void rehash() {
+        slots.assign(slots.size() * 2, none);
+        size_t mask = slots.size() - 1;
+        for (uint32_t i = 0; i < groups.size(); ++i) {
+            size_t slot = groups[i].hash & mask;
+            while (slots[slot] != none) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = i;
+        }
+    }
+
+    Stats *newStat() {
+        if (quantile) {
+            return new StatsQuantile();
+        }
+        // basic statistics are allocated in chunks rather than one at a time
+        if (stats_used == stats_chunk) {
+            stats_chunks.push_back(new Stats[stats_chunk]);
+            stats_used = 0;
+        }
+        return stats_chunks.back() + stats_used++;
+    }
+
+    double value() {
+        if (batch == NULL) {
+            return expr->valDouble();
+        }
+        const Extent &e(series.getExtentRef());
+        if (&e != values_extent.get()) {
+            values_extent = series.getSharedExtent();
+            batch->evalDouble(values);
+        }
+        size_t row = (static_cast<const uint8_t *>(series.getCurPos()) - e.fixeddata.begin())
+            / e.getTypePtr()->fixedrecordsize();
+        return values[row];
+    }
+
+    ExtentSeries &series;
+    DSExpr *expr;
+    DSExprBatch *batch; // NULL if the expression can't be evaluated in batches
+    const bool quantile;
+    vector<KeyColumn *> columns;
+
+    vector<Group> groups;
+    vector<GeneralValue> keys; // columns.size() values for each group
+    vector<uint8_t> key_arena, key;
+    vector<uint32_t> slots; // group number, or none
+
+    vector<Stats *> stats_chunks;
+    uint32_t stats_used; // in the last chunk
+
+    // the values of the expression for every row of values_extent
+    Extent::Ptr values_extent;
+    vector<double> values;
+};
+
+const uint32_t DSStatGroupByModule::Groups::none;
+
+class DSStatGroupByModule::GroupState : public RowAnalysisModule::ThreadState {
+  public:
+    GroupState(ExtentSeries &series, const string &expression,
+               const vector<string> &groupby_names, const string &stattype)
+        : groups(series, expression, groupby_names, stattype) { }
+
+    virtual void processRow() {
+        groups.processRow();
+    }
+
+    Groups groups;
+};
+
 DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
                                          const string &_expression,
                                          const string &_groupby,
@@ -28,51 +335,42 @@ DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
                                          const string &where_expr,
                                          ExtentSeries::typeCompatibilityT tc)
         : RowAnalysisModule(source, tc), expression(_expression), 
-          groupby_name(_groupby), stattype(_stattype), groupby(NULL),
-          expr(NULL)
+          groupby_name(_groupby), stattype(_stattype), groups(NULL)
 {
     SINVARIANT(validStatType(stattype));
+    if (!groupby_name.empty()) {
+        split(groupby_name, ",", groupby_names);
+    }
     if (!where_expr.empty()) {
         setWhereExpr(where_expr);
     }
 }
 
 DSStatGroupByModule::~DSStatGroupByModule() {
-    delete expr;
-    expr = NULL;
-    delete groupby;
-    groupby = NULL;
+    delete groups;
+    groups = NULL;
 }
 
 void DSStatGroupByModule::prepareForProcessing() {
     // Have to do this here rather than constructor as we need the XML
-    // from the first extent in order to build the generalfields
+    // from the first extent in order to build the fields
 
-    expr = DSExpr::make(series, expression);
-    if (!groupby_name.empty()) {
-        groupby = GeneralField::create(NULL, series, groupby_name);
-    }
+    groups = new Groups(series, expression, groupby_names, stattype);
 }
 
 void DSStatGroupByModule::processRow() {
-    GeneralValue groupby_val;
-    if (groupby != NULL) {
-        groupby_val.set(groupby);
-    } else {
-        groupby_val.setInt32(1);
-    }
-    Stats *stat = mystats[groupby_val];
-    if (stat == NULL) {
-        if (stattype == str_basic) {
-            stat = new Stats();
-        } else if (stattype == str_quantile) {
-            stat = new StatsQuantile();
-        } else {
-            FATAL_ERROR(boost::format("unknown stattype %s") % stattype);
-        }
-        mystats[groupby_val] = stat;
+    groups->processRow();
+}
+
+RowAnalysisModule::ThreadState *DSStatGroupByModule::newThreadState(ExtentSeries &thread_series) {
+    if (stattype != str_basic) {
+        return NULL;
     }
-    stat->add(expr->valDouble());
+    return new GroupState(thread_series, expression, groupby_names, stattype);
+}
+
+void DSStatGroupByModule::mergeThreadState(ThreadState &state) {
+    groups->merge(dynamic_cast<GroupState &>(state).groups);
 }
 
 void DSStatGroupByModule::printResult() {
@@ -82,8 +380,10 @@ void DSStatGroupByModule::printResult() {
 
     // Someone might call printResult on an interim basis so we can't sort 
     // the underlying hashtable.
-    vector<GeneralValue> keys = mystats.keys();
-    sort(keys.begin(), keys.end());
+    vector<uint32_t> sorted;
+    if (groups != NULL) {
+        groups->sortedGroups(sorted);
+    }
 
     if (stattype == str_basic) {
         if (groupby_name.empty()) {
@@ -92,12 +392,12 @@ void DSStatGroupByModule::printResult() {
             cout << boost::format("# %s, count(*), mean(%s), stddev, min, max\n")
                     % groupby_name % expression;
         }
-        for (vector<GeneralValue>::iterator i = keys.begin(); i != keys.end(); ++i) {
-            GeneralValue &k(*i);
-            Stats *v = mystats[k];
+        for (vector<uint32_t>::iterator i = sorted.begin(); i != sorted.end(); ++i) {
+            Stats *v = groups->stat(*i);
 
             if (!groupby_name.empty()) {
-                cout << k << ", ";
+                groups->printKey(cout, *i);
+                cout << ", ";
             }
             cout << boost::format("%1%, %2$.6g, %3$.6g, %4$.6g, %5$.6g\n")
                     % v->count() % v->mean() % v->stddev() % v->min() % v->max();
@@ -108,11 +408,12 @@ void DSStatGroupByModule::printResult() {
         } else {
             cout << boost::format("# %s(%s) group by %s\n") % stattype % expression % groupby_name;
         }
-        for (vector<GeneralValue>::iterator i = keys.begin(); i != keys.end(); ++i) {
-            GeneralValue &k(*i);
-            Stats *v = mystats[k];
+        for (vector<uint32_t>::iterator i = sorted.begin(); i != sorted.end(); ++i) {
+            Stats *v = groups->stat(*i);
             if (!groupby_name.empty()) {
-                cout << boost::format("# group %1%\n") % k;
+                cout << "# group ";
+                groups->printKey(cout, *i);
+                cout << "\n";
             }
             v->printText(cout);
         }
@@ -298,7 +298,8 @@ Extent::Ptr DStoTextModule::getSharedExtent() {
         return e; // for now, never print these, that was previous behavior of ds2txt because the default source module skips the type extent at the beginning
     }
 
-    if (print_index == false && e->type->getName() == "DataSeries: ExtentIndex") {
+    if (print_index == false && (e->type->getName() == "DataSeries: ExtentIndex"
+                                 || e->type->getName() == "DataSeries: ExtentMinMax")) {
         return e;
     }
 
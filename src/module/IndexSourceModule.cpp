@@ -13,10 +13,14 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <boost/bind.hpp>
+
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/PThread.hpp>
 
+#include <DataSeries/AsyncExtentReader.hpp>
 #include <DataSeries/IndexSourceModule.hpp>
+#include <DataSeries/UnpackPool.hpp>
 
 using namespace std;
 using boost::format;
@@ -37,24 +41,8 @@ class IndexSourceModuleCompressedPrefetchThread : public PThread {
     IndexSourceModule &ism;
 };
 
-class IndexSourceModuleUnpackThread : public PThread {
-  public:
-    IndexSourceModuleUnpackThread(IndexSourceModule &_ism)
-    : ism(_ism) { 
-        setStackSize(256*1024); // shouldn't need much
-    }
-
-    virtual ~IndexSourceModuleUnpackThread() { }
-
-    virtual void *run() {
-        ism.unpackThread();
-        return NULL;
-    }
-    IndexSourceModule &ism;
-};
-
 IndexSourceModule::IndexSourceModule()
-        : getting_extent(false), prefetch(NULL)
+        : getting_extent(false), needed_fields(), lazy_unpack(false), prefetch(NULL)
 {
 }
 
@@ -65,6 +53,16 @@ IndexSourceModule::~IndexSourceModule() {
     prefetch = NULL;
 }
 
+void IndexSourceModule::setNeededFields(const ExtentSeries &series) {
+    INVARIANT(prefetch == NULL, "must set the needed fields before prefetching starts");
+    needed_fields = series.getFieldNames();
+}
+
+void IndexSourceModule::setLazyUnpack(bool lazy) {
+    INVARIANT(prefetch == NULL, "must set lazy unpacking before prefetching starts");
+    lazy_unpack = lazy;
+}
+
 void
 IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
                                     unsigned prefetch_max_unpacked,
@@ -74,23 +72,20 @@ IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
     SINVARIANT(prefetch_max_compressed > 0);
     SINVARIANT(prefetch_max_unpacked > 0);
 
-    PrefetchInfo *tmp = new PrefetchInfo(prefetch_max_compressed,
-                                         prefetch_max_unpacked);
-    tmp->mutex.lock();
-    prefetch = tmp;
-
-    unsigned unpack_count;
-    if (n_unpack_threads == -1) {
-        unpack_count = min(PThreadMisc::getNCpus(), MAX_THREADS/2);
-    } else {
+    dataseries::UnpackPool &pool(dataseries::UnpackPool::instance());
+    pool.raiseCompressedBudget(prefetch_max_compressed);
+    if (n_unpack_threads != -1) {
         // TODO: Add support (and test) for 0 unpack threads which should
         // disable all of the prefetching.
         SINVARIANT(n_unpack_threads > 0);
-        unpack_count = static_cast<unsigned>(n_unpack_threads);
+        pool.setThreadCount(n_unpack_threads); // ignored if the pool is running
     } 
 
-    INVARIANT(unpack_count > 0, "?");
-    tmp->unpack_threads.resize(unpack_count);
+    PrefetchInfo *tmp = new PrefetchInfo(prefetch_max_compressed,
+                                         prefetch_max_unpacked);
+    tmp->mutex.lock();
+    prefetch = tmp;
+
     INVARIANT(prefetch == tmp, "two simulataneous calls to startPrefetching??");
     lockedStartThreads();
     tmp->mutex.unlock();
@@ -101,10 +96,6 @@ void IndexSourceModule::lockedStartThreads() {
     prefetch->compressed_prefetch_thread = 
             new IndexSourceModuleCompressedPrefetchThread(*this);
     prefetch->compressed_prefetch_thread->start();
-    for (unsigned i = 0; i < prefetch->unpack_threads.size(); ++i) {
-        prefetch->unpack_threads[i] = new IndexSourceModuleUnpackThread(*this);
-        prefetch->unpack_threads[i]->start();
-    }
 }
 
 static inline double 
@@ -125,7 +116,6 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     while (!prefetch->allDone() &&
           !prefetch->unpackedReady()) {
         ++prefetch->stats.consumer;
-        prefetch->unpack_cond.broadcast();
         prefetch->ready_cond.wait(prefetch->mutex);
     }
     if (prefetch->allDone()) {
@@ -139,12 +129,7 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     PrefetchExtent *buf = prefetch->unpacked.getFront();
     SINVARIANT(buf->bytes.empty() && buf->unpacked != NULL);
     prefetch->unpacked.subtract(buf->unpacked->size());
-    if (!prefetch->compressed.empty() &&
-        prefetch->unpacked.can_add(prefetch->compressed.front())) {
-        prefetch->unpack_cond.signal();
-    } else {
-        ++prefetch->stats.skip_unpack_signal;
-    }
+    lockedSubmitUnpacks();
     prefetch->mutex.unlock();
 
     Extent::Ptr ret = buf->unpacked;
@@ -180,11 +165,12 @@ void IndexSourceModule::close() {
         return;
     }
     if (prefetch->abort_prefetching == 0) {
-        //                          me + compressed_prefetch + unpackers
-        prefetch->abort_prefetching = 2 + prefetch->unpack_threads.size();
+        dataseries::UnpackPool &pool(dataseries::UnpackPool::instance());
+        //                          me + compressed_prefetch
+        prefetch->abort_prefetching = 2;
         prefetch->compressed_cond.broadcast();
-        prefetch->unpack_cond.broadcast();
         prefetch->ready_cond.broadcast();
+        pool.wakeBudgetWaiters();
 
         while (prefetch->abort_prefetching > 1) {
             prefetch->compressed_cond.wait(prefetch->mutex);
@@ -193,17 +179,23 @@ void IndexSourceModule::close() {
         prefetch->compressed_prefetch_thread->join();
         delete prefetch->compressed_prefetch_thread;
         prefetch->compressed_prefetch_thread = NULL;
-        for (vector<PThread *>::iterator i = prefetch->unpack_threads.begin();
-            i != prefetch->unpack_threads.end(); ++i) {
-            (**i).join();
-            delete *i;
-            *i = NULL;
+
+        // Reads and jobs in the pool point at this module, so wait for them
+        // to finish.
+        while (prefetch->outstanding_reads > 0 || prefetch->outstanding_unpacks > 0) {
+            prefetch->compressed_cond.wait(prefetch->mutex);
         }
         while (prefetch->compressed.empty() == false) {
-            delete prefetch->compressed.getFront();
+            PrefetchExtent *pe = prefetch->compressed.getFront();
+            prefetch->compressed.subtract(pe->bytes.size());
+            pool.releaseCompressed(pe->bytes.size());
+            delete pe;
         }
         while (prefetch->unpacked.empty() == false) {
-            delete prefetch->unpacked.getFront();
+            PrefetchExtent *pe = prefetch->unpacked.getFront();
+            SINVARIANT(pe->unpacked != NULL);
+            prefetch->unpacked.subtract(pe->unpacked->size());
+            delete pe;
         }
         SINVARIANT(prefetch->abort_prefetching == 1);
         prefetch->abort_prefetching = 0;
@@ -226,17 +218,8 @@ bool IndexSourceModule::isClosed() {
 }
 
 bool IndexSourceModule::lockedIsClosed() {
-    if (prefetch->compressed_prefetch_thread != NULL) {
-        return false;
-    } 
-
-    for (vector<PThread *>::iterator i = prefetch->unpack_threads.begin(); 
-         i != prefetch->unpack_threads.end(); ++i) {
-        if (*i != NULL) {
-            return false;
-        }
-    }
-    return true;
+    return prefetch->compressed_prefetch_thread == NULL
+        && prefetch->outstanding_reads == 0 && prefetch->outstanding_unpacks == 0;
 }
 
 double 
@@ -271,9 +254,25 @@ IndexSourceModule::getWaitStats(WaitStats &stats)
 }
 
 void IndexSourceModule::compressedPrefetchThread() {
+    dataseries::UnpackPool &pool(dataseries::UnpackPool::instance());
+    dataseries::AsyncExtentReader &reader(dataseries::AsyncExtentReader::instance());
     prefetch->mutex.lock();
     while (prefetch->abort_prefetching == 0) {
-        if (!prefetch->source_done && prefetch->compressed.can_add(0)) {
+        if (prefetch->source_done) {
+            prefetch->compressed_cond.wait(prefetch->mutex);
+        } else if (prefetch->outstanding_reads > 0
+                   && prefetch->outstanding_reads >= reader.queueDepth()) {
+            prefetch->compressed_cond.wait(prefetch->mutex); // readDone signals
+        } else if (prefetch->compressed.cur > 0 && !pool.underCompressedBudget()) {
+            // We may always have one compressed extent waiting even if the
+            // pool is over budget, otherwise a module whose consumer is
+            // waiting on it could be starved by other modules.
+            ++prefetch->stats.compressed_downstream_full;
+            uint64_t generation = pool.budgetGeneration();
+            prefetch->mutex.unlock();
+            pool.waitForCompressedBudget(generation);
+            prefetch->mutex.lock();
+        } else {
             PrefetchExtent *p = lockedGetCompressedExtent();
             if (p == NULL) {
                 prefetch->source_done = true;
@@ -281,15 +280,11 @@ void IndexSourceModule::compressedPrefetchThread() {
             } else {
                 SINVARIANT(p->extent_source != Extent::in_memory_str &&
                            p->extent_source_offset > 0);
+                // pending reads are accounted for in readDone()
+                pool.reserveCompressed(p->bytes.size());
                 prefetch->compressed.add(p, p->bytes.size());
-                if (prefetch->unpacked.can_add(prefetch->compressed.front())) {
-                    prefetch->unpack_cond.signal();
-                } else {
-                    ++prefetch->stats.skip_unpack_signal;
-                }
+                lockedSubmitUnpacks();
             }
-        } else {
-            prefetch->compressed_cond.wait(prefetch->mutex);
         }
     }
     SINVARIANT(prefetch->abort_prefetching > 0);
@@ -298,80 +293,96 @@ void IndexSourceModule::compressedPrefetchThread() {
     prefetch->mutex.unlock();
 }
 
-void IndexSourceModule::unpackThread() {
+void IndexSourceModule::lockedSubmitUnpacks() {
+    // Extents move to the unpacked queue as soon as they are submitted so
+    // that the consumer gets them in order no matter which pool thread
+    // finishes first.  Similarly, we stop at a read that hasn't finished
+    // even if later ones have.
+    while (prefetch->abort_prefetching == 0 && !prefetch->compressed.empty()
+           && !prefetch->compressed.front()->read_pending) {
+        if (!prefetch->unpacked.can_add(prefetch->compressed.front())) {
+            ++prefetch->stats.unpack_downstream_full;
+            return;
+        }
+        PrefetchExtent *pe = prefetch->compressed.getFront();
+        prefetch->compressed.subtract(pe->bytes.size());
+        uint32_t unpacked_size 
+                = Extent::unpackedSize(pe->bytes, pe->need_bitflip, pe->type);
+        prefetch->unpacked.add(pe, unpacked_size);
+        ++prefetch->outstanding_unpacks;
+        dataseries::UnpackPool::instance().submit
+            (boost::bind(&IndexSourceModule::unpackJob, this, pe, unpacked_size));
+    }
+}
+
+void IndexSourceModule::unpackJob(PrefetchExtent *pe, uint32_t unpacked_size) {
     prefetch->mutex.lock();
     ++prefetch->stats.active_unpackers;
-    while (prefetch->abort_prefetching == 0) {
-        if (prefetch->compressed.data.empty() || 
-            !prefetch->unpacked.can_add(prefetch->compressed.front())) {
-            --prefetch->stats.active_unpackers;
-            if (prefetch->compressed.data.empty()) {
-                ++prefetch->stats.unpack_no_upstream;
-            } else {
-                ++prefetch->stats.unpack_downstream_full;
-            }
-            prefetch->unpack_cond.wait(prefetch->mutex);
-            ++prefetch->stats.active_unpackers;
-        }
-        
-        if (prefetch->abort_prefetching > 0) {
-            break;
-        }
+    prefetch->stats.lockedUpdateActive();
+    prefetch->mutex.unlock();
 
-        prefetch->stats.lockedUpdateActive();
-        if (!prefetch->compressed.data.empty() &&
-            prefetch->unpacked.can_add(prefetch->compressed.front())) {
-            PrefetchExtent *pe = prefetch->compressed.getFront();
-            prefetch->compressed.subtract(pe->bytes.size());
-            uint32_t unpacked_size 
-                    = Extent::unpackedSize(pe->bytes, pe->need_bitflip,pe->type);
-            prefetch->unpacked.add(pe, unpacked_size);
-            prefetch->compressed_cond.signal();
-            bool should_yield; 
-            if (prefetch->unpackedReady()) {
-                // For small extents, almost equivalent to just having the
-                // next condition, but not equivalent with large extents.
-                // really want a directed yield here to the consumer.
-                ++prefetch->stats.unpack_yield_ready;
-                should_yield = true;
-            } else if (prefetch->unpacked.data.size() > 2*prefetch->unpack_threads.size()) {
-                ++prefetch->stats.unpack_yield_front;
-                // The front of the queue isn't done, but we have a lot of 
-                // things in the queue, this means whatever thread is working
-                // on that element has been preempted.
-                // really want a directed yield to the thread processing the
-                // first extent.
-                should_yield = true;
-            } else {
-                should_yield = false;
-            }
-            prefetch->mutex.unlock();
-            if (should_yield) {
-                sched_yield();
-            }
-            Extent::Ptr e(new Extent(pe->type));
-            e->unpackData(pe->bytes, pe->need_bitflip);
-            e->extent_source = pe->extent_source;
-            e->extent_source_offset = pe->extent_source_offset;
-            SINVARIANT(e->type->getName() == pe->uncompressed_type);
-            SINVARIANT(e->size() == unpacked_size);
-            prefetch->mutex.lock();
-            SINVARIANT(pe->unpacked == NULL && pe->bytes.size() > 0);
-            total_compressed_bytes += pe->bytes.size();
-            total_uncompressed_bytes += e->size();
-            pe->bytes.clear();
-            pe->unpacked = e;
-            SINVARIANT(!prefetch->unpacked.empty());
-            if (prefetch->unpackedReady()) {
-                prefetch->ready_cond.signal();
-            }
-        }
-    }
+    size_t compressed_size = pe->bytes.size();
+    Extent::Ptr e(new Extent(pe->type));
+    e->unpackData(pe->bytes, pe->need_bitflip, needed_fields.empty() ? NULL : &needed_fields,
+                  lazy_unpack);
+    e->extent_source = pe->extent_source;
+    e->extent_source_offset = pe->extent_source_offset;
+    SINVARIANT(e->type->getName() == pe->uncompressed_type);
+    // smaller if columns or the variable data were skipped
+    SINVARIANT(e->size() == unpacked_size
+               || (!needed_fields.empty() && e->size() < unpacked_size));
+
+    PThreadScopedLock lock(prefetch->mutex);
+    SINVARIANT(pe->unpacked == NULL && compressed_size > 0);
+    total_compressed_bytes += compressed_size;
+    total_uncompressed_bytes += e->size();
+    pe->bytes.clear();
+    pe->unpacked = e;
     --prefetch->stats.active_unpackers;
-    SINVARIANT(prefetch->abort_prefetching > 0);
-    --prefetch->abort_prefetching;
-    prefetch->compressed_cond.broadcast();
-    prefetch->mutex.unlock();
+    SINVARIANT(!prefetch->unpacked.empty());
+    if (prefetch->unpackedReady()) {
+        prefetch->ready_cond.signal();
+    }
+    dataseries::UnpackPool::instance().releaseCompressed(compressed_size);
+    SINVARIANT(prefetch->outstanding_unpacks > 0);
+    --prefetch->outstanding_unpacks;
+    if (prefetch->outstanding_unpacks == 0) {
+        prefetch->compressed_cond.broadcast(); // close() may be waiting
+    }
+}
+
+void IndexSourceModule::lockedReadStarted() {
+    if (prefetch->outstanding_reads == 0) {
+        gettimeofday(&prefetch->read_busy_start, NULL);
+    }
+    ++prefetch->outstanding_reads;
+    prefetch->stats.read_queue_depth.add(prefetch->outstanding_reads);
+}
+
+void IndexSourceModule::lockedReadFinished(size_t nbytes) {
+    SINVARIANT(prefetch->outstanding_reads > 0);
+    --prefetch->outstanding_reads;
+    prefetch->stats.read_bytes += nbytes;
+    if (prefetch->outstanding_reads == 0) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        prefetch->stats.read_busy_seconds += timediff(now, prefetch->read_busy_start);
+    }
+}
+
+void IndexSourceModule::readDone(PrefetchExtent *pe) {
+    PThreadScopedLock lock(prefetch->mutex);
+    SINVARIANT(pe->read_pending);
+    INVARIANT(Extent::getPackedExtentType(pe->bytes) == pe->type->getName(),
+              format("%s:%d is a %s extent, not %s") % pe->extent_source
+              % pe->extent_source_offset % Extent::getPackedExtentType(pe->bytes)
+              % pe->type->getName());
+    pe->read_pending = false;
+    dataseries::UnpackPool::instance().reserveCompressed(pe->bytes.size());
+    prefetch->compressed.cur += pe->bytes.size();
+    lockedReadFinished(pe->bytes.size());
+    lockedSubmitUnpacks();
+    prefetch->compressed_cond.broadcast(); // prefetch thread or close() may be waiting
 }
 
 IndexSourceModule::PrefetchExtent *
@@ -379,6 +390,29 @@ IndexSourceModule::readCompressed(DataSeriesSource *dss,
                                   off64_t offset,
                                   const string &uncompressed_type)
 {
+    dataseries::AsyncExtentReader &reader(dataseries::AsyncExtentReader::instance());
+    if (reader.queueDepth() > 0 && !dss->isMapped()) {
+        // The index tells us the type, so we can look it up before the read.
+        PrefetchExtent *p = new PrefetchExtent;
+        p->extent_source = dss->getFilename();
+        p->extent_source_offset = offset;
+        p->type = dss->getLibrary().getTypeByNamePtr(uncompressed_type);
+        p->need_bitflip = dss->needBitflip();
+        p->read_pending = true;
+        p->uncompressed_type = uncompressed_type;
+
+        dataseries::AsyncExtentReader::Request request;
+        request.file = dss->sharedFd();
+        request.offset = offset;
+        request.need_bitflip = p->need_bitflip;
+        request.into = &p->bytes;
+        request.done = boost::bind(&IndexSourceModule::readDone, this, p);
+        lockedReadStarted();
+        reader.submit(request);
+        return p;
+    }
+
+    lockedReadStarted();
     prefetch->mutex.unlock();
     PrefetchExtent *p = new PrefetchExtent;
     p->extent_source = dss->getFilename();
@@ -389,5 +423,6 @@ IndexSourceModule::readCompressed(DataSeriesSource *dss,
     p->need_bitflip = dss->needBitflip();
     p->uncompressed_type = uncompressed_type;
     prefetch->mutex.lock();
+    lockedReadFinished(p->bytes.size());
     return p;
 }
@@ -9,19 +9,78 @@
     implementation
 */
 
+#include <vector>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/LintelLog.hpp>
+#include <Lintel/PThread.hpp>
+
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/RowAnalysisModule.hpp>
 #include <DataSeries/SequenceModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+
+struct RowAnalysisModule::ParallelInfo {
+    struct Worker {
+        Worker(ExtentSeries::typeCompatibilityT tc)
+            : series(tc), where(NULL), state(NULL), thread(NULL), processed(0), ignored(0) { }
+        ~Worker() {
+            delete where;
+            delete state;
+            delete thread;
+        }
+        ExtentSeries series;
+        DSExpr *where;
+        ThreadState *state;
+        PThread *thread;
+        uint64_t processed, ignored;
+    };
+
+    ParallelInfo(size_t max_queued) : max_queued(max_queued), done(false) { }
+    ~ParallelInfo() {
+        for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+            delete *i;
+        }
+    }
+
+    vector<Worker *> workers;
+    // protects everything below
+    PThreadMutex mutex;
+    PThreadCond queue_cond, space_cond;
+    Deque<Extent::Ptr> queue;
+    size_t max_queued;
+    bool done;
+};
+
+class RowAnalysisWorker : public PThread {
+  public:
+    RowAnalysisWorker(RowAnalysisModule &module, unsigned worker_num)
+        : module(module), worker_num(worker_num) { }
+    virtual void *run() {
+        module.workerThread(worker_num);
+        return NULL;
+    }
+    RowAnalysisModule &module;
+    unsigned worker_num;
+};
+
+RowAnalysisModule::ThreadState::~ThreadState() { }
 
 RowAnalysisModule::RowAnalysisModule(DataSeriesModule &_source,
                                      ExtentSeries::typeCompatibilityT _tc)
         : processed_rows(0), ignored_rows(0), 
-          series(_tc), source(_source), prepared(false), where_expr(NULL)
+          series(_tc), source(_source), prepared(false), where_expr(NULL),
+          type_compatibility(_tc), parallel_threads(0), parallel(NULL)
 {
     SINVARIANT(&source != NULL);
 }
 
 RowAnalysisModule::~RowAnalysisModule() {
+    if (parallel != NULL) {
+        finishParallel(false);
+    }
     delete where_expr;
     where_expr = NULL;
 }
@@ -35,6 +94,9 @@ void RowAnalysisModule::prepareForProcessing() { }
 Extent::Ptr RowAnalysisModule::getSharedExtent() {
     Extent::Ptr e = source.getSharedExtent();
     if (e == NULL) {
+        if (parallel != NULL) {
+            finishParallel(true);
+        }
         completeProcessing();
         return e;
     }
@@ -49,19 +111,132 @@ Extent::Ptr RowAnalysisModule::getSharedExtent() {
         if (!where_expr_str.empty()) {
             where_expr = DSExpr::make(series, where_expr_str);
         }
+        if (parallel_threads > 0) {
+            startParallel(*e);
+        }
     }
-    for (;series.morerecords();++series) {
-        if (!where_expr || where_expr->valBool()) {
-            ++processed_rows;
-            processRow();
-        } else {
-            ++ignored_rows;
+    if (parallel != NULL) {
+        series.clearExtent();
+        // The workers, and any later module in this thread, use the extent at the same time.
+        e->unpackAllFields();
+        PThreadScopedLock lock(parallel->mutex);
+        while (parallel->queue.size() >= parallel->max_queued) {
+            parallel->space_cond.wait(parallel->mutex);
         }
+        parallel->queue.push_back(e);
+        parallel->queue_cond.signal();
+        return e;
     }
+    processExtent(series, where_expr, NULL, processed_rows, ignored_rows);
     series.clearExtent();
     return e;
 }
 
+void RowAnalysisModule::processExtent(ExtentSeries &in, DSExpr *where, ThreadState *state,
+                                      uint64_t &processed, uint64_t &ignored) {
+    for (;in.morerecords();++in) {
+        if (!where || where->valBool()) {
+            ++processed;
+            if (state == NULL) {
+                processRow();
+            } else {
+                state->processRow();
+            }
+        } else {
+            ++ignored;
+        }
+    }
+}
+
+void RowAnalysisModule::enableParallel(int nthreads) {
+    INVARIANT(!prepared, "can't enable parallel processing after prepare");
+    parallel_threads = nthreads == -1 ? PThreadMisc::getNCpus() : nthreads;
+    INVARIANT(parallel_threads > 0, boost::format("invalid thread count %d") % nthreads);
+}
+
+RowAnalysisModule::ThreadState *RowAnalysisModule::newThreadState(ExtentSeries &) {
+    return NULL;
+}
+
+void RowAnalysisModule::mergeThreadState(ThreadState &) {
+    FATAL_ERROR("modules implementing newThreadState() need to implement mergeThreadState()");
+}
+
+void RowAnalysisModule::startParallel(const Extent &e) {
+    // a couple of extents per worker keeps them busy while the source catches up
+    parallel = new ParallelInfo(2 * parallel_threads);
+    for (int i = 0; i < parallel_threads; ++i) {
+        ParallelInfo::Worker *worker = new ParallelInfo::Worker(type_compatibility);
+        parallel->workers.push_back(worker);
+        worker->series.setType(e.getTypePtr());
+        worker->state = newThreadState(worker->series);
+        if (worker->state == NULL) {
+            LintelLogDebug("RowAnalysisModule", "module does not support parallel processing");
+            delete parallel;
+            parallel = NULL;
+            parallel_threads = 0;
+            return;
+        }
+        if (!where_expr_str.empty()) {
+            worker->where = DSExpr::make(worker->series, where_expr_str);
+        }
+    }
+    for (int i = 0; i < parallel_threads; ++i) {
+        parallel->workers[i]->thread = new RowAnalysisWorker(*this, i);
+        parallel->workers[i]->thread->start();
+    }
+}
+
+void RowAnalysisModule::workerThread(unsigned worker_num) {
+    ParallelInfo::Worker &worker(*parallel->workers[worker_num]);
+    while (true) {
+        Extent::Ptr e;
+        {
+            PThreadScopedLock lock(parallel->mutex);
+            while (parallel->queue.empty() && !parallel->done) {
+                parallel->queue_cond.wait(parallel->mutex);
+            }
+            if (parallel->queue.empty()) {
+                return;
+            }
+            e = parallel->queue.front();
+            parallel->queue.pop_front();
+            parallel->space_cond.signal();
+        }
+        worker.series.setExtent(e);
+        processExtent(worker.series, worker.where, worker.state, worker.processed,
+                      worker.ignored);
+        worker.series.clearExtent();
+    }
+}
+
+void RowAnalysisModule::finishParallel(bool merge) {
+    {
+        PThreadScopedLock lock(parallel->mutex);
+        if (!merge) {
+            while (!parallel->queue.empty()) {
+                parallel->queue.pop_front();
+            }
+        }
+        parallel->done = true;
+        parallel->queue_cond.broadcast();
+    }
+    for (vector<ParallelInfo::Worker *>::iterator i = parallel->workers.begin();
+         i != parallel->workers.end(); ++i) {
+        (**i).thread->join();
+    }
+    if (merge) {
+        for (vector<ParallelInfo::Worker *>::iterator i = parallel->workers.begin();
+             i != parallel->workers.end(); ++i) {
+            mergeThreadState(*(**i).state);
+            processed_rows += (**i).processed;
+            ignored_rows += (**i).ignored;
+        }
+    }
+    delete parallel;
+    parallel = NULL;
+}
+
 void RowAnalysisModule::completeProcessing() { }
 
 void RowAnalysisModule::printResult() { }
@@ -71,6 +246,13 @@ void RowAnalysisModule::setWhereExpr(const std::string &expr) {
     INVARIANT(!prepared, "can't set where expr after prepare");
 }
 
+bool RowAnalysisModule::pushWhereExprDown(TypeIndexModule &from) {
+    if (where_expr_str.empty()) {
+        return false;
+    }
+    return from.addWherePredicates(where_expr_str);
+}
+
 int RowAnalysisModule::printAllResults(SequenceModule &sequence, int expected_nonprintable) {
     int non_rowmods = 0;
     bool printed_any = false;
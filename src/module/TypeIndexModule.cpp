@@ -5,7 +5,12 @@
   See the file named COPYING for license details
 */
 
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+
 #include <DataSeries/TypeIndexModule.hpp>
+#include <DataSeries/UnpackPool.hpp>
 
 using namespace std;
 
@@ -16,12 +21,15 @@ TypeIndexModule::TypeIndexModule(const string &_type_match)
           indexSeries(ExtentSeries::typeExact),
           extentOffset(indexSeries,"offset"), 
           extentType(indexSeries,"extenttype"),
-          cur_file(0), cur_source(NULL),
-          my_type()
+          predicates(), where_exprs(), skip_offsets(), skipped_extents(0),
+          cur_file(0), cur_source(NULL), my_type(), open_mutex(), open_cond(),
+          open_ahead(8), next_open(0), outstanding_opens(0), opens()
 { }
 
-TypeIndexModule::~TypeIndexModule()
-{ }
+TypeIndexModule::~TypeIndexModule() {
+    resetOpens(); // open jobs point at this module
+    delete cur_source;
+}
 
 void TypeIndexModule::setMatch(const string &_type_match) {
     INVARIANT(startedPrefetching() == false,
@@ -42,11 +50,155 @@ void TypeIndexModule::addSource(const std::string &filename) {
     inputFiles.push_back(filename);
 }
 
+void TypeIndexModule::setOpenAhead(unsigned nfiles) {
+    INVARIANT(startedPrefetching() == false, "can't change open ahead after starting prefetching");
+    open_ahead = nfiles;
+}
+
+void TypeIndexModule::addRangePredicate(const string &column, double min, double max) {
+    INVARIANT(startedPrefetching() == false, "can't add predicates after starting prefetching");
+    DSExpr::FieldRange range;
+    range.field_name = column;
+    range.is_string = false;
+    range.min = min;
+    range.max = max;
+    range.max_string_unbounded = false;
+    predicates.push_back(range);
+}
+
+void TypeIndexModule::addRangePredicate(const string &column, const string &min, 
+                                        const string &max) {
+    INVARIANT(startedPrefetching() == false, "can't add predicates after starting prefetching");
+    DSExpr::FieldRange range;
+    range.field_name = column;
+    range.is_string = true;
+    range.min = -Double::Inf;
+    range.max = Double::Inf;
+    range.min_string = min;
+    range.max_string = max;
+    range.max_string_unbounded = false;
+    predicates.push_back(range);
+}
+
+bool TypeIndexModule::addWherePredicates(const string &where_expr) {
+    if (startedPrefetching()) {
+        return false;
+    }
+    where_exprs.push_back(where_expr);
+    return true;
+}
+
+void TypeIndexModule::lockedFindSkippable() {
+    skip_offsets.clear();
+    Extent::Ptr stats(cur_source->minMaxExtent());
+    if (stats == NULL) {
+        return; // written without recordMinMax()
+    }
+
+    ExtentSeries s(stats);
+    Int64Field offset(s, "offset");
+    Variable32Field column(s, "column");
+    DoubleField min(s, "min", Field::flag_nullable), max(s, "max", Field::flag_nullable);
+    Variable32Field min_string(s, "min_string", Field::flag_nullable),
+        max_string(s, "max_string", Field::flag_nullable);
+    for (; s.morerecords(); ++s) {
+        BOOST_FOREACH(const DSExpr::FieldRange &range, predicates) {
+            if (!column.equal(range.field_name)) {
+                continue;
+            }
+            bool disjoint = false;
+            if (range.is_string && !min_string.isNull()) {
+                disjoint = max_string.stringval() < range.min_string
+                    || (!range.max_string_unbounded && min_string.stringval() > range.max_string);
+            } else if (!range.is_string && !min.isNull()) {
+                disjoint = max.val() < range.min || min.val() > range.max;
+            }
+            if (disjoint) {
+                skip_offsets.insert(offset.val());
+                break;
+            }
+        }
+    }
+}
+
 void TypeIndexModule::lockedResetModule() {
     indexSeries.clearExtent();
+    skip_offsets.clear();
+    delete cur_source;
+    cur_source = NULL;
+    resetOpens();
     cur_file = 0;
 }
 
+DataSeriesSource *TypeIndexModule::takeSource(unsigned file) {
+    if (open_ahead == 0) {
+        return new DataSeriesSource(inputFiles[file]);
+    }
+    dataseries::UnpackPool &pool(dataseries::UnpackPool::instance());
+    open_mutex.lock();
+    next_open = max(next_open, file);
+    unsigned end = min(static_cast<size_t>(file) + 1 + open_ahead, inputFiles.size());
+    for (; next_open < end; ++next_open) {
+        opens[next_open] = OpenSlot();
+        ++outstanding_opens;
+        pool.submit(boost::bind(&TypeIndexModule::openJob, this, next_open,
+                                inputFiles[next_open]));
+    }
+
+    // If the job hasn't started we open the file here rather than waiting behind whatever is
+    // in the pool, which may include unpack jobs for this module waiting on our caller's lock.
+    OpenSlot &slot(opens[file]);
+    while (slot.claimed && slot.source == NULL) {
+        open_cond.wait(open_mutex);
+    }
+    DataSeriesSource *ret = slot.source;
+    if (!slot.claimed) {
+        slot.claimed = true;
+        open_mutex.unlock();
+        ret = new DataSeriesSource(inputFiles[file]);
+        open_mutex.lock();
+    }
+    opens.erase(file);
+    open_mutex.unlock();
+    return ret;
+}
+
+void TypeIndexModule::openJob(unsigned file, const string &filename) {
+    {
+        PThreadScopedLock lock(open_mutex);
+        map<unsigned, OpenSlot>::iterator i = opens.find(file);
+        if (i == opens.end() || i->second.claimed) { // taken or reset before we got to run
+            --outstanding_opens;
+            open_cond.broadcast();
+            return;
+        }
+        i->second.claimed = true;
+    }
+    DataSeriesSource *source = new DataSeriesSource(filename);
+
+    PThreadScopedLock lock(open_mutex);
+    map<unsigned, OpenSlot>::iterator i = opens.find(file);
+    SINVARIANT(i != opens.end() && i->second.source == NULL);
+    i->second.source = source;
+    --outstanding_opens;
+    open_cond.broadcast();
+}
+
+void TypeIndexModule::resetOpens() {
+    PThreadScopedLock lock(open_mutex);
+    for (map<unsigned, OpenSlot>::iterator i = opens.begin(); i != opens.end(); ++i) {
+        i->second.claimed = true; // queued jobs return without opening
+    }
+    while (outstanding_opens > 0) {
+        open_cond.wait(open_mutex);
+    }
+    for (map<unsigned, OpenSlot>::iterator i = opens.begin(); i != opens.end(); ++i) {
+        delete i->second.source;
+    }
+    opens.clear();
+    next_open = 0;
+}
+
 TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
     while (true) {
         if (!indexSeries.hasExtent()) {
@@ -54,7 +206,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
                 INVARIANT(!inputFiles.empty(), "type index module had no input files??");
                 return NULL;
             }
-            cur_source = new DataSeriesSource(inputFiles[cur_file]);
+            cur_source = takeSource(cur_file);
             INVARIANT(cur_source->index_extent != NULL,
                       "can't handle source with null index extent\n");
             if (type_match.empty()) {
@@ -71,13 +223,31 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
                           % tmp->getXmlDescriptionString()); 
             }
 
+            if (!where_exprs.empty() && my_type != NULL) {
+                BOOST_FOREACH(const string &where, where_exprs) {
+                    ExtentSeries series(my_type);
+                    boost::scoped_ptr<DSExpr> expr(DSExpr::make(series, where));
+                    DSExpr::conjunctiveRanges(expr.get(), predicates);
+                }
+                where_exprs.clear();
+            }
+            if (!predicates.empty()) {
+                lockedFindSkippable();
+            }
             indexSeries.setExtent(cur_source->index_extent);
         }
+        const string &minmax_type_name(ExtentType::getDataSeriesMinMaxTypePtr()->getName());
         for (;indexSeries.morerecords();++indexSeries) {
-            if (type_match.empty() ||
+            // The ExtentMinMax statistics describe the other extents, so an empty
+            // match that returns everything still skips them.
+            if ((type_match.empty() && extentType.stringval() != minmax_type_name) ||
                 (my_type != NULL &&
                  extentType.stringval() == my_type->getName())) {
                 off64_t v = extentOffset.val();
+                if (!skip_offsets.empty() && skip_offsets.count(v) > 0) {
+                    ++skipped_extents;
+                    continue;
+                }
                 PrefetchExtent *ret 
                         = readCompressed(cur_source, v, extentType.stringval());
                 ++indexSeries;
@@ -86,6 +256,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
         }
         if (indexSeries.morerecords() == false) {
             indexSeries.clearExtent();
+            skip_offsets.clear();
             delete cur_source;
             cur_source = NULL;
             ++cur_file;
@@ -0,0 +1,200 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <Lintel/LintelLog.hpp>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/UnpackPool.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+class UnpackPoolThread : public PThread {
+  public:
+    UnpackPoolThread(UnpackPool &pool, unsigned worker_num)
+        : pool(pool), worker_num(worker_num) {
+        setStackSize(256*1024); // shouldn't need much
+    }
+
+    virtual ~UnpackPoolThread() { }
+
+    virtual void *run() {
+        pool.workerThread(worker_num);
+        return NULL;
+    }
+    UnpackPool &pool;
+    unsigned worker_num;
+};
+
+UnpackPool &UnpackPool::instance() {
+    // Deliberately never deleted; the worker threads block forever once
+    // there is no more work, and joining them from a static destructor
+    // would race with other static destructors.
+    static UnpackPool *pool = new UnpackPool();
+    return *pool;
+}
+
+UnpackPool::UnpackPool()
+    : workers(), requested_threads(-1), mutex(), work_cond(), budget_cond(),
+      pending_jobs(0), next_worker(0), compressed_budget(8 * 1024 * 1024),
+      compressed_used(0), budget_generation(0)
+{ }
+
+UnpackPool::~UnpackPool() {
+    FATAL_ERROR("UnpackPool should never be destroyed");
+}
+
+void UnpackPool::setThreadCount(int nthreads) {
+    INVARIANT(nthreads == -1 || nthreads > 0, format("invalid thread count %d") % nthreads);
+    PThreadScopedLock lock(mutex);
+    if (workers.empty()) {
+        requested_threads = nthreads;
+    }
+}
+
+void UnpackPool::lockedStartThreads() {
+    unsigned nthreads = requested_threads == -1
+        ? min(PThreadMisc::getNCpus(), MAX_THREADS/2) : requested_threads;
+    INVARIANT(nthreads > 0, "?");
+    workers.reserve(nthreads);
+    for (unsigned i = 0; i < nthreads; ++i) {
+        workers.push_back(new Worker());
+    }
+    for (unsigned i = 0; i < nthreads; ++i) {
+        workers[i]->thread = new UnpackPoolThread(*this, i);
+        workers[i]->thread->start();
+    }
+    LintelLogDebug("UnpackPool", format("started %d unpack threads") % nthreads);
+}
+
+void UnpackPool::submit(const Job &job) {
+    // Queue and count the job under the pool mutex, otherwise a worker could take it and
+    // decrement pending_jobs before we increment it.  The pool mutex is ordered before the
+    // worker mutexes.
+    PThreadScopedLock lock(mutex);
+    if (workers.empty()) {
+        lockedStartThreads();
+    }
+    Worker *to = workers[next_worker % workers.size()];
+    ++next_worker;
+    {
+        PThreadScopedLock worker_lock(to->mutex);
+        to->jobs.push_back(job);
+    }
+    ++pending_jobs;
+    work_cond.signal();
+}
+
+bool UnpackPool::tryGetJob(unsigned worker_num, Job &job) {
+    // Own queue from the front, so that each module's jobs run roughly in
+    // the order they were submitted ...
+    {
+        Worker &mine(*workers[worker_num]);
+        PThreadScopedLock lock(mine.mutex);
+        if (!mine.jobs.empty()) {
+            job = mine.jobs.front();
+            mine.jobs.pop_front();
+            return true;
+        }
+    }
+    // ... and steal from the back of the others.
+    for (unsigned i = 1; i < workers.size(); ++i) {
+        Worker &victim(*workers[(worker_num + i) % workers.size()]);
+        PThreadScopedLock lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void UnpackPool::workerThread(unsigned worker_num) {
+    while (true) {
+        Job job;
+        if (tryGetJob(worker_num, job)) {
+            {
+                PThreadScopedLock lock(mutex);
+                SINVARIANT(pending_jobs > 0);
+                --pending_jobs;
+            }
+            job();
+        } else {
+            PThreadScopedLock lock(mutex);
+            // pending_jobs is incremented along with queueing the job, so
+            // if it is non-zero there is a job we can find (or that some
+            // other worker is about to take).
+            while (pending_jobs == 0) {
+                work_cond.wait(mutex);
+            }
+        }
+    }
+}
+
+void UnpackPool::raiseCompressedBudget(size_t nbytes) {
+    PThreadScopedLock lock(mutex);
+    if (nbytes > compressed_budget) {
+        compressed_budget = nbytes;
+        budget_cond.broadcast();
+    }
+}
+
+void UnpackPool::setCompressedBudget(size_t nbytes) {
+    SINVARIANT(nbytes > 0);
+    PThreadScopedLock lock(mutex);
+    compressed_budget = nbytes;
+    budget_cond.broadcast();
+}
+
+bool UnpackPool::underCompressedBudget() {
+    PThreadScopedLock lock(mutex);
+    return compressed_used < compressed_budget;
+}
+
+void UnpackPool::reserveCompressed(size_t nbytes) {
+    PThreadScopedLock lock(mutex);
+    compressed_used += nbytes;
+}
+
+void UnpackPool::releaseCompressed(size_t nbytes) {
+    PThreadScopedLock lock(mutex);
+    SINVARIANT(compressed_used >= nbytes);
+    compressed_used -= nbytes;
+    budget_cond.broadcast();
+}
+
+size_t UnpackPool::compressedUsed() {
+    PThreadScopedLock lock(mutex);
+    return compressed_used;
+}
+
+uint64_t UnpackPool::budgetGeneration() {
+    PThreadScopedLock lock(mutex);
+    return budget_generation;
+}
+
+void UnpackPool::waitForCompressedBudget(uint64_t generation) {
+    PThreadScopedLock lock(mutex);
+    while (compressed_used >= compressed_budget && generation == budget_generation) {
+        budget_cond.wait(mutex);
+    }
+}
+
+void UnpackPool::wakeBudgetWaiters() {
+    PThreadScopedLock lock(mutex);
+    ++budget_generation;
+    budget_cond.broadcast();
+}
+
+}
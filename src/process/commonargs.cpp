@@ -10,7 +10,9 @@
 */
 
 #include <DataSeries/commonargs.hpp>
+#include <DataSeries/DataSeriesSink.hpp>
 #include <iostream>
+using namespace std;
 using boost::format;
 
 // Specifies the different options for dealing with a specified compression alg.
@@ -124,6 +126,16 @@ void getPackingArgs(int *argc, char *argv[], commonPackingArgs *commonArgs) {
             INVARIANT(commonArgs->extent_size >= 1024,
                       format("extent size %d (%s), < 1024 doesn't make sense")
                       % commonArgs->extent_size % argv[cur_arg]);
+        } else if (strncmp(argv[cur_arg],"--compress-policy=",18) == 0) {
+            string policy(argv[cur_arg]+18);
+            if (policy == "all") {
+                commonArgs->adaptive_compression = false;
+            } else if (policy == "adaptive") {
+                commonArgs->adaptive_compression = true;
+            } else {
+                FATAL_ERROR(format("compression policy '%s' invalid, should be all or adaptive")
+                            % policy);
+            }
             // Check for arguments in the old format -- provided for backwards
             // compatability.
         } else if (oldStyle(argv, cur_arg, num_munged_args, commonArgs)) {
@@ -147,6 +159,10 @@ void getPackingArgs(int *argc, char *argv[], commonPackingArgs *commonArgs) {
     }
     *argc -= (num_munged_args);
 
+    DataSeriesSink::setDefaultCompressionPolicy(commonArgs->adaptive_compression 
+                                                ? DataSeriesSink::CompressAdaptive
+                                                : DataSeriesSink::CompressTryAll);
+
     if (commonArgs->extent_size < 0) {
         // the analysis work in the paper shows that 64-96k is the
         // peak decompression rate, with a sacrifice of a slight
@@ -178,6 +194,8 @@ const std::string packingOptions() {
     returnStr += 
             "} (default enables all --- enable does little on its own)\n"
             "    --compress-level=[0-9] (default 9)\n"
+            "    --compress-policy={all,adaptive} (default all; adaptive only tries the\n"
+            "      algorithms that recently won for each extent type)\n"
             "    --extent-size=[>=1024] (default 16*1024*1024 if bz2 is "
             "enabled, 64*1024 otherwise)\n";
 
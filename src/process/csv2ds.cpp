@@ -94,6 +94,12 @@ nulls.
 Specifies that any variable32 fields (as indicated by the xml description) are hex encoded, and
 so should be decoded before being added to the dataseries file.
 
+=item --minmax-columns=I<column,column,...>
+
+Record the minimum and maximum of each of the named numeric or variable32 columns in every
+extent, so that readers with a range predicate on one of them can skip extents without reading
+them (see DataSeriesSink::recordMinMax).
+
 =back
 
 =head1 TODO
@@ -119,6 +125,7 @@ namespace {
     lintel::ProgramOption<string> po_field_separator("field-separator", "Specify the string that separates fields in the csv file", ",");
     lintel::ProgramOption<bool> po_hex_encoded_variable32("hex-encoded-variable32", "Specify that variable32 fields are hex encoded.");
     lintel::ProgramOption<string> po_null_string("null-string", "Specify the string that will be interpreted as a null field", "null");
+    lintel::ProgramOption<string> po_minmax_columns("minmax-columns", "Specify a comma separated list of columns whose per-extent minimum and maximum should be recorded");
 }
 
 const ExtentType::Ptr getXMLDescFromFile(const string &filename, ExtentTypeLibrary &lib) {
@@ -196,6 +203,11 @@ int main(int argc, char *argv[]) {
 
     DataSeriesSink outds(ds_output_filename, packing_args.compress_modes,
                          packing_args.compress_level);
+    if (po_minmax_columns.used()) {
+        vector<string> columns;
+        split(po_minmax_columns.get(), ",", columns);
+        outds.recordMinMax(type, columns);
+    }
 
     outds.writeExtentLibrary(lib);
     ExtentSeries series(type);
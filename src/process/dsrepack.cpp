@@ -67,6 +67,19 @@ Outputs progress reports as it processes the extents.
 
 =back
 
+=head1 ENVIRONMENT
+
+=over 4
+
+=item B<DATASERIES_BUFFER_POOL_MB>
+
+Limit on memory retained for recycling extent buffers, default 256.  At the end
+of a run, dsrepack reports how many buffer allocations were satisfied from the
+pool; running with DATASERIES_BUFFER_POOL_MB=0 shows the number of allocations
+made without pooling.
+
+=back
+
 =head1 SEE ALSO
 
 dataseries-utils(7), dsselect(1)
@@ -89,6 +102,7 @@ dataseries-utils(7), dsselect(1)
 #include <Lintel/StringUtil.hpp>
 #include <Lintel/PointerUtil.hpp>
 
+#include <DataSeries/BufferPool.hpp>
 #include <DataSeries/commonargs.hpp>
 #include <DataSeries/DataSeriesFile.hpp>
 #include <DataSeries/GeneralField.hpp>
@@ -272,6 +286,7 @@ void writeRepackInfo(DataSeriesSink &sink, const commonPackingArgs &cpa, int fil
 
 bool skipType(const ExtentType::Ptr type) {
     return type->getName() == "DataSeries: ExtentIndex"
+            || type->getName() == "DataSeries: ExtentMinMax"
             || type->getName() == "DataSeries: XmlType"
             || (type->getName() == "Info::DSRepack"
                 && type->getNamespace() == "ssd.hpl.hp.com");
@@ -523,6 +538,10 @@ int main(int argc, char *argv[]) {
     cout << boost::format("total repacking cpu time: %f") % ( ((float)cpu_time)/CLOCKS_PER_SEC ) << endl;
 #endif
 
+    dataseries::BufferPool::Stats pool_stats = dataseries::BufferPool::instance().getStats();
+    cout << boost::format("buffer pool: %d hits, %d misses, %d released buffers kept, %d freed")
+        % pool_stats.hits % pool_stats.misses % pool_stats.kept % pool_stats.freed << endl;
+
      return 0;
 }
 
@@ -22,6 +22,9 @@ dsselect allows you to calculate subset (both in rows and columns) of an existin
 So you can, for example, run dsselect --where='size > 10' box_number,size boxes.ds big-boxes.ds to
 extract only the box_number and size columns and only extract rows where the size is at least 10.
 To get all the fields of a type simply pass 'all' instead of specific fields.
+If the input files were written with per-extent min/max statistics, comparisons
+between a field and a constant that are and'ed together in the where expression
+are used to skip extents that can not contain a matching row.
 
 =over
 
@@ -117,6 +120,10 @@ int main(int argc, char *argv[]) {
     for (unsigned i=2; i < (extra_args.size()-1); ++i) {
         source.addSource(extra_args[i]);
     }
+    if (where_arg.used()) {
+        // skip extents whose min/max statistics (if any) show they can't match
+        source.addWherePredicates(where_arg.get());
+    }
     source.startPrefetching();
 
     ExtentSeries inputseries(ExtentSeries::typeLoose);
@@ -177,10 +184,14 @@ int main(int argc, char *argv[]) {
         outfields.push_back(GeneralField::create(NULL,outputseries,*i));
     }
     DSExpr *where = NULL;
+    DSExprBatch *where_batch = NULL;
     if (where_arg.used()) {
         string tmp = where_arg.get();
         where = DSExpr::make(inputseries, tmp);
+        where_batch = DSExprBatch::compile(where, inputseries);
+        SINVARIANT(where_batch != NULL);
     }
+    DSExprBatch::Selection selected;
 
     OutputModule outmodule(output,outputseries,outputtype,
                            packing_args.extent_size);
@@ -189,11 +200,20 @@ int main(int argc, char *argv[]) {
         Extent::Ptr inextent = source.getSharedExtent();
         if (inextent == NULL) 
             break;
-        for (inputseries.setExtent(inextent);inputseries.morerecords(); ++inputseries) {
-            ++input_row_count;
-            if (where && !where->valBool()) {
-                continue;
+        inputseries.setExtent(inextent);
+        input_row_count += inextent->nRecords();
+        if (where_batch != NULL) {
+            where_batch->select(selected);
+        } else {
+            selected.resize(inextent->nRecords());
+            for (uint32_t row = 0; row < selected.size(); ++row) {
+                selected[row] = row;
             }
+        }
+        const uint32_t record_size = inextent->getTypePtr()->fixedrecordsize();
+        for (DSExprBatch::Selection::iterator row = selected.begin(); 
+             row != selected.end(); ++row) {
+            inputseries.setCurPos(inextent->fixeddata.begin() + *row * record_size);
             ++output_row_count;
             outmodule.newRecord();
             for (unsigned int i=0;i<infields.size();++i) {
@@ -206,6 +226,7 @@ int main(int argc, char *argv[]) {
     
     GeneralField::deleteFields(infields);
     GeneralField::deleteFields(outfields);
+    delete where_batch;
     delete where;
 
     cout << format("%d input rows, %d output rows\n") % input_row_count % output_row_count;
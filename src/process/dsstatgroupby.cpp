@@ -14,7 +14,7 @@ dsstatgroupby - Calculate some derived value from a dataseries and calculate a s
 
 =head1 SYNOPSIS
 
-% dsstatgroupby I<extent-type-match> I<statistic-description>... from file...
+% dsstatgroupby [--threads=I<n>] I<extent-type-match> I<statistic-description>... from file...
 
 =head1 STATISTIC DESCRIPTION
 
@@ -23,17 +23,21 @@ Two types of statistic types are currently implemented basic (mean, stddev, min,
 (percentile/100).  The expression implements the standard + - * / () and constants.  Two optional
 arguments can be added.  where I<expr> adds in a conditional expression so you could calculate
 separate statistics over large and small files.  group by <field> specifies a column that should be
-used for grouping the statistics.
+used for grouping the statistics; group by <field>,<field>... groups on several columns.
 
 =head1 DESCRIPTION
 
 dsstatgroupby processes one or more input files calculating multiple statistics in a single pass
-over that input file.
+over that input file.  With --threads=I<n>, basic statistics are calculated on I<n> threads, -1 for
+one per cpu; the results can differ from a serial run in the last few digits because the
+statistics are summed in a different order.
 
 */
 
 #include <boost/format.hpp>
 
+#include <Lintel/StringUtil.hpp>
+
 #include <DataSeries/DSStatGroupByModule.hpp>
 #include <DataSeries/TypeIndexModule.hpp>
 #include <DataSeries/PrefetchBufferModule.hpp>
@@ -48,7 +52,8 @@ usage(const std::string &program_name, const std::string &error)
     // TODO: should we make the usage ... from <prefix> in <file...>?
     cerr << error << "\n"
          << "Usage: " << program_name 
-         << " <extent-type-match> (<stat-type> <expr> [where <expr>] [group by <group-by>])+\n"
+         << " [--threads=n] <extent-type-match>\n"
+         << "  (<stat-type> <expr> [where <expr>] [group by <group-by>])+\n"
          << "  from file...\n"
          << "\n"
          << "  stat-types include:\n\n"
@@ -67,11 +72,22 @@ main(int argc, char *_argv[])
     for (int i=0; i<argc; ++i) {
         argv.push_back(string(_argv[i]));
     }
-    if (argc <= 5) usage(argv[0], "insufficient arguments");
+    int nthreads = 0;
+    if (argv.size() > 1 && prefixequal(argv[1], "--threads=")) {
+        nthreads = stringToInteger<int32_t>(argv[1].substr(10));
+        if (nthreads == 0 || nthreads < -1) {
+            usage(argv[0], "--threads must be -1 or > 0");
+        }
+        argv.erase(argv.begin() + 1);
+    }
+    if (argv.size() <= 5) usage(argv[0], "insufficient arguments");
 
     string extent_type_match(argv[1]);
     
     TypeIndexModule source(extent_type_match);
+    // The statistics only read the extents through fields, so columns that no expression uses
+    // are never byte flipped or unpacked.
+    source.setLazyUnpack(true);
     PrefetchBufferModule *prefetch = new PrefetchBufferModule(source, 64*1024*1024);
 
     SequenceModule seq(prefetch);
@@ -106,8 +122,16 @@ main(int argc, char *_argv[])
             argpos += 3;
         }
 
-        seq.addModule(new DSStatGroupByModule(seq.tail(), expr, group_by, 
-                                              stat_type, where_expr));
+        DSStatGroupByModule *module = new DSStatGroupByModule(seq.tail(), expr, group_by,
+                                                              stat_type, where_expr);
+        if (nthreads != 0) {
+            module->enableParallel(nthreads);
+        }
+        seq.addModule(module);
+    }
+    if (seq.size() == 2) {
+        // With a single statistic, nothing needs the extents its where clause rejects.
+        dynamic_cast<RowAnalysisModule &>(seq.tail()).pushWhereExprDown(source);
     }
 
     if (argpos >= argv.size() || argv[argpos] != "from") {
@@ -343,16 +343,14 @@ main(int argc, char *argv[])
         cerr << format("# %d extents: %.2f%% compressed downstream full\n")
                 % wait_stats.nextents 
                 % (100.0 * wait_stats.compressed_downstream_full / wait_stats.nextents);
-        cerr << format("# %.2f%% unpack no upstream, %.2f%% unpack downstream full\n")
-                % (100.0 * wait_stats.unpack_no_upstream / wait_stats.nextents)
+        cerr << format("# %.2f%% unpack downstream full\n")
                 % (100.0 * wait_stats.unpack_downstream_full / wait_stats.nextents);
-        cerr << format("# %d unpack yield ready, %d unpack yield front, %d skip unpack signal\n")
-                % wait_stats.unpack_yield_ready
-                % wait_stats.unpack_yield_front
-                % wait_stats.skip_unpack_signal;
         cerr << format("# %.2f mean active unpackers, %.2f%% consumer wait\n")
                 % wait_stats.active_unpack_stats.mean()
                 % (100.0 * wait_stats.consumer / wait_stats.nextents);
+        cerr << format("# %.2f MiB/s read bandwidth, %.2f mean read queue depth\n")
+                % (wait_stats.readBandwidth() / (1024.0 * 1024.0))
+                % wait_stats.read_queue_depth.mean();
     }
     return 0;
 }
@@ -11,8 +11,10 @@ nettrace2ds - convert network traces into NFS packet and IP packet information
 
 =head1 SYNOPSIS
 
-% nettrace2ds --info --{erf|pcap} I<input file>
-% nettrace2ds [common-args] --convert --{erf|pcap} I<first-record-num> I<expected-record-count> I<output.ds> I<input>...
+% nettrace2ds [--parse-threads=N] --info --{erf|pcap} I<input file>
+% nettrace2ds [common-args] [--parse-threads=N] --convert --{erf|pcap} I<first-record-num> I<expected-record-count> I<output.ds> I<input>...
+% nettrace2ds [common-args] --capture --afpacket I<interface> I<output-prefix> I<rotate-seconds>
+% nettrace2ds [common-args] --capture --follow-pcap I<input.pcap> I<output-prefix> I<rotate-seconds>
 
 =head1 DESCRIPTION
 
@@ -30,28 +32,30 @@ separate groups.  In the second phase (--convert) the data is read and converted
 output.  The two phases allow the conversion to run in parallel on multiple cores, and even on
 separate machines.
 
+Within each phase, a reader thread copies batches of packets out of the input and
+--parse-threads=N threads (default half the cpus, up to 4) locate and hash the RPC requests in
+them.  The rest of the parsing matches replies with requests and assigns record ids, so it runs
+on one thread and sees the packets in trace order; the output does not depend on N.
+--parse-threads=0 reads and parses the packets on a single thread as before.
+
 =head1 EXAMPLES
 
 =head2 Bulk conversion with lindump-mmap...
 
 ...
 
-=head2 Continuous conversion with tcpdump...
+=head2 Continuous capture...
 
-# TODO: this process doesn't actually generate valid .ds files for analysis.
-# Likely fix is to change nettrace2ds.pm such that when the we are doing
-# conversion, we set finished_before to the first number we found, and we set
-# @nums to 0..last_num_found.  Then it should scan all the info files (and so
-# properly track the last record number), but not try to do a conversion on any
-# of the files we've already handled.
+In --capture mode, nettrace2ds reads packets as they arrive and converts them directly, without
+the separate info phase; record ids start at 0.  --afpacket reads from a TPACKET_V3 ring on the
+named interface, which it puts into promiscuous mode (this needs CAP_NET_RAW); --follow-pcap reads
+a pcap file that is still being appended to, which is mostly useful for testing.  Output goes to
+I<output-prefix>.I<start-seconds>.ds, with a new file started every I<rotate-seconds> seconds of
+packet time.  As each file is finished, nettrace2ds reports the packets per second and the
+number of packets the kernel dropped; the total is recorded as capture_drop in the statistics of
+the last file.  Capture stops on SIGINT or SIGTERM, after which the current file is completed.
 
-% sudo tcpdump -i eth0 -s 2000 -w /dev/shm/trace.pcap -C 1
-% CUR_FILES=`echo /dev/shm/trace.pcap*`
-% batch-parallel nettrace2ds info infodir=/tmp/info groupsize=1 -- ${=CUR_FILES}
-% batch-parallel nettrace2ds convert infodir=/tmp/info dsdir=/tmp/ds record-start=0 groupsize=1 -- ${=CUR_FILES}
-% sudo rm -f ${=CUR_FILES}
-# and repeat from the CUR_FILES line.  I tried it manually and it seemed
-# to work.
+% sudo nettrace2ds --capture --afpacket eth0 /var/tmp/trace 300
 
 =head1 BUGS
 
@@ -64,7 +68,9 @@ start of that packet was an nfs operation boundary.
 
 =item *
 
-The revision number of the code should be recorded in the output file
+The revision number of the code should be recorded in the output file.  Until this and the next
+item are done, and replies are matched with requests in a way that always cleans up, nettrace2ds
+stops with a TODO error unless the NETTRACE2DS_IGNORE_TODO environment variable is set.
 
 =item *
 
@@ -121,12 +127,18 @@ dataseries-utils(7), batch-parallel(1)
 #include <zlib.h>
 #include <bzlib.h>
 
+#include <poll.h>
+
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/statvfs.h>
 
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
@@ -134,6 +146,8 @@ dataseries-utils(7), batch-parallel(1)
 
 #include <string>
 
+#include <boost/bind.hpp>
+
 #include <Lintel/HashTable.hpp>
 #include <Lintel/AssertBoost.hpp>
 #include <Lintel/AssertException.hpp>
@@ -146,6 +160,7 @@ dataseries-utils(7), batch-parallel(1)
 
 #include <DataSeries/commonargs.hpp>
 #include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/RotatingFileSink.hpp>
 
 #include <process/nfs_prot.h>
 #include <DataSeries/cryptutil.hpp>
@@ -204,6 +219,7 @@ enum CountTypes {
     readdir_continuations_ignored,
     long_packets,
     long_packets_port_2049,
+    capture_drop,
     last_count // marker: maximum count of types
 };
 
@@ -244,12 +260,20 @@ string count_names[] = {
     "readdir_continuations_ignored",
     "long_packets_ignored",
     "long_packets_port_2049_ignored",
+    "capture_drop",
 };
 
 vector<int64_t> counts;
 
 static int exitvalue = 0;
 static string tracename;
+
+// Stops on a known gap in the conversion unless NETTRACE2DS_IGNORE_TODO is set, as
+// run-check-nettrace2ds.sh does so that the rest of the conversion can be tested.
+static void fatalTodo(const char *what) {
+    static const bool ignore_todo = getenv("NETTRACE2DS_IGNORE_TODO") != NULL;
+    INVARIANT(ignore_todo, format("TODO: %s") % what);
+}
 int cur_file_packet_num = 0;
 
 int64_t cur_record_id = -1000000000;
@@ -506,7 +530,7 @@ class ERFReader : public NettraceReader {
             counts[packet_loss] += ntohs(*reinterpret_cast<uint16_t *>(buffer_cur + 12));
             cerr << format("packet loss, %d packets in %s") 
                     % ntohs(*reinterpret_cast<uint16_t *>(buffer_cur + 12))
-                    % tracename
+                    % filename
                  << endl;
         }
 
@@ -673,6 +697,7 @@ class PCAPReader: public NettraceReader {
     bool eof, popened;
 };
 
+/// Reads the files in turn; filename is the name of the file currently being read.
 class MultiFileReader : public NettraceReader {
   public:
     MultiFileReader() : NettraceReader(""), started(false) { }
@@ -697,7 +722,7 @@ class MultiFileReader : public NettraceReader {
             started = true;
             cur_reader = readers.begin();
             INVARIANT(!readers.empty(), "bad");
-            tracename = (**cur_reader).filename.c_str();
+            filename = (**cur_reader).filename;
             for (unsigned i = 1;i<=prefetch_ahead_amount && i < readers.size(); ++i) {
                 cout << format("prefetching %d\n") % i;
                 readers[i]->prefetch();
@@ -711,7 +736,7 @@ class MultiFileReader : public NettraceReader {
             }
             ++cur_reader;
             if (cur_reader != readers.end()) {
-                tracename = (**cur_reader).filename.c_str();
+                filename = (**cur_reader).filename;
                 if (cur_reader + prefetch_ahead_amount < readers.end()) {
                     (**(cur_reader + prefetch_ahead_amount)).prefetch();
                 }
@@ -733,6 +758,256 @@ class MultiFileReader : public NettraceReader {
     bool started;
 };
     
+// Set by SIGINT/SIGTERM in --capture mode; the live readers then report EOF.
+static volatile sig_atomic_t stop_capture = 0;
+
+// Called by the live readers while they are waiting for packets, so that an idle link still
+// rotates files.
+void captureIdle();
+
+/// Base class for the --capture readers, which run until stop_capture is set.
+class LiveReader : public NettraceReader {
+  public:
+    LiveReader(const string &filename) : NettraceReader(filename) { }
+
+    virtual void prefetch() { }
+
+    /// Returns the number of packets the capture source dropped since the last call.
+    virtual uint64_t newDrops() { return 0; }
+
+  protected:
+    // packetHandler requires an ethernet and an IP header.
+    static const uint32_t min_capture_size = 14 + 20;
+};
+
+/// Reads packets from a TPACKET_V3 ring on an AF_PACKET socket.  The packet returned by
+/// nextPacket() points into the ring, and its block is handed back to the kernel on the next
+/// call after the last packet in the block.  Note that the kernel strips VLAN tags that were
+/// offloaded to the card, so packetHandler() sees those packets as untagged.
+class AFPacketReader : public LiveReader {
+  public:
+    // 64 MiB of ring; blocks are retired after 100ms even if they are not full so that packets
+    // on a quiet link are not held indefinitely.
+    static const uint32_t block_size = 1024 * 1024;
+    static const uint32_t block_count = 64;
+    static const uint32_t frame_size = 2048;
+    static const uint32_t block_timeout_ms = 100;
+
+    AFPacketReader(const string &ifname)
+        : LiveReader(ifname), fd(-1), ring(NULL), cur_block(0), block_packets(0), next_packet(NULL)
+    { }
+
+    virtual ~AFPacketReader() {
+        if (ring != NULL) {
+            INVARIANT(munmap(ring, block_size * block_count) == 0, "bad");
+        }
+        if (fd >= 0) {
+            INVARIANT(close(fd) == 0, "bad");
+        }
+    }
+
+    virtual bool nextPacket(unsigned char **packet_ptr, uint32_t *capture_size,
+                            uint32_t *wire_length, Clock::Tfrac *time) {
+#ifdef TPACKET3_HDRLEN
+        if (ring == NULL) {
+            open();
+        }
+        while (!stop_capture) {
+            tpacket_block_desc *block = blockAt(cur_block);
+            if (next_packet == NULL) {
+                if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+                    waitForBlock();
+                    continue;
+                }
+                block_packets = block->hdr.bh1.num_pkts;
+                next_packet = reinterpret_cast<unsigned char *>(block)
+                    + block->hdr.bh1.offset_to_first_pkt;
+            }
+            if (block_packets == 0) { // done with the block, give it back
+                __sync_synchronize();
+                block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+                cur_block = (cur_block + 1) % block_count;
+                next_packet = NULL;
+                continue;
+            }
+            tpacket3_hdr *hdr = reinterpret_cast<tpacket3_hdr *>(next_packet);
+            next_packet += hdr->tp_next_offset;
+            --block_packets;
+            ++cur_file_packet_num;
+            if (hdr->tp_snaplen < min_capture_size) {
+                ++counts[tiny_packet];
+                continue;
+            }
+            *packet_ptr = reinterpret_cast<unsigned char *>(hdr) + hdr->tp_mac;
+            *capture_size = hdr->tp_snaplen;
+            *wire_length = hdr->tp_len;
+            *time = Clock::secMicroToTfrac(hdr->tp_sec, hdr->tp_nsec / 1000);
+            return true;
+        }
+        return false;
+#else
+        FATAL_ERROR("nettrace2ds was built without TPACKET_V3 support");
+#endif
+    }
+
+    virtual uint64_t newDrops() {
+#ifdef TPACKET3_HDRLEN
+        if (fd < 0) {
+            return 0;
+        }
+        tpacket_stats_v3 stats; // the kernel resets these on every read
+        socklen_t len = sizeof(stats);
+        INVARIANT(getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0,
+                  format("unable to get packet statistics on %s: %s") % filename % strerror(errno));
+        return stats.tp_drops;
+#else
+        return 0;
+#endif
+    }
+
+  private:
+#ifdef TPACKET3_HDRLEN
+    void open() {
+        fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        INVARIANT(fd >= 0, format("unable to open packet socket: %s") % strerror(errno));
+
+        int version = TPACKET_V3;
+        INVARIANT(setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == 0,
+                  format("unable to select TPACKET_V3: %s") % strerror(errno));
+
+        tpacket_req3 req;
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = block_size;
+        req.tp_block_nr = block_count;
+        req.tp_frame_size = frame_size;
+        req.tp_frame_nr = (block_size / frame_size) * block_count;
+        req.tp_retire_blk_tov = block_timeout_ms;
+        INVARIANT(setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == 0,
+                  format("unable to set up the receive ring: %s") % strerror(errno));
+
+        void *mapped = mmap(NULL, block_size * block_count, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+        INVARIANT(mapped != MAP_FAILED, format("unable to mmap the receive ring: %s")
+                  % strerror(errno));
+        ring = reinterpret_cast<unsigned char *>(mapped);
+
+        unsigned ifindex = if_nametoindex(filename.c_str());
+        INVARIANT(ifindex != 0, format("unknown interface %s: %s") % filename % strerror(errno));
+        sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = ifindex;
+        INVARIANT(bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0,
+                  format("unable to bind to %s: %s") % filename % strerror(errno));
+
+        packet_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        INVARIANT(setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0,
+                  format("unable to make %s promiscuous: %s") % filename % strerror(errno));
+        cout << format("capturing on %s\n") % filename;
+    }
+
+    tpacket_block_desc *blockAt(uint32_t block) {
+        return reinterpret_cast<tpacket_block_desc *>(ring + block * block_size);
+    }
+
+    void waitForBlock() {
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, block_timeout_ms);
+        INVARIANT(ret >= 0 || errno == EINTR, format("poll failed on %s: %s")
+                  % filename % strerror(errno));
+        captureIdle();
+    }
+#endif
+
+    int fd;
+    unsigned char *ring;
+    uint32_t cur_block, block_packets;
+    unsigned char *next_packet;
+};
+
+/// Reads a pcap file that another program, e.g. tcpdump -U, is still appending to; a partially
+/// written packet at the end of the file is retried until it is complete.  Used to test
+/// --capture without a network interface.
+class FollowPCAPReader : public LiveReader {
+  public:
+    static const uint32_t retry_us = 100 * 1000;
+
+    FollowPCAPReader(const string &filename)
+        : LiveReader(filename), fd(-1), offset(0), packet_buf()
+    { }
+
+    virtual ~FollowPCAPReader() {
+        if (fd >= 0) {
+            INVARIANT(close(fd) == 0, "bad");
+        }
+    }
+
+    virtual bool nextPacket(unsigned char **packet_ptr, uint32_t *capture_size,
+                            uint32_t *wire_length, Clock::Tfrac *time) {
+        if (fd < 0) {
+            fd = open(filename.c_str(), O_RDONLY);
+            INVARIANT(fd >= 0, format("cannot open PCAP file %s: %s") % filename % strerror(errno));
+            cout << format("following file %s\n") % filename;
+            if (!readFully(&file_header, sizeof(file_header))) {
+                return false;
+            }
+            INVARIANT(file_header.magic == 0xa1b2c3d4, "??");
+            INVARIANT(file_header.version_major == 2 && file_header.version_minor == 4, "??");
+            packet_buf.resize(file_header.snaplen);
+        }
+        while (true) {
+            correct_pcap_pkthdr ph;
+            if (!readFully(&ph, sizeof(ph))) {
+                return false;
+            }
+            INVARIANT(ph.caplen <= file_header.snaplen,
+                      format("captured more than specified snapshot length %d > %d")
+                      % ph.caplen % file_header.snaplen);
+            if (!readFully(&packet_buf[0], ph.caplen)) {
+                return false;
+            }
+            ++cur_file_packet_num;
+            if (ph.caplen < min_capture_size) {
+                ++counts[tiny_packet];
+                continue;
+            }
+            *packet_ptr = &packet_buf[0];
+            *capture_size = ph.caplen;
+            *wire_length = ph.len;
+            *time = Clock::secMicroToTfrac(ph.tv_sec, ph.tv_usec);
+            return true;
+        }
+    }
+
+  private:
+    // Reads bytes at offset, waiting for the writer to append them, and advances offset past
+    // them.  Returns false if stop_capture is set first.
+    bool readFully(void *into, size_t bytes) {
+        while (!stop_capture) {
+            ssize_t ret = pread(fd, into, bytes, offset);
+            INVARIANT(ret >= 0, format("error reading %s: %s") % filename % strerror(errno));
+            if (static_cast<size_t>(ret) == bytes) {
+                offset += bytes;
+                return true;
+            }
+            usleep(retry_us);
+        }
+        return false;
+    }
+
+    pcap_file_header file_header;
+    int fd;
+    off64_t offset;
+    vector<unsigned char> packet_buf;
+};
+
 struct network_error_listT {
     ExtentType::int64 h_rid, v_rid;
     unsigned int h_hash, v_hash;
@@ -2639,6 +2914,28 @@ duplicateRequestCheck(RPCRequestData &d, RPCRequestData *hval)
     // since a response will match to the nearest request.
 }
 
+// The hash of an RPC request message, computed ahead of time by a ParsePipeline worker; offset
+// and length locate the message in its packet.
+struct PreparsedRequest {
+    uint32_t offset, length;
+    unsigned int hash;
+};
+
+// The requests preparsed for the packet being handled, if any.
+const unsigned char *preparsed_packet = NULL;
+const PreparsedRequest *preparsed_begin = NULL, *preparsed_end = NULL;
+
+unsigned int
+requestHash(const unsigned char *p, const unsigned char *pend)
+{
+    for (const PreparsedRequest *i = preparsed_begin; i != preparsed_end; ++i) {
+        if (preparsed_packet + i->offset == p && i->length == static_cast<uint32_t>(pend - p)) {
+            return i->hash;
+        }
+    }
+    return lintel::bobJenkinsHash(1972, p, pend - p);
+}
+
 void
 handleRPCRequest(Clock::Tfrac time, const struct iphdr *ip_hdr,
                  int source_port, int dest_port, int l4checksum, int payload_len,
@@ -2657,7 +2954,7 @@ handleRPCRequest(Clock::Tfrac time, const struct iphdr *ip_hdr,
     d.program = req.host_prognum();
     d.procnum = req.host_procnum();
     d.request_at = time;
-    d.rpcreqhashval = lintel::bobJenkinsHash(1972,p,pend-p);
+    d.rpcreqhashval = requestHash(p, pend);
     d.ipchecksum = ntohs(ip_hdr->check);
     d.l4checksum = l4checksum;
     d.reqdata = NULL;
@@ -2698,7 +2995,7 @@ handleRPCReply(Clock::Tfrac time, const struct iphdr *ip_hdr,
     RPCRequestData *req = rpcHashTable.lookup(RPCRequestData(ip_hdr->daddr,ip_hdr->saddr,reply.xid(),source_port));
         
     if (req != NULL) {
-        FATAL_ERROR("TODO: make this do a try, catch, rethrow bit so we can always cleanup the rpcHashTable.  We want to guarantee that each request is used exactly once, but if the reply processing finds a short message or a parse error, it can throw an exception avoiding cleanup.  Could also make a CleanupRPCRequest class, which is probably the better way to do this; may want to combine this with checksum verification, we saw this problem in nfs-2/set-5/000000-000499.ds with request 122897542333, responses 122897542350, 122897542357; also in nfs-2/set-4/001000-001499.ds with request 107266700514, responses 107266700523, 107266714386; both were on readdirplus, unknown what exactly is going on.");
+        fatalTodo("make this do a try, catch, rethrow bit so we can always cleanup the rpcHashTable.  We want to guarantee that each request is used exactly once, but if the reply processing finds a short message or a parse error, it can throw an exception avoiding cleanup.  Could also make a CleanupRPCRequest class, which is probably the better way to do this; may want to combine this with checksum verification, we saw this problem in nfs-2/set-5/000000-000499.ds with request 122897542333, responses 122897542350, 122897542357; also in nfs-2/set-4/001000-001499.ds with request 107266700514, responses 107266700523, 107266714386; both were on readdirplus, unknown what exactly is going on.");
         if (req->program == RPCRequest::host_prog_nfs) {
             handleNFSReply(time,ip_hdr,source_port,dest_port,l4checksum,payload_len,req,reply);
         } else if (req->program == RPCRequest::host_prog_mount) {
@@ -2996,7 +3293,77 @@ packetHandler(const unsigned char *packetdata, uint32_t capture_size, uint32_t w
         }
     }   
 }
- 
+
+void
+addPreparsedRequest(const unsigned char *packetdata, const unsigned char *p,
+                    const unsigned char *pend, vector<PreparsedRequest> &into)
+{
+    PreparsedRequest request;
+    request.offset = p - packetdata;
+    request.length = pend - p;
+    request.hash = lintel::bobJenkinsHash(1972, p, pend - p);
+    into.push_back(request);
+}
+
+// The part of packetHandler() that doesn't depend on earlier packets: find the RPC requests the
+// same way handleUDPPacket() and handleTCPPacket() will, and hash them.  Any request missed here
+// is hashed by requestHash() when the packet is handled, so this only has to be fast, not
+// complete.
+void
+preparseRequests(const unsigned char *packetdata, uint32_t capture_size,
+                 vector<PreparsedRequest> &into)
+{
+    if (capture_size < min_ethernet_header_length + min_ip_header_length) {
+        return;
+    }
+    const unsigned char *p = packetdata;
+    const unsigned char *pend = p + capture_size;
+
+    int ethtype = (p[12] << 8) | p[13];
+    p += min_ethernet_header_length;
+    if (ethtype == 0x8100) { // vlan
+        ethtype = p[2] << 8 | p[3];
+        p += 4;
+    }
+    if (ethtype != 0x800 || p + min_ip_header_length > pend) {
+        return;
+    }
+    const struct iphdr *ip_hdr = reinterpret_cast<const struct iphdr *>(p);
+    if (ip_hdr->version != 4 || (ntohs(ip_hdr->frag_off) & 0x1FFF) != 0) {
+        return;
+    }
+    p += ip_hdr->ihl * 4;
+
+    if (ip_hdr->protocol == IPPROTO_UDP) {
+        p += 8;
+        if (p + 2*4 + 2*4 <= pend && reinterpret_cast<const uint32_t *>(p)[1] == 0) {
+            addPreparsedRequest(packetdata, p, pend, into);
+        }
+    } else if (ip_hdr->protocol == IPPROTO_TCP && p + sizeof(struct tcphdr) <= pend) {
+        const struct tcphdr *tcp_hdr = reinterpret_cast<const struct tcphdr *>(p);
+        if (tcp_hdr->doff * 4 < static_cast<int>(sizeof(struct tcphdr))) {
+            return;
+        }
+        p += tcp_hdr->doff * 4;
+        while (p + 4 + 2*4 <= pend) {
+            uint32_t rpclen = ntohl(*reinterpret_cast<const uint32_t *>(p));
+            if ((rpclen & 0x80000000) == 0) {
+                return;
+            }
+            rpclen &= 0x7FFFFFFF;
+            p += 4;
+            const unsigned char *thismsgend = (p + rpclen) > pend ? pend : p + rpclen;
+            uint32_t direction = reinterpret_cast<const uint32_t *>(p)[1];
+            if (direction == 0) {
+                addPreparsedRequest(packetdata, p, thismsgend, into);
+            } else if (direction != RPC::net_reply) {
+                return;
+            }
+            p = thismsgend;
+        }
+    }
+}
+
 int
 get_max_missing_request_count(const char *tracename)
 {
@@ -3013,43 +3380,316 @@ freeDiskBytes(const char *outputname)
     return static_cast<unsigned long long>(buf.f_bavail) * buf.f_bsize;
 }
 
+/// Rotates the --capture output to a new file every rotate_seconds of packet time, and reports
+/// the packet rate and drops for each file.
+class CaptureRotator {
+  public:
+    CaptureRotator(RotatingFileSink &sink, LiveReader &reader, const string &prefix,
+                   int32_t rotate_seconds)
+        : sink(sink), reader(reader), prefix(prefix), rotate_seconds(rotate_seconds),
+          interval_end(0), cur_filename(), report_start(Clock::tod()), report_packets(0)
+    {
+        INVARIANT(rotate_seconds > 0, "rotation interval must be positive");
+    }
+
+    /// Opens the first file, or rotates to a new one if time is past the current interval.
+    void checkTime(Clock::Tfrac time) {
+        int64_t seconds = Clock::TfracToSec(time);
+        if (interval_end == 0) {
+            changeFile(seconds);
+        } else if (seconds >= interval_end) {
+            // Everything from the previous interval belongs in the previous file.
+            flushOutputModules();
+            report();
+            changeFile(seconds);
+        }
+    }
+
+    /// Called after the last packet; the summary statistics go into the current file.
+    void finish() {
+        if (interval_end == 0) {
+            changeFile(Clock::TfracToSec(Clock::todTfrac()));
+        }
+        report();
+    }
+
+  private:
+    void changeFile(int64_t seconds) {
+        int64_t start = seconds - seconds % rotate_seconds;
+        interval_end = start + rotate_seconds;
+        cur_filename = str(format("%s.%d.ds") % prefix % start);
+        sink.waitForCanChange();
+        sink.changeFile(cur_filename);
+    }
+
+    void report() {
+        Clock::Tdbl now = Clock::tod();
+        uint64_t drops = reader.newDrops();
+        counts[capture_drop] += drops;
+        int64_t packets = counts[packet_count] - report_packets;
+        double elapsed = now - report_start;
+        cout << format("%s: %d packets in %.1fs, %.0f packets/s, %d dropped")
+                % cur_filename % packets % elapsed % (elapsed > 0 ? packets / elapsed : 0.0)
+                % drops
+             << endl;
+        report_start = now;
+        report_packets = counts[packet_count];
+    }
+
+    RotatingFileSink &sink;
+    LiveReader &reader;
+    const string prefix;
+    const int32_t rotate_seconds;
+    int64_t interval_end;
+    string cur_filename;
+    Clock::Tdbl report_start;
+    int64_t report_packets;
+};
+
+CaptureRotator *capture_rotator = NULL;
+
 void
-doProcess(NettraceReader *from, const char *outputname)
+captureIdle()
 {
-    unsigned char *packet;
-    uint32_t capture_size, wire_length;
-    Clock::Tfrac time;
+    if (capture_rotator != NULL) {
+        capture_rotator->checkTime(Clock::todTfrac());
+    }
+}
 
-    prepareBandwidthInformation();
-    while (from->nextPacket(&packet, &capture_size, &wire_length, &time)) {
-        if (file_type == ERF) {
-            // for ERF packets, full packets are typically captured, 
-            // hence wire_length should = capture_size; however, capture_size 
-            // is rounded to 8 bytes, hence wire_length could be < capture_size
-            INVARIANT(wire_length <= capture_size, "bad");
-            if (wire_length < 64) {
-                cout << format("weird tiny packet length %d") % wire_length
-                     << endl;
-                ++counts[tiny_packet];
+/// Moves reading packets and preparseRequests() off the thread running packetHandler(), which
+/// has to see the packets in order since it matches replies with requests and assigns the
+/// record ids.  A reader thread copies the packets into batches, the workers preparse whole
+/// batches, and nextBatch() returns the batches in the order they were read, so the output is
+/// the same as reading the packets directly.
+class ParsePipeline {
+  public:
+    struct Packet {
+        uint32_t offset, capture_size, wire_length;
+        Clock::Tfrac time;
+        uint32_t requests_begin, requests_end; // preparsed requests in Batch::requests
+    };
+
+    struct Batch {
+        string filename; // file the packets were read from
+        vector<unsigned char> data;
+        vector<Packet> packets;
+        vector<PreparsedRequest> requests;
+        bool in_progress, parsed;
+        Batch() : filename(), data(), packets(), requests(), in_progress(false), parsed(false) { }
+    };
+
+    static const size_t batch_packets = 4096;
+
+    ParsePipeline(NettraceReader *from, unsigned nworkers)
+        : from(from), max_batches(4 * nworkers), mutex(), work_cond(), ready_cond(),
+          space_cond(), batches(), eof(false), stopping(false), reader(NULL), workers()
+    {
+        INVARIANT(nworkers > 0, "?");
+        reader = new PThreadFunction(boost::bind(&ParsePipeline::readerThread, this));
+        reader->start();
+        for (unsigned i = 0; i < nworkers; ++i) {
+            workers.push_back(new PThreadFunction(boost::bind(&ParsePipeline::workerThread,
+                                                              this)));
+            workers.back()->start();
+        }
+    }
+
+    ~ParsePipeline() {
+        {
+            PThreadScopedLock lock(mutex);
+            SINVARIANT(eof && batches.empty());
+            stopping = true;
+            work_cond.broadcast();
+        }
+        reader->join();
+        delete reader;
+        for (vector<PThreadFunction *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+            (**i).join();
+            delete *i;
+        }
+    }
+
+    /// Returns the next batch, which the caller deletes, or NULL after the last one.
+    Batch *nextBatch() {
+        PThreadScopedLock lock(mutex);
+        while (batches.empty() ? !eof : !batches.front()->parsed) {
+            ready_cond.wait(mutex);
+        }
+        if (batches.empty()) {
+            return NULL;
+        }
+        Batch *ret = batches.front();
+        batches.pop_front();
+        space_cond.signal();
+        return ret;
+    }
+
+  private:
+    void *readerThread() {
+        unsigned char *packet;
+        uint32_t capture_size, wire_length;
+        Clock::Tfrac time;
+        Batch *batch = NULL;
+
+        while (from->nextPacket(&packet, &capture_size, &wire_length, &time)) {
+            if (batch != NULL && (batch->packets.size() == batch_packets
+                                  || batch->filename != from->filename)) {
+                queueBatch(batch);
+                batch = NULL;
+            }
+            if (batch == NULL) {
+                batch = new Batch();
+                batch->filename = from->filename;
+                batch->packets.reserve(batch_packets);
+            }
+            Packet p;
+            // keep the packets 8 byte aligned, as they would be in the readers' buffers
+            p.offset = (batch->data.size() + 7) & ~7;
+            p.capture_size = capture_size;
+            p.wire_length = wire_length;
+            p.time = time;
+            batch->data.resize(p.offset + capture_size);
+            memcpy(&batch->data[p.offset], packet, capture_size);
+            batch->packets.push_back(p);
+        }
+        if (batch != NULL) {
+            queueBatch(batch);
+        }
+        PThreadScopedLock lock(mutex);
+        eof = true;
+        ready_cond.broadcast();
+        return NULL;
+    }
+
+    void queueBatch(Batch *batch) {
+        PThreadScopedLock lock(mutex);
+        while (batches.size() >= max_batches) {
+            space_cond.wait(mutex);
+        }
+        batches.push_back(batch);
+        work_cond.signal();
+    }
+
+    void *workerThread() {
+        PThreadScopedLock lock(mutex);
+        while (!stopping) {
+            Batch *batch = NULL;
+            for (Deque<Batch *>::iterator i = batches.begin(); i != batches.end(); ++i) {
+                if (!(**i).in_progress && !(**i).parsed) {
+                    batch = *i;
+                    break;
+                }
+            }
+            if (batch == NULL) {
+                work_cond.wait(mutex);
                 continue;
             }
-        } else if (file_type == PCAP) {
-            INVARIANT(wire_length >= capture_size, "bad packet, wire_length shouldn't < capture_size");
-        } else {
-            FATAL_ERROR("nuh uh");
-        }
-        packetHandler(packet, capture_size, wire_length, time);
-        if ((outputname != NULL) && (counts[packet_count] & 0x1FFFFF) == 0) { 
-            // every 2 million packets
-            while (freeDiskBytes(outputname) < 1024*1024*1024) {
-                cerr << "Pausing in conversion, free disk space < 1GiB" 
-                     << endl;
-                sleep(300);
+            batch->in_progress = true;
+            {
+                PThreadScopedUnlock unlock(lock);
+                for (vector<Packet>::iterator i = batch->packets.begin();
+                     i != batch->packets.end(); ++i) {
+                    i->requests_begin = batch->requests.size();
+                    preparseRequests(&batch->data[i->offset], i->capture_size, batch->requests);
+                    i->requests_end = batch->requests.size();
+                }
             }
-            cout << format("Free disk bytes: %d") 
-                    % freeDiskBytes(outputname)
+            batch->in_progress = false;
+            batch->parsed = true;
+            ready_cond.broadcast();
+        }
+        return NULL;
+    }
+
+    NettraceReader *from;
+    const size_t max_batches;
+
+    PThreadMutex mutex;
+    PThreadCond work_cond, ready_cond, space_cond;
+    Deque<Batch *> batches; // in the order they were read
+    bool eof, stopping;
+
+    PThreadFunction *reader;
+    vector<PThreadFunction *> workers;
+};
+
+// Number of ParsePipeline workers; 0 handles the packets as they are read.
+int parse_threads = -1;
+
+void
+processPacket(const unsigned char *packet, uint32_t capture_size, uint32_t wire_length,
+              Clock::Tfrac time, const char *outputname)
+{
+    if (file_type == ERF) {
+        // for ERF packets, full packets are typically captured, 
+        // hence wire_length should = capture_size; however, capture_size 
+        // is rounded to 8 bytes, hence wire_length could be < capture_size
+        INVARIANT(wire_length <= capture_size, "bad");
+        if (wire_length < 64) {
+            cout << format("weird tiny packet length %d") % wire_length
                  << endl;
+            ++counts[tiny_packet];
+            return;
         }
+    } else if (file_type == PCAP) {
+        INVARIANT(wire_length >= capture_size, "bad packet, wire_length shouldn't < capture_size");
+    } else {
+        FATAL_ERROR("nuh uh");
+    }
+    if (capture_rotator != NULL) {
+        capture_rotator->checkTime(time);
+    }
+    packetHandler(packet, capture_size, wire_length, time);
+    if ((outputname != NULL) && (counts[packet_count] & 0x1FFFFF) == 0) { 
+        // every 2 million packets
+        while (freeDiskBytes(outputname) < 1024*1024*1024) {
+            cerr << "Pausing in conversion, free disk space < 1GiB" 
+                 << endl;
+            sleep(300);
+        }
+        cout << format("Free disk bytes: %d") 
+                % freeDiskBytes(outputname)
+             << endl;
+    }
+}
+
+void
+doProcess(NettraceReader *from, const char *outputname)
+{
+    prepareBandwidthInformation();
+    // The live readers call captureIdle(), which rotates files, so they stay on this thread.
+    if (parse_threads > 0 && capture_rotator == NULL) {
+        ParsePipeline pipeline(from, parse_threads);
+        while (ParsePipeline::Batch *batch = pipeline.nextBatch()) {
+            tracename = batch->filename;
+            for (vector<ParsePipeline::Packet>::iterator i = batch->packets.begin();
+                 i != batch->packets.end(); ++i) {
+                preparsed_packet = &batch->data[i->offset];
+                if (i->requests_begin != i->requests_end) {
+                    preparsed_begin = &batch->requests[0] + i->requests_begin;
+                    preparsed_end = &batch->requests[0] + i->requests_end;
+                }
+                processPacket(preparsed_packet, i->capture_size, i->wire_length, i->time,
+                              outputname);
+                preparsed_begin = preparsed_end = NULL;
+            }
+            preparsed_packet = NULL;
+            delete batch;
+        }
+    } else {
+        unsigned char *packet;
+        uint32_t capture_size, wire_length;
+        Clock::Tfrac time;
+
+        while (from->nextPacket(&packet, &capture_size, &wire_length, &time)) {
+            if (from->filename != tracename) {
+                tracename = from->filename;
+            }
+            processPacket(packet, capture_size, wire_length, time, outputname);
+        }
+    }
+    if (capture_rotator != NULL) {
+        capture_rotator->finish();
     }
     delete from;
     for (rpcHashTableT::iterator i = rpcHashTable.begin();
@@ -3091,65 +3731,59 @@ doInfo(NettraceReader *from)
     exit(exitvalue);
 }
 
-void
-doConvert(NettraceReader *from, const char *ds_output_name, 
-          commonPackingArgs &packing_args, uint64_t expected_records)
-{
-    mode = Convert;
+const ExtentType::Ptr registerOutputType(ExtentTypeLibrary &library, const string &xml) {
+    return library.registerTypePtr(xml);
+}
 
-    DataSeriesSink *nfsdsout = new DataSeriesSink(ds_output_name, 
-                                                  packing_args.compress_modes, 
-                                                  packing_args.compress_level);
-    ExtentTypeLibrary library;
+const ExtentType::Ptr registerOutputType(RotatingFileSink &sink, const string &xml) {
+    return sink.registerType(xml);
+}
 
-    const ExtentType::Ptr nfs_convert_stats_type(library.registerTypePtr(nfs_convert_stats_xml));
+// Registry is where the output types are registered: the library for a DataSeriesSink, or the
+// RotatingFileSink itself.
+template<class Registry> void
+makeOutputModules(dataseries::IExtentSink &sink, Registry &registry, int extent_size)
+{
+    const ExtentType::Ptr nfs_convert_stats_type(registerOutputType(registry,
+                                                                     nfs_convert_stats_xml));
     nfs_convert_stats_series.setType(nfs_convert_stats_type);
     nfs_convert_stats_outmodule = 
-            new OutputModule(*nfsdsout, nfs_convert_stats_series,
-                             nfs_convert_stats_type, packing_args.extent_size);
+            new OutputModule(sink, nfs_convert_stats_series, nfs_convert_stats_type, extent_size);
 
-    const ExtentType::Ptr ip_bwrolling_type(library.registerTypePtr(ip_bwrolling_xml));
+    const ExtentType::Ptr ip_bwrolling_type(registerOutputType(registry, ip_bwrolling_xml));
     ip_bwrolling_series.setType(ip_bwrolling_type);
     ip_bwrolling_outmodule 
-            = new OutputModule(*nfsdsout, ip_bwrolling_series,
-                               ip_bwrolling_type, packing_args.extent_size);
+            = new OutputModule(sink, ip_bwrolling_series, ip_bwrolling_type, extent_size);
 
-    const ExtentType::Ptr nfs_common_type(library.registerTypePtr(nfs_common_xml));
+    const ExtentType::Ptr nfs_common_type(registerOutputType(registry, nfs_common_xml));
     nfs_common_series.setType(nfs_common_type);
     nfs_common_outmodule 
-            = new OutputModule(*nfsdsout,nfs_common_series,
-                               nfs_common_type,packing_args.extent_size);
+            = new OutputModule(sink, nfs_common_series, nfs_common_type, extent_size);
 
-    const ExtentType::Ptr nfs_attrops_type(library.registerTypePtr(nfs_attrops_xml));
+    const ExtentType::Ptr nfs_attrops_type(registerOutputType(registry, nfs_attrops_xml));
     nfs_attrops_series.setType(nfs_attrops_type);
     nfs_attrops_outmodule 
-            = new OutputModule(*nfsdsout, nfs_attrops_series,
-                               nfs_attrops_type,packing_args.extent_size);
+            = new OutputModule(sink, nfs_attrops_series, nfs_attrops_type, extent_size);
 
-    const ExtentType::Ptr nfs_readwrite_type(library.registerTypePtr(nfs_readwrite_xml));
+    const ExtentType::Ptr nfs_readwrite_type(registerOutputType(registry, nfs_readwrite_xml));
     nfs_readwrite_series.setType(nfs_readwrite_type);
     nfs_readwrite_outmodule 
-            = new OutputModule(*nfsdsout, nfs_readwrite_series,
-                               nfs_readwrite_type,packing_args.extent_size);
+            = new OutputModule(sink, nfs_readwrite_series, nfs_readwrite_type, extent_size);
 
-    const ExtentType::Ptr ippacket_type(library.registerTypePtr(ippacket_xml));
+    const ExtentType::Ptr ippacket_type(registerOutputType(registry, ippacket_xml));
     ippacket_series.setType(ippacket_type);
     ippacket_outmodule 
-            = new OutputModule(*nfsdsout, ippacket_series,
-                               ippacket_type, packing_args.extent_size);
+            = new OutputModule(sink, ippacket_series, ippacket_type, extent_size);
 
-    const ExtentType::Ptr nfs_mount_type(library.registerTypePtr(nfs_mount_xml));
+    const ExtentType::Ptr nfs_mount_type(registerOutputType(registry, nfs_mount_xml));
     nfs_mount_series.setType(nfs_mount_type);
     nfs_mount_outmodule 
-            = new OutputModule(*nfsdsout, nfs_mount_series,
-                               nfs_mount_type, packing_args.extent_size);
-
-    nfsdsout->writeExtentLibrary(library);
+            = new OutputModule(sink, nfs_mount_series, nfs_mount_type, extent_size);
+}
 
-    doProcess(from, ds_output_name);
-    
-    // Want complete statistics, so flush first
-    cout << "flushing extents...\n";
+void
+flushOutputModules()
+{
     nfs_convert_stats_outmodule->flushExtent();
     ip_bwrolling_outmodule->flushExtent();
     nfs_common_outmodule->flushExtent();
@@ -3157,6 +3791,14 @@ doConvert(NettraceReader *from, const char *ds_output_name,
     nfs_readwrite_outmodule->flushExtent();
     ippacket_outmodule->flushExtent();
     nfs_mount_outmodule->flushExtent();
+}
+
+void
+finishOutputModules()
+{
+    // Want complete statistics, so flush first
+    cout << "flushing extents...\n";
+    flushOutputModules();
 
     cout << "Extent statistics:\n";
     nfs_convert_stats_outmodule->printStats(cout); cout << endl;
@@ -3174,6 +3816,24 @@ doConvert(NettraceReader *from, const char *ds_output_name,
     delete nfs_readwrite_outmodule;
     delete ippacket_outmodule;
     delete nfs_mount_outmodule;
+}
+
+void
+doConvert(NettraceReader *from, const char *ds_output_name, 
+          commonPackingArgs &packing_args, uint64_t expected_records)
+{
+    mode = Convert;
+
+    DataSeriesSink *nfsdsout = new DataSeriesSink(ds_output_name, 
+                                                  packing_args.compress_modes, 
+                                                  packing_args.compress_level);
+    ExtentTypeLibrary library;
+    makeOutputModules(*nfsdsout, library, packing_args.extent_size);
+    nfsdsout->writeExtentLibrary(library);
+
+    doProcess(from, ds_output_name);
+
+    finishOutputModules();
     delete nfsdsout;
 
     INVARIANT((cur_record_id + 1 - first_record_id) == static_cast<int64_t>(expected_records),
@@ -3182,6 +3842,40 @@ doConvert(NettraceReader *from, const char *ds_output_name,
     exit(exitvalue);
 }
 
+void
+stopCapture(int)
+{
+    stop_capture = 1;
+}
+
+void
+doCapture(LiveReader *from, const string &output_prefix, int32_t rotate_seconds,
+          commonPackingArgs &packing_args)
+{
+    mode = Convert;
+
+    RotatingFileSink sink(packing_args.compress_modes, packing_args.compress_level);
+    makeOutputModules(sink, sink, packing_args.extent_size);
+
+    CaptureRotator rotator(sink, *from, output_prefix, rotate_seconds);
+    capture_rotator = &rotator;
+    signal(SIGINT, stopCapture);
+    signal(SIGTERM, stopCapture);
+
+    string::size_type slash = output_prefix.rfind('/');
+    string output_dir = slash == string::npos ? "." : output_prefix.substr(0, slash + 1);
+    doProcess(from, output_dir.c_str());
+
+    // RotatingFileSink can't report per module statistics or remove their stats updates, so
+    // unlike finishOutputModules() just flush the modules and finish the last file; the
+    // modules are left for exit() to clean up.
+    cout << "flushing extents...\n";
+    flushOutputModules();
+    capture_rotator = NULL;
+    sink.close();
+    exit(exitvalue);
+}
+
 void
 check_file_missing(const string &filename)
 {
@@ -3300,8 +3994,8 @@ void testBWRolling() {
 
 
 int main(int argc, char **argv) {
-    FATAL_ERROR("TODO: stamp the revision into the output file");
-    FATAL_ERROR("TODO: add in the raw RPC size, and the packet overhead, so we can do a proper accounting w.r.t the IP table");
+    fatalTodo("stamp the revision into the output file");
+    fatalTodo("add in the raw RPC size, and the packet overhead, so we can do a proper accounting w.r.t the IP table");
     if (false) testBWRolling();
     if (argc == 4 && strcmp(argv[1],"--uncompress") == 0) {
         uncompressFile(argv[2],argv[3]);
@@ -3322,6 +4016,52 @@ int main(int argc, char **argv) {
     INVARIANT(enable_encrypt_filenames || getenv("DISABLE_ENCRYPTION") != NULL, 
               "enable_encrypt_filenames must be true or DISABLE_ENCRYPTION env variable set");
 
+    // Take out --parse-threads=N before the positional arguments are looked at.
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--parse-threads=", 16) == 0) {
+            parse_threads = stringToInteger<int32_t>(argv[i] + 16);
+            INVARIANT(parse_threads >= 0, format("invalid %s") % argv[i]);
+            for (int j = i; j + 1 < argc; ++j) {
+                argv[j] = argv[j + 1];
+            }
+            --argc;
+            break;
+        }
+    }
+    if (parse_threads == -1) {
+        parse_threads = min(PThreadMisc::getNCpus(), 8) / 2;
+    }
+
+    // common args come before --capture, so look for it rather than checking argv[1]
+    bool capture = false;
+    for (int i = 1; i < argc; ++i) {
+        capture = capture || strcmp(argv[i], "--capture") == 0;
+    }
+    if (capture) {
+        commonPackingArgs packing_args;
+        getPackingArgs(&argc, argv, &packing_args);
+        INVARIANT(argc == 6 && strcmp(argv[1], "--capture") == 0,
+                  "Wrong arguments to --capture; try -h for usage");
+        if (enable_encrypt_filenames) {
+            prepareEncryptEnvOrRandom();
+        }
+        first_record_id = 0;
+        cur_record_id = -1;
+        file_type = PCAP;
+
+        LiveReader *reader = NULL;
+        if (strcmp(argv[2], "--afpacket") == 0) {
+            reader = new AFPacketReader(argv[3]);
+        } else if (strcmp(argv[2], "--follow-pcap") == 0) {
+            reader = new FollowPCAPReader(argv[3]);
+        } else {
+            FATAL_ERROR(format("expecting --afpacket or --follow-pcap after --capture, not %s")
+                        % argv[2]);
+        }
+        tracename = argv[3];
+        doCapture(reader, argv[4], stringToInteger<int32_t>(argv[5]), packing_args);
+    }
+
     if (argc >= 4) {
         bool info = strcmp(argv[1], "--info") == 0;
         bool conv = strcmp(argv[1], "--convert") == 0;
@@ -3378,6 +4118,8 @@ int main(int argc, char **argv) {
                 "       --info --erf <input-erf...>\n"
                 "       --info --pcap <input-pcap...>\n"
                 "       --convert --erf <first-record-num> <expected-record-count> <output-ds-name> <input-erf...>\n"
-                "       --convert --pcap <first-record-num> <expected-record-count> <output-ds-name> <input-pcap...>\n");
+                "       --convert --pcap <first-record-num> <expected-record-count> <output-ds-name> <input-pcap...>\n"
+                "       --capture --afpacket <interface> <output-prefix> <rotate-seconds>\n"
+                "       --capture --follow-pcap <input-pcap> <output-prefix> <rotate-seconds>\n");
 }
 
@@ -0,0 +1,87 @@
+#include <DataSeries/DataSeriesSource.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include "DSSModule.hpp"
+#include "ExtentCache.hpp"
+
+/* Reads a table through the extent cache.  On the first call the table's index is checked; if
+   every extent of the table's type is cached, they are returned from the cache, otherwise the
+   file is read through a TypeIndexModule and each extent is added to the cache as it passes.
+   Serving a partially cached table from both places would need the uncached extents to be read
+   one at a time, losing the TypeIndexModule prefetching, and partial presence only happens
+   after evictions, so it isn't worth doing. */
+class CachedTableModule : public DataSeriesModule {
+  public:
+    CachedTableModule(ExtentCache &cache, const string &table, uint64_t generation,
+                      const string &path, const string &type_name)
+        : cache(cache), table(table), generation(generation), path(path), type_name(type_name),
+          started(false), cached(), next_cached(0), input()
+    { }
+
+    virtual ~CachedTableModule() {
+        if (input != NULL) {
+            input->close(); // stops the prefetching of a table that wasn't read to the end
+        }
+    }
+
+    virtual Extent::Ptr getSharedExtent() {
+        if (!started) {
+            start();
+        }
+        if (input == NULL) {
+            if (next_cached == cached.size()) {
+                cached.clear(); // don't pin the extents after the last one is returned
+                next_cached = 0;
+                return Extent::Ptr();
+            }
+            return cached[next_cached++];
+        }
+        Extent::Ptr e(input->getSharedExtent());
+        if (e != NULL) {
+            cache.insert(table, generation, e->extent_source_offset, e);
+        }
+        return e;
+    }
+
+  private:
+    void start() {
+        started = true;
+        DataSeriesSource source(path);
+        INVARIANT(source.index_extent != NULL, format("%s has no index extent") % path);
+        ExtentSeries index(source.index_extent);
+        Int64Field offset(index, "offset");
+        Variable32Field extent_type(index, "extenttype");
+        for (; index.morerecords(); ++index) {
+            if (extent_type.equal(type_name)) {
+                Extent::Ptr e(cache.lookup(table, generation, offset.val()));
+                if (e == NULL) {
+                    cached.clear();
+                    break;
+                }
+                cached.push_back(e);
+            }
+        }
+        if (!index.morerecords()) {
+            LintelLogDebug("CachedTableModule", format("%s: %d extents from cache")
+                           % table % cached.size());
+            return;
+        }
+        input.reset(new TypeIndexModule(type_name));
+        input->addSource(path);
+    }
+
+    ExtentCache &cache;
+    const string table;
+    const uint64_t generation;
+    const string path, type_name;
+    bool started;
+    vector<Extent::Ptr> cached;
+    size_t next_cached;
+    scoped_ptr<TypeIndexModule> input;
+};
+
+DataSeriesModule::Ptr dataseries::makeCachedTableModule
+(ExtentCache &cache, const string &table, uint64_t generation, const string &path,
+ const string &type_name) {
+    return DataSeriesModule::Ptr(new CachedTableModule(cache, table, generation, path, type_name));
+}
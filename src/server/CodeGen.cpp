@@ -0,0 +1,202 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include <Lintel/LintelLog.hpp>
+
+#include "CodeGen.hpp"
+
+using namespace std;
+using boost::format;
+
+#ifndef DATASERIES_CODEGEN_CXX
+#define DATASERIES_CODEGEN_CXX "c++"
+#endif
+
+namespace {
+    const char *codegen_flags = "-O2 -fPIC -shared";
+
+    // FNV-1a; only used to name the cache files, the source is checked on load.
+    uint64_t sourceHash(const string &source) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < source.size(); ++i) {
+            hash = (hash ^ static_cast<uint8_t>(source[i])) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    bool readFile(const string &path, string &into) {
+        ifstream in(path.c_str());
+        if (!in.good()) {
+            return false;
+        }
+        into.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        return !in.bad();
+    }
+
+    // The output of the compiler's --version, or "" if it can't be run.
+    string compilerVersion() {
+        string command(str(format("%s --version 2>/dev/null") % DATASERIES_CODEGEN_CXX));
+        FILE *pipe = popen(command.c_str(), "r");
+        if (pipe == NULL) {
+            return string();
+        }
+        string ret;
+        char buf[256];
+        size_t amt;
+        while ((amt = fread(buf, 1, sizeof(buf), pipe)) > 0) {
+            ret.append(buf, amt);
+        }
+        return pclose(pipe) == 0 ? ret : string();
+    }
+
+    // Prefixes each line of text with "// ".
+    string commentLines(const string &text) {
+        string ret;
+        for (size_t begin = 0; begin < text.size(); ) {
+            size_t end = text.find('\n', begin);
+            end = end == string::npos ? text.size() : end + 1;
+            ret.append("// ").append(text, begin, end - begin);
+            if (ret[ret.size() - 1] != '\n') {
+                ret.push_back('\n');
+            }
+            begin = end;
+        }
+        return ret;
+    }
+}
+
+namespace dataseries {
+
+CodeGen &CodeGen::instance() {
+    // Deliberately never deleted, shared objects stay loaded until exit.
+    static CodeGen *codegen = new CodeGen();
+    return *codegen;
+}
+
+CodeGen::CodeGen()
+    : mutex(), enabled(true), cache_dir("codegen"), compiler_header(), loaded(), stats() { }
+
+CodeGen::~CodeGen() {
+    FATAL_ERROR("CodeGen should never be destroyed");
+}
+
+void CodeGen::setEnabled(bool enabled) {
+    PThreadScopedLock lock(mutex);
+    this->enabled = enabled;
+}
+
+void CodeGen::setCacheDirectory(const string &dir) {
+    SINVARIANT(!dir.empty());
+    PThreadScopedLock lock(mutex);
+    cache_dir = dir;
+}
+
+void *CodeGen::load(const string &source, const string &symbol) {
+    PThreadScopedLock lock(mutex);
+    if (!enabled) {
+        return NULL;
+    }
+    pair<string, string> key(source, symbol);
+    map<pair<string, string>, void *>::iterator i = loaded.find(key);
+    if (i != loaded.end()) {
+        ++stats.memory_hits;
+        return i->second;
+    }
+    void *ret = lockedCompileAndOpen(source, symbol);
+    if (ret == NULL) {
+        ++stats.failures;
+    }
+    loaded[key] = ret; // remember failures too, recompiling would fail the same way
+    return ret;
+}
+
+CodeGen::Stats CodeGen::getStats() {
+    PThreadScopedLock lock(mutex);
+    return stats;
+}
+
+void *CodeGen::lockedCompileAndOpen(const string &generated, const string &symbol) {
+    if (mkdir(cache_dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        LintelLog::warn(format("codegen: unable to create %s: %s") % cache_dir % strerror(errno));
+        return NULL;
+    }
+    if (compiler_header.empty()) {
+        string version(compilerVersion());
+        if (version.empty()) {
+            LintelLog::warn(format("codegen: unable to run %s --version")
+                            % DATASERIES_CODEGEN_CXX);
+            return NULL;
+        }
+        compiler_header = str(format("// compiler: %s\n// flags: %s\n%s")
+                              % DATASERIES_CODEGEN_CXX % codegen_flags % commentLines(version));
+    }
+    // The compiler, its version and the flags are part of the saved source, and so of the
+    // cache key, so shared objects built by a different compiler are never reused.
+    const string source(compiler_header + generated);
+    string base(str(format("%s/gen-%016x") % cache_dir % sourceHash(source)));
+    string source_path(base + ".cpp"), so_path(base + ".so");
+
+    // A hash collision, or a crash between writing the source and compiling it, would leave
+    // a shared object that doesn't match; only reuse it if the saved source is identical.
+    string cached_source;
+    struct stat stat_buf;
+    if (readFile(source_path, cached_source) && cached_source == source
+        && stat(so_path.c_str(), &stat_buf) == 0) {
+        ++stats.disk_hits;
+    } else {
+        string tmp_source(str(format("%s.%d.cpp") % base % getpid()));
+        string tmp_so(str(format("%s.%d.so") % base % getpid()));
+        string log_path(base + ".log");
+        {
+            ofstream out(tmp_source.c_str());
+            out << source;
+            out.close();
+            if (!out.good()) {
+                LintelLog::warn(format("codegen: unable to write %s") % tmp_source);
+                return NULL;
+            }
+        }
+        string command(str(format("%s %s -o %s %s > %s 2>&1") % DATASERIES_CODEGEN_CXX
+                           % codegen_flags % tmp_so % tmp_source % log_path));
+        LintelLogDebug("CodeGen", format("compiling: %s") % command);
+        ++stats.compiles;
+        int ret = system(command.c_str());
+        if (ret != 0) {
+            LintelLog::warn(format("codegen: compile failed (%d), see %s") % ret % log_path);
+            unlink(tmp_source.c_str());
+            unlink(tmp_so.c_str());
+            return NULL;
+        }
+        // the shared object goes first so a matching source always has its shared object.
+        if (rename(tmp_so.c_str(), so_path.c_str()) != 0
+            || rename(tmp_source.c_str(), source_path.c_str()) != 0) {
+            LintelLog::warn(format("codegen: unable to rename into %s: %s") % base
+                            % strerror(errno));
+            return NULL;
+        }
+        unlink(log_path.c_str());
+    }
+
+    void *handle = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        LintelLog::warn(format("codegen: dlopen(%s) failed: %s") % so_path % dlerror());
+        return NULL;
+    }
+    void *ret = dlsym(handle, symbol.c_str());
+    if (ret == NULL) {
+        LintelLog::warn(format("codegen: %s has no symbol %s") % so_path % symbol);
+        dlclose(handle);
+    }
+    return ret;
+}
+
+}
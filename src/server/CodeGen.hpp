@@ -0,0 +1,62 @@
+#ifndef DATASERIES_CODEGEN_HPP
+#define DATASERIES_CODEGEN_HPP
+
+#include <inttypes.h>
+
+#include <map>
+#include <string>
+
+#include <boost/utility.hpp>
+
+#include <Lintel/PThread.hpp>
+
+namespace dataseries {
+    /** Compiles generated C++ source into shared objects and loads them, so operators can run
+        code specialized for their ExtentTypes rather than going through GeneralField.
+
+        The source is compiled with the compiler that built the server, since the generated
+        code may pass STL types across the boundary.  Each source is compiled once: the shared
+        object is named by a hash of the source, the compiler, its --version output and the
+        flags, and kept in the cache directory, where later runs of the server built with the
+        same compiler find it; the loaded symbols are remembered in memory.  Any
+        failure (no compiler, a compile error, dlopen failing) is logged and load() returns
+        NULL, so callers must always keep their generic implementation as the fallback. */
+    class CodeGen : boost::noncopyable {
+      public:
+        struct Stats {
+            uint64_t memory_hits, disk_hits, compiles, failures;
+            Stats() : memory_hits(0), disk_hits(0), compiles(0), failures(0) { }
+        };
+
+        /** Returns the process-wide instance; it lives until the process exits. */
+        static CodeGen &instance();
+
+        /** Turns code generation on or off; while off, load() always returns NULL. */
+        void setEnabled(bool enabled);
+
+        /** Sets the directory for sources and shared objects; the default is "codegen",
+            relative to the current directory when it is first used. */
+        void setCacheDirectory(const std::string &dir);
+
+        /** Returns the address of the extern "C" function symbol defined by source, or NULL
+            if it is unavailable. */
+        void *load(const std::string &source, const std::string &symbol);
+
+        Stats getStats();
+
+      private:
+        CodeGen();
+        ~CodeGen();
+
+        void *lockedCompileAndOpen(const std::string &source, const std::string &symbol);
+
+        PThreadMutex mutex;
+        bool enabled;
+        std::string cache_dir;
+        std::string compiler_header; // comments naming the compiler, prepended to each source
+        std::map<std::pair<std::string, std::string>, void *> loaded; // (source, symbol)
+        Stats stats;
+    };
+}
+
+#endif
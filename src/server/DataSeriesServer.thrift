@@ -17,6 +17,35 @@ struct TableData {
     3: optional bool more_rows;
 }
 
+enum PageEncoding {
+    PE_InvalidEnumConst = 0;
+    PE_Strings = 1; // TablePage.rows, every value converted to a string as in TableData
+    PE_Columns = 2; // TablePage.column_data, values kept in their column types
+}
+
+// The values of one column in a page.  nulls has one byte per row, non-zero ==> null, and is
+// empty if the column is not nullable.  Only the list for the column's type is filled in,
+// with one entry per row (the entry for a null row is 0 or empty): bool ==> bools,
+// byte ==> bytes (one byte per row), int32 ==> i32s, int64 ==> i64s, double ==> doubles,
+// variable32 and fixedwidth ==> strings.
+struct ColumnData {
+    1: required binary nulls;
+    2: required list<bool> bools;
+    3: required binary bytes;
+    4: required list<i32> i32s;
+    5: required list<i64> i64s;
+    6: required list<double> doubles;
+    7: required list<binary> strings;
+}
+
+struct TablePage {
+    1: required list<TableColumn> columns;
+    2: required i32 nrows;
+    3: required bool more_rows; // false ==> the cursor is exhausted
+    4: optional list<list<NullableString>> rows; // PE_Strings
+    5: optional list<ColumnData> column_data; // PE_Columns, in the order of columns
+}
+
 struct Dimension {
     // separate dimension_name and source_table allows for multiple dimensions generated
     // from a single table.
@@ -63,12 +92,39 @@ struct SortColumn {
     3: required NullMode null_mode;
 }
 
+enum JoinMode {
+    JM_InvalidEnumConst = 0;
+    JM_Inner = 1;
+    JM_LeftOuter = 2; // also a rows with no matching b row, b columns null
+    JM_FullOuter = 3; // also unmatched rows from both sides
+}
+
+// a_column and b_column are equal in matching rows; both tables must be sorted on the keys with
+// sort_mode and null_mode, in the order of the key list.
+struct MergeJoinKey {
+    1: required string a_column;
+    2: required string b_column;
+    3: required SortMode sort_mode;
+    4: required NullMode null_mode;
+}
+
 struct ExprColumn {
     1: required string name;
     2: required string type;
     3: required string expr;
 }
 
+// Counters for the cache of unpacked table extents; hits and misses count extent lookups, so
+// a table read from its file after a miss counts one miss however many extents it has.
+struct ExtentCacheStats {
+    1: required i64 hits;
+    2: required i64 misses;
+    3: required i64 evictions;
+    4: required i64 extents;
+    5: required i64 bytes;
+    6: required i64 max_bytes;
+}
+
 service DataSeriesServer {
     void ping();
     void shutdown();
@@ -85,6 +141,13 @@ service DataSeriesServer {
 
     TableData getTableData(string source_table, i32 max_rows = 1000000, string where_expr = '');
 
+    // Cursors return the rows of a table a page at a time, so large results are neither held
+    // in the server nor sent as one response.  Cursors are closed by closeCursor, and fail with
+    // a RequestError if the table is rewritten while they are open.
+    i64 openCursor(string source_table, string where_expr, PageEncoding encoding);
+    TablePage fetchCursor(i64 cursor_id, i32 max_rows = 10000);
+    void closeCursor(i64 cursor_id);
+
     // Table a will be loaded into memory; join will be on all column pairs in eq_columns
     // keep columns sources a.<name> or b.<name> will be mapped to the dest name.
 
@@ -97,6 +160,14 @@ service DataSeriesServer {
                   map<string, string> eq_columns, map<string, string> keep_columns,
                   i32 max_a_rows = 1000000);
 
+    // Join of two tables already sorted by the keys, e.g. by sortTable; keep_columns is as for
+    // hashJoin.  Both tables are streamed, only the b rows for one key are held in memory.  Rows
+    // with a null key column never match.  A request error is returned if either table turns
+    // out not to be sorted.
+    void sortedMergeJoin(string a_table, string b_table, string out_table,
+                         list<MergeJoinKey> keys, map<string, string> keep_columns,
+                         JoinMode mode);
+
     void starJoin(string fact_table, list<Dimension> dimensions, string out_table,
                   map<string, string> fact_columns, list<DimensionFactJoin> dimension_fact_join,
                   i32 max_dimension_rows = 1000000);
@@ -149,6 +220,8 @@ service DataSeriesServer {
     //    If base_table.row > update_table.row, advance update_from
     void sortedUpdateTable(string base_table, string update_from, string update_column,
                            list<string> primary_key);
+
+    ExtentCacheStats getExtentCacheStats();
 }
 
 exception InvalidTableName {
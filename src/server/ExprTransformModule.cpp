@@ -12,7 +12,7 @@ class ExprTransformModule : public OutputSeriesModule {
                         const string &output_table_name)
             : OutputSeriesModule(), source(source), input_series(), previous_row_series(),
               copier(output_series, previous_row_series), expr_columns(expr_columns),
-              output_table_name(output_table_name)
+              output_table_name(output_table_name), input_row(0)
     { }
 
     bool hasColumn(ExtentSeries &series, const string &field_name) {
@@ -70,7 +70,30 @@ class ExprTransformModule : public OutputSeriesModule {
             
             outputs.push_back(Output(expr, field, 
                                      output_series.getTypePtr()->getFieldType(column.name)));
+            // Expressions that only use the input row are evaluated a whole extent at a time;
+            // ones using out. or prev. values have to be evaluated as each row is made.
+            if (outputs.back().type != ExtentType::ft_variable32) {
+                outputs.back().batch.reset(DSExprBatch::compile(expr.get(), input_series));
+            }
+        }
+    }
+
+    void evalBatches() {
+        BOOST_FOREACH(Output &output, outputs) {
+            if (output.batch == NULL) {
+                continue;
+            }
+            output.batch->evalNull(output.nulls);
+            switch(output.type)
+            {
+                case ExtentType::ft_bool: 
+                    output.batch->evalBool(output.bools, &output.nulls); break;
+                case ExtentType::ft_double: 
+                    output.batch->evalDouble(output.doubles, &output.nulls); break;
+                default: output.batch->evalInt64(output.int64s, &output.nulls); break;
+            }
         }
+        input_row = 0;
     }
 
     virtual Extent::Ptr getSharedExtent() {
@@ -84,6 +107,7 @@ class ExprTransformModule : public OutputSeriesModule {
                     firstExtent(in);
                 }
                 input_series.setExtent(in);
+                evalBatches();
             }
 
             SINVARIANT(!output_series.hasExtent());
@@ -93,6 +117,29 @@ class ExprTransformModule : public OutputSeriesModule {
                 output_series.newRecord();
                 BOOST_FOREACH(Output &output, outputs) {
                     GeneralValue val;
+                    if (output.batch != NULL) {
+                        if (output.nulls[input_row]) {
+                            output.field->setNull();
+                            continue;
+                        }
+                        switch(output.type)
+                        {
+                            case ExtentType::ft_bool: 
+                                val.setBool(output.bools[input_row]); break;
+                            case ExtentType::ft_byte: 
+                                val.setByte(output.int64s[input_row]); break;
+                            case ExtentType::ft_int32: 
+                                val.setInt32(output.int64s[input_row]); break;
+                            case ExtentType::ft_int64: 
+                                val.setInt64(output.int64s[input_row]); break;
+                            case ExtentType::ft_double: 
+                                val.setDouble(output.doubles[input_row]); break;
+                            default:
+                                FATAL_ERROR("internal error, unexpected type");
+                        }
+                        output.field->set(val);
+                        continue;
+                    }
                     if (output.expr->isNull()) {
                         output.field->setNull();
                         continue;
@@ -114,6 +161,7 @@ class ExprTransformModule : public OutputSeriesModule {
                     output.field->set(val);
                 }
                 input_series.next();
+                ++input_row;
 
                 if (previous_row_series.getSharedExtent()->variabledata.size() > 16*1024) {
                     // limit unbounded memory usage.
@@ -135,11 +183,16 @@ class ExprTransformModule : public OutputSeriesModule {
 
     struct Output {
         Output(boost::shared_ptr<DSExpr> expr, GeneralField::Ptr field, ExtentType::fieldType type)
-                : expr(expr), field(field), type(type) { }
+                : expr(expr), field(field), type(type), batch() { }
 
         boost::shared_ptr<DSExpr> expr;
         GeneralField::Ptr field;
         ExtentType::fieldType type;
+        // Values for each row of the current input extent, if batch != NULL
+        boost::shared_ptr<DSExprBatch> batch;
+        vector<uint8_t> nulls, bools;
+        vector<double> doubles;
+        vector<int64_t> int64s;
     };
 
     DataSeriesModule &source;
@@ -148,6 +201,7 @@ class ExprTransformModule : public OutputSeriesModule {
     vector<ExprColumn> expr_columns;
     vector<Output> outputs;
     string output_table_name;
+    size_t input_row; // row number of input_series in the current extent
 };
 
 OutputSeriesModule::OSMPtr dataseries::makeExprTransformModule
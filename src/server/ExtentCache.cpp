@@ -0,0 +1,74 @@
+#include <limits>
+
+#include <Lintel/LintelLog.hpp>
+
+#include "ExtentCache.hpp"
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+Extent::Ptr ExtentCache::lookup(const string &table, uint64_t generation, int64_t offset) {
+    PThreadScopedLock lock(mutex);
+    Index::iterator i = index.find(Key(table, generation, offset));
+    if (i == index.end()) {
+        ++stats.misses;
+        return Extent::Ptr();
+    }
+    ++stats.hits;
+    lru.splice(lru.begin(), lru, i->second);
+    return i->second->extent;
+}
+
+void ExtentCache::insert(const string &table, uint64_t generation, int64_t offset,
+                         Extent::Ptr extent) {
+    SINVARIANT(extent != NULL && offset >= 0);
+    uint64_t bytes = extent->size();
+    PThreadScopedLock lock(mutex);
+    if (max_bytes == 0 || bytes > max_bytes) {
+        return;
+    }
+    Key key(table, generation, offset);
+    Index::iterator i = index.find(key);
+    if (i != index.end()) {
+        lockedErase(i);
+    }
+    while (cur_bytes + bytes > max_bytes) {
+        SINVARIANT(!lru.empty());
+        LintelLogDebug("ExtentCache", format("evicting %s@%d") % lru.back().key.get<0>()
+                       % lru.back().key.get<2>());
+        lockedErase(index.find(lru.back().key));
+        ++stats.evictions;
+    }
+    lru.push_front(Entry(key, extent, bytes));
+    index[key] = lru.begin();
+    cur_bytes += bytes;
+}
+
+void ExtentCache::eraseTable(const string &table) {
+    PThreadScopedLock lock(mutex);
+    Index::iterator i = index.lower_bound(Key(table, 0, numeric_limits<int64_t>::min()));
+    while (i != index.end() && i->first.get<0>() == table) {
+        Index::iterator erase = i++;
+        lockedErase(erase);
+    }
+}
+
+ExtentCache::Stats ExtentCache::getStats() {
+    PThreadScopedLock lock(mutex);
+    Stats ret(stats);
+    ret.extents = lru.size();
+    ret.bytes = cur_bytes;
+    ret.max_bytes = max_bytes;
+    return ret;
+}
+
+void ExtentCache::lockedErase(Index::iterator i) {
+    SINVARIANT(i != index.end() && cur_bytes >= i->second->bytes);
+    cur_bytes -= i->second->bytes;
+    lru.erase(i->second);
+    index.erase(i);
+}
+
+}
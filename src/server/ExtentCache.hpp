@@ -0,0 +1,70 @@
+#ifndef DATASERIES_EXTENTCACHE_HPP
+#define DATASERIES_EXTENTCACHE_HPP
+
+#include <inttypes.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <boost/utility.hpp>
+
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/Extent.hpp>
+
+namespace dataseries {
+    /** Byte-budgeted LRU cache of unpacked extents read from server tables.  Entries are keyed
+        by (table, generation, extent offset in the table's file); the server bumps a table's
+        generation whenever it rewrites the table, so stale entries can never be returned, and
+        calls eraseTable() to drop them early.  Cached extents are shared between readers, so
+        modules reading through the cache must not modify their input extents. */
+    class ExtentCache : boost::noncopyable {
+      public:
+        struct Stats {
+            uint64_t hits, misses, evictions, extents, bytes, max_bytes;
+            Stats() : hits(0), misses(0), evictions(0), extents(0), bytes(0), max_bytes(0) { }
+        };
+
+        ExtentCache(uint64_t max_bytes) : max_bytes(max_bytes), cur_bytes(0) { }
+
+        /** Returns the cached extent, or NULL (counting a miss) if it is not present. */
+        Extent::Ptr lookup(const std::string &table, uint64_t generation, int64_t offset);
+
+        /** Adds an extent, evicting the least recently used extents to stay within the budget;
+            extents larger than the whole budget, or any extent if the budget is 0, are not
+            cached. */
+        void insert(const std::string &table, uint64_t generation, int64_t offset,
+                    Extent::Ptr extent);
+
+        /** Drops all of the extents of a table, whatever their generation. */
+        void eraseTable(const std::string &table);
+
+        Stats getStats();
+
+      private:
+        typedef boost::tuple<std::string, uint64_t, int64_t> Key;
+        struct Entry {
+            Key key;
+            Extent::Ptr extent;
+            uint64_t bytes;
+            Entry(const Key &key, Extent::Ptr extent, uint64_t bytes)
+                : key(key), extent(extent), bytes(bytes) { }
+        };
+        typedef std::list<Entry> LRU; // most recently used at the front
+        typedef std::map<Key, LRU::iterator> Index;
+
+        void lockedErase(Index::iterator i);
+
+        PThreadMutex mutex;
+        const uint64_t max_bytes;
+        uint64_t cur_bytes;
+        LRU lru;
+        Index index;
+        Stats stats;
+    };
+}
+
+#endif
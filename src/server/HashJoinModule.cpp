@@ -1,20 +1,326 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Lintel/HashUnique.hpp>
+#include <Lintel/PThread.hpp>
+
 #include "ServerModules.hpp"
 #include "DSSModule.hpp"
 #include "JoinModule.hpp"
 
 // TODO: merge common code with StarJoinModule
 
-class HashJoinModule : public JoinModule { 
+/* This is a radix partitioned hash join.  Rows are stored flat rather than as GVVecs: each column
+   is encoded through its typed field as a null byte followed, if not null, by the value (variable32
+   values length prefixed), and the key is the concatenation of the encoded eq columns, so keys are
+   compared bytewise.  Each a (build) row is stored in one of the partitions chosen by the top
+   bits of its key hash, as the key followed by the encoded a values that are kept.  Once all of a
+   is read, every partition builds its own hash index, in parallel.  Each b extent is then probed
+   by splitting its rows into ranges that are looked up in parallel; the output is written in b
+   row order.
+
+   If the encoded a rows use more than memory_limit bytes, the largest partitions are spilled to
+   files in the working directory, as in a grace hash join.  b rows that hash to a spilled
+   partition are buffered and spilled the same way, and each spilled partition is joined after all
+   of b has been read.  Output from spilled partitions therefore comes after the rest of the
+   output, grouped by partition rather than in b order. */
+
+namespace {
+    /// A column read or written through its typed field, encoded as described above.
+    class FlatColumn {
+      public:
+        typedef boost::shared_ptr<FlatColumn> Ptr;
+
+        FlatColumn(ExtentSeries &series, const string &name)
+            : type(series.getTypePtr()->getFieldType(name)), field()
+        {
+            switch (type)
+                {
+                case ExtentType::ft_bool:
+                    field.reset(new BoolField(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_byte:
+                    field.reset(new ByteField(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_int32:
+                    field.reset(new Int32Field(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_int64:
+                    field.reset(new Int64Field(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_double: // same flags as GF_Double
+                    field.reset(new DoubleField(series, name, DoubleField::flag_nullable
+                                                | DoubleField::flag_allownonzerobase));
+                    break;
+                case ExtentType::ft_fixedwidth:
+                    field.reset(new FixedWidthField(series, name, Field::flag_nullable)); break;
+                case ExtentType::ft_variable32:
+                    field.reset(new Variable32Field(series, name, Field::flag_nullable)); break;
+                default:
+                    FATAL_ERROR(format("unsupported type for column %s") % name);
+                }
+        }
+
+        static bool supported(ExtentType::fieldType type) {
+            return type == ExtentType::ft_bool || type == ExtentType::ft_byte
+                || type == ExtentType::ft_int32 || type == ExtentType::ft_int64
+                || type == ExtentType::ft_double || type == ExtentType::ft_fixedwidth
+                || type == ExtentType::ft_variable32;
+        }
+
+        /// Append the value in row o of e; safe to call from multiple threads.
+        void encode(vector<uint8_t> &to, const Extent &e, const SEP_RowOffset &o) const {
+            if (field->isNull(e, o)) {
+                to.push_back(0);
+                return;
+            }
+            to.push_back(1);
+            switch (type)
+                {
+                case ExtentType::ft_bool:
+                    to.push_back(static_cast<const BoolField &>(*field).val(e, o) ? 1 : 0);
+                    break;
+                case ExtentType::ft_byte:
+                    to.push_back(static_cast<const ByteField &>(*field).val(e, o));
+                    break;
+                case ExtentType::ft_int32:
+                    append(to, static_cast<const Int32Field &>(*field).val(e, o));
+                    break;
+                case ExtentType::ft_int64:
+                    append(to, static_cast<const Int64Field &>(*field).val(e, o));
+                    break;
+                case ExtentType::ft_double:
+                    append(to, static_cast<const DoubleField &>(*field).val(e, o));
+                    break;
+                case ExtentType::ft_fixedwidth: { // the width is in the type, so no size
+                    const FixedWidthField &f(static_cast<const FixedWidthField &>(*field));
+                    const uint8_t *val = f.val(e, o);
+                    to.insert(to.end(), val, val + f.size());
+                    break;
+                }
+                case ExtentType::ft_variable32: {
+                    const Variable32Field &f(static_cast<const Variable32Field &>(*field));
+                    int32_t size = f.size(e, o);
+                    const uint8_t *val = f.val(e, o);
+                    append(to, size);
+                    to.insert(to.end(), val, val + size);
+                    break;
+                }
+                default:
+                    FATAL_ERROR("internal error, unexpected type");
+                }
+        }
+
+        /// Set the current row of the series from encoded bytes; returns the following bytes.
+        const uint8_t *decode(const uint8_t *from) {
+            if (*from++ == 0) {
+                field->setNull();
+                return from;
+            }
+            switch (type)
+                {
+                case ExtentType::ft_bool:
+                    static_cast<BoolField &>(*field).set(*from != 0);
+                    return from + 1;
+                case ExtentType::ft_byte:
+                    static_cast<ByteField &>(*field).set(*from);
+                    return from + 1;
+                case ExtentType::ft_int32:
+                    static_cast<Int32Field &>(*field).set(extract<int32_t>(from));
+                    return from + sizeof(int32_t);
+                case ExtentType::ft_int64:
+                    static_cast<Int64Field &>(*field).set(extract<int64_t>(from));
+                    return from + sizeof(int64_t);
+                case ExtentType::ft_double:
+                    static_cast<DoubleField &>(*field).set(extract<double>(from));
+                    return from + sizeof(double);
+                case ExtentType::ft_fixedwidth: {
+                    FixedWidthField &f(static_cast<FixedWidthField &>(*field));
+                    f.set(from, f.size());
+                    return from + f.size();
+                }
+                case ExtentType::ft_variable32: {
+                    int32_t size = extract<int32_t>(from);
+                    from += sizeof(int32_t);
+                    static_cast<Variable32Field &>(*field).set(from, size);
+                    return from + size;
+                }
+                default:
+                    FATAL_ERROR("internal error, unexpected type");
+                }
+            return from;
+        }
+
+      private:
+        template<typename T> static void append(vector<uint8_t> &to, T v) {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&v);
+            to.insert(to.end(), bytes, bytes + sizeof(T));
+        }
+        template<typename T> static T extract(const uint8_t *from) {
+            T ret;
+            memcpy(&ret, from, sizeof(T));
+            return ret;
+        }
+
+        const ExtentType::fieldType type;
+        boost::shared_ptr<Field> field;
+    };
+
+    struct ColumnCopy {
+        ColumnCopy(FlatColumn::Ptr from, FlatColumn::Ptr into) : from(from), into(into) { }
+        FlatColumn::Ptr from, into;
+    };
+
+    uint32_t hashKey(const vector<uint8_t> &key) {
+        return key.empty() ? 1942 : lintel::hashBytes(&key[0], key.size(), 1942);
+    }
+
+    /// Encoded rows; each is the key followed by the values.
+    struct RowBuffer {
+        struct Row {
+            uint32_t hash, offset, key_size, size;
+        };
+
+        RowBuffer() : bytes(), rows() { }
+
+        void add(uint32_t hash, const vector<uint8_t> &row, uint32_t key_size) {
+            add(hash, row.empty() ? NULL : &row[0], key_size, row.size());
+        }
+
+        void add(uint32_t hash, const uint8_t *data, uint32_t key_size, uint32_t size) {
+            SINVARIANT(bytes.size() + size < numeric_limits<uint32_t>::max());
+            Row row;
+            row.hash = hash;
+            row.offset = bytes.size();
+            row.key_size = key_size;
+            row.size = size;
+            bytes.insert(bytes.end(), data, data + size);
+            rows.push_back(row);
+        }
+
+        const uint8_t *key(const Row &row) const {
+            return &bytes[row.offset];
+        }
+        const uint8_t *values(const Row &row) const {
+            return &bytes[row.offset + row.key_size];
+        }
+        size_t memoryUsed() const {
+            return bytes.size() + rows.size() * sizeof(Row);
+        }
+        bool empty() const {
+            return rows.empty();
+        }
+        void clear() {
+            vector<uint8_t>().swap(bytes);
+            vector<Row>().swap(rows);
+        }
+
+        vector<uint8_t> bytes;
+        vector<Row> rows;
+    };
+
+    struct Partition {
+        static const uint32_t none = numeric_limits<uint32_t>::max();
+
+        Partition() : a_rows(), b_rows(), a_files(), b_files(), spilled(false), slots(), next() { }
+
+        /// Index the a rows; rows with the same key are chained in insertion order.
+        void buildIndex() {
+            size_t nslots = 16;
+            while (nslots < a_rows.rows.size() * 2) {
+                nslots *= 2;
+            }
+            slots.assign(nslots, none);
+            next.assign(a_rows.rows.size(), none);
+            vector<uint32_t> tail(a_rows.rows.size(), none);
+            for (uint32_t i = 0; i < a_rows.rows.size(); ++i) {
+                const RowBuffer::Row &row(a_rows.rows[i]);
+                for (size_t slot = row.hash & (nslots - 1); ; slot = (slot + 1) & (nslots - 1)) {
+                    uint32_t head = slots[slot];
+                    if (head == none) {
+                        slots[slot] = i;
+                        tail[i] = i;
+                        break;
+                    } else if (sameKey(a_rows.rows[head], row.hash, a_rows.key(row),
+                                       row.key_size)) {
+                        next[tail[head]] = i;
+                        tail[head] = i;
+                        break;
+                    }
+                }
+            }
+        }
+
+        /// Returns the first a row with the key, or none; safe to call from multiple threads.
+        uint32_t find(uint32_t hash, const uint8_t *key, uint32_t key_size) const {
+            if (slots.empty()) {
+                return none;
+            }
+            size_t mask = slots.size() - 1;
+            for (size_t slot = hash & mask; slots[slot] != none; slot = (slot + 1) & mask) {
+                if (sameKey(a_rows.rows[slots[slot]], hash, key, key_size)) {
+                    return slots[slot];
+                }
+            }
+            return none;
+        }
+
+        bool sameKey(const RowBuffer::Row &row, uint32_t hash, const uint8_t *key,
+                     uint32_t key_size) const {
+            return row.hash == hash && row.key_size == key_size
+                && memcmp(a_rows.key(row), key, key_size) == 0;
+        }
+
+        void clearIndex() {
+            vector<uint32_t>().swap(slots);
+            vector<uint32_t>().swap(next);
+        }
+
+        RowBuffer a_rows, b_rows; // b_rows are only used once spilled
+        vector<string> a_files, b_files;
+        bool spilled;
+        vector<uint32_t> slots, next;
+    };
+
+    const uint32_t Partition::none;
+
+    /// A b row matched to an a row, or if a_row == Partition::none, a b row to spill.
+    struct Match {
+        uint32_t b_row, partition, a_row;
+    };
+}
+
+class HashJoinModule : public JoinModule {
   public:
     typedef map<string, string> CMap; // column map
 
+    static const uint32_t partition_bits = 6;
+    static const uint32_t npartitions = 1 << partition_bits;
+    // Smaller extents are probed on the calling thread.
+    static const uint32_t min_parallel_rows = 4096;
+
     HashJoinModule(DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
                    const map<string, string> &eq_columns, const map<string, string> &keep_columns,
-                   const string &output_table_name) 
-            : a_input(a_input), b_input(b_input), max_a_rows(max_a_rows), 
-              eq_columns(eq_columns), keep_columns(keep_columns), 
-              output_table_name(output_table_name)
-    { }
+                   const string &output_table_name, size_t memory_limit, int nthreads)
+            : a_input(a_input), b_input(b_input), max_a_rows(max_a_rows),
+              eq_columns(eq_columns), keep_columns(keep_columns),
+              output_table_name(output_table_name), memory_limit(memory_limit),
+              nthreads(nthreads == -1 ? PThreadMisc::getNCpus() : nthreads),
+              partitions(), a_memory(0), b_memory(0), spill_count(0), b_done(false),
+              next_spilled(0), joining(NULL), joining_b_rows(), joining_b(NULL), joining_b_row(0),
+              joining_a_row(Partition::none)
+    {
+        SINVARIANT(memory_limit > 0 && this->nthreads > 0);
+    }
+
+    virtual ~HashJoinModule() {
+        // Remove any spill files left if the join was abandoned.
+        BOOST_FOREACH(Partition &p, partitions) {
+            BOOST_FOREACH(const string &f, p.a_files) {
+                unlink(f.c_str());
+            }
+            BOOST_FOREACH(const string &f, p.b_files) {
+                unlink(f.c_str());
+            }
+        }
+    }
 
     static const string mapDGet(const map<string, string> &a_map, const string &a_key) {
         map<string, string>::const_iterator i = a_map.find(a_key);
@@ -22,9 +328,50 @@ class HashJoinModule : public JoinModule {
         return i->second;
     }
 
-    void firstExtent(const Extent &b_e) {
-        ExtentSeries a_series;
+    class ParallelThread : public PThread {
+      public:
+        ParallelThread(HashJoinModule &hj) : hj(hj) { }
+        HashJoinModule &hj;
+    };
+
+    class BuildThread : public ParallelThread {
+      public:
+        BuildThread(HashJoinModule &hj, uint32_t first) : ParallelThread(hj), first(first) { }
+
+        virtual void *run() {
+            for (uint32_t i = first; i < npartitions; i += hj.nthreads) {
+                if (!hj.partitions[i].spilled) {
+                    hj.partitions[i].buildIndex();
+                }
+            }
+            return NULL;
+        }
+
+        uint32_t first;
+    };
+
+    class ProbeThread : public ParallelThread {
+      public:
+        ProbeThread(HashJoinModule &hj, const Extent &e, uint32_t begin, uint32_t end)
+            : ParallelThread(hj), e(e), begin(begin), end(end), matches() { }
+
+        virtual void *run() {
+            hj.probeRows(e, begin, end, matches);
+            return NULL;
+        }
+
+        const Extent &e;
+        uint32_t begin, end;
+        vector<Match> matches;
+    };
+
+    void checkColumnType(ExtentSeries &series, const string &name) {
+        if (!FlatColumn::supported(series.getTypePtr()->getFieldType(name))) {
+            requestError(format("unsupported type for column %s") % name);
+        }
+    }
 
+    void firstExtent(const Extent &b_e) {
         a_series.setExtent(a_input.getSharedExtent());
         b_series.setType(b_e.getTypePtr());
         if (a_series.getSharedExtent() == NULL) {
@@ -32,37 +379,22 @@ class HashJoinModule : public JoinModule {
         }
 
         // Three possible sources for values in the output:
-        // 
-        // 1) the a value fields, so from the hash-map
+        //
+        // 1) the a value fields, so from the partitions
         // 2a) the b fields, as one of the a eq fields.
         // 2b) the b fields, as one of the b values or eq fields
-        // 
-        // We do not try to optimize the extraction and just create a new general field for each
-        // extraction so if the hash-map has duplicate columns, there will be duplicate fields.
-        vector<GeneralField::Ptr> a_eq_fields;
         HashUnique<string> known_a_eq_fields;
 
         BOOST_FOREACH(const CMap::value_type &vt, eq_columns) {
             SINVARIANT(a_series.getTypePtr()->getFieldType(vt.first)
                        == b_series.getTypePtr()->getFieldType(vt.second));
-            a_eq_fields.push_back(GeneralField::make(a_series, vt.first));
-            b_eq_fields.push_back(GeneralField::make(b_series, vt.second));
+            checkColumnType(a_series, vt.first);
+            a_key_columns.push_back(FlatColumn::Ptr(new FlatColumn(a_series, vt.first)));
+            b_key_columns.push_back(FlatColumn::Ptr(new FlatColumn(b_series, vt.second)));
             known_a_eq_fields.add(vt.first);
         }
 
-        vector<GeneralField::Ptr> a_val_fields;
-        HashMap<string, uint32_t> a_name_to_val_pos;
-
-        BOOST_FOREACH(const CMap::value_type &vt, keep_columns) {
-            if (prefixequal(vt.first, "a.")) {
-                string field_name(vt.first.substr(2));
-                if (!known_a_eq_fields.exists(field_name)) { // don't store eq fields we will
-                    // access from the b eq fields
-                    a_name_to_val_pos[field_name] = a_val_fields.size();
-                    a_val_fields.push_back(GeneralField::make(a_series, field_name));
-                }
-            }
-        }
+        vector<string> a_from, b_from, a_into, b_into;
         string output_xml(str(format("<ExtentType name=\"hash-join -> %s\""
                                      " namespace=\"server.example.com\" version=\"1.0\">\n")
                               % output_table_name));
@@ -71,23 +403,25 @@ class HashJoinModule : public JoinModule {
             string field_name(vt.first.substr(2));
             string output_field_xml;
 
-            if (prefixequal(vt.first, "a.") && a_name_to_val_pos.exists(field_name)) { // case 1
+            if (prefixequal(vt.first, "a.") && !known_a_eq_fields.exists(field_name)) {
+                // case 1; don't store eq fields we can access from the b eq fields
                 TINVARIANT(a_series.getTypePtr()->hasColumn(field_name));
+                checkColumnType(a_series, field_name);
                 output_field_xml = renameField(a_series.getTypePtr(), field_name, vt.second);
-                extractors.push_back
-                        (ExtractorValue::make(vt.second, a_name_to_val_pos[field_name]));
-            } else if (prefixequal(vt.first, "a.") 
-                       && eq_columns.find(field_name) != eq_columns.end()) { // case 2a
+                a_from.push_back(field_name);
+                a_into.push_back(vt.second);
+            } else if (prefixequal(vt.first, "a.")) { // case 2a
                 const string b_field_name(eq_columns.find(field_name)->second);
                 TINVARIANT(b_series.getTypePtr()->hasColumn(b_field_name));
                 output_field_xml = renameField(a_series.getTypePtr(), field_name, vt.second);
-                GeneralField::Ptr b_field(GeneralField::make(b_series, b_field_name));
-                extractors.push_back(ExtractorField::make(vt.second, b_field));
+                b_from.push_back(b_field_name);
+                b_into.push_back(vt.second);
             } else if (prefixequal(vt.first, "b.")
                        && b_series.getTypePtr()->hasColumn(field_name)) { // case 2b
+                checkColumnType(b_series, field_name);
                 output_field_xml = renameField(b_series.getTypePtr(), field_name, vt.second);
-                GeneralField::Ptr b_field(GeneralField::make(b_series, field_name));
-                extractors.push_back(ExtractorField::make(vt.second, b_field));
+                b_from.push_back(field_name);
+                b_into.push_back(vt.second);
             } else {
                 requestError("invalid extraction");
             }
@@ -95,93 +429,411 @@ class HashJoinModule : public JoinModule {
         }
 
         output_xml.append("</ExtentType>\n");
-                    
-        INVARIANT(!extractors.empty(), "must extract at least one field");
+
+        INVARIANT(!a_into.empty() || !b_into.empty(), "must extract at least one field");
+
+        ExtentTypeLibrary lib;
+        LintelLog::info(format("output xml: %s") % output_xml);
+        output_series.setType(lib.registerTypePtr(output_xml));
+
+        for (size_t i = 0; i < a_from.size(); ++i) {
+            a_copies.push_back(ColumnCopy(FlatColumn::Ptr(new FlatColumn(a_series, a_from[i])),
+                                          FlatColumn::Ptr(new FlatColumn(output_series,
+                                                                         a_into[i]))));
+        }
+        for (size_t i = 0; i < b_from.size(); ++i) {
+            b_copies.push_back(ColumnCopy(FlatColumn::Ptr(new FlatColumn(b_series, b_from[i])),
+                                          FlatColumn::Ptr(new FlatColumn(output_series,
+                                                                         b_into[i]))));
+        }
+
+        partitions.resize(npartitions);
         int32_t row_count = 0;
-        key.resize(a_eq_fields.size());
-        GVVec val;
-        val.resize(a_val_fields.size());
+        vector<uint8_t> row;
         while (1) {
-            if (a_series.getSharedExtent() == NULL) {
+            Extent::Ptr e = a_series.getSharedExtent();
+            if (e == NULL) {
                 break;
             }
-            for (; a_series.more(); a_series.next()) {
+            const uint32_t record_size = e->getTypePtr()->fixedrecordsize();
+            for (uint32_t offset = 0; offset < e->fixeddata.size(); offset += record_size) {
                 ++row_count;
 
                 if (row_count >= max_a_rows) {
                     requestError("a table has too many rows");
                 }
-                key.extract(a_eq_fields);
-                val.extract(a_val_fields);
-                a_hashmap[key].push_back(val);
+                SEP_RowOffset o(offset, e);
+                row.clear();
+                BOOST_FOREACH(FlatColumn::Ptr &c, a_key_columns) {
+                    c->encode(row, *e, o);
+                }
+                uint32_t key_size = row.size();
+                uint32_t hash = hashKey(row);
+                BOOST_FOREACH(ColumnCopy &c, a_copies) {
+                    c.from->encode(row, *e, o);
+                }
+                Partition &p(partitions[partitionOf(hash)]);
+                p.a_rows.add(hash, row, key_size);
+                a_memory += row.size() + sizeof(RowBuffer::Row);
+                while (a_memory > memory_limit) {
+                    spillLargestA();
+                }
             }
             a_series.setExtent(a_input.getSharedExtent());
         }
 
-        ExtentTypeLibrary lib;
-        LintelLog::info(format("output xml: %s") % output_xml);
-        output_series.setType(lib.registerTypePtr(output_xml));
-        
-        Extractor::makeInto(extractors, output_series);
+        // Everything spilled goes to disk so that b can use the memory.
+        BOOST_FOREACH(Partition &p, partitions) {
+            if (p.spilled && !p.a_rows.empty()) {
+                a_memory -= p.a_rows.memoryUsed();
+                p.a_files.push_back(writeSpill(p.a_rows));
+            }
+        }
+        buildIndexes();
     }
 
-    virtual Extent::Ptr getSharedExtent() {
-        while (true) {
-            Extent::Ptr e = b_input.getSharedExtent();
-            if (e == NULL) {
-                break;
+    static uint32_t partitionOf(uint32_t hash) {
+        return hash >> (32 - partition_bits);
+    }
+
+    void buildIndexes() {
+        vector<PThread *> threads;
+        for (uint32_t i = 0; i < min(nthreads, npartitions); ++i) {
+            threads.push_back(new BuildThread(*this, i));
+            threads.back()->start();
+        }
+        BOOST_FOREACH(PThread *t, threads) {
+            t->join();
+            delete t;
+        }
+    }
+
+    void spillLargestA() {
+        Partition *largest = NULL;
+        BOOST_FOREACH(Partition &p, partitions) {
+            if (largest == NULL || p.a_rows.memoryUsed() > largest->a_rows.memoryUsed()) {
+                largest = &p;
+            }
+        }
+        SINVARIANT(largest != NULL && !largest->a_rows.empty());
+        largest->spilled = true;
+        a_memory -= largest->a_rows.memoryUsed();
+        largest->a_files.push_back(writeSpill(largest->a_rows));
+    }
+
+    void spillAllB() {
+        BOOST_FOREACH(Partition &p, partitions) {
+            if (!p.b_rows.empty()) {
+                p.b_files.push_back(writeSpill(p.b_rows));
+            }
+        }
+        b_memory = 0;
+    }
+
+    /// Write rows to a new spill file, and clear them.
+    string writeSpill(RowBuffer &rows) {
+        string filename(str(format("hash-join-spill.%d.%p.%d.ds") % getpid() % this
+                            % spill_count));
+        ++spill_count;
+        if (spill_type == NULL) {
+            spill_type = spill_library.registerTypePtr
+                ("<ExtentType name=\"hash-join spill\" namespace=\"server.example.com\""
+                 " version=\"1.0\">\n"
+                 "  <field type=\"int32\" name=\"hash\" />\n"
+                 "  <field type=\"int32\" name=\"key_size\" />\n"
+                 "  <field type=\"variable32\" name=\"row\" />\n"
+                 "</ExtentType>\n");
+        }
+        DataSeriesSink sink(filename,
+                            Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1);
+        sink.writeExtentLibrary(spill_library);
+        ExtentSeries series;
+        OutputModule output(sink, series, spill_type, 96*1024);
+        Int32Field hash(series, "hash"), key_size(series, "key_size");
+        Variable32Field row(series, "row");
+        BOOST_FOREACH(const RowBuffer::Row &r, rows.rows) {
+            output.newRecord();
+            hash.set(static_cast<int32_t>(r.hash));
+            key_size.set(r.key_size);
+            row.set(rows.key(r), r.size);
+        }
+        output.close();
+        sink.close();
+        rows.clear();
+        return filename;
+    }
+
+    /// Append the rows in a spill file to into, and remove the file.
+    void readSpill(const string &filename, RowBuffer &into) {
+        {
+            DataSeriesSource source(filename);
+            ExtentSeries series;
+            Int32Field hash(series, "hash"), key_size(series, "key_size");
+            Variable32Field row(series, "row");
+            while (true) {
+                Extent::Ptr e(source.readExtent());
+                if (e == NULL || e->getTypePtr()->getName() != "hash-join spill") {
+                    break; // reached the index
+                }
+                for (series.setExtent(e); series.more(); series.next()) {
+                    into.add(static_cast<uint32_t>(hash.val()), row.val(), key_size.val(),
+                             row.size());
+                }
             }
-            if (output_series.getTypePtr() == NULL) {
-                firstExtent(*e);
+            series.clearExtent();
+        }
+        CHECKED(unlink(filename.c_str()) == 0,
+                format("unable to remove %s: %s") % filename % strerror(errno));
+    }
+
+    /// Look up rows [begin, end) of b extent e; safe to call from multiple threads.
+    void probeRows(const Extent &e, uint32_t begin, uint32_t end, vector<Match> &matches) {
+        const uint32_t record_size = e.getTypePtr()->fixedrecordsize();
+        vector<uint8_t> key;
+        for (uint32_t b_row = begin; b_row < end; ++b_row) {
+            SEP_RowOffset o(b_row * record_size, &e);
+            key.clear();
+            BOOST_FOREACH(FlatColumn::Ptr &c, b_key_columns) {
+                c->encode(key, e, o);
             }
-        
-            if (output_series.getSharedExtent() == NULL) {
-                SINVARIANT(output_series.getTypePtr() != NULL);
-                output_series.newExtent();
+            uint32_t hash = hashKey(key);
+            Match m;
+            m.b_row = b_row;
+            m.partition = partitionOf(hash);
+            const Partition &p(partitions[m.partition]);
+            if (p.spilled) {
+                m.a_row = Partition::none;
+                matches.push_back(m);
+                continue;
             }
-            for (b_series.setExtent(e); b_series.more(); b_series.next()) {
-                processRow();
+            for (m.a_row = p.find(hash, key.empty() ? NULL : &key[0], key.size());
+                 m.a_row != Partition::none; m.a_row = p.next[m.a_row]) {
+                matches.push_back(m);
             }
+        }
+    }
 
-            if (output_series.getSharedExtent()->size() > 96*1024) {
-                break;
+    void outputRow(const Partition &p, uint32_t a_row, const Extent &b_e,
+                   const SEP_RowOffset &b_o) {
+        output_series.newRecord();
+        const uint8_t *a_vals = p.a_rows.values(p.a_rows.rows[a_row]);
+        BOOST_FOREACH(ColumnCopy &c, a_copies) {
+            a_vals = c.into->decode(a_vals);
+        }
+        BOOST_FOREACH(ColumnCopy &c, b_copies) {
+            scratch.clear();
+            c.from->encode(scratch, b_e, b_o);
+            c.into->decode(&scratch[0]);
+        }
+    }
+
+    void spillB(Partition &p, const Extent &b_e, const SEP_RowOffset &b_o) {
+        scratch.clear();
+        BOOST_FOREACH(FlatColumn::Ptr &c, b_key_columns) {
+            c->encode(scratch, b_e, b_o);
+        }
+        uint32_t key_size = scratch.size();
+        uint32_t hash = hashKey(scratch);
+        BOOST_FOREACH(ColumnCopy &c, b_copies) {
+            c.from->encode(scratch, b_e, b_o);
+        }
+        p.b_rows.add(hash, scratch, key_size);
+        b_memory += scratch.size() + sizeof(RowBuffer::Row);
+        if (b_memory > memory_limit) {
+            spillAllB();
+        }
+    }
+
+    void probeExtent(const Extent &e) {
+        uint32_t nrows = e.fixeddata.size() / e.getTypePtr()->fixedrecordsize();
+        uint32_t nparallel = min(nthreads, max(1U, nrows / min_parallel_rows));
+        vector<ProbeThread *> threads;
+        for (uint32_t i = 0; i < nparallel; ++i) {
+            uint32_t begin = (static_cast<uint64_t>(nrows) * i) / nparallel;
+            uint32_t end = (static_cast<uint64_t>(nrows) * (i + 1)) / nparallel;
+            threads.push_back(new ProbeThread(*this, e, begin, end));
+            if (i > 0) {
+                threads.back()->start();
             }
         }
-        return returnOutputSeries();
+        threads[0]->run();
+
+        const uint32_t record_size = e.getTypePtr()->fixedrecordsize();
+        for (uint32_t i = 0; i < threads.size(); ++i) {
+            if (i > 0) {
+                threads[i]->join();
+            }
+            BOOST_FOREACH(const Match &m, threads[i]->matches) {
+                SEP_RowOffset o(m.b_row * record_size, &e);
+                Partition &p(partitions[m.partition]);
+                if (m.a_row == Partition::none) {
+                    spillB(p, e, o);
+                } else {
+                    outputRow(p, m.a_row, e, o);
+                }
+            }
+            delete threads[i];
+        }
+    }
+
+    bool outputFull() {
+        return output_series.hasExtent() && output_series.getExtentRef().size() > 96*1024;
+    }
+
+    /// Start joining b_rows against the partition being joined.
+    void startB(const RowBuffer *b_rows) {
+        joining_b = b_rows;
+        joining_b_row = 0;
+        joining_a_row = Partition::none;
+        if (!b_rows->rows.empty()) {
+            const RowBuffer::Row &b(b_rows->rows[0]);
+            joining_a_row = joining->find(b.hash, b_rows->key(b), b.key_size);
+        }
     }
 
-    void processRow() {
-        key.extract(b_eq_fields);
-        vector<GVVec> *v = a_hashmap.lookup(key);
-        if (v != NULL) {
-            cout << format("%d match on %s\n") % v->size() % key;
-            BOOST_FOREACH(const GVVec &a_vals, *v) {
+    /// Join the rest of joining_b into the output; returns false if it stopped because the
+    /// output extent is full.
+    bool joinB() {
+        const Partition &p(*joining);
+        const RowBuffer &b_rows(*joining_b);
+        while (joining_b_row < b_rows.rows.size()) {
+            const RowBuffer::Row &b(b_rows.rows[joining_b_row]);
+            for (; joining_a_row != Partition::none; joining_a_row = p.next[joining_a_row]) {
+                if (outputFull()) {
+                    return false;
+                }
                 output_series.newRecord();
-                BOOST_FOREACH(Extractor::Ptr p, extractors) {
-                    p->extract(a_vals);
+                const uint8_t *vals = p.a_rows.values(p.a_rows.rows[joining_a_row]);
+                BOOST_FOREACH(ColumnCopy &c, a_copies) {
+                    vals = c.into->decode(vals);
+                }
+                vals = b_rows.values(b);
+                BOOST_FOREACH(ColumnCopy &c, b_copies) {
+                    vals = c.into->decode(vals);
                 }
             }
+            ++joining_b_row;
+            if (joining_b_row < b_rows.rows.size()) {
+                const RowBuffer::Row &next_b(b_rows.rows[joining_b_row]);
+                joining_a_row = p.find(next_b.hash, b_rows.key(next_b), next_b.key_size);
+            }
+        }
+        return true;
+    }
+
+    void startSpilled(Partition &p) {
+        LintelLogDebug("HashJoinModule", format("joining spilled partition, %d a files, %d b files")
+                       % p.a_files.size() % p.b_files.size());
+        BOOST_FOREACH(const string &f, p.a_files) {
+            readSpill(f, p.a_rows);
         }
+        p.a_files.clear();
+        p.buildIndex();
+        joining = &p;
+        joining_b = NULL;
+    }
+
+    /// Join the spilled partition, one b spill file at a time and then the b rows still in
+    /// memory, until the output extent is full or the partition is done.  Like the in-memory
+    /// probe, this returns the output an extent at a time rather than all at once.
+    void joinSpilled() {
+        Partition &p(*joining);
+        while (true) {
+            if (joining_b != NULL && !joinB()) {
+                return; // output is full; carry on from here next time
+            }
+            if (!p.b_files.empty()) {
+                joining_b_rows.clear();
+                readSpill(p.b_files.front(), joining_b_rows);
+                p.b_files.erase(p.b_files.begin());
+                startB(&joining_b_rows);
+            } else if (joining_b != &p.b_rows) {
+                startB(&p.b_rows);
+            } else {
+                break;
+            }
+        }
+        joining_b_rows.clear();
+        p.a_rows.clear();
+        p.b_rows.clear();
+        p.clearIndex();
+        joining = NULL;
+        joining_b = NULL;
+    }
+
+    virtual Extent::Ptr getSharedExtent() {
+        while (true) {
+            if (!b_done) {
+                Extent::Ptr e = b_input.getSharedExtent();
+                if (e == NULL) {
+                    b_done = true;
+                    continue;
+                }
+                if (output_series.getTypePtr() == NULL) {
+                    firstExtent(*e);
+                }
+                if (!output_series.hasExtent()) {
+                    output_series.newExtent();
+                }
+                probeExtent(*e);
+            } else if (joining != NULL) {
+                if (!output_series.hasExtent()) {
+                    output_series.newExtent();
+                }
+                joinSpilled();
+            } else {
+                if (next_spilled >= partitions.size()) {
+                    break;
+                }
+                Partition &p(partitions[next_spilled]);
+                ++next_spilled;
+                if (p.spilled) {
+                    startSpilled(p);
+                }
+                continue;
+            }
+
+            if (outputFull()) {
+                break;
+            }
+        }
+        return returnOutputSeries();
     }
 
     DataSeriesModule &a_input, &b_input;
     int32_t max_a_rows;
     const CMap eq_columns, keep_columns;
-    
-    HashMap< GVVec, vector<GVVec> > a_hashmap;
-    GVVec key;
-    ExtentSeries b_series;
-    vector<GeneralField::Ptr> b_eq_fields;
-    vector<Extractor::Ptr> extractors;
+    // a_series is only used while reading a in firstExtent(), but the columns stay on it.
+    ExtentSeries a_series, b_series;
+    vector<FlatColumn::Ptr> a_key_columns, b_key_columns;
+    vector<ColumnCopy> a_copies, b_copies;
     const string output_table_name;
-    
+    const size_t memory_limit;
+    const uint32_t nthreads;
+
+    vector<Partition> partitions;
+    size_t a_memory, b_memory;
+    vector<uint8_t> scratch;
+    ExtentTypeLibrary spill_library;
+    ExtentType::Ptr spill_type;
+    uint32_t spill_count;
+    bool b_done;
+    size_t next_spilled;
+    // The spilled partition being joined, or NULL, and how far the join has got.
+    Partition *joining;
+    RowBuffer joining_b_rows; // from the current b spill file
+    const RowBuffer *joining_b; // joining_b_rows or joining->b_rows, NULL before either
+    size_t joining_b_row;
+    uint32_t joining_a_row; // next a row matching joining_b_row, or Partition::none
 };
 
+const uint32_t HashJoinModule::npartitions;
+
 OutputSeriesModule::OSMPtr dataseries::makeHashJoinModule
 (DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
  const map<string, string> &eq_columns, const map<string, string> &keep_columns,
- const string &output_table_name) {
+ const string &output_table_name, size_t memory_limit, int nthreads) {
     return OutputSeriesModule::OSMPtr(new HashJoinModule(a_input, max_a_rows, b_input, eq_columns,
-                                                         keep_columns, output_table_name));
+                                                         keep_columns, output_table_name,
+                                                         memory_limit, nthreads));
 }
-
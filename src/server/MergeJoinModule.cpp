@@ -0,0 +1,323 @@
+#include "DSSModule.hpp"
+
+/* A merge join of two tables that are both sorted by the key columns, in the order and with the
+   sort and null modes of the keys, i.e. as sortTable would leave them.  Both inputs are read
+   once, in order; the only rows held in memory are the b rows of the current key, so that
+   duplicate keys on both sides produce every pairing.
+
+   Rows whose key has a null in it never match, as in SQL, but still take their place in the
+   merge order, so they come out as unmatched rows in the outer modes.  Output rows are in merge
+   order; the rows for one key are each a row in a order, paired with each of the b rows in b
+   order.  Columns from a side that can be missing from an output row (b for a left outer join,
+   both for a full outer join) are made nullable in the output. */
+
+class MergeJoinModule : public OutputSeriesModule, public ThrowError {
+  public:
+    typedef map<string, string> CMap; // column map
+
+    MergeJoinModule(DataSeriesModule &a_input, DataSeriesModule &b_input,
+                    const vector<MergeJoinKey> &keys, const CMap &keep_columns, JoinMode mode,
+                    const string &output_table_name)
+        : a_input(a_input), b_input(b_input), keys(keys), keep_columns(keep_columns), mode(mode),
+          output_table_name(output_table_name), a_series(), b_series(), a_key_fields(),
+          b_key_fields(), a_copies(), b_from(), b_into(), a_key(), b_key(), next_key(),
+          group_key(), b_values(), group(), group_rows(0), group_b_row(0), in_group(false),
+          started(false), a_done(false), b_done(false)
+    {
+        if (keys.empty()) {
+            requestError("merge join needs at least one key column");
+        }
+        if (mode != JM_Inner && mode != JM_LeftOuter && mode != JM_FullOuter) {
+            requestError(format("invalid join mode %d") % mode);
+        }
+        BOOST_FOREACH(const MergeJoinKey &key, keys) {
+            if (key.sort_mode != SM_Ascending && key.sort_mode != SM_Decending) {
+                requestError(format("invalid sort mode for key %s") % key.a_column);
+            }
+            if (key.null_mode != NM_First && key.null_mode != NM_Last) {
+                requestError(format("invalid null mode for key %s") % key.a_column);
+            }
+        }
+    }
+
+    virtual ~MergeJoinModule() { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        if (!started) {
+            firstExtent();
+        }
+        if (!output_series.hasExtent()) {
+            output_series.newExtent();
+        }
+        if (in_group && !joinGroup()) {
+            return returnOutputSeries();
+        }
+        // Once a is done, only a full outer join has anything left to output.
+        while (!a_done || (!b_done && mode == JM_FullOuter)) {
+            int cmp = a_done ? 1 : (b_done ? -1 : compareKeys(a_key, b_key));
+            if (cmp == 0 && a_key.anyNull()) {
+                cmp = -1; // null keys don't match; the b rows follow once a moves past them
+            }
+            if (cmp < 0) {
+                if (mode != JM_Inner) {
+                    emit(true, NULL);
+                }
+                advance(a_series, a_input, a_key_fields, a_key, a_done, "a");
+            } else if (cmp > 0) {
+                if (mode == JM_FullOuter) {
+                    b_values.read(b_from);
+                    emit(false, &b_values);
+                }
+                advance(b_series, b_input, b_key_fields, b_key, b_done, "b");
+            } else if (!joinGroup()) {
+                return returnOutputSeries();
+            }
+            if (outputFull()) {
+                return returnOutputSeries();
+            }
+        }
+        if (output_series.getExtentRef().nRecords() == 0) {
+            output_series.clearExtent();
+            return Extent::Ptr();
+        }
+        return returnOutputSeries();
+    }
+
+  private:
+    /// Values of a set of columns in one row, keeping track of which are null
+    struct RowValues {
+        vector<GeneralValue> values;
+        vector<bool> nulls;
+
+        void read(const vector<GeneralField::Ptr> &fields) {
+            values.resize(fields.size());
+            nulls.resize(fields.size());
+            for (size_t i = 0; i < fields.size(); ++i) {
+                nulls[i] = fields[i]->isNull();
+                if (!nulls[i]) {
+                    values[i].set(*fields[i]);
+                }
+            }
+        }
+
+        bool anyNull() const {
+            return find(nulls.begin(), nulls.end(), true) != nulls.end();
+        }
+    };
+
+    // < 0 if a sorts before b; same rules as SortModule's keys
+    int compareKeys(const RowValues &a, const RowValues &b) const {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (a.nulls[i] || b.nulls[i]) {
+                if (a.nulls[i] && b.nulls[i]) {
+                    continue;
+                }
+                return a.nulls[i] == (keys[i].null_mode == NM_First) ? -1 : 1;
+            }
+            int sign = keys[i].sort_mode == SM_Ascending ? 1 : -1;
+            if (a.values[i] < b.values[i]) {
+                return -sign;
+            } else if (b.values[i] < a.values[i]) {
+                return sign;
+            }
+        }
+        return 0;
+    }
+
+    // Column xml for the output, nullable if the row it comes from may be missing.
+    string outputField(const ExtentType::Ptr type, const string &from, const string &into,
+                       bool may_be_missing) {
+        string ret(renameField(type, from, into));
+        if (may_be_missing && !type->getNullable(from)) {
+            size_t end = ret.rfind("/>");
+            SINVARIANT(end != string::npos);
+            ret.insert(end, " opt_nullable=\"yes\"");
+        }
+        return ret;
+    }
+
+    void firstExtent() {
+        started = true;
+        a_done = !nextExtent(a_series, a_input);
+        b_done = !nextExtent(b_series, b_input);
+        if (a_series.getTypePtr() == NULL || b_series.getTypePtr() == NULL) {
+            requestError("merge join inputs must have at least one extent");
+        }
+        BOOST_FOREACH(const MergeJoinKey &key, keys) {
+            if (!a_series.getTypePtr()->hasColumn(key.a_column)) {
+                requestError(format("a table has no key column %s") % key.a_column);
+            }
+            if (!b_series.getTypePtr()->hasColumn(key.b_column)) {
+                requestError(format("b table has no key column %s") % key.b_column);
+            }
+            if (a_series.getTypePtr()->getFieldType(key.a_column)
+                != b_series.getTypePtr()->getFieldType(key.b_column)) {
+                requestError(format("key columns %s and %s have different types")
+                             % key.a_column % key.b_column);
+            }
+            a_key_fields.push_back(GeneralField::make(a_series, key.a_column));
+            b_key_fields.push_back(GeneralField::make(b_series, key.b_column));
+        }
+
+        string output_xml(str(format("<ExtentType name=\"merge-join -> %s\""
+                                     " namespace=\"server.example.com\" version=\"1.0\">\n")
+                              % output_table_name));
+        vector<string> a_from, a_into;
+        BOOST_FOREACH(const CMap::value_type &vt, keep_columns) {
+            string field_name(vt.first.substr(2));
+            if (prefixequal(vt.first, "a.") && a_series.getTypePtr()->hasColumn(field_name)) {
+                output_xml.append(outputField(a_series.getTypePtr(), field_name, vt.second,
+                                              mode == JM_FullOuter));
+                a_from.push_back(field_name);
+                a_into.push_back(vt.second);
+            } else if (prefixequal(vt.first, "b.")
+                       && b_series.getTypePtr()->hasColumn(field_name)) {
+                output_xml.append(outputField(b_series.getTypePtr(), field_name, vt.second,
+                                              mode != JM_Inner));
+                b_from.push_back(GeneralField::make(b_series, field_name));
+                b_into.push_back(vt.second);
+            } else {
+                requestError(format("invalid extraction %s") % vt.first);
+            }
+        }
+        output_xml.append("</ExtentType>\n");
+        if (a_from.empty() && b_from.empty()) {
+            requestError("must extract at least one field");
+        }
+
+        ExtentTypeLibrary lib;
+        LintelLogDebug("MergeJoinModule", format("output xml: %s") % output_xml);
+        output_series.setType(lib.registerTypePtr(output_xml));
+        for (size_t i = 0; i < a_from.size(); ++i) {
+            a_copies.push_back(make_pair(GeneralField::make(a_series, a_from[i]),
+                                         GeneralField::make(output_series, a_into[i])));
+        }
+        for (size_t i = 0; i < b_into.size(); ++i) {
+            b_into_fields.push_back(GeneralField::make(output_series, b_into[i]));
+        }
+        if (!a_done) {
+            a_key.read(a_key_fields);
+        }
+        if (!b_done) {
+            b_key.read(b_key_fields);
+        }
+    }
+
+    // Moves series to the next non-empty extent, returns false at the end of the input.
+    bool nextExtent(ExtentSeries &series, DataSeriesModule &input) {
+        while (true) {
+            Extent::Ptr e(input.getSharedExtent());
+            if (e == NULL) {
+                series.clearExtent();
+                return false;
+            }
+            if (series.getTypePtr() == NULL) {
+                series.setType(e->getTypePtr());
+            }
+            if (e->nRecords() > 0) {
+                series.setExtent(e);
+                return true;
+            }
+        }
+    }
+
+    // Moves to the next row of one input and reads its key, checking the input is sorted.
+    void advance(ExtentSeries &series, DataSeriesModule &input,
+                 const vector<GeneralField::Ptr> &key_fields, RowValues &key, bool &done,
+                 const char *which) {
+        ++series;
+        if (!series.more() && !nextExtent(series, input)) {
+            done = true;
+            return;
+        }
+        next_key.read(key_fields);
+        if (compareKeys(key, next_key) > 0) {
+            requestError(format("%s table is not sorted by the join keys") % which);
+        }
+        swap(key, next_key);
+    }
+
+    bool outputFull() {
+        return output_series.getExtentRef().size() > 96*1024;
+    }
+
+    // Pairs every a row with the current key with every b row with that key.  Returns false
+    // if the output extent filled up part way through; the next call resumes the group at the
+    // pairing after the last one emitted, so a group with many rows on both sides is spread
+    // over as many output extents as it needs.
+    bool joinGroup() {
+        if (!in_group) {
+            group_key = b_key;
+            group_rows = 0;
+            while (!b_done && compareKeys(b_key, group_key) == 0) {
+                if (group_rows == group.size()) {
+                    group.resize(group_rows + 1);
+                }
+                group[group_rows].read(b_from);
+                ++group_rows;
+                advance(b_series, b_input, b_key_fields, b_key, b_done, "b");
+            }
+            group_b_row = 0;
+            in_group = true;
+        }
+        while (!a_done && compareKeys(a_key, group_key) == 0) {
+            while (group_b_row < group_rows) {
+                emit(true, &group[group_b_row]);
+                ++group_b_row;
+                if (outputFull()) {
+                    return false;
+                }
+            }
+            group_b_row = 0;
+            advance(a_series, a_input, a_key_fields, a_key, a_done, "a");
+        }
+        in_group = false;
+        if (group_rows < group.size() / 2) {
+            group.resize(group_rows); // don't keep the memory of an unusually large group
+        }
+        return true;
+    }
+
+    // Adds an output row from the current a row (or nulls if !from_a) and b (or nulls).
+    void emit(bool from_a, const RowValues *b) {
+        output_series.newRecord();
+        for (size_t i = 0; i < a_copies.size(); ++i) {
+            if (from_a) {
+                a_copies[i].second->set(a_copies[i].first);
+            } else {
+                a_copies[i].second->setNull();
+            }
+        }
+        for (size_t i = 0; i < b_into_fields.size(); ++i) {
+            if (b == NULL || b->nulls[i]) {
+                b_into_fields[i]->setNull();
+            } else {
+                b_into_fields[i]->set(b->values[i]);
+            }
+        }
+    }
+
+    DataSeriesModule &a_input, &b_input;
+    const vector<MergeJoinKey> keys;
+    const CMap keep_columns;
+    const JoinMode mode;
+    const string output_table_name;
+
+    ExtentSeries a_series, b_series;
+    vector<GeneralField::Ptr> a_key_fields, b_key_fields;
+    vector< pair<GeneralField::Ptr, GeneralField::Ptr> > a_copies; // (a field, output field)
+    vector<GeneralField::Ptr> b_from, b_into_fields;
+    vector<string> b_into;
+    RowValues a_key, b_key, next_key, group_key, b_values;
+    vector<RowValues> group; // b rows with the current key; may have extra unused entries
+    size_t group_rows, group_b_row; // rows used in group, next one to pair with the a row
+    bool in_group; // part way through joinGroup()
+    bool started, a_done, b_done;
+};
+
+OutputSeriesModule::OSMPtr dataseries::makeMergeJoinModule
+(DataSeriesModule &a_input, DataSeriesModule &b_input, const vector<MergeJoinKey> &keys,
+ const map<string, string> &keep_columns, JoinMode mode, const string &output_table_name) {
+    return OutputSeriesModule::OSMPtr(new MergeJoinModule(a_input, b_input, keys, keep_columns,
+                                                          mode, output_table_name));
+}
@@ -22,17 +22,19 @@ class SelectModule : public OutputSeriesModule {
 
                 copier.prep();
                 where_expr.reset(DSExpr::make(input_series, where_expr_str));
+                where_batch.reset(DSExprBatch::compile(where_expr.get(), input_series));
+                SINVARIANT(where_batch != NULL);
             }
 
             if (!output_series.hasExtent()) {
                 output_series.newExtent();
             }
         
-            for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-                if (where_expr->valBool()) {
-                    output_series.newRecord();
-                    copier.copyRecord();
-                }
+            input_series.setExtent(in);
+            where_batch->select(selected);
+            BOOST_FOREACH(uint32_t row, selected) {
+                output_series.newRecord();
+                copier.copyRecord(*in, where_batch->rowOffset(row));
             }
             if (output_series.getExtentRef().size() > 96*1024) {
                 return returnOutputSeries();
@@ -45,6 +47,8 @@ class SelectModule : public OutputSeriesModule {
     ExtentSeries input_series;
     ExtentRecordCopy copier;
     boost::shared_ptr<DSExpr> where_expr;
+    boost::scoped_ptr<DSExprBatch> where_batch;
+    DSExprBatch::Selection selected;
 };
 
 DataSeriesModule::Ptr 
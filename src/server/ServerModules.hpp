@@ -12,6 +12,8 @@
 // from inheritence.
 
 namespace dataseries {
+    class ExtentCache;
+
     struct SortColumnImpl {
         SortColumnImpl(GeneralField::Ptr field, bool sort_less, NullMode null_mode)
                 : field(field), sort_less(sort_less), null_mode(null_mode)
@@ -37,14 +39,43 @@ namespace dataseries {
     };
 
 
+    /** Read the extents of type_name from the table stored at path through cache; generation
+        must change whenever the table is rewritten. */
+    DataSeriesModule::Ptr makeCachedTableModule
+    (ExtentCache &cache, const std::string &table, uint64_t generation, const std::string &path,
+     const std::string &type_name);
+
     DataSeriesModule::Ptr makeTeeModule(DataSeriesModule &source_module, 
                                         const std::string &output_path);
-    DataSeriesModule::Ptr makeTableDataModule(DataSeriesModule &source_module,
-                                              TableData &into, uint32_t max_rows);
+
+    /** Returns the rows of a module a page at a time, see openCursor in DataSeriesServer.thrift */
+    class TableCursor {
+      public:
+        typedef boost::shared_ptr<TableCursor> Ptr;
+
+        virtual ~TableCursor() { }
+
+        /** Fills in into with up to max_rows rows after those returned by earlier calls. */
+        virtual void fetch(TablePage &into, uint32_t max_rows) = 0;
+    };
+
+    /** Cursor over input, or the rows of it that match where_expr if it is not empty */
+    TableCursor::Ptr makeTableCursor(DataSeriesModule::Ptr input, const std::string &where_expr,
+                                     PageEncoding encoding);
+    /** Join using at most about memory_limit bytes to hold a; beyond that, partitions of a and
+        of the matching b rows are spilled to files in the current directory and joined at the
+        end.  nthreads builds and probes in parallel, -1 ==> # cpus */
     OutputSeriesModule::OSMPtr makeHashJoinModule
     (DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
      const std::map<std::string, std::string> &eq_columns,
      const std::map<std::string, std::string> &keep_columns,
+     const std::string &output_table_name, size_t memory_limit = 1024 * 1024 * 1024,
+     int nthreads = -1);
+
+    /** Join of inputs sorted by keys; streams both, holding only the b rows of one key */
+    OutputSeriesModule::OSMPtr makeMergeJoinModule
+    (DataSeriesModule &a_input, DataSeriesModule &b_input, const std::vector<MergeJoinKey> &keys,
+     const std::map<std::string, std::string> &keep_columns, JoinMode mode,
      const std::string &output_table_name);
 
     OutputSeriesModule::OSMPtr makeStarJoinModule
@@ -67,8 +98,12 @@ namespace dataseries {
      const std::vector<SortColumn> &order_columns,
      const std::string &output_table_name);
 
+    /** Sort using at most about memory_limit bytes of input extents in memory; beyond that,
+        sorted runs are spilled to files in the current directory and merged.  nthreads sorts
+        in parallel, -1 ==> # cpus */
     OutputSeriesModule::OSMPtr makeSortModule
-    (DataSeriesModule &source, const std::vector<SortColumn> &sort_by);
+    (DataSeriesModule &source, const std::vector<SortColumn> &sort_by,
+     size_t memory_limit = 1024 * 1024 * 1024, int nthreads = -1);
 
     OutputSeriesModule::OSMPtr makeExprTransformModule
     (DataSeriesModule &source, const std::vector<ExprColumn> &expr_columns,
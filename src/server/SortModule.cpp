@@ -1,8 +1,17 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include "CodeGen.hpp"
 #include "DSSModule.hpp"
 
 #include <new> // losertree.h needs this and forgot to include it.
 #include <parallel/losertree.h>
 
+#include <Lintel/PThread.hpp>
+
 /* Note: there are several versions of sort modules on the tomer sub-branch.  There is an in-memory
    sort, a radix in memory sort, a spilling to disk sort and a parallel sort.  The latter versions
    are somewhat specific to the sorting rules needed for the sort benchmark.  The former is a
@@ -11,6 +20,25 @@
    generate C++ source code for specific operations, we don't need the complication of the
    template, and so we create yet another module to be more in the style of the server */
 
+/* This version is an external sort.  Input extents are collected until they use up the memory
+   limit; that batch is then split into one chunk per thread and each chunk is sorted in parallel.
+   If the whole input fits, the chunks are merged straight to the output; otherwise each batch is
+   merged into a run file (a DataSeries file in the working directory), and the run files, plus
+   the chunks of the last batch, are merged to make the output.  If there are too many runs to
+   merge at once, groups of them are first merged into bigger runs.
+
+   Rows are compared through normalized keys rather than GeneralValue: each row's sort columns
+   are encoded once into a byte string whose memcmp order is the sort order, so a comparison is
+   just a memcmp.  Each column encodes as a null marker byte (null first < value < null last)
+   followed, if not null, by the value: integers and doubles big endian with the sign handled so
+   that unsigned byte order is numeric order, strings with each 0 byte escaped as 0 0xFF and a
+   terminating 0 0.  Descending columns invert the value bytes but not the null marker.
+
+   When CodeGen is available the keys are built by generated code specialized for the input type
+   and sort columns (see sortKeySource()), which reads the values straight out of the extent's
+   bytes at fixed offsets; appendSortKey() remains the reference version, and is used whenever
+   code can not be generated. */
+
 #if 0
 #include <algorithm>
 #include <vector>
@@ -44,88 +72,445 @@ int main() {
 }
 #endif
 
-class SortModule : public OutputSeriesModule {
-  public:
-    SortModule(DataSeriesModule &source, const vector<SortColumn> &sort_by)
-            : source(source), sort_by(sort_by), copier(input_series, output_series), ercs(),
-              sorted_extents(), merge()
-    { }
-
-    virtual ~SortModule() { }
-
-    struct ExtentRowCompareState {
-        ExtentRowCompareState() : extent(), columns() { }
-        Extent::Ptr extent;
-        vector<SortColumnImpl> columns;
-    };
+namespace {
+    void appendBigEndian(vector<uint8_t> &key, uint64_t v, unsigned nbytes, uint8_t flip) {
+        for (int shift = (nbytes - 1) * 8; shift >= 0; shift -= 8) {
+            key.push_back(static_cast<uint8_t>(v >> shift) ^ flip);
+        }
+    }
 
-    static bool strictlyLessThan(const Extent::Ptr &ea, const SEP_RowOffset &oa,
-                                 const Extent::Ptr &eb, const SEP_RowOffset &ob,
-                                 const vector<SortColumnImpl> &columns) {
+    void appendSortKey(vector<uint8_t> &key, const vector<SortColumnImpl> &columns,
+                       const Extent &e, const SEP_RowOffset &o) {
         BOOST_FOREACH(const SortColumnImpl &c, columns) {
-            bool a_null = c.field->isNull(*ea, oa);
-            bool b_null = c.field->isNull(*eb, ob);
-
-            if (a_null || b_null) {
-                if (a_null && !b_null) { //         a < b : a > b
-                    return c.null_mode == NM_First ? true : false;
-                } else if (!a_null && b_null) { //   a > b : a < b
-                    return c.null_mode == NM_First ? false : true;
-                } else {
-                    // ==; keep going
+            if (c.field->isNull(e, o)) {
+                key.push_back(c.null_mode == NM_First ? 0 : 2);
+                continue;
+            }
+            key.push_back(1);
+            uint8_t flip = c.sort_less ? 0 : 0xFF;
+            GeneralValue v(c.field->val(e, o));
+            switch (v.getType()) 
+                {
+                case ExtentType::ft_bool: 
+                    appendBigEndian(key, v.valBool() ? 1 : 0, 1, flip); 
+                    break;
+                case ExtentType::ft_byte: 
+                    appendBigEndian(key, v.valByte(), 1, flip); 
+                    break;
+                case ExtentType::ft_int32:
+                    appendBigEndian(key, static_cast<uint32_t>(v.valInt32()) ^ 0x80000000U, 
+                                    4, flip);
+                    break;
+                case ExtentType::ft_int64:
+                    appendBigEndian(key, static_cast<uint64_t>(v.valInt64()) ^ (1ULL << 63),
+                                    8, flip);
+                    break;
+                case ExtentType::ft_double: {
+                    double d = v.valDouble();
+                    if (d == 0) {
+                        d = 0; // -0.0 == 0.0
+                    }
+                    uint64_t bits;
+                    memcpy(&bits, &d, sizeof(bits));
+                    bits = (bits >> 63) != 0 ? ~bits : bits | (1ULL << 63);
+                    appendBigEndian(key, bits, 8, flip);
+                    break;
                 }
-            } else {
-                GeneralValue va(c.field->val(*ea, oa));
-                GeneralValue vb(c.field->val(*eb, ob));
-                if (va < vb) {
-                    return c.sort_less;
-                } else if (vb < va) {
-                    return !c.sort_less;
-                } else {
-                    // ==; keep going
+                case ExtentType::ft_variable32: case ExtentType::ft_fixedwidth: {
+                    const string str(v.valString());
+                    for (size_t i = 0; i < str.size(); ++i) {
+                        key.push_back(static_cast<uint8_t>(str[i]) ^ flip);
+                        if (str[i] == 0) {
+                            key.push_back(0xFF ^ flip);
+                        }
+                    }
+                    key.push_back(flip);
+                    key.push_back(flip);
+                    break;
+                }
+                default:
+                    FATAL_ERROR("internal error, unexpected type");
+                }
+        }
+    }
+
+    /// Generated equivalent of appendSortKey() for one row
+    typedef void (*SortKeyFn)(vector<uint8_t> &key, const uint8_t *row,
+                              const uint8_t *variable_data);
+
+    // Generated code for a column's value, assuming it is not null; sortKeySource() indents it.
+    string sortKeyValueSource(const ExtentType &type, const string &column, const string &flip) {
+        int32_t offset = type.getOffset(column);
+        switch (type.getFieldType(column)) 
+            {
+            case ExtentType::ft_bool:
+                return str(format("appendBigEndian(key, (row[%d] & 0x%x) ? 1 : 0, 1, %s);\n")
+                           % offset % (1 << type.getBitPos(column)) % flip);
+            case ExtentType::ft_byte:
+                return str(format("appendBigEndian(key, row[%d], 1, %s);\n") % offset % flip);
+            case ExtentType::ft_int32:
+                return str(format("int32_t v;\n"
+                                  "memcpy(&v, row + %d, 4);\n"
+                                  "appendBigEndian(key, static_cast<uint32_t>(v) ^ 0x80000000U,"
+                                  " 4, %s);\n")
+                           % offset % flip);
+            case ExtentType::ft_int64:
+                return str(format("int64_t v;\n"
+                                  "memcpy(&v, row + %d, 8);\n"
+                                  "appendBigEndian(key, static_cast<uint64_t>(v) ^ (1ULL << 63),"
+                                  " 8, %s);\n")
+                           % offset % flip);
+            case ExtentType::ft_double:
+                if (type.getDoubleBase(column) != 0) {
+                    return string(); // rare, and the base would need to be printed exactly
                 }
+                return str(format("double d;\n"
+                                  "memcpy(&d, row + %d, 8);\n"
+                                  "if (d == 0) {\n"
+                                  "    d = 0; // -0.0 == 0.0\n"
+                                  "}\n"
+                                  "uint64_t bits;\n"
+                                  "memcpy(&bits, &d, 8);\n"
+                                  "bits = (bits >> 63) != 0 ? ~bits : bits | (1ULL << 63);\n"
+                                  "appendBigEndian(key, bits, 8, %s);\n") % offset % flip);
+            case ExtentType::ft_variable32:
+                return str(format("int32_t var_offset, size;\n"
+                                  "memcpy(&var_offset, row + %d, 4);\n"
+                                  "memcpy(&size, variable_data + var_offset, 4);\n"
+                                  "appendString(key, variable_data + var_offset + 4, size, %s);\n")
+                           % offset % flip);
+            case ExtentType::ft_fixedwidth:
+                return str(format("appendString(key, row + %d, %d, %s);\n")
+                           % offset % type.getSize(column) % flip);
+            default:
+                return string();
+            }
+    }
+
+    string indent(const string &code, const string &by) {
+        string ret;
+        for (size_t begin = 0; begin < code.size(); ) {
+            size_t end = code.find('\n', begin);
+            end = end == string::npos ? code.size() : end + 1;
+            ret.append(by).append(code, begin, end - begin);
+            begin = end;
+        }
+        return ret;
+    }
+
+    /** Returns the source of dataseries_sort_key, a SortKeyFn that builds the same keys as
+        appendSortKey() for rows of type, or "" if one of the columns isn't supported.  Type and
+        column names come from clients, so none of them are written into the source. */
+    string sortKeySource(const ExtentType &type, const vector<SortColumn> &sort_by) {
+        string ret("// Generated by SortModule; see appendSortKey()\n"
+                   "#include <stdint.h>\n"
+                   "#include <string.h>\n"
+                   "#include <vector>\n"
+                   "\n"
+                   "static inline void appendBigEndian(std::vector<uint8_t> &key,"
+                   " uint64_t v, unsigned nbytes, uint8_t flip) {\n"
+                   "    for (int shift = (nbytes - 1) * 8; shift >= 0; shift -= 8) {\n"
+                   "        key.push_back(static_cast<uint8_t>(v >> shift) ^ flip);\n"
+                   "    }\n"
+                   "}\n"
+                   "\n"
+                   "static inline void appendString(std::vector<uint8_t> &key,"
+                   " const uint8_t *str, int32_t size, uint8_t flip) {\n"
+                   "    for (int32_t i = 0; i < size; ++i) {\n"
+                   "        key.push_back(str[i] ^ flip);\n"
+                   "        if (str[i] == 0) {\n"
+                   "            key.push_back(0xFF ^ flip);\n"
+                   "        }\n"
+                   "    }\n"
+                   "    key.push_back(flip);\n"
+                   "    key.push_back(flip);\n"
+                   "}\n"
+                   "\n"
+                   "extern \"C\" void dataseries_sort_key(std::vector<uint8_t> &key,"
+                   " const uint8_t *row, const uint8_t *variable_data) {\n");
+        for (size_t i = 0; i < sort_by.size(); ++i) {
+            const SortColumn &by(sort_by[i]);
+            string value(sortKeyValueSource(type, by.column,
+                                             by.sort_mode == SM_Ascending ? "0" : "0xFF"));
+            if (value.empty()) {
+                return string();
+            }
+            ret.append(str(format("    // sort column %d\n") % i));
+            if (type.getNullable(by.column)) {
+                string null_column(ExtentType::nullableFieldname(by.column));
+                ret.append(str(format("    if (row[%d] & 0x%x) {\n"
+                                      "        key.push_back(%d);\n"
+                                      "    } else {\n")
+                               % type.getOffset(null_column) % (1 << type.getBitPos(null_column))
+                               % (by.null_mode == NM_First ? 0 : 2)));
+            } else {
+                ret.append("    {\n");
             }
+            ret.append("        key.push_back(1);\n");
+            ret.append(indent(value, "        "));
+            ret.append("    }\n");
         }
-        return false; // all == so not <
+        ret.append("}\n");
+        return ret;
+    }
+
+    // Returns NULL if the caller should use appendSortKey().
+    SortKeyFn loadSortKeyFn(const ExtentType &type, const vector<SortColumn> &sort_by) {
+        string source(sortKeySource(type, sort_by));
+        if (source.empty()) {
+            return NULL;
+        }
+        void *fn = CodeGen::instance().load(source, "dataseries_sort_key");
+        return reinterpret_cast<SortKeyFn>(fn);
+    }
+
+    bool keyLess(const uint8_t *a, size_t a_size, const uint8_t *b, size_t b_size) {
+        int cmp = memcmp(a, b, min(a_size, b_size));
+        return cmp < 0 || (cmp == 0 && a_size < b_size);
     }
 
-    class ExtentRowCompare {
+    /// Rows from a batch of input extents, sorted by sortChunk()
+    struct SortChunk {
+        typedef boost::shared_ptr<SortChunk> Ptr;
+
+        struct Entry {
+            uint32_t key_offset, key_size;
+            uint32_t extent, row_offset;
+        };
+
+        struct EntryLess {
+            EntryLess(const vector<uint8_t> &keys) : keys(&keys[0]) { }
+            bool operator ()(const Entry &a, const Entry &b) const {
+                return keyLess(keys + a.key_offset, a.key_size, keys + b.key_offset, b.key_size);
+            }
+            const uint8_t *keys;
+        };
+
+        SortChunk() : extents(), keys(), entries() { }
+
+        vector<Extent::Ptr> extents;
+        vector<uint8_t> keys;
+        vector<Entry> entries;
+    };
+
+    /// A sorted sequence of rows, either a chunk in memory or a run file.
+    class SortRun {
+      public:
+        typedef boost::shared_ptr<SortRun> Ptr;
+
+        virtual ~SortRun() { }
+
+        virtual bool more() const = 0;
+        virtual void next() = 0;
+        virtual const uint8_t *key() const = 0;
+        virtual size_t keySize() const = 0;
+        virtual const Extent &extent() const = 0;
+        virtual SEP_RowOffset rowOffset() const = 0;
+    };
+
+    class MemoryRun : public SortRun {
+      public:
+        MemoryRun(SortChunk::Ptr chunk) : chunk(chunk), pos(0) { }
+
+        virtual bool more() const { 
+            return pos < chunk->entries.size(); 
+        }
+        virtual void next() { 
+            ++pos; 
+        }
+        virtual const uint8_t *key() const { 
+            return &chunk->keys[chunk->entries[pos].key_offset]; 
+        }
+        virtual size_t keySize() const { 
+            return chunk->entries[pos].key_size; 
+        }
+        virtual const Extent &extent() const { 
+            return *chunk->extents[chunk->entries[pos].extent]; 
+        }
+        virtual SEP_RowOffset rowOffset() const {
+            const SortChunk::Entry &entry(chunk->entries[pos]);
+            return SEP_RowOffset(entry.row_offset, chunk->extents[entry.extent]);
+        }
+
+      private:
+        SortChunk::Ptr chunk;
+        size_t pos;
+    };
+
+    /// Reads back a run written by SortModule::writeRun(), removing the file when done.
+    class FileRun : public SortRun {
       public:
-        ExtentRowCompare(ExtentRowCompareState *state) : state(state) { }
-        ExtentRowCompare(const ExtentRowCompare &from) : state(from.state) { }
-        ExtentRowCompare &operator =(const ExtentRowCompare &rhs) {
-            state = rhs.state;
-            return *this;
+        FileRun(const string &filename, const vector<SortColumn> &sort_by, SortKeyFn sort_key_fn)
+            : filename(filename), source(filename), extent_ptr(), series(), columns(), key_buf(),
+              sort_key_fn(sort_key_fn)
+        { 
+            // The source has already read the type extent; the index is skipped in setExtent().
+            Extent::Ptr first(source.readExtent());
+            series.setType(first->getTypePtr());
+            BOOST_FOREACH(const SortColumn &by, sort_by) {
+                columns.push_back(SortColumnImpl(GeneralField::make(series, by.column),
+                                                 by.sort_mode == SM_Ascending, by.null_mode));
+            }
+            setExtent(first);
+        }
+
+        virtual ~FileRun() {
+            series.clearExtent();
+            source.closefile();
+            CHECKED(unlink(filename.c_str()) == 0, 
+                    format("unable to remove sort run %s: %s") % filename % strerror(errno));
+        }
+
+        virtual bool more() const { 
+            return extent_ptr != NULL; 
+        }
+        virtual void next() {
+            ++series;
+            if (series.more()) {
+                computeKey();
+            } else {
+                setExtent(Extent::Ptr(source.readExtent()));
+            }
+        }
+        virtual const uint8_t *key() const { 
+            return &key_buf[0]; 
+        }
+        virtual size_t keySize() const { 
+            return key_buf.size(); 
+        }
+        virtual const Extent &extent() const { 
+            return *extent_ptr; 
+        }
+        virtual SEP_RowOffset rowOffset() const {
+            return const_cast<ExtentSeries &>(series).getRowOffset();
         }
 
-        bool operator ()(const SEP_RowOffset &a, const SEP_RowOffset &b) const {
-            return strictlyLessThan(state->extent, a, state->extent, b, state->columns);
+      private:
+        void setExtent(Extent::Ptr e) {
+            if (e != NULL && e->getTypePtr() != series.getTypePtr()) {
+                // Reached the index at the end of the run file.
+                SINVARIANT(e->getTypePtr() == ExtentType::getDataSeriesIndexTypeV0Ptr());
+                e.reset();
+            }
+            extent_ptr = e;
+            if (e == NULL) {
+                series.clearExtent();
+            } else {
+                series.setExtent(e);
+                SINVARIANT(series.more()); // never write empty extents
+                computeKey();
+            }
         }
 
-        const ExtentRowCompareState *state;
+        void computeKey() {
+            key_buf.clear();
+            if (sort_key_fn != NULL) {
+                const Extent &e(*extent_ptr);
+                sort_key_fn(key_buf, e.fixeddata.begin() + series.getRowOffset().fixedOffset(),
+                            e.variabledata.begin());
+            } else {
+                appendSortKey(key_buf, columns, *extent_ptr, series.getRowOffset());
+            }
+        }
+
+        const string filename;
+        DataSeriesSource source;
+        Extent::Ptr extent_ptr;
+        ExtentSeries series;
+        vector<SortColumnImpl> columns;
+        vector<uint8_t> key_buf;
+        SortKeyFn sort_key_fn; // the run has the same type as the input, so the same layout
     };
+
+    /// Merges a set of runs; ties go to the earlier run so the sort is stable.
+    class RunMerger {
+      public:
+        RunMerger(const vector<SortRun::Ptr> &runs) : runs(runs), merge(NULL) {
+            if (runs.size() > 1) {
+                merge = new LoserTree(runs.size(), LoserTreeCompare(this));
+                for (uint32_t i = 0; i < runs.size(); ++i) {
+                    merge->insert_start(i, i, !runs[i]->more());
+                }
+                merge->init();
+            }
+        }
+
+        ~RunMerger() {
+            delete merge;
+        }
+
+        /// Returns the run holding the next row, or NULL if all are done.
+        SortRun *top() {
+            if (runs.size() <= 1) {
+                // loser tree gets the single run case wrong, and goes into an infinite loop
+                // (log_2(0) is a bad idea with a check 0 * 2^n > 0.
+                return runs.empty() || !runs[0]->more() ? NULL : runs[0].get();
+            }
+            int min = merge->get_min_source();
+            if (min < 0 || static_cast<size_t>(min) >= runs.size() || !runs[min]->more()) {
+                return NULL; // the loser tree has two different exit paths
+            }
+            return runs[min].get();
+        }
+
+        /// Move past the row returned by top()
+        void pop() {
+            if (runs.size() == 1) {
+                runs[0]->next();
+                return;
+            }
+            int min = merge->get_min_source();
+            runs[min]->next();
+            merge->delete_min_insert(min, !runs[min]->more());
+        }
+
+      private:
+        struct LoserTreeCompare {
+            LoserTreeCompare(RunMerger *rm) : rm(rm) { }
+            bool operator()(uint32_t ia, uint32_t ib) const {
+                const SortRun &a(*rm->runs[ia]), &b(*rm->runs[ib]);
+                return keyLess(a.key(), a.keySize(), b.key(), b.keySize());
+            }
+
+            const RunMerger *rm;
+        };
         
-    struct SortedExtent {
-        SortedExtent(Extent::Ptr e) : e(e), offsets(), pos() { }
-        typedef boost::shared_ptr<SortedExtent> Ptr;
+        typedef __gnu_parallel::LoserTree<true, uint32_t, LoserTreeCompare> LoserTree;
 
-        Extent::Ptr e;
-        vector<SEP_RowOffset> offsets;
-        vector<SEP_RowOffset>::iterator pos;
+        vector<SortRun::Ptr> runs;
+        LoserTree *merge;
     };
-    
-    struct LoserTreeCompare {
-        LoserTreeCompare(SortModule *sm) : sm(sm) { }
-        bool operator()(uint32_t ia, uint32_t ib) const {
-            const SortedExtent &sea(*sm->sorted_extents[ia]);
-            const SortedExtent &seb(*sm->sorted_extents[ib]);
-            return strictlyLessThan(sea.e, *sea.pos, seb.e, *seb.pos, sm->ercs.columns);
-        }
+}
+
+class SortModule : public OutputSeriesModule {
+  public:
+    // Merging opens one extent from each run, so limit how many are merged at once.
+    static const size_t max_merge_fanin = 64;
+
+    SortModule(DataSeriesModule &source, const vector<SortColumn> &sort_by, 
+               size_t memory_limit, int nthreads)
+            : source(source), sort_by(sort_by), memory_limit(memory_limit), 
+              nthreads(nthreads == -1 ? PThreadMisc::getNCpus() : nthreads),
+              copier(input_series, output_series), columns(), sort_key_fn(NULL), pending(),
+              pending_bytes(0), runs(), run_count(0), merger(), done(false)
+    { 
+        SINVARIANT(memory_limit > 0 && this->nthreads > 0);
+    }
+
+    virtual ~SortModule() { }
+
+    class SortChunkThread : public PThread {
+      public:
+        SortChunkThread(SortModule &sm, SortChunk &chunk) : sm(sm), chunk(chunk) { }
 
-        const SortModule *sm;
-    };        
+        virtual void *run() {
+            sm.sortChunk(chunk);
+            return NULL;
+        }
 
-    typedef __gnu_parallel::LoserTree<true, uint32_t, LoserTreeCompare> LoserTree;
+        SortModule &sm;
+        SortChunk &chunk;
+    };
 
     void firstExtent(Extent &in) {
         const ExtentType::Ptr t(in.getTypePtr());
@@ -137,75 +522,141 @@ class SortModule : public OutputSeriesModule {
         BOOST_FOREACH(SortColumn &by, sort_by) {
             TINVARIANT(by.sort_mode == SM_Ascending || by.sort_mode == SM_Decending);
             TINVARIANT(by.null_mode == NM_First || by.null_mode == NM_Last);
-            ercs.columns.push_back(SortColumnImpl(GeneralField::make(input_series, by.column),
-                                                  by.sort_mode == SM_Ascending ? true : false,
-                                                  by.null_mode));
+            columns.push_back(SortColumnImpl(GeneralField::make(input_series, by.column),
+                                             by.sort_mode == SM_Ascending ? true : false,
+                                             by.null_mode));
         }
+        sort_key_fn = loadSortKeyFn(*t, sort_by);
+        LintelLogDebug("SortModule", format("%s sort keys for %s")
+                       % (sort_key_fn == NULL ? "generic" : "generated") % t->getName());
     }
 
-    void sortExtent(Extent::Ptr in) {
-        ercs.extent = in;
-        SortedExtent::Ptr se(new SortedExtent(in));
-        se->offsets.reserve(in->nRecords());
-        for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-            se->offsets.push_back(input_series.getRowOffset());
+    // Runs in parallel on separate chunks; only reads shared state.
+    void sortChunk(SortChunk &chunk) {
+        size_t nrows = 0;
+        BOOST_FOREACH(Extent::Ptr &e, chunk.extents) {
+            nrows += e->nRecords();
         }
+        chunk.entries.reserve(nrows);
+
+        ExtentSeries series(input_series.getTypePtr());
+        for (uint32_t i = 0; i < chunk.extents.size(); ++i) {
+            const Extent &e(*chunk.extents[i]);
+            for (series.setExtent(chunk.extents[i]); series.more(); series.next()) {
+                SortChunk::Entry entry;
+                SEP_RowOffset offset(series.getRowOffset());
+                entry.key_offset = chunk.keys.size();
+                if (sort_key_fn != NULL) {
+                    sort_key_fn(chunk.keys, e.fixeddata.begin() + offset.fixedOffset(),
+                                e.variabledata.begin());
+                } else {
+                    appendSortKey(chunk.keys, columns, e, offset);
+                }
+                entry.key_size = chunk.keys.size() - entry.key_offset;
+                entry.extent = i;
+                entry.row_offset = offset.fixedOffset();
+                chunk.entries.push_back(entry);
+            }
+        }
+        series.clearExtent();
+        if (!chunk.entries.empty()) {
+            stable_sort(chunk.entries.begin(), chunk.entries.end(), 
+                        SortChunk::EntryLess(chunk.keys));
+        }
+    }
 
-        stable_sort(se->offsets.begin(), se->offsets.end(), ExtentRowCompare(&ercs));
+    /// Sort the pending extents, returning one run per chunk in input order.
+    vector<SortRun::Ptr> sortPending() {
+        // Split into contiguous chunks of about the same size so the runs stay in input order.
+        vector<SortChunk::Ptr> chunks;
+        size_t chunk_target = pending_bytes / nthreads + 1, chunk_bytes = 0;
+        BOOST_FOREACH(Extent::Ptr &e, pending) {
+            if (chunks.empty() || chunk_bytes >= chunk_target) {
+                chunks.push_back(SortChunk::Ptr(new SortChunk()));
+                chunk_bytes = 0;
+            }
+            chunks.back()->extents.push_back(e);
+            chunk_bytes += e->size();
+        }
+        pending.clear();
+        pending_bytes = 0;
 
-        ercs.extent.reset();
-        sorted_extents.push_back(se);
-    }
+        vector<PThread *> threads;
+        for (size_t i = 1; i < chunks.size(); ++i) {
+            threads.push_back(new SortChunkThread(*this, *chunks[i]));
+            threads.back()->start();
+        }
+        if (!chunks.empty()) {
+            sortChunk(*chunks[0]);
+        }
+        BOOST_FOREACH(PThread *t, threads) {
+            t->join();
+            delete t;
+        }
 
-    Extent::Ptr processSingleMerge() {
-        output_series.newExtent();
-        // loser tree gets this case wrong, and goes into an infinite loop (log_2(0) is a bad
-        // idea with a check 0 * 2^n > 0.
-        SortedExtent &se(*sorted_extents[0]);
-        for (se.pos = se.offsets.begin(); se.pos != se.offsets.end(); ++se.pos) {
-            output_series.newRecord();
-            copier.copyRecord(*se.e, *se.pos);
+        vector<SortRun::Ptr> ret;
+        BOOST_FOREACH(SortChunk::Ptr &chunk, chunks) {
+            ret.push_back(SortRun::Ptr(new MemoryRun(chunk)));
         }
-        sorted_extents.clear();
-        return returnOutputSeries();
+        return ret;
     }
 
-    Extent::Ptr cleanupMultiMerge() {
-        BOOST_FOREACH(SortedExtent::Ptr p, sorted_extents) {
-            SINVARIANT(p->pos == p->offsets.end());
+    /// Merge runs into a new run file
+    SortRun::Ptr writeRun(const vector<SortRun::Ptr> &from) {
+        // the server runs in its working directory, so the runs end up there.
+        string filename(str(format("sort-run.%d.%p.%d.ds") % getpid() % this % run_count));
+        ++run_count;
+        LintelLogDebug("SortModule", format("merging %d runs into %s") % from.size() % filename);
+        {
+            DataSeriesSink sink(filename, 
+                                Extent::compression_algs[Extent::compress_mode_lzf].compress_flag,
+                                1);
+            ExtentTypeLibrary library;
+            library.registerType(input_series.getTypePtr());
+            sink.writeExtentLibrary(library);
+
+            ExtentSeries run_series;
+            OutputModule output(sink, run_series, input_series.getTypePtr(), 96*1024);
+            ExtentRecordCopy run_copier(input_series, run_series);
+            run_copier.prep();
+            RunMerger merge(from);
+            for (SortRun *run = merge.top(); run != NULL; run = merge.top()) {
+                output.newRecord();
+                run_copier.copyRecord(run->extent(), run->rowOffset());
+                merge.pop();
+            }
+            output.close();
+            sink.close();
         }
-        sorted_extents.clear();
-        return returnOutputSeries();
+        return SortRun::Ptr(new FileRun(filename, sort_by, sort_key_fn));
     }
 
-    Extent::Ptr processMerge() {
-        LintelLogDebug("SortModule", "doing multi-extent-merge");
-        output_series.newExtent();
-        while (true) {
-            int min = merge->get_min_source();
-            if (min < 0 || static_cast<size_t>(min) >= sorted_extents.size()) {
-                // loser tree exit path 1
-                return cleanupMultiMerge();
-            }
-            SortedExtent &se(*sorted_extents[min]);
-            if (se.pos == se.offsets.end()) {
-                // loser tree exit path 2
-                return cleanupMultiMerge();
-            }
+    void spillPending() {
+        vector<SortRun::Ptr> chunks(sortPending());
+        runs.push_back(writeRun(chunks));
+    }
 
-            output_series.newRecord();
-            copier.copyRecord(*se.e, *se.pos);
-            ++se.pos;
-            merge->delete_min_insert(min, se.pos == se.offsets.end());
-            if (output_series.getExtentRef().size() > 96*1024) {
-                break;
+    void startMerge() {
+        vector<SortRun::Ptr> last(sortPending());
+        runs.insert(runs.end(), last.begin(), last.end());
+        while (runs.size() > max_merge_fanin) {
+            // Merge consecutive groups so that ties still come out in input order.
+            vector<SortRun::Ptr> merged;
+            for (size_t i = 0; i < runs.size(); i += max_merge_fanin) {
+                vector<SortRun::Ptr> group(runs.begin() + i, 
+                                           runs.begin() + min(i + max_merge_fanin, runs.size()));
+                merged.push_back(group.size() == 1 ? group[0] : writeRun(group));
             }
+            runs.swap(merged);
         }
-        return returnOutputSeries();
+        merger.reset(new RunMerger(runs));
     }
 
     virtual Extent::Ptr getSharedExtent() {
-        if (sorted_extents.empty()) {
+        if (done) {
+            return Extent::Ptr();
+        }
+        if (merger == NULL) {
             while (true) {
                 Extent::Ptr in = source.getSharedExtent();
                 if (in == NULL) {
@@ -214,39 +665,61 @@ class SortModule : public OutputSeriesModule {
                 if (input_series.getTypePtr() == NULL) {
                     firstExtent(*in);
                 }
-                
-                sortExtent(in);
+                if (in->nRecords() == 0) {
+                    continue;
+                }
+                pending.push_back(in);
+                pending_bytes += in->size();
+                if (pending_bytes >= memory_limit) {
+                    spillPending();
+                }
             }
-
-            if (sorted_extents.empty()) {
+            if (input_series.getTypePtr() == NULL) {
+                done = true; // no input at all
                 return Extent::Ptr();
-            } else if (sorted_extents.size() == 1) {
-                return processSingleMerge();
-            } else {
-                merge = new LoserTree(sorted_extents.size(), LoserTreeCompare(this));
-
-                for (uint32_t i = 0; i < sorted_extents.size(); ++i) {
-                    merge->insert_start(i, i, false);
-                    sorted_extents[i]->pos = sorted_extents[i]->offsets.begin();
-                }
-                merge->init();
             }
+            startMerge();
         } 
 
-        return processMerge();
+        output_series.newExtent();
+        for (SortRun *run = merger->top(); run != NULL; run = merger->top()) {
+            output_series.newRecord();
+            copier.copyRecord(run->extent(), run->rowOffset());
+            merger->pop();
+            if (output_series.getExtentRef().size() > 96*1024) {
+                return returnOutputSeries();
+            }
+        }
+        // Releasing the runs frees the memory and removes the run files.
+        merger.reset();
+        runs.clear();
+        done = true;
+        if (output_series.getExtentRef().nRecords() == 0) {
+            output_series.clearExtent();
+            return Extent::Ptr();
+        }
+        return returnOutputSeries();
     }
         
     DataSeriesModule &source;
     vector<SortColumn> sort_by;
+    const size_t memory_limit;
+    const unsigned nthreads;
     ExtentSeries input_series;
     ExtentRecordCopy copier;
-    ExtentRowCompareState ercs;
-    vector<SortedExtent::Ptr> sorted_extents;
-    LoserTree *merge;
+    vector<SortColumnImpl> columns;
+    SortKeyFn sort_key_fn; // NULL ==> use appendSortKey()
+    vector<Extent::Ptr> pending; // input extents not yet sorted
+    size_t pending_bytes;
+    vector<SortRun::Ptr> runs;
+    uint32_t run_count;
+    boost::scoped_ptr<RunMerger> merger;
+    bool done;
 };
 
+const size_t SortModule::max_merge_fanin;
+
 OutputSeriesModule::OSMPtr dataseries::makeSortModule
-(DataSeriesModule &source, const vector<SortColumn> &sort_by) {
-    return OutputSeriesModule::OSMPtr(new SortModule(source, sort_by));
+(DataSeriesModule &source, const vector<SortColumn> &sort_by, size_t memory_limit, int nthreads) {
+    return OutputSeriesModule::OSMPtr(new SortModule(source, sort_by, memory_limit, nthreads));
 }
-
@@ -0,0 +1,232 @@
+#include <DataSeries/BoolField.hpp>
+#include <DataSeries/ByteField.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/FixedWidthField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/Variable32Field.hpp>
+
+#include "DSSModule.hpp"
+
+/* Appends the value of one column in the current row to a ColumnData.  The typed fields are
+   used rather than GeneralField so that values are copied without going through a
+   GeneralValue. */
+class ColumnWriter {
+  public:
+    typedef boost::shared_ptr<ColumnWriter> Ptr;
+
+    ColumnWriter(const Field &field, bool nullable) : base_field(field), nullable(nullable) { }
+    virtual ~ColumnWriter() { }
+
+    void append(ColumnData &into) {
+        bool null = base_field.isNull();
+        if (nullable) {
+            into.nulls.push_back(null ? 1 : 0);
+        }
+        appendValue(into, null);
+    }
+
+  protected:
+    virtual void appendValue(ColumnData &into, bool null) = 0;
+
+  private:
+    const Field &base_field;
+    const bool nullable;
+};
+
+// Container is the member of ColumnData that holds values of FieldT.
+template<class FieldT, class Container> class FixedColumnWriter : public ColumnWriter {
+  public:
+    FixedColumnWriter(ExtentSeries &series, const string &name, bool nullable,
+                      Container ColumnData::*values)
+        : ColumnWriter(field, nullable), field(series, name, Field::flag_nullable),
+          values(values) { }
+
+  protected:
+    virtual void appendValue(ColumnData &into, bool null) {
+        typedef typename Container::value_type V;
+        (into.*values).push_back(null ? V() : static_cast<V>(field.val()));
+    }
+
+  private:
+    FieldT field;
+    Container ColumnData::*values;
+};
+
+class Variable32ColumnWriter : public ColumnWriter {
+  public:
+    Variable32ColumnWriter(ExtentSeries &series, const string &name, bool nullable)
+        : ColumnWriter(field, nullable), field(series, name, Field::flag_nullable) { }
+
+  protected:
+    virtual void appendValue(ColumnData &into, bool null) {
+        into.strings.push_back(null ? string() : field.stringval());
+    }
+
+  private:
+    Variable32Field field;
+};
+
+class FixedWidthColumnWriter : public ColumnWriter {
+  public:
+    FixedWidthColumnWriter(ExtentSeries &series, const string &name, bool nullable)
+        : ColumnWriter(field, nullable), field(series, name, Field::flag_nullable) { }
+
+  protected:
+    virtual void appendValue(ColumnData &into, bool null) {
+        if (null) {
+            into.strings.push_back(string());
+        } else {
+            into.strings.push_back(string(reinterpret_cast<const char *>(field.val()),
+                                          field.size()));
+        }
+    }
+
+  private:
+    FixedWidthField field;
+};
+
+class TableCursorImpl : public TableCursor, public ThrowError {
+  public:
+    TableCursorImpl(DataSeriesModule::Ptr input, const string &where_expr, PageEncoding encoding)
+        : input(input), select(), source(input.get()), encoding(encoding), series(), columns(),
+          string_fields(), column_writers(), done(false)
+    {
+        if (encoding != PE_Strings && encoding != PE_Columns) {
+            requestError(format("invalid page encoding %d") % encoding);
+        }
+        if (!where_expr.empty()) {
+            select = makeSelectModule(*input, where_expr);
+            source = select.get();
+        }
+    }
+
+    virtual ~TableCursorImpl() { }
+
+    virtual void fetch(TablePage &into, uint32_t max_rows) {
+        SINVARIANT(max_rows > 0);
+        into.nrows = 0;
+        if (!done && !series.hasExtent()) {
+            nextExtent(); // first fetch, get the columns
+        }
+        into.columns = columns;
+        if (encoding == PE_Strings) {
+            into.rows.clear();
+            into.__isset.rows = true;
+        } else {
+            into.column_data.clear();
+            into.column_data.resize(columns.size());
+            into.__isset.column_data = true;
+        }
+        while (!done && static_cast<uint32_t>(into.nrows) < max_rows) {
+            if (encoding == PE_Strings) {
+                appendStrings(into);
+            } else {
+                appendColumns(into);
+            }
+            ++into.nrows;
+            ++series;
+            if (!series.morerecords()) {
+                nextExtent();
+            }
+        }
+        into.more_rows = !done;
+    }
+
+  private:
+    // Moves to the next non-empty extent; at the end releases the input, it may hold a lot
+    // of memory, and the cursor may stay open for a while after the last page.
+    void nextExtent() {
+        while (true) {
+            Extent::Ptr e(source->getSharedExtent());
+            if (e == NULL) {
+                done = true;
+                series.clearExtent();
+                select.reset();
+                input.reset();
+                source = NULL;
+                return;
+            }
+            if (series.getTypePtr() == NULL) {
+                firstExtent(e->getTypePtr());
+            }
+            if (e->nRecords() > 0) {
+                series.setExtent(e);
+                return;
+            }
+        }
+    }
+
+    void firstExtent(const ExtentType::Ptr type) {
+        series.setType(type);
+        for (uint32_t i = 0; i < type->getNFields(); ++i) {
+            string name(type->getFieldName(i));
+            columns.push_back(TableColumn(name, type->getFieldTypeStr(name)));
+            if (encoding == PE_Strings) {
+                string_fields.push_back(GeneralField::make(series, name));
+            } else {
+                column_writers.push_back(makeColumnWriter(*type, name));
+            }
+        }
+    }
+
+    ColumnWriter::Ptr makeColumnWriter(const ExtentType &type, const string &name) {
+        bool nullable = type.getNullable(name);
+        switch (type.getFieldType(name)) {
+            case ExtentType::ft_bool:
+                return ColumnWriter::Ptr(new FixedColumnWriter<BoolField, vector<bool> >
+                                         (series, name, nullable, &ColumnData::bools));
+            case ExtentType::ft_byte:
+                return ColumnWriter::Ptr(new FixedColumnWriter<ByteField, string>
+                                         (series, name, nullable, &ColumnData::bytes));
+            case ExtentType::ft_int32:
+                return ColumnWriter::Ptr(new FixedColumnWriter<Int32Field, vector<int32_t> >
+                                         (series, name, nullable, &ColumnData::i32s));
+            case ExtentType::ft_int64:
+                return ColumnWriter::Ptr(new FixedColumnWriter<Int64Field, vector<int64_t> >
+                                         (series, name, nullable, &ColumnData::i64s));
+            case ExtentType::ft_double:
+                return ColumnWriter::Ptr(new FixedColumnWriter<DoubleField, vector<double> >
+                                         (series, name, nullable, &ColumnData::doubles));
+            case ExtentType::ft_variable32:
+                return ColumnWriter::Ptr(new Variable32ColumnWriter(series, name, nullable));
+            case ExtentType::ft_fixedwidth:
+                return ColumnWriter::Ptr(new FixedWidthColumnWriter(series, name, nullable));
+            default:
+                FATAL_ERROR(format("unhandled type for column %s") % name);
+        }
+    }
+
+    void appendStrings(TablePage &into) {
+        into.rows.resize(into.rows.size() + 1);
+        vector<NullableString> &row(into.rows.back());
+        row.reserve(string_fields.size());
+        BOOST_FOREACH(GeneralField::Ptr g, string_fields) {
+            if (g->isNull()) {
+                row.push_back(NullableString());
+            } else {
+                row.push_back(NullableString(g->val().valString()));
+            }
+        }
+    }
+
+    void appendColumns(TablePage &into) {
+        for (size_t i = 0; i < column_writers.size(); ++i) {
+            column_writers[i]->append(into.column_data[i]);
+        }
+    }
+
+    DataSeriesModule::Ptr input, select;
+    DataSeriesModule *source;
+    const PageEncoding encoding;
+    ExtentSeries series;
+    vector<TableColumn> columns;
+    vector<GeneralField::Ptr> string_fields;
+    vector<ColumnWriter::Ptr> column_writers;
+    bool done;
+};
+
+TableCursor::Ptr dataseries::makeTableCursor(DataSeriesModule::Ptr input,
+                                             const string &where_expr, PageEncoding encoding) {
+    return TableCursor::Ptr(new TableCursorImpl(input, where_expr, encoding));
+}
@@ -31,6 +31,8 @@
 #include <DataSeries/TFixedField.hpp>
 #include <DataSeries/TypeIndexModule.hpp>
 
+#include "CodeGen.hpp"
+#include "ExtentCache.hpp"
 #include "GVVec.hpp"
 #include "ServerModules.hpp"
 #include "ThrowError.hpp"
@@ -57,18 +59,56 @@ namespace std {
     }
 }
 
+lintel::ProgramOption<uint32_t> po_sort_memory_mb
+("sort-memory-mb", "Memory in MB to use for sorting before spilling runs to the working directory",
+ 1024);
+
+lintel::ProgramOption<int32_t> po_sort_threads
+("sort-threads", "Number of threads used to sort a table, -1 ==> # cpus", -1);
+
+lintel::ProgramOption<uint32_t> po_hash_join_memory_mb
+("hash-join-memory-mb", "Memory in MB to use for the build side of a hash join before spilling"
+ " partitions to the working directory", 1024);
+
+lintel::ProgramOption<int32_t> po_hash_join_threads
+("hash-join-threads", "Number of threads used to build and probe a hash join, -1 ==> # cpus", -1);
+
+lintel::ProgramOption<bool> po_disable_codegen
+("disable-codegen", "Always use the generic operators rather than compiling specialized code");
+
+lintel::ProgramOption<uint32_t> po_max_cursors
+("max-cursors", "Maximum number of cursors that can be open at once", 256);
+
+lintel::ProgramOption<uint32_t> po_extent_cache_mb
+("extent-cache-mb", "Memory in MB to use for caching unpacked extents of tables, 0 ==> no cache",
+ 1024);
+
+// The catalog records the tables in the working directory so they survive a restart.
+const string catalog_path("catalog.ds");
+const string catalog_xml
+("<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"DataSeries: ServerCatalog\" version=\"1.0\">\n"
+ "  <field type=\"variable32\" name=\"table_name\" />\n"
+ "  <field type=\"variable32\" name=\"extent_type\" pack_unique=\"yes\" />\n"
+ "  <field type=\"int64\" name=\"last_update\" comment=\"Clock::Tfrac\" />\n"
+ "</ExtentType>\n");
+
 class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
   public:
     struct TableInfo {
         ExtentType::Ptr extent_type;
         vector<string> depends_on;
         Clock::Tfrac last_update;
-        TableInfo() : extent_type(), last_update(0) { }
+        uint64_t generation; // changes whenever the table is rewritten, see ExtentCache
+        TableInfo() : extent_type(), last_update(0), generation(0) { }
     };
 
     typedef HashMap<string, TableInfo> NameToInfo;
 
-    DataSeriesServerHandler() { };
+    /** Must be constructed in the working directory, the catalog is loaded from there. */
+    DataSeriesServerHandler(uint64_t extent_cache_bytes)
+        : extent_cache(extent_cache_bytes), table_info(), cursors(), next_cursor_id(1) {
+        loadCatalog();
+    }
 
     void ping() {
         LintelLog::info("ping()");
@@ -96,14 +136,12 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         }
 
         TypeIndexModule input(extent_type);
-        DataSeriesModule::Ptr output_module = makeTeeModule(input, tableToPath(dest_table));
+        DataSeriesModule::Ptr output_module = makeTeeModule(input, tablePathForWrite(dest_table));
         BOOST_FOREACH(const string &path, source_paths) {
             input.addSource(path);
         }
         output_module->getAndDeleteShared();
-        TableInfo &ti(table_info[dest_table]);
-        ti.extent_type = input.getTypePtr();
-        ti.last_update = Clock::todTfrac();
+        updateTableInfo(dest_table, input.getTypePtr());
     }
 
     void importCSVFiles(const vector<string> &source_paths, const string &xml_desc, 
@@ -116,6 +154,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             requestError("only supporting single insert");
         }
         verifyTableName(dest_table);
+        const string dest_path(tablePathForWrite(dest_table));
         pid_t pid = fork();
         if (pid < 0) {
             requestError("fork failed");
@@ -133,8 +172,8 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             args.push_back(str(format("--comment-prefix=%s") % comment_prefix));
             SINVARIANT(source_paths.size() == 1);
             copy(source_paths.begin(), source_paths.end(), back_inserter(args));
-            args.push_back(tableToPath(dest_table));
-            unlink(tableToPath(dest_table).c_str()); // ignore errors
+            args.push_back(dest_path);
+            unlink(dest_path.c_str()); // ignore errors
 
             LintelLogDebug("child", format("pid %d running: %s") % getpid() % args);
             exec(args);
@@ -149,6 +188,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
 
     void importSQLTable(const string &dsn, const string &src_table, const string &dest_table) {
         verifyTableName(dest_table);
+        const string dest_path(tablePathForWrite(dest_table));
 
         pid_t pid = fork();
         if (pid < 0) {
@@ -164,7 +204,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
                 args.push_back(str(format("--dsn=%s") % dsn));
             }
             args.push_back(src_table);
-            args.push_back(tableToPath(dest_table));
+            args.push_back(dest_path);
             exec(args);
         } else {
             waitForSuccessfulChild(pid);
@@ -185,7 +225,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         const ExtentType::Ptr type(lib.registerTypePtr(xml_desc));
 
         ExtentSeries output_series(type);
-        DataSeriesSink output_sink(tableToPath(dest_table), 
+        DataSeriesSink output_sink(tablePathForWrite(dest_table), 
                                    Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1);
         OutputModule output_module(output_sink, output_series, type, 96*1024);
 
@@ -255,18 +295,49 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         }
         NameToInfo::iterator i = getTableInfo(source_table);
 
-        TypeIndexModule input(i->second.extent_type->getName());
-        input.addSource(tableToPath(source_table));
-        DataSeriesModule *mod = &input;
-        DataSeriesModule::Ptr select_module;
-        if (!where_expr.empty()) {
-            select_module = makeSelectModule(input, where_expr);
-            mod = select_module.get();
+        TablePage page;
+        makeTableCursor(openTable(i), where_expr, PE_Strings)->fetch(page, max_rows);
+        ret.rows.swap(page.rows);
+        ret.columns.swap(page.columns);
+        ret.__isset.columns = true;
+        ret.more_rows = page.more_rows;
+        ret.__isset.more_rows = true;
+    }
+
+    int64_t openCursor(const string &source_table, const string &where_expr,
+                       const PageEncoding encoding) {
+        verifyTableName(source_table);
+        if (cursors.size() >= po_max_cursors.get()) {
+            requestError(format("too many open cursors (%d)") % cursors.size());
+        }
+        NameToInfo::iterator i = getTableInfo(source_table);
+
+        CursorInfo &info(cursors[next_cursor_id]);
+        info.table = source_table;
+        try {
+            info.cursor = makeTableCursor(openTable(i), where_expr, encoding);
+        } catch (...) {
+            cursors.erase(next_cursor_id);
+            throw;
         }
+        return next_cursor_id++;
+    }
 
-        DataSeriesModule::Ptr sink(makeTableDataModule(*mod, ret, max_rows));
+    void fetchCursor(TablePage &ret, const int64_t cursor_id, const int32_t max_rows) {
+        if (max_rows <= 0) {
+            requestError("max_rows must be > 0");
+        }
+        CursorInfo &info(getCursor(cursor_id));
+        if (info.cursor == NULL) {
+            requestError(format("table %s was rewritten while cursor %d was open")
+                         % info.table % cursor_id);
+        }
+        info.cursor->fetch(ret, max_rows);
+    }
 
-        sink->getAndDeleteShared();
+    void closeCursor(const int64_t cursor_id) {
+        getCursor(cursor_id);
+        cursors.erase(cursor_id);
     }
 
     void hashJoin(const string &a_table, const string &b_table, const string &out_table,
@@ -277,21 +348,41 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
 
         verifyTableName(out_table);
 
-        TypeIndexModule a_input(a_info->second.extent_type->getName());
-        a_input.addSource(tableToPath(a_table));
-        TypeIndexModule b_input(b_info->second.extent_type->getName());
-        b_input.addSource(tableToPath(b_table));
+        DataSeriesModule::Ptr a_input(openTable(a_info));
+        DataSeriesModule::Ptr b_input(openTable(b_info));
 
         OutputSeriesModule::OSMPtr 
-                hj_module(makeHashJoinModule(a_input, max_a_rows, b_input,
-                                             eq_columns, keep_columns, out_table));
+                hj_module(makeHashJoinModule
+                          (*a_input, max_a_rows, *b_input, eq_columns, keep_columns, out_table,
+                           static_cast<size_t>(po_hash_join_memory_mb.get()) * 1024 * 1024,
+                           po_hash_join_threads.get()));
 
-        DataSeriesModule::Ptr output_module = makeTeeModule(*hj_module, tableToPath(out_table));
+        DataSeriesModule::Ptr output_module = makeTeeModule(*hj_module, tablePathForWrite(out_table));
         
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, hj_module->output_series.getTypePtr());
     }
 
+    void sortedMergeJoin(const string &a_table, const string &b_table, const string &out_table,
+                         const vector<MergeJoinKey> &keys,
+                         const map<string, string> &keep_columns, JoinMode mode) {
+        NameToInfo::iterator a_info = getTableInfo(a_table);
+        NameToInfo::iterator b_info = getTableInfo(b_table);
+
+        verifyTableName(out_table);
+
+        DataSeriesModule::Ptr a_input(openTable(a_info));
+        DataSeriesModule::Ptr b_input(openTable(b_info));
+
+        OutputSeriesModule::OSMPtr mj_module
+            (makeMergeJoinModule(*a_input, *b_input, keys, keep_columns, mode, out_table));
+
+        DataSeriesModule::Ptr output_module = makeTeeModule(*mj_module, tablePathForWrite(out_table));
+
+        output_module->getAndDeleteShared();
+        updateTableInfo(out_table, mj_module->output_series.getTypePtr());
+    }
+
     void starJoin(const string &fact_table, const vector<Dimension> &dimensions, 
                   const string &out_table, const map<string, string> &fact_columns,
                   const vector<DimensionFactJoin> &dimension_columns, int32_t max_dimension_rows) {
@@ -302,23 +393,18 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         
         BOOST_FOREACH(const Dimension &dim, dimensions) {
             if (!dimension_modules.exists(dim.source_table)) {
-                NameToInfo::iterator dim_info = getTableInfo(dim.source_table);
-                shared_ptr<TypeIndexModule> 
-                        ptr(new TypeIndexModule(dim_info->second.extent_type->getName()));
-                ptr->addSource(tableToPath(dim.source_table));
-                dimension_modules[dim.source_table] = ptr;
+                dimension_modules[dim.source_table] = openTable(getTableInfo(dim.source_table));
             }
         }
         
-        TypeIndexModule fact_input(fact_info->second.extent_type->getName());
-        fact_input.addSource(tableToPath(fact_table));
+        DataSeriesModule::Ptr fact_input(openTable(fact_info));
 
         // TODO: use and check max_dimension_rows
         OutputSeriesModule::OSMPtr
-                sj_module(makeStarJoinModule(fact_input, dimensions, out_table,
+                sj_module(makeStarJoinModule(*fact_input, dimensions, out_table,
                                              fact_columns, dimension_columns, dimension_modules));
 
-        DataSeriesModule::Ptr output_module = makeTeeModule(*sj_module, tableToPath(out_table));
+        DataSeriesModule::Ptr output_module = makeTeeModule(*sj_module, tablePathForWrite(out_table));
 
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, sj_module->output_series.getTypePtr());
@@ -328,10 +414,9 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         verifyTableName(in_table);
         verifyTableName(out_table);
         NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
-        input.addSource(tableToPath(in_table));
-        DataSeriesModule::Ptr select(makeSelectModule(input, where_expr));
-        DataSeriesModule::Ptr output_module = makeTeeModule(*select, tableToPath(out_table));
+        DataSeriesModule::Ptr input(openTable(info));
+        DataSeriesModule::Ptr select(makeSelectModule(*input, where_expr));
+        DataSeriesModule::Ptr output_module = makeTeeModule(*select, tablePathForWrite(out_table));
 
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, info->second.extent_type);
@@ -343,10 +428,9 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         verifyTableName(out_table);
 
         NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
-        input.addSource(tableToPath(in_table));
-        OutputSeriesModule::OSMPtr project(makeProjectModule(input, keep_columns));
-        DataSeriesModule::Ptr output_module = makeTeeModule(*project, tableToPath(out_table));
+        DataSeriesModule::Ptr input(openTable(info));
+        OutputSeriesModule::OSMPtr project(makeProjectModule(*input, keep_columns));
+        DataSeriesModule::Ptr output_module = makeTeeModule(*project, tablePathForWrite(out_table));
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, project->output_series.getTypePtr());
     }
@@ -357,11 +441,10 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         verifyTableName(out_table);
 
         NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
-        input.addSource(tableToPath(in_table));
+        DataSeriesModule::Ptr input(openTable(info));
         OutputSeriesModule::OSMPtr transform
-                (makeExprTransformModule(input, expr_columns, out_table));
-        DataSeriesModule::Ptr output_module = makeTeeModule(*transform, tableToPath(out_table));
+                (makeExprTransformModule(*input, expr_columns, out_table));
+        DataSeriesModule::Ptr output_module = makeTeeModule(*transform, tablePathForWrite(out_table));
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, transform->output_series.getTypePtr());
     }
@@ -377,22 +460,20 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             base_info = createTable(base_table, update_info, update_column);
         }
 
-        TypeIndexModule base_input(base_info->second.extent_type->getName());
-        base_input.addSource(tableToPath(base_table));
-
-        TypeIndexModule update_input(update_info->second.extent_type->getName());
-        update_input.addSource(tableToPath(update_from));
+        DataSeriesModule::Ptr base_input(openTable(base_info));
+        DataSeriesModule::Ptr update_input(openTable(update_info));
 
-        DataSeriesModule::Ptr updater(makeSortedUpdateModule(base_input, update_input, 
+        DataSeriesModule::Ptr updater(makeSortedUpdateModule(*base_input, *update_input, 
                                                              update_column, primary_key));
 
         DataSeriesModule::Ptr output_module 
                 = makeTeeModule(*updater, tableToPath(base_table, "tmp."));
         output_module->getAndDeleteShared();
         output_module.reset();
-        string from(tableToPath(base_table, "tmp.")), to(tableToPath(base_table));
+        string from(tableToPath(base_table, "tmp.")), to(tablePathForWrite(base_table));
         int ret = rename(from.c_str(), to.c_str());
         INVARIANT(ret == 0, format("rename %s -> %s failed: %s") % from % to % strerror(errno));
+        updateTableInfo(base_table, base_info->second.extent_type);
     }
 
     void unionTables(const vector<UnionTable> &in_tables, const vector<SortColumn> &order_columns,
@@ -400,35 +481,53 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         vector<UM_UnionTable> tables;
         BOOST_FOREACH(const UnionTable &table, in_tables) {
             verifyTableName(table.table_name);
-            NameToInfo::iterator table_info(getTableInfo(table.table_name));
-
-            TypeIndexModule::Ptr p =
-                    TypeIndexModule::make(table_info->second.extent_type->getName());
-            p->addSource(tableToPath(table_info->first));
-            tables.push_back(UM_UnionTable(table, p));
+            tables.push_back(UM_UnionTable(table, openTable(getTableInfo(table.table_name))));
         }
         
         OutputSeriesModule::OSMPtr union_mod(makeUnionModule(tables, order_columns, out_table));
-        DataSeriesModule::Ptr output_module = makeTeeModule(*union_mod, tableToPath(out_table));
+        DataSeriesModule::Ptr output_module = makeTeeModule(*union_mod, tablePathForWrite(out_table));
 
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, union_mod->output_series.getTypePtr());
     }
 
     void sortTable(const string &in_table, const string &out_table, const vector<SortColumn> &by) {
-        NameToInfo::iterator table_info(getTableInfo(in_table));
-        
-        TypeIndexModule::Ptr p(TypeIndexModule::make(table_info->second.extent_type->getName()));
-        p->addSource(tableToPath(table_info->first));
+        DataSeriesModule::Ptr input(openTable(getTableInfo(in_table)));
 
-        OutputSeriesModule::OSMPtr sorter(makeSortModule(*p, by));
+        OutputSeriesModule::OSMPtr sorter
+            (makeSortModule(*input, by, static_cast<size_t>(po_sort_memory_mb.get()) * 1024 * 1024,
+                            po_sort_threads.get()));
         
-        DataSeriesModule::Ptr output_module = makeTeeModule(*sorter, tableToPath(out_table));
+        DataSeriesModule::Ptr output_module = makeTeeModule(*sorter, tablePathForWrite(out_table));
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, sorter->output_series.getTypePtr());
     }
 
+    void getExtentCacheStats(ExtentCacheStats &ret) {
+        ExtentCache::Stats stats(extent_cache.getStats());
+        ret.hits = stats.hits;
+        ret.misses = stats.misses;
+        ret.evictions = stats.evictions;
+        ret.extents = stats.extents;
+        ret.bytes = stats.bytes;
+        ret.max_bytes = stats.max_bytes;
+    }
+
   private:
+    struct CursorInfo {
+        string table;
+        TableCursor::Ptr cursor; // NULL once the table has been rewritten
+    };
+    typedef map<int64_t, CursorInfo> IdToCursor;
+
+    CursorInfo &getCursor(int64_t cursor_id) {
+        IdToCursor::iterator i = cursors.find(cursor_id);
+        if (i == cursors.end()) {
+            requestError(format("unknown cursor %d") % cursor_id);
+        }
+        return i->second;
+    }
+
     void verifyTableName(const string &name) {
         if (name.size() >= 200) {
             invalidTableName(name, "name too long");
@@ -443,9 +542,98 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         return prefix + table_name;
     }
 
+    // The path to write a table's file to.  Open cursors on the table are closed first, as
+    // their prefetching could otherwise still be reading the file while it is rewritten.
+    string tablePathForWrite(const string &table) {
+        closeTableCursors(table);
+        return tableToPath(table);
+    }
+
+    void closeTableCursors(const string &table) {
+        for (IdToCursor::iterator i = cursors.begin(); i != cursors.end(); ++i) {
+            if (i->second.table == table) {
+                i->second.cursor.reset();
+            }
+        }
+    }
+
+    // Call after every write of a table's file.
     void updateTableInfo(const string &table, const ExtentType::Ptr extent_type) {
         TableInfo &info(table_info[table]);
         info.extent_type = extent_type;
+        info.last_update = Clock::todTfrac();
+        ++info.generation;
+        extent_cache.eraseTable(table);
+        closeTableCursors(table); // in case one was opened during the write
+        saveCatalog();
+    }
+
+    DataSeriesModule::Ptr openTable(NameToInfo::iterator info) {
+        return makeCachedTableModule(extent_cache, info->first, info->second.generation,
+                                     tableToPath(info->first),
+                                     info->second.extent_type->getName());
+    }
+
+    void loadCatalog() {
+        struct stat stat_buf;
+        if (stat(catalog_path.c_str(), &stat_buf) != 0) {
+            INVARIANT(errno == ENOENT, format("stat(%s) failed: %s") % catalog_path
+                      % strerror(errno));
+            return;
+        }
+        TypeIndexModule input("DataSeries: ServerCatalog");
+        input.addSource(catalog_path);
+        ExtentSeries series;
+        Variable32Field table_name(series, "table_name");
+        Variable32Field extent_type(series, "extent_type");
+        Int64Field last_update(series, "last_update");
+        while (true) {
+            Extent::Ptr e(input.getSharedExtent());
+            if (e == NULL) {
+                break;
+            }
+            for (series.setExtent(e); series.morerecords(); ++series) {
+                string table(table_name.stringval());
+                if (stat(tableToPath(table).c_str(), &stat_buf) != 0) {
+                    LintelLog::warn(format("dropping table %s from the catalog: %s")
+                                    % table % strerror(errno));
+                    continue;
+                }
+                ExtentTypeLibrary library;
+                TableInfo &info(table_info[table]);
+                info.extent_type = library.registerTypePtr(extent_type.stringval());
+                info.last_update = last_update.val();
+            }
+        }
+        LintelLog::info(format("loaded %d tables from %s") % table_info.size() % catalog_path);
+    }
+
+    // Rewrites the whole catalog; it only has one row per table.
+    void saveCatalog() {
+        string tmp_path(catalog_path + ".tmp");
+        ExtentTypeLibrary library;
+        const ExtentType::Ptr type(library.registerTypePtr(catalog_xml));
+        ExtentSeries series(type);
+        Variable32Field table_name(series, "table_name");
+        Variable32Field extent_type(series, "extent_type");
+        Int64Field last_update(series, "last_update");
+        {
+            DataSeriesSink sink
+                (tmp_path, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1);
+            sink.writeExtentLibrary(library);
+            OutputModule output(sink, series, type, 96*1024);
+            for (NameToInfo::iterator i = table_info.begin(); i != table_info.end(); ++i) {
+                output.newRecord();
+                table_name.set(i->first);
+                extent_type.set(i->second.extent_type->getXmlDescriptionString());
+                last_update.set(i->second.last_update);
+            }
+            output.close();
+            sink.close();
+        }
+        int ret = rename(tmp_path.c_str(), catalog_path.c_str());
+        INVARIANT(ret == 0, format("rename %s -> %s failed: %s") % tmp_path % catalog_path
+                  % strerror(errno));
     }
 
     void waitForSuccessfulChild(pid_t pid) {
@@ -477,7 +665,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         }
         extent_type.append("</ExtentType>");
 
-        DataSeriesSink output(tableToPath(table_name), 
+        DataSeriesSink output(tablePathForWrite(table_name), 
                               Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1);
         ExtentTypeLibrary library;
         const ExtentType::Ptr type(library.registerTypePtr(extent_type));
@@ -509,7 +697,10 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         return ret;
     }
 
+    ExtentCache extent_cache;
     NameToInfo table_info;
+    IdToCursor cursors;
+    int64_t next_cursor_id;
 };
 
 lintel::ProgramOption<string> po_working_directory
@@ -539,16 +730,25 @@ void setupWorkingDirectory() {
 
 int main(int argc, char *argv[]) {
     LintelLog::parseEnv();
+    lintel::parseCommandLine(argc, argv);
+    INVARIANT(po_sort_memory_mb.get() > 0, "--sort-memory-mb must be > 0");
+    INVARIANT(po_sort_threads.get() == -1 || po_sort_threads.get() > 0,
+              "--sort-threads must be -1 or > 0");
+    INVARIANT(po_hash_join_memory_mb.get() > 0, "--hash-join-memory-mb must be > 0");
+    INVARIANT(po_hash_join_threads.get() == -1 || po_hash_join_threads.get() > 0,
+              "--hash-join-threads must be -1 or > 0");
+    setupWorkingDirectory();
+    CodeGen::instance().setEnabled(!po_disable_codegen.get());
+
     shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    shared_ptr<DataSeriesServerHandler> handler(new DataSeriesServerHandler());
+    uint64_t extent_cache_bytes = static_cast<uint64_t>(po_extent_cache_mb.get()) * 1024 * 1024;
+    shared_ptr<DataSeriesServerHandler> handler(new DataSeriesServerHandler(extent_cache_bytes));
     shared_ptr<TProcessor> processor(new DataSeriesServerProcessor(handler));
     shared_ptr<TServerTransport> serverTransport(new TServerSocket(49476));
     shared_ptr<TTransportFactory> transportFactory(new TBufferedTransportFactory());
 
     TSimpleServer server(processor, serverTransport, transportFactory, protocolFactory);
 
-    setupWorkingDirectory();
-
     LintelLog::info("start...");
     server.serve();
     LintelLog::info("finish.");
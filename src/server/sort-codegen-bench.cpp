@@ -0,0 +1,158 @@
+/** @file
+    Compare SortModule with generic and generated sort keys: sorts the same rows both ways,
+    in memory and spilling runs, checks the outputs match, and reports the times.
+
+    Usage: sort-codegen-bench [nrows (default 1000000)] [repetitions (default 3)]
+*/
+
+#include <iostream>
+
+#include <boost/lexical_cast.hpp>
+
+#include <Lintel/Clock.hpp>
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/BoolField.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/Variable32Field.hpp>
+
+#include "CodeGen.hpp"
+#include "DSSModule.hpp"
+
+const string bench_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"sort-codegen-bench\" version=\"1.0\" >\n"
+        "  <field type=\"int32\" name=\"a\" />\n"
+        "  <field type=\"int64\" name=\"b\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"c\" />\n"
+        "  <field type=\"variable32\" name=\"d\" pack_unique=\"yes\" />\n"
+        "  <field type=\"bool\" name=\"e\" />\n"
+        "</ExtentType>\n";
+
+class VectorSource : public DataSeriesModule {
+  public:
+    VectorSource(const vector<Extent::Ptr> &extents) : extents(extents), next(0) { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        return next == extents.size() ? Extent::Ptr() : extents[next++];
+    }
+
+    const vector<Extent::Ptr> &extents;
+    size_t next;
+};
+
+vector<Extent::Ptr> makeInput(const ExtentType::Ptr type, int64_t nrows) {
+    MersenneTwisterRandom rng(1776);
+    vector<Extent::Ptr> ret;
+    ExtentSeries series(type);
+    Int32Field a(series, "a");
+    Int64Field b(series, "b", Field::flag_nullable);
+    DoubleField c(series, "c");
+    Variable32Field d(series, "d");
+    BoolField e(series, "e");
+    for (int64_t row = 0; row < nrows; ++row) {
+        if (row % 10000 == 0) {
+            ret.push_back(Extent::Ptr(new Extent(type)));
+            series.setExtent(ret.back());
+        }
+        series.newRecord();
+        a.set(rng.randInt(100) - 50);
+        if (rng.randInt(10) == 0) {
+            b.setNull();
+        } else {
+            b.set(static_cast<int64_t>(rng.randLongLong()) >> rng.randInt(64));
+        }
+        c.set(rng.randDouble() - 0.5);
+        d.set(str(format("%d") % rng.randInt(1000)));
+        e.set(rng.randInt(2) == 0);
+    }
+    series.clearExtent();
+    return ret;
+}
+
+// Sorts the input, returning a checksum of the output in order.
+uint64_t runSort(const vector<Extent::Ptr> &input, const vector<SortColumn> &sort_by,
+                 size_t memory_limit, double &elapsed) {
+    VectorSource source(input);
+    Clock::Tdbl start = Clock::tod();
+    OutputSeriesModule::OSMPtr sorter(makeSortModule(source, sort_by, memory_limit, -1));
+    ExtentSeries series;
+    Int32Field a(series, "a");
+    Int64Field b(series, "b", Field::flag_nullable);
+    DoubleField c(series, "c");
+    Variable32Field d(series, "d");
+    BoolField e(series, "e");
+    uint64_t checksum = 0;
+    while (true) {
+        Extent::Ptr out(sorter->getSharedExtent());
+        if (out == NULL) {
+            break;
+        }
+        for (series.setExtent(out); series.more(); series.next()) {
+            string row(str(format("%d %d %d %.17g %s %d") % a.val() % b.isNull() % b.val()
+                           % c.val() % d.stringval() % e.val()));
+            for (size_t i = 0; i < row.size(); ++i) {
+                checksum = (checksum ^ static_cast<uint8_t>(row[i])) * 1099511628211ULL;
+            }
+        }
+    }
+    elapsed = Clock::tod() - start;
+    return checksum;
+}
+
+SortColumn sortColumn(const string &column, SortMode sort_mode, NullMode null_mode) {
+    SortColumn ret;
+    ret.column = column;
+    ret.sort_mode = sort_mode;
+    ret.null_mode = null_mode;
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    int64_t nrows = argc > 1 ? boost::lexical_cast<int64_t>(argv[1]) : 1000000;
+    int repetitions = argc > 2 ? boost::lexical_cast<int>(argv[2]) : 3;
+    INVARIANT(nrows > 0 && repetitions > 0, "usage: sort-codegen-bench [nrows] [repetitions]");
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(bench_xml));
+    vector<Extent::Ptr> input(makeInput(type, nrows));
+    size_t input_bytes = 0;
+    BOOST_FOREACH(Extent::Ptr &e, input) {
+        input_bytes += e->size();
+    }
+
+    vector<SortColumn> sort_by;
+    sort_by.push_back(sortColumn("a", SM_Ascending, NM_First));
+    sort_by.push_back(sortColumn("e", SM_Decending, NM_First));
+    sort_by.push_back(sortColumn("d", SM_Decending, NM_First));
+    sort_by.push_back(sortColumn("b", SM_Ascending, NM_Last));
+    sort_by.push_back(sortColumn("c", SM_Decending, NM_First));
+
+    CodeGen &codegen(CodeGen::instance());
+    codegen.setCacheDirectory("sort-codegen-bench.codegen");
+    for (int spill = 0; spill < 2; ++spill) {
+        size_t memory_limit = spill ? input_bytes / 8 + 1 : input_bytes * 2;
+        double generic_time = 0, generated_time = 0;
+        for (int i = 0; i < repetitions; ++i) {
+            double elapsed;
+            codegen.setEnabled(false);
+            uint64_t generic = runSort(input, sort_by, memory_limit, elapsed);
+            generic_time += elapsed;
+            codegen.setEnabled(true);
+            uint64_t generated = runSort(input, sort_by, memory_limit, elapsed);
+            generated_time += elapsed;
+            INVARIANT(generic == generated, "generic and generated sorts differ");
+        }
+        cout << format("%s sort of %d rows: generic %.3fs, generated %.3fs, speedup %.2fx\n")
+            % (spill ? "spilling" : "in-memory") % nrows % (generic_time / repetitions)
+            % (generated_time / repetitions) % (generic_time / generated_time);
+    }
+    CodeGen::Stats stats(codegen.getStats());
+    if (stats.failures > 0) {
+        cout << "code generation failed, the generated times are for the generic fallback\n";
+    }
+    cout << format("codegen: %d compiles, %d disk hits, %d memory hits, %d failures\n")
+        % stats.compiles % stats.disk_hits % stats.memory_hits % stats.failures;
+    return 0;
+}
@@ -0,0 +1,133 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify the modes DataSeriesSink::CompressAdaptive picks: between
+    probes it only uses the algorithm the last probe chose, a drop in the
+    compression ratio makes it re-probe on the next extent, and it goes
+    back to compressing at the next periodic probe.
+*/
+
+#include <iostream>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesSink.hpp>
+#include <DataSeries/DataSeriesSource.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+using boost::format;
+
+const string adaptive_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"adaptive-compress\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "</ExtentType>\n";
+
+// Only the one column, so the random extents have nothing to compress.
+static const unsigned rows_per_extent = 4000;
+// Written in order: compressible, random, then compressible again.
+static const unsigned compressible_extents = 40;
+static const unsigned random_extents = 10;
+static const unsigned nextents = 2 * compressible_extents + random_extents;
+
+static bool isRandom(unsigned extent) {
+    return extent >= compressible_extents && extent < compressible_extents + random_extents;
+}
+
+void writeFile(const string &filename, DataSeriesSink::CompressionPolicy policy) {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(adaptive_xml));
+    DataSeriesSink sink(filename);
+    sink.setCompressionPolicy(policy);
+    sink.writeExtentLibrary(library);
+
+    MersenneTwisterRandom rng;
+    ExtentSeries s(type);
+    Int64Field value(s, "value");
+    for (unsigned i = 0; i < nextents; ++i) {
+        s.newExtent();
+        for (unsigned j = 0; j < rows_per_extent; ++j) {
+            s.newRecord();
+            value.set(isRandom(i) ? rng.randLongLong() : j % 16);
+        }
+        sink.writeExtent(s.getExtentRef(), NULL);
+    }
+    sink.close();
+}
+
+// Returns the fixed data compression mode of each extent, in file order.
+vector<int> fixedModes(const string &filename) {
+    DataSeriesSource source(filename);
+    ExtentSeries index(source.index_extent);
+    Int64Field offset(index, "offset");
+    Variable32Field type(index, "extenttype");
+
+    vector<int> ret;
+    for (; index.more(); index.next()) {
+        if (type.stringval() != "adaptive-compress") {
+            continue;
+        }
+        off64_t at = offset.val();
+        Extent::ByteArray bytes;
+        SINVARIANT(source.preadCompressed(at, bytes));
+        ret.push_back(bytes[6*4]);
+    }
+    SINVARIANT(ret.size() == nextents);
+    return ret;
+}
+
+void testTryAll() {
+    writeFile("adaptive-compress-all.ds", DataSeriesSink::CompressTryAll);
+    vector<int> modes(fixedModes("adaptive-compress-all.ds"));
+    for (unsigned i = 0; i < nextents; ++i) {
+        INVARIANT((modes[i] == Extent::compress_mode_none) == isRandom(i),
+                  format("extent %d packed with mode %d") % i % modes[i]);
+    }
+}
+
+void testAdaptive() {
+    writeFile("adaptive-compress.ds", DataSeriesSink::CompressAdaptive);
+    vector<int> modes(fixedModes("adaptive-compress.ds"));
+
+    // The first extent probes; the rest of the compressible ones, including
+    // the periodic probe at adaptive_probe_interval + 1, pick the same mode.
+    int compressed_mode = modes[0];
+    SINVARIANT(compressed_mode != Extent::compress_mode_none);
+    SINVARIANT(compressible_extents > DataSeriesSink::adaptive_probe_interval + 1);
+    for (unsigned i = 0; i < compressible_extents; ++i) {
+        INVARIANT(modes[i] == compressed_mode,
+                  format("extent %d packed with mode %d, not %d") % i % modes[i]
+                  % compressed_mode);
+    }
+
+    // The first random extent only tries compressed_mode, which doesn't
+    // help; the ratio drifts, so the next extent probes and finds nothing
+    // that compresses.
+    unsigned drift_probe = compressible_extents + 1;
+    SINVARIANT(modes[compressible_extents] == compressed_mode
+               || modes[compressible_extents] == Extent::compress_mode_none);
+
+    // From there on nothing is tried until the next periodic probe, even
+    // once the data compresses again.
+    unsigned next_probe = drift_probe + DataSeriesSink::adaptive_probe_interval + 1;
+    SINVARIANT(next_probe > compressible_extents + random_extents && next_probe < nextents);
+    for (unsigned i = drift_probe; i < nextents; ++i) {
+        int expect = i < next_probe ? Extent::compress_mode_none : compressed_mode;
+        INVARIANT(modes[i] == expect, format("extent %d packed with mode %d, not %d")
+                  % i % modes[i] % expect);
+    }
+}
+
+int main() {
+    // Pack in writeExtent() so the extents reach the adaptive state in order.
+    DataSeriesSink::setCompressorCount(0);
+    testTryAll();
+    testAdaptive();
+    cout << "Passed adaptive-compress tests\n";
+    return 0;
+}
@@ -0,0 +1,66 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that asynchronous reads through the IndexSourceModules return
+    the same extents, in the same order, as reading the files directly.
+*/
+
+#include <iostream>
+
+#include <DataSeries/AsyncExtentReader.hpp>
+#include <DataSeries/DataSeriesSource.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+int main(int argc, char *argv[]) {
+    INVARIANT(argc > 1, "Usage: async-read file.ds...");
+    dataseries::AsyncExtentReader::instance().setQueueDepth(4);
+    DataSeriesSource::setDefaultReadMode(DataSeriesSource::ReadPread);
+
+    TypeIndexModule module;
+    for (int i = 1; i < argc; ++i) {
+        module.addSource(argv[i]);
+    }
+
+    unsigned nextents = 0;
+    for (int i = 1; i < argc; ++i) {
+        DataSeriesSource source(argv[i]);
+        while (true) {
+            Extent *expect = source.readExtent();
+            if (expect == NULL) {
+                break;
+            }
+            Extent::Ptr got = module.getSharedExtent();
+            SINVARIANT(got != NULL);
+            SINVARIANT(got->extent_source == expect->extent_source);
+            SINVARIANT(got->extent_source_offset == expect->extent_source_offset);
+            SINVARIANT(got->fixeddata.size() == expect->fixeddata.size());
+            SINVARIANT(memcmp(got->fixeddata.begin(), expect->fixeddata.begin(),
+                              got->fixeddata.size()) == 0);
+            SINVARIANT(got->variabledata.size() == expect->variabledata.size());
+            SINVARIANT(memcmp(got->variabledata.begin(), expect->variabledata.begin(),
+                              got->variabledata.size()) == 0);
+            delete expect;
+            ++nextents;
+        }
+    }
+    SINVARIANT(module.getSharedExtent() == NULL);
+
+    IndexSourceModule::WaitStats stats;
+    SINVARIANT(module.getWaitStats(stats));
+    SINVARIANT(stats.read_queue_depth.count() == nextents);
+    SINVARIANT(stats.read_bytes > 0 && stats.read_busy_seconds > 0);
+    cout << format("%d extents via %s, %.2f MiB/s, mean queue depth %.2f\n")
+        % nextents
+        % (dataseries::AsyncExtentReader::instance().usingUring() ? "io_uring" : "pread threads")
+        % (stats.readBandwidth() / (1024.0 * 1024.0)) % stats.read_queue_depth.mean();
+    cout << "Passed async-read tests\n";
+    return 0;
+}
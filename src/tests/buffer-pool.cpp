@@ -0,0 +1,130 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that large Extent::ByteArray buffers are recycled through
+    dataseries::BufferPool, including across threads, and that the pool
+    respects its retain limit.
+*/
+
+#include <iostream>
+
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/BufferPool.hpp>
+#include <DataSeries/Extent.hpp>
+
+using namespace std;
+using boost::format;
+using dataseries::BufferPool;
+
+void testReuse() {
+    BufferPool::Stats before = BufferPool::instance().getStats();
+    Extent::byte *first;
+    {
+        Extent::ByteArray a;
+        a.resize(1024 * 1024);
+        first = a.begin();
+    }
+    for (unsigned i = 0; i < 100; ++i) {
+        Extent::ByteArray a;
+        a.resize(1000 * 1000 + i); // same size class
+        SINVARIANT(a.begin() == first);
+        memset(a.begin(), i, a.size());
+    }
+    BufferPool::Stats after = BufferPool::instance().getStats();
+    SINVARIANT(after.hits - before.hits == 100);
+    SINVARIANT(after.misses - before.misses == 1);
+
+    // resize up to the capacity rounded to the size class doesn't reallocate
+    Extent::ByteArray a;
+    a.resize(1024 * 1024 + 1);
+    Extent::byte *begin = a.begin();
+    a.resize(1024 * 1024 + 2 * 1024);
+    SINVARIANT(a.begin() == begin);
+
+    // small buffers are not pooled
+    before = BufferPool::instance().getStats();
+    for (unsigned i = 0; i < 100; ++i) {
+        Extent::ByteArray small;
+        small.resize(1000);
+    }
+    after = BufferPool::instance().getStats();
+    SINVARIANT(after.hits == before.hits && after.misses == before.misses);
+}
+
+// Buffers allocated on one thread and released on another, as happens with
+// extents unpacked on the UnpackPool threads.
+class AllocateThread : public PThread {
+  public:
+    AllocateThread(vector<Extent::ByteArray *> &into) : into(into) { }
+    virtual void *run() {
+        for (unsigned i = 0; i < 64; ++i) {
+            Extent::ByteArray *a = new Extent::ByteArray();
+            a->resize(256 * 1024);
+            into.push_back(a);
+        }
+        return NULL;
+    }
+    vector<Extent::ByteArray *> &into;
+};
+
+void testThreads() {
+    BufferPool::Stats before = BufferPool::instance().getStats();
+    vector<Extent::ByteArray *> arrays;
+    for (unsigned round = 0; round < 4; ++round) {
+        AllocateThread thread(arrays);
+        thread.start();
+        thread.join();
+        for (vector<Extent::ByteArray *>::iterator i = arrays.begin(); i != arrays.end(); ++i) {
+            delete *i;
+        }
+        arrays.clear();
+    }
+    BufferPool::Stats after = BufferPool::instance().getStats();
+    // Later rounds find the buffers released by this thread in the shared lists, once its own
+    // cache is full.
+    SINVARIANT(after.hits - before.hits >= 64 * 2);
+}
+
+void testRetainLimit() {
+    BufferPool::instance().setRetainLimit(4 * 1024 * 1024);
+    SINVARIANT(BufferPool::instance().getStats().retained_bytes <= 4 * 1024 * 1024
+               + 8 * 1024 * 1024); // thread caches are not trimmed
+    vector<Extent::ByteArray *> arrays;
+    for (unsigned i = 0; i < 32; ++i) {
+        arrays.push_back(new Extent::ByteArray());
+        arrays.back()->resize(1024 * 1024);
+    }
+    BufferPool::Stats before = BufferPool::instance().getStats();
+    for (vector<Extent::ByteArray *>::iterator i = arrays.begin(); i != arrays.end(); ++i) {
+        delete *i;
+    }
+    BufferPool::Stats after = BufferPool::instance().getStats();
+    SINVARIANT(after.freed > before.freed);
+    SINVARIANT(after.retained_bytes <= before.retained_bytes + 4 * 1024 * 1024);
+
+    BufferPool::instance().setRetainLimit(0);
+    before = BufferPool::instance().getStats();
+    {
+        Extent::ByteArray a;
+        a.resize(1024 * 1024);
+    }
+    after = BufferPool::instance().getStats();
+    SINVARIANT(after.misses == before.misses + 1 && after.kept == before.kept);
+}
+
+int main() {
+    testReuse();
+    testThreads();
+    testRetainLimit();
+    BufferPool::Stats stats = BufferPool::instance().getStats();
+    cout << format("%d hits, %d misses, %d kept, %d freed\n") % stats.hits % stats.misses
+        % stats.kept % stats.freed;
+    cout << "Passed buffer-pool tests\n";
+    return 0;
+}
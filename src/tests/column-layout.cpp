@@ -0,0 +1,172 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that pack_layout="columns" extents unpack to the same bytes as
+    row layout extents, that unpacking only some fields gets those fields
+    right and skips the variable data when it isn't needed, and that
+    IndexSourceModule::setNeededFields() passes the fields through.
+*/
+
+#include <iostream>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesSink.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include "extent-check.hpp"
+
+using namespace std;
+using boost::format;
+
+const string fields_xml =
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" />\n"
+        "  <field type=\"int32\" name=\"count\" pack_relative=\"base\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"base\" />\n"
+        "  <field type=\"double\" name=\"ratio\" pack_scale=\"1e-3\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"byte\" name=\"kind\" />\n"
+        "  <field type=\"fixedwidth\" name=\"id\" size=\"6\" />\n"
+        "  <field type=\"variable32\" name=\"path\" pack_unique=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"op\" pack_dictionary=\"yes\" />\n"
+        "</ExtentType>\n";
+
+const string columns_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"column-layout\" version=\"1.0\""
+        " pack_layout=\"columns\" >\n" + fields_xml;
+
+const string rows_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"column-layout-rows\" version=\"1.0\" >\n"
+        + fields_xml;
+
+static const unsigned nrecords = 20 * 1000;
+static const string filename("column-layout.ds");
+
+Extent::Ptr fill(const ExtentType::Ptr type) {
+    static const string ops[] = { "READ", "WRITE", "GETATTR", "" };
+    MersenneTwisterRandom rng(1776);
+    ExtentSeries s(type);
+    s.newExtent();
+    Int64Field time(s, "time");
+    Int32Field count(s, "count", Field::flag_nullable), base(s, "base");
+    DoubleField ratio(s, "ratio");
+    BoolField flag(s, "flag");
+    ByteField kind(s, "kind");
+    FixedWidthField id(s, "id");
+    Variable32Field path(s, "path"), op(s, "op");
+    int64_t now = 1234567890LL * 1000 * 1000 * 1000;
+    uint8_t id_bytes[6];
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        now += rng.randInt(1000 * 1000);
+        time.set(now);
+        base.set(rng.randInt(1000));
+        if (rng.randInt(10) == 0) {
+            count.setNull();
+        } else {
+            count.set(base.val() + rng.randInt(100));
+        }
+        ratio.set(rng.randInt(1000) * 1.0e-3);
+        flag.set(rng.randInt(2) == 1);
+        kind.set(rng.randInt(4));
+        for (unsigned j = 0; j < sizeof(id_bytes); ++j) {
+            id_bytes[j] = rng.randInt(256);
+        }
+        id.set(id_bytes, sizeof(id_bytes));
+        path.set(str(format("/home/user%d/file-%d") % rng.randInt(100) % rng.randInt(1000)));
+        op.set(ops[rng.randInt(4)]);
+    }
+    return s.getSharedExtent();
+}
+
+void testInMemory(Extent::Ptr columns, Extent::Ptr rows) {
+    const uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    Extent::ByteArray columns_packed, rows_packed;
+    columns->packData(columns_packed, lzf);
+    rows->packData(rows_packed, lzf);
+    cout << format("%d records lzf: columns %d bytes, rows %d bytes\n")
+        % nrecords % columns_packed.size() % rows_packed.size();
+
+    Extent::Ptr full(unpack(columns->getTypePtr(), columns_packed, NULL));
+    Extent::Ptr full_rows(unpack(rows->getTypePtr(), rows_packed, NULL));
+    SINVARIANT(sameBytes(full->fixeddata, full_rows->fixeddata));
+    SINVARIANT(sameBytes(full->variabledata, full_rows->variabledata));
+    SINVARIANT(full->size() == Extent::unpackedSize(columns_packed, false, full->getTypePtr()));
+
+    // count needs its base and its null flag, but not the variable data
+    vector<string> fields;
+    fields.push_back("count");
+    fields.push_back("ratio");
+    Extent::Ptr partial(unpack(columns->getTypePtr(), columns_packed, &fields));
+    checkFields(partial, full, fields);
+    SINVARIANT(partial->variabledata.size() == 4 && partial->size() < full->size());
+    fields.push_back("base");
+    checkFields(partial, full, fields);
+
+    fields.clear();
+    fields.push_back("op");
+    fields.push_back("flag");
+    fields.push_back("not-in-the-type");
+    partial = unpack(columns->getTypePtr(), columns_packed, &fields);
+    fields.pop_back();
+    checkFields(partial, full, fields);
+    SINVARIANT(sameBytes(partial->variabledata, full->variabledata));
+    ExtentSeries s(partial);
+    Variable32Field op(s, "op");
+    SINVARIANT(op.dictionary() != NULL);
+}
+
+void testModule(Extent::Ptr columns) {
+    {
+        ExtentTypeLibrary library;
+        library.registerType(columns->getTypePtr());
+        DataSeriesSink sink(filename);
+        sink.writeExtentLibrary(library);
+        sink.writeExtent(*fill(columns->getTypePtr()), NULL); // writeExtent empties it
+        sink.close();
+    }
+
+    TypeIndexModule source("column-layout");
+    source.addSource(filename);
+    ExtentSeries s;
+    Int64Field time(s, "time");
+    Variable32Field path(s, "path");
+    source.setNeededFields(s);
+    Extent::Ptr e(source.getSharedExtent());
+    SINVARIANT(e != NULL && source.getSharedExtent() == NULL);
+    vector<string> fields(s.getFieldNames());
+    SINVARIANT(fields.size() == 2);
+    checkFields(e, columns, fields);
+}
+
+int main() {
+    // Verify the internal checksums, including the per-column ones, on every unpack.
+    Extent::setReadChecksFromEnv(true);
+
+    const ExtentType::Ptr columns_type(ExtentTypeLibrary::sharedExtentTypePtr(columns_xml));
+    const ExtentType::Ptr rows_type(ExtentTypeLibrary::sharedExtentTypePtr(rows_xml));
+    SINVARIANT(columns_type->getPackLayout() == ExtentType::LayoutColumns
+               && rows_type->getPackLayout() == ExtentType::LayoutRows);
+
+    Extent::Ptr columns(fill(columns_type)), rows(fill(rows_type));
+    SINVARIANT(sameBytes(columns->fixeddata, rows->fixeddata));
+
+    testInMemory(columns, rows);
+    testModule(columns);
+
+    // An empty extent has empty columns
+    Extent::Ptr empty(new Extent(columns_type));
+    Extent::ByteArray packed;
+    empty->packData(packed);
+    SINVARIANT(unpack(columns_type, packed, NULL)->nRecords() == 0);
+
+    cout << "Passed column-layout tests\n";
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <DataSeries/commonargs.hpp>
 #include <DataSeries/DataSeriesModule.hpp>
 #include <DataSeries/DSExpr.hpp>
+#include <DataSeries/ExtentField.hpp>
 
 using namespace std;
 
@@ -155,9 +156,137 @@ void testNullExpr() {
     cout << "Null Expr passed.\n";
 }
 
+// Batch evaluation has to give exactly the same answers as evaluating each row.
+void testBatch() {
+    static string extent_type_xml(
+        "<ExtentType name=\"Test1\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\" >"
+        "  <field type=\"bool\" name=\"f\" />"
+        "  <field type=\"byte\" name=\"g\" />"
+        "  <field type=\"int32\" name=\"a\" opt_nullable=\"yes\" />"
+        "  <field type=\"int64\" name=\"b\" />"
+        "  <field type=\"double\" name=\"c\" />"
+        "  <field type=\"variable32\" name=\"d\" opt_nullable=\"yes\" />"
+        "  <field type=\"int64\" name=\"e\" opt_nullable=\"yes\" />"
+        "</ExtentType>");
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr extent_type(library.registerTypePtr(extent_type_xml));
+
+    ExtentSeries series(extent_type);
+    BoolField f(series, "f");
+    ByteField g(series, "g");
+    Int32Field a(series, "a", Field::flag_nullable);
+    Int64Field b(series, "b");
+    DoubleField c(series, "c");
+    Variable32Field d(series, "d", Field::flag_nullable);
+    Int64Field e(series, "e", Field::flag_nullable);
+
+    series.newExtent();
+    for (int i = 0; i < 1000; ++i) {
+        series.newRecord();
+        f.set(i % 3 == 0);
+        g.set(i % 256);
+        if (i % 7 == 0) {
+            a.setNull();
+        } else {
+            a.set(i % 50 - 25);
+        }
+        b.set(static_cast<int64_t>(i) * 1000003 - 500000000);
+        c.set(i / 8.0 - 60);
+        if (i % 11 == 0) {
+            d.setNull();
+        } else {
+            d.set(string(i % 5, 'x') + (i % 2 == 0 ? string("\0", 1) : "") 
+                  + (boost::format("%d") % (i % 13)).str());
+        }
+        if (i % 5 == 0) {
+            e.setNull(); // reads as 0
+        } else {
+            e.set(i % 9 + 1);
+        }
+    }
+
+    const char *bool_exprs[] = {
+        "a > 3", "a == 0", "b >= 0 && c < 10", "f || a < -20", "!(g <= 100)",
+        "d == \"x1\"", "d < \"xx\"", "d != \"\"", "\"xxx3\" >= d",
+        "a * 2 + b / 3 > c", "-a < c || (d > \"x\" && g == 7)", "f && fn.TfracToSeconds(b) > 0",
+        "g", "a", NULL };
+    const char *numeric_exprs[] = {
+        "a", "b", "c", "g", "f", "a + b * 2", "c / 3 - a", "-c", "b - 7", "a * a",
+        "fn.TfracToSeconds(b)", NULL };
+
+    DSExprBatch::Selection selected;
+    for (unsigned i = 0; bool_exprs[i] != NULL; ++i) {
+        boost::scoped_ptr<DSExpr> expr(DSExpr::make(series, bool_exprs[i]));
+        boost::scoped_ptr<DSExprBatch> batch(DSExprBatch::compile(expr.get(), series));
+        SINVARIANT(batch != NULL);
+        batch->select(selected);
+        DSExprBatch::Selection expected;
+        uint32_t row = 0;
+        for (series.setExtent(series.getSharedExtent()); series.more(); series.next(), ++row) {
+            if (expr->valBool()) {
+                expected.push_back(row);
+            }
+        }
+        INVARIANT(selected == expected, boost::format("batch mismatch on %s: %d != %d rows")
+                  % bool_exprs[i] % selected.size() % expected.size());
+    }
+
+    for (unsigned i = 0; numeric_exprs[i] != NULL; ++i) {
+        boost::scoped_ptr<DSExpr> expr(DSExpr::make(series, numeric_exprs[i]));
+        boost::scoped_ptr<DSExprBatch> batch(DSExprBatch::compile(expr.get(), series));
+        vector<double> doubles;
+        vector<int64_t> int64s;
+        vector<uint8_t> nulls;
+        batch->evalDouble(doubles);
+        batch->evalNull(nulls);
+        bool int64_ok = string(numeric_exprs[i]).find("fn.") == string::npos;
+        if (int64_ok) {
+            batch->evalInt64(int64s);
+        }
+        uint32_t row = 0;
+        for (series.setExtent(series.getSharedExtent()); series.more(); series.next(), ++row) {
+            SINVARIANT(doubles[row] == expr->valDouble()); 
+            SINVARIANT(nulls[row] == (expr->isNull() ? 1 : 0));
+            SINVARIANT(!int64_ok || int64s[row] == expr->valInt64());
+        }
+    }
+
+    // Given the nulls, null rows aren't evaluated, so the integer division by the null e
+    // doesn't trap.
+    {
+        boost::scoped_ptr<DSExpr> expr(DSExpr::make(series, "b / e"));
+        boost::scoped_ptr<DSExprBatch> batch(DSExprBatch::compile(expr.get(), series));
+        vector<double> doubles;
+        vector<int64_t> int64s;
+        vector<uint8_t> nulls;
+        batch->evalNull(nulls);
+        batch->evalInt64(int64s, &nulls);
+        batch->evalDouble(doubles, &nulls);
+        uint32_t row = 0;
+        for (series.setExtent(series.getSharedExtent()); series.more(); series.next(), ++row) {
+            SINVARIANT(nulls[row] == (expr->isNull() ? 1 : 0));
+            if (nulls[row]) {
+                SINVARIANT(int64s[row] == 0 && doubles[row] == 0);
+            } else {
+                SINVARIANT(int64s[row] == expr->valInt64() && doubles[row] == expr->valDouble());
+            }
+        }
+    }
+
+    // Fields from other series can only be evaluated row by row.
+    ExtentSeries other(extent_type);
+    vector<ExtentSeries *> all_series;
+    all_series.push_back(&other);
+    boost::scoped_ptr<DSExpr> expr(DSExpr::make(boost::bind(firstMatch, &all_series, _1), "a"));
+    SINVARIANT(DSExprBatch::compile(expr.get(), series) == NULL);
+    cout << "Batch Expr passed.\n";
+}
+
 int main(int argc, char **argv) {
     testSeriesSelect();
     testNullExpr();
+    testBatch();
     makeFile();
 
     return 0;
@@ -0,0 +1,58 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Helpers shared by the tests that compare differently unpacked copies
+    of the same extent.
+*/
+
+#ifndef DATASERIES_TESTS_EXTENT_CHECK_HPP
+#define DATASERIES_TESTS_EXTENT_CHECK_HPP
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/ExtentSeries.hpp>
+#include <DataSeries/GeneralField.hpp>
+
+// Unpacks a copy of packed, since unpackData modifies its input.
+inline Extent::Ptr unpack(const ExtentType::Ptr type, const Extent::ByteArray &packed,
+                          const std::vector<std::string> *only_fields = NULL,
+                          bool lazy = false) {
+    Extent::ByteArray tmp;
+    tmp.resize(packed.size(), false);
+    memcpy(tmp.begin(), packed.begin(), packed.size());
+    Extent::Ptr ret(new Extent(type));
+    ret->unpackData(tmp, false, only_fields, lazy);
+    return ret;
+}
+
+inline bool sameBytes(const Extent::ByteArray &a, const Extent::ByteArray &b) {
+    return a.size() == b.size() && memcmp(a.begin(), b.begin(), a.size()) == 0;
+}
+
+// Checks that the named fields of a have the same values as in b.
+inline void checkFields(Extent::Ptr a, Extent::Ptr b, const std::vector<std::string> &names) {
+    SINVARIANT(a->nRecords() == b->nRecords());
+    ExtentSeries a_series(a), b_series(b);
+    std::vector<GeneralField::Ptr> a_fields, b_fields;
+    for (std::vector<std::string>::const_iterator i = names.begin(); i != names.end(); ++i) {
+        a_fields.push_back(GeneralField::make(a_series, *i));
+        b_fields.push_back(GeneralField::make(b_series, *i));
+    }
+    for (; a_series.more(); a_series.next(), b_series.next()) {
+        for (size_t i = 0; i < a_fields.size(); ++i) {
+            SINVARIANT(a_fields[i]->isNull() == b_fields[i]->isNull());
+            SINVARIANT(a_fields[i]->isNull() || a_fields[i]->val().equal(b_fields[i]->val()));
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,227 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that pack_int_encoding fields round trip through packing with
+    both unpack strategies, including nulls, pack_relative and values
+    that don't suit the encoding; then repack the extents of the files
+    given as arguments with each encoding on all their int32 and int64
+    fields, and compare the packed size and unpack time with the plain
+    fields.
+*/
+
+#include <iostream>
+
+#include <libxml/tree.h>
+
+#include <Lintel/Clock.hpp>
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesSource.hpp>
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/GeneralField.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"int-encoding\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"time\" pack_int_encoding=\"zigzag_delta\" />\n"
+        "  <field type=\"int64\" name=\"end\" pack_relative=\"time\""
+        " pack_int_encoding=\"frame_of_reference\" />\n"
+        "  <field type=\"int32\" name=\"offset\" pack_int_encoding=\"frame_of_reference\""
+        " opt_nullable=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"random\" pack_int_encoding=\"frame_of_reference\" />\n"
+        "  <field type=\"int32\" name=\"delta\" pack_relative=\"delta\""
+        " pack_int_encoding=\"zigzag_delta\" />\n"
+        "  <field type=\"int32\" name=\"plain\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"variable32\" name=\"name\" pack_unique=\"yes\" />\n"
+        "</ExtentType>\n";
+
+static const unsigned nrecords = 50 * 1000;
+static const unsigned reps = 10;
+
+// Sets pack_int_encoding to encoding on all the int32 and int64 fields of type.
+const ExtentType::Ptr encodedType(const ExtentType::Ptr type, const string &encoding) {
+    xmlDocPtr doc = xmlCopyDoc(type->getXmlDescriptionDoc(), 1);
+    xmlNodePtr root = xmlDocGetRootElement(doc);
+    for (xmlNodePtr cur = root->children; cur != NULL; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE
+            || xmlStrcmp(cur->name, reinterpret_cast<const xmlChar *>("field")) != 0) {
+            continue;
+        }
+        xmlChar *field_type = xmlGetProp(cur, reinterpret_cast<const xmlChar *>("type"));
+        string field_type_str(reinterpret_cast<char *>(field_type));
+        xmlFree(field_type);
+        if (field_type_str == "int32" || field_type_str == "int64") {
+            xmlSetProp(cur, reinterpret_cast<const xmlChar *>("pack_int_encoding"),
+                       reinterpret_cast<const xmlChar *>(encoding.c_str()));
+        }
+    }
+    xmlBufferPtr buf = xmlBufferCreate();
+    xmlNodeDump(buf, doc, root, 0, 0);
+    string xml(reinterpret_cast<const char *>(xmlBufferContent(buf)));
+    xmlBufferFree(buf);
+    xmlFreeDoc(doc);
+    return ExtentTypeLibrary::sharedExtentTypePtr(xml);
+}
+
+// Encoding doesn't change the record layout, so the bytes can be copied between the types.
+Extent::Ptr copyAs(const ExtentType::Ptr type, const Extent &from) {
+    Extent::Ptr ret(new Extent(type));
+    ret->fixeddata.resize(from.fixeddata.size(), false);
+    memcpy(ret->fixeddata.begin(), from.fixeddata.begin(), from.fixeddata.size());
+    ret->variabledata.resize(from.variabledata.size(), false);
+    memcpy(ret->variabledata.begin(), from.variabledata.begin(), from.variabledata.size());
+    return ret;
+}
+
+double timeUnpack(const ExtentType::Ptr type, const Extent::ByteArray &packed,
+                  Extent::Ptr &result, unsigned repetitions) {
+    Extent::ByteArray tmp;
+    double elapsed = 0;
+    for (unsigned i = 0; i < repetitions; ++i) {
+        result.reset(new Extent(type));
+        tmp.resize(packed.size(), false);
+        memcpy(tmp.begin(), packed.begin(), packed.size()); // unpackData modifies its input
+        Clock::Tfrac start = Clock::todTfrac();
+        result->unpackData(tmp, false);
+        elapsed += Clock::TfracToDouble(Clock::todTfrac() - start);
+    }
+    return elapsed / repetitions;
+}
+
+// Checks that the int32 and int64 fields of a and b have the same values.
+void checkSameInts(Extent::Ptr a, Extent::Ptr b) {
+    SINVARIANT(a->nRecords() == b->nRecords());
+    ExtentSeries a_series(a), b_series(b);
+    vector<GeneralField::Ptr> a_fields, b_fields;
+    const ExtentType::Ptr type(a->getTypePtr());
+    for (uint32_t i = 0; i < type->getNFields(); ++i) {
+        const string &name(type->getFieldName(i));
+        if (type->getFieldType(name) == ExtentType::ft_int32
+            || type->getFieldType(name) == ExtentType::ft_int64) {
+            a_fields.push_back(GeneralField::make(a_series, name));
+            b_fields.push_back(GeneralField::make(b_series, name));
+        }
+    }
+    for (; a_series.more(); a_series.next(), b_series.next()) {
+        for (size_t i = 0; i < a_fields.size(); ++i) {
+            SINVARIANT(a_fields[i]->isNull() == b_fields[i]->isNull());
+            SINVARIANT(a_fields[i]->isNull() || a_fields[i]->val().equal(b_fields[i]->val()));
+        }
+    }
+}
+
+void testRoundTrip() {
+    const ExtentType::Ptr type(ExtentTypeLibrary::sharedExtentTypePtr(test_xml));
+    SINVARIANT(type->getIntEncoding("time") == ExtentType::IntEncodingZigZagDelta
+               && type->getIntEncoding("plain") == ExtentType::IntEncodingNone);
+    const ExtentType::Ptr plain_type(encodedType(type, "none"));
+    MersenneTwisterRandom rng(1776);
+
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    Int64Field time(s, "time"), end(s, "end"), random(s, "random");
+    Int32Field offset(s, "offset", Field::flag_nullable), delta(s, "delta"), plain(s, "plain");
+    BoolField flag(s, "flag");
+    Variable32Field name(s, "name");
+    int64_t now = 1234567890LL * 1000 * 1000 * 1000;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        now += rng.randInt(1000 * 1000);
+        time.set(now);
+        end.set(now + rng.randInt(1000));
+        if (rng.randInt(10) == 0) {
+            offset.setNull();
+        } else {
+            offset.set(-100 * 1000 + static_cast<int32_t>(rng.randInt(64 * 1024)));
+        }
+        random.set(static_cast<int64_t>(rng.randLongLong())); // needs all 64 bits
+        delta.set(static_cast<int32_t>(i * 3) - static_cast<int32_t>(rng.randInt(5)));
+        plain.set(rng.randInt());
+        flag.set(rng.randInt(2) == 1);
+        name.set(str(format("name-%d") % rng.randInt(100)));
+    }
+
+    Extent::ByteArray packed, plain_packed;
+    e->packData(packed, 0);
+    copyAs(plain_type, *e)->packData(plain_packed, 0);
+    cout << format("%d records uncompressed: encoded %d bytes, plain %d bytes\n")
+        % nrecords % packed.size() % plain_packed.size();
+    SINVARIANT(packed.size() < plain_packed.size());
+
+    Extent::Ptr by_row, by_column;
+    Extent::setUnpackStrategy(Extent::UnpackByRow);
+    timeUnpack(type, packed, by_row, 1);
+    Extent::setUnpackStrategy(Extent::UnpackByColumn);
+    timeUnpack(type, packed, by_column, 1);
+    checkSameInts(e, by_row);
+    checkSameInts(e, by_column);
+
+    // An empty extent has empty encoded columns
+    Extent::Ptr empty(new Extent(type));
+    empty->packData(packed, 0);
+    timeUnpack(type, packed, by_row, 1);
+    SINVARIANT(by_row->nRecords() == 0);
+}
+
+// Repacks each extent of file plain and with each encoding, and reports the sizes and the
+// unpack times per type.
+void benchmarkFile(const string &filename) {
+    static const string encodings[] = { "none", "frame_of_reference", "zigzag_delta" };
+    static const unsigned nencodings = 3;
+    const uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+
+    DataSeriesSource source(filename);
+    map<string, vector<double> > sizes, times;
+    while (true) {
+        Extent *e = source.readExtent();
+        if (e == NULL) {
+            break;
+        }
+        const ExtentType::Ptr type(e->getTypePtr());
+        if (type->getName().compare(0, 11, "DataSeries:") == 0) { // index extents
+            delete e;
+            continue;
+        }
+        vector<double> &type_sizes(sizes[type->getName()]), &type_times(times[type->getName()]);
+        type_sizes.resize(nencodings);
+        type_times.resize(nencodings);
+        for (unsigned i = 0; i < nencodings; ++i) {
+            const ExtentType::Ptr encoded_type(encodedType(type, encodings[i]));
+            Extent::ByteArray packed;
+            copyAs(encoded_type, *e)->packData(packed, lzf);
+            Extent::Ptr unpacked;
+            type_times[i] += timeUnpack(encoded_type, packed, unpacked, reps);
+            type_sizes[i] += packed.size();
+            checkSameInts(copyAs(encoded_type, *e), unpacked);
+        }
+        delete e;
+    }
+    for (map<string, vector<double> >::iterator i = sizes.begin(); i != sizes.end(); ++i) {
+        const vector<double> &type_times(times[i->first]);
+        for (unsigned j = 0; j < nencodings; ++j) {
+            cout << format("%s %s: lzf %.0f bytes (%.3f of plain), unpack %.3fms\n")
+                % i->first % encodings[j] % i->second[j] % (i->second[j] / i->second[0])
+                % (1.0e3 * type_times[j]);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Verify the internal checksums on every unpack.
+    Extent::setReadChecksFromEnv(true);
+    testRoundTrip();
+    for (int i = 1; i < argc; ++i) {
+        benchmarkFile(argv[i]);
+    }
+    cout << "Passed int-encoding tests\n";
+    return 0;
+}
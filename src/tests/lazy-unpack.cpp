@@ -0,0 +1,190 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that lazily unpacked extents unpack the fields a series uses,
+    including the fields they are relative to, leave the others packed,
+    and end up with the same bytes as an eager unpack; that SortedSearch
+    unpacks the field it searches; and the same through
+    IndexSourceModule::setLazyUnpack().  The comparison helpers are shared
+    with column-layout in extent-check.hpp.
+*/
+
+#include <iostream>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesSink.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/SortedSearch.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include "extent-check.hpp"
+
+using namespace std;
+using namespace dataseries;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"lazy-unpack\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" />\n"
+        "  <field type=\"int64\" name=\"end\" pack_relative=\"time\" />\n"
+        "  <field type=\"int64\" name=\"last\" pack_relative=\"end\" />\n"
+        "  <field type=\"int32\" name=\"base\" />\n"
+        "  <field type=\"int32\" name=\"count\" pack_relative=\"base\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"ratio\" pack_scale=\"1e-3\" pack_relative=\"ratio\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"variable32\" name=\"path\" pack_unique=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"op\" pack_dictionary=\"yes\" />\n"
+        "</ExtentType>\n";
+
+static const unsigned nrecords = 20 * 1000;
+static const string filename("lazy-unpack.ds");
+
+Extent::Ptr fill(const ExtentType::Ptr type) {
+    static const string ops[] = { "READ", "WRITE", "GETATTR", "" };
+    MersenneTwisterRandom rng(1776);
+    ExtentSeries s(type);
+    s.newExtent();
+    Int64Field time(s, "time"), end(s, "end"), last(s, "last");
+    Int32Field base(s, "base"), count(s, "count", Field::flag_nullable);
+    DoubleField ratio(s, "ratio");
+    BoolField flag(s, "flag");
+    Variable32Field path(s, "path"), op(s, "op");
+    int64_t now = 1234567890LL * 1000 * 1000 * 1000;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        now += rng.randInt(1000 * 1000);
+        time.set(now);
+        end.set(now + rng.randInt(1000));
+        last.set(end.val() + rng.randInt(1000));
+        base.set(rng.randInt(1000));
+        if (rng.randInt(10) == 0) {
+            count.setNull();
+        } else {
+            count.set(base.val() + rng.randInt(100));
+        }
+        ratio.set(rng.randInt(1000 * 1000) * 1.0e-3);
+        flag.set(rng.randInt(2) == 1);
+        path.set(str(format("/home/user%d/file-%d") % rng.randInt(100) % rng.randInt(1000)));
+        op.set(ops[rng.randInt(4)]);
+    }
+    return s.getSharedExtent();
+}
+
+void testInMemory(Extent::Ptr e, Extent::UnpackStrategy strategy) {
+    Extent::setUnpackStrategy(strategy);
+    Extent::ByteArray packed;
+    e->packData(packed, 0);
+    Extent::Ptr eager(unpack(e->getTypePtr(), packed, NULL, false));
+    SINVARIANT(!eager->hasPendingFields());
+
+    // last needs end, which needs time; count needs base and its null flag
+    Extent::Ptr lazy(unpack(e->getTypePtr(), packed, NULL, true));
+    SINVARIANT(lazy->hasPendingFields());
+    vector<string> fields;
+    fields.push_back("last");
+    fields.push_back("count");
+    fields.push_back("op");
+    checkFields(lazy, eager, fields);
+    SINVARIANT(lazy->hasPendingFields()); // ratio hasn't been used
+    fields.push_back("time");
+    fields.push_back("end");
+    fields.push_back("base");
+    checkFields(lazy, eager, fields);
+
+    // A field added to a series that is already on the extent is unpacked too
+    {
+        ExtentSeries s(lazy);
+        DoubleField ratio(s, "ratio");
+        ExtentSeries eager_series(eager);
+        DoubleField eager_ratio(eager_series, "ratio");
+        for (; s.more(); s.next(), eager_series.next()) {
+            SINVARIANT(ratio.val() == eager_ratio.val());
+        }
+    }
+    lazy->unpackAllFields();
+    SINVARIANT(!lazy->hasPendingFields());
+    SINVARIANT(sameBytes(lazy->fixeddata, eager->fixeddata));
+    SINVARIANT(sameBytes(lazy->variabledata, eager->variabledata));
+
+    // SortedSearch unpacks the field it searches, even with no series on the extent
+    {
+        Extent::Ptr searched(unpack(e->getTypePtr(), packed, NULL, true));
+        ExtentSeries s(e->getTypePtr()), eager_series(eager);
+        Int64Field time(s, "time"), eager_time(eager_series, "time");
+        for (unsigned i = 0; i < 100; ++i, eager_series.next()) {
+            SEP_RowOffset found(lowerBound(*searched, time, eager_time.val()));
+            SEP_RowOffset expect(lowerBound(*eager, eager_time, eager_time.val()));
+            SINVARIANT(SEP_RowOffset::distance(SEP_RowOffset(0, searched.get()), found,
+                                               searched.get())
+                       == SEP_RowOffset::distance(SEP_RowOffset(0, eager.get()), expect,
+                                                  eager.get()));
+        }
+        SINVARIANT(searched->hasPendingFields()); // only time and what it needs
+    }
+
+    // Repacking finishes the unpacking first
+    Extent::ByteArray repacked, eager_repacked;
+    unpack(e->getTypePtr(), packed, NULL, true)->packData(repacked, 0);
+    eager->packData(eager_repacked, 0);
+    SINVARIANT(sameBytes(repacked, eager_repacked));
+}
+
+void testModule(const ExtentType::Ptr type) {
+    {
+        ExtentTypeLibrary library;
+        library.registerType(type);
+        DataSeriesSink sink(filename);
+        sink.writeExtentLibrary(library);
+        sink.writeExtent(*fill(type), NULL); // writeExtent empties it
+        sink.close();
+    }
+
+    // Scaled doubles may not round trip exactly, so compare against an eager read of the file
+    TypeIndexModule eager_source("lazy-unpack");
+    eager_source.addSource(filename);
+    Extent::Ptr expect(eager_source.getSharedExtent());
+    SINVARIANT(expect != NULL && !expect->hasPendingFields());
+
+    TypeIndexModule source("lazy-unpack");
+    source.addSource(filename);
+    source.setLazyUnpack(true);
+    Extent::Ptr e(source.getSharedExtent());
+    SINVARIANT(e != NULL && source.getSharedExtent() == NULL);
+    SINVARIANT(e->hasPendingFields());
+
+    // The fields of a series are unpacked when it is set to the extent
+    ExtentSeries s, expect_series(expect);
+    Int64Field last(s, "last"), expect_last(expect_series, "last");
+    Variable32Field path(s, "path"), expect_path(expect_series, "path");
+    for (s.setExtent(e); s.more(); s.next(), expect_series.next()) {
+        SINVARIANT(last.val() == expect_last.val() && path.equal(expect_path.stringval()));
+    }
+    SINVARIANT(e->hasPendingFields());
+    s.clearExtent();
+
+    e->unpackAllFields();
+    SINVARIANT(!e->hasPendingFields());
+    SINVARIANT(sameBytes(e->fixeddata, expect->fixeddata));
+    SINVARIANT(sameBytes(e->variabledata, expect->variabledata));
+}
+
+int main() {
+    // Verify the internal checksums and variable offsets on every unpack.
+    Extent::setReadChecksFromEnv(true);
+
+    const ExtentType::Ptr type(ExtentTypeLibrary::sharedExtentTypePtr(test_xml));
+    Extent::Ptr e(fill(type));
+    testInMemory(e, Extent::UnpackByRow);
+    testInMemory(e, Extent::UnpackByColumn);
+    testModule(type);
+
+    cout << "Passed lazy-unpack tests\n";
+    return 0;
+}
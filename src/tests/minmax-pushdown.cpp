@@ -0,0 +1,125 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that TypeIndexModule uses the min/max statistics recorded by
+    DataSeriesSink to skip extents, and never skips one that could match.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesSink.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string minmax_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"minmax-pushdown\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "  <field type=\"int32\" name=\"maybe\" opt_nullable=\"yes\" />\n"
+        "</ExtentType>\n";
+
+static const unsigned nextents = 10;
+static const unsigned rows_per_extent = 100;
+static const string filename("minmax-pushdown.ds");
+
+// Extent i holds values [i*100, i*100 + 99] and names "name-<i>"; maybe is
+// null in the even extents.
+void writeFile() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(minmax_xml));
+    DataSeriesSink sink(filename);
+    vector<string> columns;
+    columns.push_back("value");
+    columns.push_back("name");
+    columns.push_back("maybe");
+    sink.recordMinMax(type, columns);
+    sink.writeExtentLibrary(library);
+
+    ExtentSeries s(type);
+    Int64Field value(s, "value");
+    Variable32Field name(s, "name");
+    Int32Field maybe(s, "maybe", Field::flag_nullable);
+    for (unsigned i = 0; i < nextents; ++i) {
+        s.newExtent();
+        for (unsigned j = 0; j < rows_per_extent; ++j) {
+            s.newRecord();
+            value.set(i * rows_per_extent + j);
+            name.set(str(format("name-%d") % i));
+            if (i % 2 == 0) {
+                maybe.setNull();
+            } else {
+                maybe.set(j);
+            }
+        }
+        sink.writeExtent(s.getExtentRef(), NULL);
+    }
+    sink.close();
+}
+
+unsigned countRows(TypeIndexModule &source, uint64_t expected_skipped) {
+    unsigned nrows = 0;
+    while (true) {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        nrows += e->nRecords();
+    }
+    INVARIANT(source.skippedExtents() == expected_skipped,
+              format("skipped %d extents, expected %d") % source.skippedExtents()
+              % expected_skipped);
+    return nrows;
+}
+
+void checkRange(double min, double max, uint64_t expected_skipped) {
+    TypeIndexModule source("minmax-pushdown");
+    source.addSource(filename);
+    source.addRangePredicate("value", min, max);
+    unsigned nrows = countRows(source, expected_skipped);
+    SINVARIANT(nrows == (nextents - expected_skipped) * rows_per_extent);
+}
+
+void checkWhere(const string &where, uint64_t expected_skipped) {
+    TypeIndexModule source("minmax-pushdown");
+    source.addSource(filename);
+    SINVARIANT(source.addWherePredicates(where));
+    unsigned nrows = countRows(source, expected_skipped);
+    SINVARIANT(nrows == (nextents - expected_skipped) * rows_per_extent);
+    cout << format("where %s: skipped %d of %d extents\n") % where % expected_skipped % nextents;
+}
+
+int main() {
+    writeFile();
+
+    checkRange(250, 260, nextents - 1);
+    checkRange(199, 200, nextents - 2); // boundary values are in both extents
+    checkRange(-10, -1, nextents);
+    checkRange(-Double::Inf, Double::Inf, 0);
+
+    checkWhere("value >= 250 && value < 300", nextents - 1);
+    checkWhere("450 < value", 4);
+    checkWhere("value == 999", nextents - 1);
+    checkWhere("name == \"name-3\"", nextents - 1);
+    checkWhere("value > 500 || value < 100", 0); // or is not pushed down
+    checkWhere("value > 500 && name <= \"name-7\"", 7);
+    // no statistics for the even extents, where maybe has nulls
+    checkWhere("maybe > 1000", nextents / 2);
+
+    // Not pushed down once the module has started.
+    TypeIndexModule source("minmax-pushdown");
+    source.addSource(filename);
+    source.startPrefetching();
+    SINVARIANT(!source.addWherePredicates("value < 0"));
+    SINVARIANT(countRows(source, 0) == nextents * rows_per_extent);
+
+    cout << "Passed minmax-pushdown tests\n";
+    return 0;
+}
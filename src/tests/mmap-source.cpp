@@ -0,0 +1,90 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that reading a file through mmap gives the same extents as
+    reading it with pread, and that views outlive their source.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesSource.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+using boost::format;
+
+void sameExtent(Extent &a, Extent &b) {
+    SINVARIANT(a.getTypePtr()->getName() == b.getTypePtr()->getName());
+    SINVARIANT(a.extent_source_offset == b.extent_source_offset);
+    SINVARIANT(a.fixeddata.size() == b.fixeddata.size());
+    SINVARIANT(memcmp(a.fixeddata.begin(), b.fixeddata.begin(), a.fixeddata.size()) == 0);
+    SINVARIANT(a.variabledata.size() == b.variabledata.size());
+    SINVARIANT(memcmp(a.variabledata.begin(), b.variabledata.begin(),
+                      a.variabledata.size()) == 0);
+}
+
+void compareModes(const string &filename) {
+    DataSeriesSource::setDefaultReadMode(DataSeriesSource::ReadPread);
+    DataSeriesSource by_pread(filename);
+    DataSeriesSource::setDefaultReadMode(DataSeriesSource::ReadMmap);
+    DataSeriesSource by_mmap(filename);
+    SINVARIANT(!by_pread.isMapped() && by_mmap.isMapped());
+
+    sameExtent(*by_pread.index_extent, *by_mmap.index_extent);
+    unsigned nextents = 0;
+    while (true) {
+        Extent *a = by_pread.readExtent();
+        Extent *b = by_mmap.readExtent();
+        SINVARIANT((a == NULL) == (b == NULL));
+        if (a == NULL) {
+            break;
+        }
+        sameExtent(*a, *b);
+        delete a;
+        delete b;
+        ++nextents;
+    }
+    cout << format("%s: %d extents match, bitflip %s\n") % filename % nextents
+        % (by_mmap.needBitflip() ? "yes" : "no");
+}
+
+void viewOutlivesSource(const string &filename) {
+    DataSeriesSource::setDefaultReadMode(DataSeriesSource::ReadMmap);
+    DataSeriesSource *source = new DataSeriesSource(filename);
+    ExtentSeries index(source->index_extent);
+    Int64Field extent_offset(index, "offset");
+    off64_t offset = extent_offset.val();
+
+    Extent::ByteArray bytes;
+    off64_t tmp_offset = offset;
+    SINVARIANT(source->preadCompressed(tmp_offset, bytes));
+    SINVARIANT(bytes.isView() == !source->needBitflip());
+    const ExtentType::Ptr type
+        = source->getLibrary().getTypeByNamePtr(Extent::getPackedExtentType(bytes));
+    bool need_bitflip = source->needBitflip();
+    delete source;
+
+    Extent from_view(type);
+    from_view.unpackData(bytes, need_bitflip);
+
+    DataSeriesSource::setDefaultReadMode(DataSeriesSource::ReadPread);
+    DataSeriesSource check(filename);
+    Extent::Ptr expect(check.preadExtent(offset));
+    from_view.extent_source_offset = expect->extent_source_offset;
+    sameExtent(from_view, *expect);
+}
+
+int main(int argc, char *argv[]) {
+    INVARIANT(argc > 1, "Usage: mmap-source file.ds...");
+    for (int i = 1; i < argc; ++i) {
+        compareModes(argv[i]);
+        viewOutlivesSource(argv[i]);
+    }
+    cout << "Passed mmap-source tests\n";
+    return 0;
+}
@@ -0,0 +1,136 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Write many DataSeries files at once through the shared SinkPool, report
+    the aggregate write rate, and verify every file by reading it back.
+
+    Usage: multi-sink [nfiles (default 16)] [MiB per file (default 8)]
+*/
+
+#include <iostream>
+
+#include <boost/lexical_cast.hpp>
+
+#include <Lintel/Clock.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/SinkPool.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+using dataseries::SinkPool;
+
+const string multi_sink_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"multi-sink\" version=\"1.0\" >\n"
+        "  <field type=\"int32\" name=\"file\" />\n"
+        "  <field type=\"int64\" name=\"row\" />\n"
+        "  <field type=\"variable32\" name=\"text\" pack_unique=\"yes\" />\n"
+        "</ExtentType>\n";
+
+static string fileName(int32_t file) {
+    return str(format("multi-sink-%d.ds") % file);
+}
+
+// Deterministic per-row text so the reader can check it without keeping state.
+static string rowText(int32_t file, int64_t row) {
+    return str(format("file %d row %d %s") % file % row % string(row % 61, 'a' + (row % 26)));
+}
+
+class WriteThread : public PThread {
+  public:
+    WriteThread(int32_t file, int64_t nbytes) : file(file), nbytes(nbytes), nrows(0) { }
+
+    virtual void *run() {
+        ExtentTypeLibrary library;
+        const ExtentType::Ptr type(library.registerTypePtr(multi_sink_xml));
+        DataSeriesSink sink(fileName(file));
+        sink.writeExtentLibrary(library);
+
+        ExtentSeries series(type);
+        OutputModule output(sink, series, type, 256 * 1024);
+        Int32Field f_file(series, "file");
+        Int64Field f_row(series, "row");
+        Variable32Field f_text(series, "text");
+
+        int64_t written = 0;
+        for (; written < nbytes; ++nrows) {
+            output.newRecord();
+            string text(rowText(file, nrows));
+            f_file.set(file);
+            f_row.set(nrows);
+            f_text.set(text);
+            written += 4 + 8 + 4 + text.size();
+        }
+        output.close();
+        sink.close();
+        return NULL;
+    }
+
+    const int32_t file;
+    const int64_t nbytes;
+    int64_t nrows;
+};
+
+void verifyFile(int32_t file, int64_t nrows) {
+    TypeIndexModule source("multi-sink");
+    source.addSource(fileName(file));
+    ExtentSeries series;
+    Int32Field f_file(series, "file");
+    Int64Field f_row(series, "row");
+    Variable32Field f_text(series, "text");
+
+    int64_t row = 0;
+    while (true) {
+        Extent::Ptr e(source.getSharedExtent());
+        if (e == NULL) {
+            break;
+        }
+        for (series.setExtent(e); series.morerecords(); ++series, ++row) {
+            INVARIANT(f_file.val() == file && f_row.val() == row && f_text.stringval()
+                      == rowText(file, row), format("mismatch in %s at row %d")
+                      % fileName(file) % row);
+        }
+    }
+    INVARIANT(row == nrows, format("%s has %d rows, expected %d") % fileName(file) % row % nrows);
+}
+
+int main(int argc, char *argv[]) {
+    int32_t nfiles = argc > 1 ? boost::lexical_cast<int32_t>(argv[1]) : 16;
+    int64_t mib_per_file = argc > 2 ? boost::lexical_cast<int64_t>(argv[2]) : 8;
+    INVARIANT(nfiles > 0 && mib_per_file > 0, "usage: multi-sink [nfiles] [MiB per file]");
+
+    // Small enough that the sinks contend for the budget.
+    SinkPool::instance().setMaxBytesInProgress(4 * 1024 * 1024);
+
+    vector<WriteThread *> threads;
+    Clock::Tdbl start = Clock::tod();
+    for (int32_t i = 0; i < nfiles; ++i) {
+        threads.push_back(new WriteThread(i, mib_per_file * 1024 * 1024));
+        threads.back()->start();
+    }
+    for (vector<WriteThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        (*i)->join();
+    }
+    Clock::Tdbl elapsed = Clock::tod() - start;
+
+    size_t nthreads = SinkPool::instance().nThreads();
+    INVARIANT(nthreads <= static_cast<size_t>(MAX_THREADS),
+              format("%d sink threads for %d files") % nthreads % nfiles);
+    cout << format("wrote %d files of %d MiB in %.3fs, %.2f MiB/s with %d sink threads\n")
+        % nfiles % mib_per_file % elapsed % (nfiles * mib_per_file / elapsed) % nthreads;
+
+    for (vector<WriteThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        verifyFile((*i)->file, (*i)->nrows);
+        delete *i;
+    }
+    cout << "Passed multi-sink tests\n";
+    return 0;
+}
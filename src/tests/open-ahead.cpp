@@ -0,0 +1,72 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that a TypeIndexModule opening files ahead, with and without
+    the metadata cache, returns the same extents in the same order as
+    opening each file when it is reached.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesSource.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+typedef vector< pair<string, int64_t> > ExtentList; // (source, offset)
+
+ExtentList scan(TypeIndexModule &module) {
+    ExtentList ret;
+    while (true) {
+        Extent::Ptr e = module.getSharedExtent();
+        if (e == NULL) {
+            return ret;
+        }
+        ret.push_back(make_pair(e->extent_source, e->extent_source_offset));
+    }
+}
+
+void addSources(TypeIndexModule &module, int argc, char *argv[]) {
+    // Repeat the files so there are many more files than are opened ahead.
+    for (int rep = 0; rep < 10; ++rep) {
+        for (int i = 1; i < argc; ++i) {
+            module.addSource(argv[i]);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    INVARIANT(argc > 1, "Usage: open-ahead file.ds...");
+
+    DataSeriesSource::setMetadataCacheFiles(0);
+    TypeIndexModule serial;
+    serial.setOpenAhead(0);
+    addSources(serial, argc, argv);
+    ExtentList expect = scan(serial);
+    SINVARIANT(!expect.empty());
+
+    for (int cache = 0; cache < 2; ++cache) {
+        DataSeriesSource::setMetadataCacheFiles(cache ? 1000 : 0);
+        TypeIndexModule ahead;
+        ahead.setOpenAhead(3);
+        addSources(ahead, argc, argv);
+        SINVARIANT(scan(ahead) == expect);
+        ahead.resetPos(); // also exercises dropping files opened ahead
+        SINVARIANT(scan(ahead) == expect);
+
+        // stop part way through a file with files opened ahead
+        TypeIndexModule partial;
+        partial.setOpenAhead(3);
+        addSources(partial, argc, argv);
+        SINVARIANT(partial.getSharedExtent() != NULL);
+        partial.close();
+    }
+    cout << format("Passed open-ahead tests, %d extents\n") % expect.size();
+    return 0;
+}
@@ -10,3 +10,13 @@ echo "Trying with different prefix/separator"
 ../process/csv2ds --compress-lzf --comment-prefix='CCC ' --field-separator=ZZZ --xml-desc-file=$SRC/check-data/csv2ds-1.xml $SRC/check-data/csv2ds-2.csv csv2ds-2.ds
 ../process/ds2txt --skip-index csv2ds-2.ds >csv2ds-2.txt
 cmp csv2ds-2.txt $SRC/check-data/csv2ds-1.txt.ref
+echo "Trying with per-extent min/max"
+../process/csv2ds --compress-lzf --minmax-columns=int32,variable32 --xml-desc-file=$SRC/check-data/csv2ds-1.xml $SRC/check-data/csv2ds-1.csv csv2ds-3.ds
+# Reading every type skips the statistics, so only the library differs from csv2ds-1.ds.
+../process/ds2txt --skip-all csv2ds-1.ds >csv2ds-1.records
+../process/ds2txt --skip-all csv2ds-3.ds >csv2ds-3.records
+cmp csv2ds-1.records csv2ds-3.records
+# --skip-index would also skip the statistics
+../process/ds2txt --skip-types --type='DataSeries: ExtentMinMax' csv2ds-3.ds >csv2ds-3.minmax
+grep ' int32 ' csv2ds-3.minmax
+grep ' variable32 ' csv2ds-3.minmax
@@ -16,6 +16,11 @@ perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.1 $1/check-data
 perl $1/check-data/clean-timing.pl <test.dsstatgroupby.tmp >test.dsstatgroupby.2
 perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.2 $1/check-data/test.dsstatgroupby.2.ref
 
+# parallel processing should give the same results to the printed precision
+../process/dsstatgroupby --threads=4 'Batch::LSF' basic 'start_time - submit_time' where 'start_time - submit_time > 50000' group by 'production' basic 'cpu_time/(end_time-start_time)' group by production quantile 'start_time - submit_time' where 'start_time - submit_time > 50000' group by production from $1/check-data/lsb.acct.2007-01-01-p1.ds >test.dsstatgroupby.tmp
+perl $1/check-data/clean-timing.pl <test.dsstatgroupby.tmp >test.dsstatgroupby.3
+perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.3 $1/check-data/test.dsstatgroupby.2.ref
+
 rm test.dsstatgroupby.tmp
 
 exit 0
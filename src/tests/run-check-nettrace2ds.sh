@@ -0,0 +1,59 @@
+#!/bin/sh
+set -e
+
+SRC=$1
+PCAP=$SRC/check-data/nfs-getattr.pcap
+NETTRACE2DS=../process/nettrace2ds
+NETTRACE2DS_IGNORE_TODO=1
+export NETTRACE2DS_IGNORE_TODO
+
+# The records that have to come out the same however the pcap was read; the statistics differ
+# between --convert and --capture.
+records() {
+    for type in Trace::NFS::common Trace::NFS::attr-ops Trace::Network::IP; do
+        ../process/ds2txt --skip-all --type=$type "$@"
+    done
+}
+
+rm -f nt2ds-*
+
+COUNT=`$NETTRACE2DS --info --pcap $PCAP | awk '/^last_record_id/ { print $3 + 1 }'`
+[ "$COUNT" = 400 ]
+
+echo "--------------- converting with and without the parse pipeline ----------"
+$NETTRACE2DS --parse-threads=0 --convert --pcap 0 $COUNT nt2ds-serial.ds $PCAP >nt2ds-serial.out
+$NETTRACE2DS --parse-threads=3 --convert --pcap 0 $COUNT nt2ds-parallel.ds $PCAP >nt2ds-parallel.out
+../process/ds2txt --skip-all nt2ds-serial.ds >nt2ds-serial.txt
+../process/ds2txt --skip-all nt2ds-parallel.ds >nt2ds-parallel.txt
+cmp nt2ds-serial.txt nt2ds-parallel.txt
+records nt2ds-serial.ds >nt2ds-expect.txt
+[ `grep -c getattr nt2ds-expect.txt` -ge 400 ]
+
+echo "--------------- following a growing pcap ----------"
+# Start with the file header and the first 100 packets, so the capture has to wait for the rest.
+HEAD_BYTES=`perl -e 'open(F, $ARGV[0]) or die; $at = 24;
+    for (1..100) { seek(F, $at + 8, 0); read(F, $caplen, 4); $at += 16 + unpack("V", $caplen); }
+    print $at;' $PCAP`
+head -c $HEAD_BYTES $PCAP >nt2ds-follow.pcap
+$NETTRACE2DS --capture --follow-pcap nt2ds-follow.pcap nt2ds-follow 4 >nt2ds-follow.out &
+PID=$!
+sleep 1
+tail -c +`expr $HEAD_BYTES + 1` $PCAP >>nt2ds-follow.pcap
+sleep 2
+kill -TERM $PID
+wait $PID
+
+# The packets span 10 seconds from 1000000000, so 4 second rotation makes 3 files.
+ls nt2ds-follow.*.ds >nt2ds-files.txt
+printf 'nt2ds-follow.1000000000.ds\nnt2ds-follow.1000000004.ds\nnt2ds-follow.1000000008.ds\n' \
+    | cmp - nt2ds-files.txt
+records `cat nt2ds-files.txt` >nt2ds-got.txt
+if cmp nt2ds-expect.txt nt2ds-got.txt; then
+    echo "ok on --follow-pcap"
+else
+    echo "error on --follow-pcap, --convert vs --capture records:"
+    diff nt2ds-expect.txt nt2ds-got.txt | head -20
+    exit 1
+fi
+
+rm nt2ds-*
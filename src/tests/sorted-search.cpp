@@ -0,0 +1,215 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify the binary searches in SortedSearch.hpp against a linear scan, and
+    the per-extent sorted markers written by DataSeriesSink::recordMinMax().
+*/
+
+#include <iostream>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/SortedSearch.hpp>
+
+using namespace std;
+using namespace dataseries;
+using boost::format;
+
+const string sorted_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"sorted-search\" version=\"1.0\" >\n"
+        "  <field type=\"int32\" name=\"int32\" />\n"
+        "  <field type=\"int64\" name=\"int64\" />\n"
+        "  <field type=\"double\" name=\"double\" />\n"
+        "  <field type=\"variable32\" name=\"variable32\" />\n"
+        "  <field type=\"int32\" name=\"n-int32\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"random\" />\n"
+        "  <field type=\"double\" name=\"based\" opt_doublebase=\"1000\" />\n"
+        "  <field type=\"double\" name=\"n-based\" opt_doublebase=\"1000\""
+        " opt_nullable=\"yes\" />\n"
+        "</ExtentType>\n";
+
+static const int32_t nrows = 1000;
+
+// Every column is sorted except random; values repeat so that equalRange is
+// interesting.  n-int32 is null (i.e. its default, -1) for the first rows.  based and n-based
+// are stored relative to their base of 1000, but are set and searched by absolute value.
+void fillExtent(ExtentSeries &s, MersenneTwisterRandom &rng) {
+    Int32Field int32(s, "int32");
+    Int64Field int64(s, "int64");
+    DoubleField dbl(s, "double");
+    Variable32Field var32(s, "variable32");
+    Int32Field n_int32(s, "n-int32", Field::flag_nullable, -1);
+    Int32Field random(s, "random");
+    DoubleField based(s, "based", DoubleField::flag_allownonzerobase);
+    DoubleField n_based(s, "n-based",
+                        DoubleField::flag_allownonzerobase | Field::flag_nullable);
+
+    s.newExtent();
+    for (int32_t i = 0; i < nrows; ++i) {
+        s.newRecord();
+        int32.set(i / 3);
+        int64.set((i / 7) * (static_cast<int64_t>(1) << 33));
+        dbl.set(i / 5 - 50.5);
+        var32.set(str(format("%04d") % (i / 4)));
+        if (i < 10) {
+            n_int32.setNull();
+        } else {
+            n_int32.set(i / 2);
+        }
+        random.set(rng.randInt(100));
+        based.setabs(i / 5 - 50.5);
+        n_based.setabs(i / 5 - 50.5);
+    }
+}
+
+template<class FieldT, typename T> bool rowLess(const FieldT &field, const T &value) {
+    return field.val() < value;
+}
+
+template<class FieldT, typename T> bool rowGreater(const FieldT &field, const T &value) {
+    return value < field.val();
+}
+
+bool rowLess(const DoubleField &field, double value) {
+    return field.absval() < value;
+}
+
+bool rowGreater(const DoubleField &field, double value) {
+    return value < field.absval();
+}
+
+bool rowLess(const Variable32Field &field, const string &value) {
+    return field.stringval() < value;
+}
+
+bool rowGreater(const Variable32Field &field, const string &value) {
+    return value < field.stringval();
+}
+
+// Checks the searches for value against the rows, as found by a linear scan.
+template<class FieldT, typename T>
+void checkSearch(ExtentSeries &s, const FieldT &field, const T &value) {
+    const Extent &e(s.getExtentRef());
+    SEP_RowOffset begin(0, &e);
+    int32_t expect_lower = 0, expect_upper = 0;
+    for (s.setRowOffset(begin); s.morerecords(); ++s) {
+        if (rowLess(field, value)) {
+            ++expect_lower;
+        }
+        if (!rowGreater(field, value)) {
+            ++expect_upper;
+        }
+    }
+    pair<SEP_RowOffset, SEP_RowOffset> range(equalRange(e, field, value));
+    SINVARIANT(SEP_RowOffset::distance(begin, lowerBound(e, field, value), &e) == expect_lower);
+    SINVARIANT(SEP_RowOffset::distance(begin, upperBound(e, field, value), &e) == expect_upper);
+    SINVARIANT(SEP_RowOffset::distance(begin, range.first, &e) == expect_lower);
+    SINVARIANT(SEP_RowOffset::distance(begin, range.second, &e) == expect_upper);
+
+    s.setRowOffset(begin);
+    SINVARIANT(seekLowerBound(s, field, value) == (expect_lower < nrows));
+    SINVARIANT(SEP_RowOffset::distance(begin, s.getRowOffset(), &e) == expect_lower);
+    SINVARIANT(seekUpperBound(s, field, value) == (expect_upper < nrows));
+}
+
+void testSearch() {
+    MersenneTwisterRandom rng;
+    ExtentTypeLibrary library;
+    ExtentSeries s(library.registerTypePtr(sorted_xml));
+    fillExtent(s, rng);
+
+    Int32Field int32(s, "int32");
+    Int64Field int64(s, "int64");
+    DoubleField dbl(s, "double");
+    Variable32Field var32(s, "variable32");
+    Int32Field n_int32(s, "n-int32", Field::flag_nullable, -1);
+    DoubleField based(s, "based", DoubleField::flag_allownonzerobase);
+    DoubleField n_based(s, "n-based", DoubleField::flag_allownonzerobase | Field::flag_nullable);
+    TFixedField<int32_t> t_int32(s, "int32");
+    GeneralField::Ptr g_int32(GeneralField::make(s, "int32"));
+
+    for (int32_t v = -5; v < nrows / 3 + 5; ++v) {
+        checkSearch(s, int32, v);
+        checkSearch(s, t_int32, v);
+        checkSearch(s, n_int32, v * 2);
+        checkSearch(s, var32, string(str(format("%04d") % v)));
+    }
+    for (int64_t v = -2; v < nrows / 7 + 2; ++v) {
+        checkSearch(s, int64, v * (static_cast<int64_t>(1) << 33));
+        checkSearch(s, int64, v * (static_cast<int64_t>(1) << 33) + 1);
+    }
+    for (double v = -60; v < nrows / 5 - 40; v += 0.25) {
+        checkSearch(s, dbl, v);
+        checkSearch(s, based, v);
+        checkSearch(s, n_based, v);
+    }
+    checkSearch(s, var32, string(""));
+    checkSearch(s, var32, string("0100x"));
+    checkSearch(s, var32, string("zzz"));
+
+    // GeneralField goes through the generic val(extent, row_offset) path.
+    const Extent &e(s.getExtentRef());
+    SEP_RowOffset begin(0, &e);
+    s.setRowOffset(begin);
+    for (int32_t i = 0; i < 40; ++i, ++s) {
+        GeneralValue v(*g_int32);
+        SINVARIANT(SEP_RowOffset::distance(begin, lowerBound(e, *g_int32, v), &e) == (i / 3) * 3);
+    }
+}
+
+void testSortedMarker() {
+    MersenneTwisterRandom rng;
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(sorted_xml));
+    DataSeriesSink sink("sorted-search.ds");
+    vector<string> columns;
+    columns.push_back("int32");
+    columns.push_back("variable32");
+    columns.push_back("n-int32");
+    columns.push_back("random");
+    sink.recordMinMax(type, columns);
+    sink.writeExtentLibrary(library);
+
+    ExtentSeries s(type);
+    for (unsigned i = 0; i < 3; ++i) {
+        fillExtent(s, rng);
+        sink.writeExtent(s.getExtentRef(), NULL);
+    }
+    sink.close();
+
+    DataSeriesSource source("sorted-search.ds");
+    SINVARIANT(source.minMaxExtent() != NULL);
+    unsigned nextents = 0;
+    while (true) {
+        Extent::Ptr e(source.readExtent());
+        if (e == NULL) {
+            break;
+        }
+        if (e->getTypePtr()->getName() != type->getName()) {
+            continue;
+        }
+        off64_t extent_offset = e->extent_source_offset;
+        ++nextents;
+        SINVARIANT(source.extentSortedBy(extent_offset, "int32"));
+        SINVARIANT(source.extentSortedBy(extent_offset, "variable32"));
+        SINVARIANT(!source.extentSortedBy(extent_offset, "n-int32")); // has nulls
+        SINVARIANT(!source.extentSortedBy(extent_offset, "random"));
+        SINVARIANT(!source.extentSortedBy(extent_offset, "int64")); // not recorded
+    }
+    SINVARIANT(nextents == 3);
+}
+
+int main() {
+    testSearch();
+    testSortedMarker();
+    cout << "Passed sorted-search tests\n";
+    return 0;
+}
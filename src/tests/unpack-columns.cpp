@@ -0,0 +1,146 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that column-at-a-time unpacking produces the same bytes as the
+    original per-row unpacking, and compare the speed of the two.
+*/
+
+#include <iostream>
+
+#include <Lintel/Clock.hpp>
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+using boost::format;
+
+// Same fields as pack-scale, plus self-relative packing on a scaled field
+const string scale_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"unpack-scale\" version=\"1.0\" >\n"
+        "  <field type=\"double\" name=\"s-1\" pack_scale=\"1.0\" pack_scale_warn=\"no\" />\n"
+        "  <field type=\"double\" name=\"s-0.1\" pack_scale=\"0.1\" pack_scale_warn=\"no\" />\n"
+        "  <field type=\"double\" name=\"s-rel\" pack_scale=\"1e-6\" pack_relative=\"s-rel\" />\n"
+        "</ExtentType>\n";
+
+// Same fields as pack-field-ordering, plus relative packing and nulls
+const string ordering_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"unpack-ordering\" version=\"1.0\""
+        " pack_field_ordering=\"big_to_small_sep_var32\" pack_null_compact=\"non_bool\" >\n"
+        "  <field type=\"variable32\" name=\"v32\" pack_unique=\"yes\" />\n"
+        "  <field type=\"bool\" name=\"bool\" />\n"
+        "  <field type=\"int32\" name=\"i32\" pack_relative=\"i32\" />\n"
+        "  <field type=\"byte\" name=\"byte\" />\n"
+        "  <field type=\"double\" name=\"dbl\" pack_scale=\"0.5\" pack_relative=\"dbl\" />\n"
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"i64-other\" pack_relative=\"i64\" />\n"
+        "</ExtentType>\n";
+
+static const unsigned nrecords = 100 * 1000;
+static const unsigned reps = 20;
+
+void fillScale(Extent::Ptr e, MersenneTwisterRandom &rng) {
+    ExtentSeries s(e);
+    DoubleField s_1(s, "s-1"), s_0_1(s, "s-0.1"), s_rel(s, "s-rel");
+
+    double base = 1.0e6;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        s_1.set(rng.randInt(1000));
+        s_0_1.set(rng.randInt(1000) / 10.0);
+        base += rng.randInt(1000) * 1.0e-6;
+        s_rel.set(base);
+    }
+}
+
+void fillOrdering(Extent::Ptr e, MersenneTwisterRandom &rng) {
+    static const string strings[] = { "READ", "WRITE", "GETATTR", "LOOKUP", "ACCESS" };
+    ExtentSeries s(e);
+    Variable32Field v32(s, "v32");
+    BoolField f_bool(s, "bool");
+    Int32Field i32(s, "i32");
+    ByteField f_byte(s, "byte");
+    DoubleField dbl(s, "dbl");
+    Int64Field i64(s, "i64", Field::flag_nullable);
+    Int64Field i64_other(s, "i64-other");
+
+    int64_t base = 1000 * 1000 * 1000;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        v32.set(strings[rng.randInt(5)]);
+        f_bool.set(rng.randInt(2) == 1);
+        i32.set(i + rng.randInt(16));
+        f_byte.set(rng.randInt(256));
+        dbl.set(i * 0.5);
+        base += rng.randInt(100000);
+        if (rng.randInt(10) == 0) {
+            i64.setNull();
+        } else {
+            i64.set(base);
+        }
+        i64_other.set(base + rng.randInt(1000));
+    }
+}
+
+void copyBytes(Extent::ByteArray &to, const Extent::ByteArray &from) {
+    to.resize(from.size(), false);
+    memcpy(to.begin(), from.begin(), from.size());
+}
+
+double timeUnpack(const ExtentType::Ptr type, const Extent::ByteArray &packed,
+                  Extent::UnpackStrategy strategy, Extent::Ptr &result) {
+    Extent::setUnpackStrategy(strategy);
+    Extent::ByteArray tmp;
+    double elapsed = 0;
+    for (unsigned i = 0; i < reps; ++i) {
+        result.reset(new Extent(type));
+        copyBytes(tmp, packed); // unpackData modifies its input
+        Clock::Tfrac start = Clock::todTfrac();
+        result->unpackData(tmp, false);
+        elapsed += Clock::TfracToDouble(Clock::todTfrac() - start);
+    }
+    return elapsed / reps;
+}
+
+void testType(const string &xml, void (*fill)(Extent::Ptr, MersenneTwisterRandom &)) {
+    const ExtentType::Ptr type(ExtentTypeLibrary::sharedExtentTypePtr(xml));
+    MersenneTwisterRandom rng(1776);
+
+    Extent::Ptr e(new Extent(type));
+    fill(e, rng);
+
+    // Pack without compression so that the timing is dominated by the transforms.
+    Extent::ByteArray packed;
+    e->packData(packed, 0);
+
+    Extent::Ptr by_row, by_column;
+    double row_time = timeUnpack(type, packed, Extent::UnpackByRow, by_row);
+    double column_time = timeUnpack(type, packed, Extent::UnpackByColumn, by_column);
+
+    SINVARIANT(by_row->fixeddata.size() == by_column->fixeddata.size());
+    SINVARIANT(memcmp(by_row->fixeddata.begin(), by_column->fixeddata.begin(),
+                      by_row->fixeddata.size()) == 0);
+    SINVARIANT(by_row->variabledata.size() == by_column->variabledata.size());
+    SINVARIANT(memcmp(by_row->variabledata.begin(), by_column->variabledata.begin(),
+                      by_row->variabledata.size()) == 0);
+
+    cout << format("%s: %d records, by row %.3fms, by column %.3fms, speedup %.2fx\n")
+            % type->getName() % nrecords % (1.0e3 * row_time) % (1.0e3 * column_time)
+            % (row_time / column_time);
+}
+
+int main() {
+    // Verify the internal checksums on every unpack.
+    Extent::setReadChecksFromEnv(true);
+    testType(scale_xml, fillScale);
+    testType(ordering_xml, fillOrdering);
+    Extent::setUnpackStrategy(Extent::UnpackByColumn);
+    cout << "Passed unpack-columns tests\n";
+    return 0;
+}
@@ -0,0 +1,132 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that several IndexSourceModules share the UnpackPool's
+    compressed budget: together they stay close to it, a module whose
+    consumer is idle can't starve the others, and every module still
+    returns all of its extents in order.
+*/
+
+#include <iostream>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/AsyncExtentReader.hpp>
+#include <DataSeries/DataSeriesSink.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+#include <DataSeries/UnpackPool.hpp>
+
+using namespace std;
+using boost::format;
+using dataseries::UnpackPool;
+
+const string pool_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"unpack-pool\" version=\"1.0\" >\n"
+        "  <field type=\"int32\" name=\"extent\" />\n"
+        "  <field type=\"int64\" name=\"random\" />\n"
+        "</ExtentType>\n";
+
+static const unsigned nextents = 40;
+static const unsigned rows_per_extent = 2500; // ~30KiB, and random, so it barely compresses
+static const size_t max_extent_bytes = 64 * 1024;
+static const unsigned nmodules = 4;
+static const size_t budget = 64 * 1024;
+static const string filename("unpack-pool.ds");
+
+void writeFile() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(pool_xml));
+    DataSeriesSink sink(filename);
+    sink.writeExtentLibrary(library);
+
+    MersenneTwisterRandom rng;
+    ExtentSeries s(type);
+    Int32Field extent(s, "extent");
+    Int64Field random(s, "random");
+    for (unsigned i = 0; i < nextents; ++i) {
+        s.newExtent();
+        for (unsigned j = 0; j < rows_per_extent; ++j) {
+            s.newRecord();
+            extent.set(i);
+            random.set(rng.randLongLong());
+        }
+        sink.writeExtent(s.getExtentRef(), NULL);
+    }
+    sink.close();
+}
+
+// Each module can go over the budget by the extent it may always have
+// waiting, and by its outstanding asynchronous reads.
+void checkBudget() {
+    size_t slack = nmodules * (dataseries::AsyncExtentReader::instance().queueDepth() + 1)
+        * max_extent_bytes;
+    size_t used = UnpackPool::instance().compressedUsed();
+    INVARIANT(used <= budget + slack,
+              format("%d compressed bytes in use, budget %d + %d") % used % budget % slack);
+}
+
+// Returns false once module has returned all of its extents.
+bool checkNextExtent(TypeIndexModule &module, unsigned &next) {
+    Extent::Ptr e(module.getSharedExtent());
+    if (e == NULL) {
+        SINVARIANT(next == nextents);
+        return false;
+    }
+    ExtentSeries s(e);
+    Int32Field extent(s, "extent");
+    SINVARIANT(e->nRecords() == rows_per_extent);
+    SINVARIANT(extent.val() == static_cast<int32_t>(next));
+    ++next;
+    checkBudget();
+    return true;
+}
+
+void testSharedBudget() {
+    UnpackPool &pool(UnpackPool::instance());
+    pool.setCompressedBudget(budget);
+
+    vector<TypeIndexModule *> modules;
+    vector<unsigned> next(nmodules, 0);
+    for (unsigned i = 0; i < nmodules; ++i) {
+        modules.push_back(new TypeIndexModule("unpack-pool"));
+        modules.back()->addSource(filename);
+        // The module limits are below the budget, so they don't raise it.
+        modules.back()->startPrefetching(budget / 2, 4 * max_extent_bytes, 2);
+    }
+
+    // Only the first module is consumed; the others read ahead until the
+    // pool is over budget, which must not stop the first from finishing.
+    while (checkNextExtent(*modules[0], next[0])) { }
+
+    // Then the rest are consumed together.
+    bool any_more = true;
+    while (any_more) {
+        any_more = false;
+        for (unsigned i = 1; i < nmodules; ++i) {
+            if (checkNextExtent(*modules[i], next[i])) {
+                any_more = true;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < nmodules; ++i) {
+        IndexSourceModule::WaitStats stats;
+        SINVARIANT(modules[i]->getWaitStats(stats));
+        SINVARIANT(stats.nextents == nextents);
+        delete modules[i];
+    }
+    SINVARIANT(pool.compressedUsed() == 0);
+}
+
+int main() {
+    writeFile();
+    testSharedBudget();
+    cout << "Passed unpack-pool tests\n";
+    return 0;
+}